@@ -71,6 +71,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <iostream>
 #include <ctype.h>
 #include "Ptexture.h"
@@ -80,6 +81,15 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
 
 PTEX_NAMESPACE_BEGIN
 
+PtexReaderCache::~PtexReaderCache()
+{
+    // finish any background loads while the cache is still intact;
+    // they hold refs and will log their files as recently used when done
+    PrefetchCanceller canceller;
+    _files.foreach(canceller);
+}
+
+
 void PtexCachedReader::release()
 {
     if (0 == unref()) {
@@ -88,6 +98,42 @@ void PtexCachedReader::release()
 }
 
 
+PtexFilter* PtexCachedReader::getFilter(const PtexFilter::Options& opts)
+{
+    // normalize options so lookups from callers compiled with older
+    // versions of the struct match (see PtexSeparableFilter)
+    PtexFilter::Options key(opts.filter, opts.lerp, opts.sharpness, false);
+    if (opts.__structSize >= (char*)&opts.noedgeblend - (char*)&opts)
+        key.noedgeblend = opts.noedgeblend;
+
+    // filters are only ever added at the head, so the list can be searched without locking
+    PtexCachedFilter* head = _filters;
+    for (PtexCachedFilter* f = head; f; f = f->next()) {
+        if (f->matches(key)) return f;
+    }
+
+    AutoMutex locker(_filtersLock);
+
+    // check again in case another thread created it while we were waiting for the lock
+    for (PtexCachedFilter* f = _filters; f != head; f = f->next()) {
+        if (f->matches(key)) return f;
+    }
+
+    PtexCachedFilter* f = new PtexCachedFilter(this, key, _filters);
+    AtomicStore(&_filters, f);
+    return f;
+}
+
+
+PtexFilter* PtexFilter::getFilter(PtexCache* cache, PtexTexture* tex, const PtexFilter::Options& opts)
+{
+    // the filters are kept with the cached reader, so the texture must have come from this cache
+    PtexCachedReader* reader = dynamic_cast<PtexCachedReader*>(tex);
+    if (!cache || !reader || reader->cache() != cache) return 0;
+    return reader->getFilter(opts);
+}
+
+
 bool PtexReaderCache::findFile(const char*& filename, std::string& buffer, Ptex::String& error)
 {
     bool isAbsolute = (filename[0] == '/'
@@ -133,7 +179,8 @@ PtexTexture* PtexReaderCache::get(const char* filename, Ptex::String& error)
         }
         reader->ref();
     } else {
-        reader = new PtexCachedReader(_premultiply, _io, _err, this);
+        int shard = int((key.hash() >> 16) % numShards);
+        reader = new PtexCachedReader(_premultiply, _io, _err, _memoryMapped, this, shard, &_useClock, &_stats);
         isNew = true;
     }
 
@@ -177,110 +224,234 @@ PtexTexture* PtexReaderCache::get(const char* filename, Ptex::String& error)
 PtexCache* PtexCache::create(int maxFiles, size_t maxMem, bool premultiply,
                              PtexInputHandler* inputHandler,
                              PtexErrorHandler* errorHandler)
+{
+    return create(maxFiles, maxMem, premultiply, inputHandler, errorHandler, false);
+}
+
+
+PtexCache* PtexCache::create(int maxFiles, size_t maxMem, bool premultiply,
+                             PtexInputHandler* inputHandler,
+                             PtexErrorHandler* errorHandler,
+                             bool memoryMapped,
+                             Policy policy)
 {
     // set default files to 100
     if (maxFiles <= 0) maxFiles = 100;
 
-    return new PtexReaderCache(maxFiles, maxMem, premultiply, inputHandler, errorHandler);
+    return new PtexReaderCache(maxFiles, maxMem, premultiply, inputHandler, errorHandler, memoryMapped, policy);
+}
+
+
+void PtexCache::getDetailedStats(DetailedStats& stats)
+{
+    // only touch the fields that exist in the caller's version of the struct
+    if (stats.version < 1) return;
+    memset(&stats.faceHits, 0, sizeof(DetailedStats) - offsetof(DetailedStats, faceHits));
 }
 
 
 void PtexReaderCache::logRecentlyUsed(PtexCachedReader* reader)
 {
+    Shard& shard = _shards[reader->_shard];
     while (1) {
-        MruList* mruList = _mruList;
+        MruList* mruList = shard.mruList;
         int slot = AtomicIncrement(&mruList->next)-1;
         if (slot < numMruFiles) {
             mruList->files[slot] = reader;
             return;
         }
         // no mru slot available, process mru list and try again
-        do processMru();
-        while (_mruList->next >= numMruFiles);
+        do processMru(shard);
+        while (shard.mruList->next >= numMruFiles);
     }
 }
 
-void PtexReaderCache::processMru()
+void PtexReaderCache::processMru(Shard& shard)
 {
     // use a non-blocking lock so we can proceed as soon as space has been freed in the mru list
     // (which happens almost immediately in the processMru thread that has the lock)
-    if (!_mruLock.trylock()) return;
-    if (_mruList->next < numMruFiles) {
-        _mruLock.unlock();
+    if (!shard.mruLock.trylock()) return;
+    if (shard.mruList->next < numMruFiles) {
+        shard.mruLock.unlock();
         return;
     }
 
     // switch mru buffers and reset slot counter so other threads can proceed immediately
-    MruList* mruList = _mruList;
-    AtomicStore(&_mruList, _prevMruList);
-    _prevMruList = mruList;
+    MruList* mruList = shard.mruList;
+    AtomicStore(&shard.mruList, shard.prevMruList);
+    shard.prevMruList = mruList;
+    AtomicIncrement(&_useClock);
 
     // extract relevant stats and add to open/active list
-    size_t memUsedChange = 0, filesOpenChange = 0;
+    size_t memUsedChange = 0, protectedMemUsedChange = 0, filesOpenChange = 0;
     for (int i = 0; i < numMruFiles; ++i) {
         PtexCachedReader* reader;
         do { reader = mruList->files[i]; } while (!reader); // loop on (unlikely) race condition
         mruList->files[i] = 0;
-        memUsedChange += reader->getMemUsedChange();
+        size_t readerMemUsedChange = reader->getMemUsedChange();
+        memUsedChange += readerMemUsedChange;
         size_t opens = reader->getOpensChange();
         size_t blockReads = reader->getBlockReadsChange();
         filesOpenChange += opens;
         if (opens || blockReads) {
-            _fileOpens += opens;
-            _blockReads += blockReads;
-            _openFiles.push(reader);
+            shard.fileOpens += opens;
+            shard.blockReads += blockReads;
+            shard.openFiles.push(reader);
         }
         if (_maxMem) {
-            _activeFiles.push(reader);
+            if (reader->_probationEvicted) {
+                // reused after losing data on probation, protect it
+                reader->_probationEvicted = false;
+                reader->_protected = true;
+                protectedMemUsedChange += reader->_memUsedAccountedFor;
+            }
+            else if (reader->_protected) protectedMemUsedChange += readerMemUsedChange;
+            if (reader->_protected) shard.protectedFiles.push(reader);
+            else shard.activeFiles.push(reader);
         }
     }
     AtomicStore(&mruList->next, 0);
-    adjustMemUsed(memUsedChange);
-    adjustFilesOpen(filesOpenChange);
+    adjustMemUsed(shard, memUsedChange);
+    adjustProtectedMemUsed(shard, protectedMemUsedChange);
+    adjustFilesOpen(shard, filesOpenChange);
 
     bool shouldPruneFiles = _filesOpen > _maxFiles;
     bool shouldPruneData = _maxMem && _memUsed > _maxMem;
 
     if (shouldPruneFiles) {
-        pruneFiles();
+        pruneFiles(shard);
     }
     if (shouldPruneData) {
-        pruneData();
+        pruneData(shard);
     }
-    _mruLock.unlock();
+    shard.mruLock.unlock();
 }
 
 
-void PtexReaderCache::pruneFiles()
+void PtexReaderCache::pruneFiles(Shard& shard)
 {
-    size_t numToClose = _filesOpen - _maxFiles;
-    if (numToClose > 0) {
-        while (numToClose) {
-            PtexCachedReader* reader = _openFiles.pop();
-            if (!reader) { _filesOpen = 0; break; }
-            if (reader->tryClose()) {
-                --numToClose;
-                --_filesOpen;
-            }
+    // close files from this shard down to its share of the limit, then from
+    // any other shards that are over their share (skipping shards that are busy),
+    // and finally take whatever is still needed from this shard
+    size_t share = _maxFiles / numShards;
+    if (shard.filesOpen > share) {
+        size_t filesOpen = _filesOpen;
+        if (filesOpen > _maxFiles)
+            closeFiles(shard, std::min(filesOpen - _maxFiles, shard.filesOpen - share));
+    }
+    for (int i = 1; i < numShards && _filesOpen > _maxFiles; i++) {
+        Shard& other = _shards[(&shard - _shards + i) % numShards];
+        if (other.filesOpen > share && other.mruLock.trylock()) {
+            size_t filesOpen = _filesOpen;
+            if (filesOpen > _maxFiles && other.filesOpen > share)
+                closeFiles(other, std::min(filesOpen - _maxFiles, other.filesOpen - share));
+            other.mruLock.unlock();
         }
     }
+    size_t filesOpen = _filesOpen;
+    if (filesOpen > _maxFiles) {
+        closeFiles(shard, filesOpen - _maxFiles);
+    }
 }
 
 
-void PtexReaderCache::pruneData()
+size_t PtexReaderCache::closeFiles(Shard& shard, size_t count)
 {
-    size_t memUsedChangeTotal = 0;
-    size_t memUsed = _memUsed;
-    while (memUsed + memUsedChangeTotal > _maxMem) {
-        PtexCachedReader* reader = _activeFiles.pop();
+    size_t numClosed = 0;
+    while (numClosed < count) {
+        PtexCachedReader* reader = shard.openFiles.pop();
+        if (!reader) {
+            // nothing left to close, resync shard's count
+            adjustFilesOpen(shard, 0 - shard.filesOpen);
+            return numClosed;
+        }
+        if (reader->tryClose()) {
+            ++numClosed;
+        }
+    }
+    adjustFilesOpen(shard, 0 - numClosed);
+    return numClosed;
+}
+
+
+void PtexReaderCache::pruneData(Shard& shard)
+{
+    // With policy_2q, the protected files are first pruned down to their
+    // share of the limit (as with the Kin/Kout split of 2Q) so that files on
+    // probation always have some room, then the files on probation are
+    // pruned, and only then the rest of the protected data.
+    uint32_t now = _useClock;
+    if (_policy == policy_2q) {
+        pruneList(shard, true, true, _maxMem - _maxMem / 4, now);
+        pruneList(shard, false, false, _maxMem, now);
+        pruneList(shard, true, false, _maxMem, now);
+    }
+    else {
+        pruneList(shard, false, false, _maxMem, now);
+    }
+}
+
+
+void PtexReaderCache::pruneList(Shard& shard, bool protectedFiles, bool protectedShare,
+                                size_t limit, uint32_t now)
+{
+    // evict faces from files that aren't in use, starting with faces that
+    // haven't been used for a long time and narrowing the age on each pass
+    // until the memory used (by protected files only, if protectedShare)
+    // is within the limit; the last pass prunes entire files.
+    // Each pass visits all shards so the coldest faces go first regardless
+    // of which file they belong to (shards that are busy are skipped).
+    static const uint32_t ages[] = { 4096, 512, 64, 8, 1, 0 };
+    static const int numAges = int(sizeof(ages)/sizeof(ages[0]));
+    for (int pass = 0; pass < numAges; pass++) {
+        bool all = ages[pass] == 0;
+        for (int i = 0; i < numShards; i++) {
+            size_t memUsed = protectedShare ? protectedMemUsed() : _memUsed;
+            if (memUsed <= limit) return;
+            Shard& s = _shards[(&shard - _shards + i) % numShards];
+            if (i && !s.mruLock.trylock()) continue;
+            freeData(s, protectedFiles, memUsed - limit, now - ages[pass], all);
+            if (i) s.mruLock.unlock();
+        }
+    }
+}
+
+
+size_t PtexReaderCache::freeData(Shard& shard, bool protectedFiles, size_t amount, uint32_t cutoff, bool all)
+{
+    // visited files that still have data are moved to the end of the list
+    // (files that are in use are dropped; they'll be added back on release)
+    ActiveList& files = protectedFiles ? shard.protectedFiles : shard.activeFiles;
+    ActiveList visited;
+    size_t memUsedChangeTotal = 0, demotedMemUsed = 0;
+    while (0 - memUsedChangeTotal < amount) {
+        PtexCachedReader* reader = files.pop();
         if (!reader) break;
         size_t memUsedChange;
-        if (reader->tryPrune(memUsedChange)) {
+        bool pruned;
+        if (all) {
+            pruned = reader->tryPrune(memUsedChange);
+            // a protected file has to be reused again to regain protection
+            if (pruned && protectedFiles) {
+                reader->_protected = false;
+                demotedMemUsed += reader->_memUsedAccountedFor;
+            }
+        }
+        else {
+            pruned = reader->tryPruneFaces(cutoff, memUsedChange);
+            if (pruned) visited.push(reader);
+        }
+        if (pruned) {
             // Note: after clearing, memUsedChange is negative
             memUsedChangeTotal += memUsedChange;
+            if (_policy == policy_2q && !protectedFiles && std::ptrdiff_t(memUsedChange) < 0)
+                reader->_probationEvicted = true;
         }
     }
-    adjustMemUsed(memUsedChangeTotal);
+    while (PtexCachedReader* reader = visited.pop()) files.push(reader);
+    adjustMemUsed(shard, memUsedChangeTotal);
+    if (protectedFiles) adjustProtectedMemUsed(shard, memUsedChangeTotal - demotedMemUsed);
+    return 0 - memUsedChangeTotal;
 }
 
 
@@ -302,25 +473,20 @@ void PtexReaderCache::purge(const char* filename)
 
 void PtexReaderCache::purge(PtexCachedReader* reader)
 {
+    // hold the shard lock so the protected state can't change underneath the accounting
+    Shard& shard = _shards[reader->_shard];
+    AutoMutex locker(shard.mruLock);
     size_t memUsedChange;
     if (reader->tryPurge(memUsedChange)) {
-        adjustMemUsed(memUsedChange);
-    }
-}
-
-void PtexReaderCache::Purger::operator()(PtexCachedReader* reader)
-{
-    size_t memUsedChange;
-    if (reader->tryPurge(memUsedChange)) {
-        memUsedChangeTotal += memUsedChange;
+        adjustMemUsed(shard, memUsedChange);
+        if (reader->_protected) adjustProtectedMemUsed(shard, memUsedChange);
     }
 }
 
 void PtexReaderCache::purgeAll()
 {
-    Purger purger;
+    Purger purger(this);
     _files.foreach(purger);
-    adjustMemUsed(purger.memUsedChangeTotal);
 }
 
 void PtexReaderCache::getStats(Stats& stats)
@@ -330,8 +496,30 @@ void PtexReaderCache::getStats(Stats& stats)
     stats.filesOpen = _filesOpen;
     stats.peakFilesOpen = _peakFilesOpen;
     stats.filesAccessed = _files.size();
-    stats.fileReopens = _fileOpens < stats.filesAccessed ? 0 : _fileOpens - stats.filesAccessed;
-    stats.blockReads = _blockReads;
+    size_t fileOpens = 0, blockReads = 0;
+    for (int i = 0; i < numShards; i++) {
+        fileOpens += _shards[i].fileOpens;
+        blockReads += _shards[i].blockReads;
+    }
+    stats.fileReopens = fileOpens < stats.filesAccessed ? 0 : fileOpens - stats.filesAccessed;
+    stats.blockReads = blockReads;
+}
+
+void PtexReaderCache::getDetailedStats(DetailedStats& stats)
+{
+    if (stats.version < 1) return;
+    stats.faceHits = _stats.total(PtexStats::faceHits);
+    stats.faceMisses = _stats.total(PtexStats::faceMisses);
+    stats.tileHits = _stats.total(PtexStats::tileHits);
+    stats.tileMisses = _stats.total(PtexStats::tileMisses);
+    stats.reductionHits = _stats.total(PtexStats::reductionHits);
+    stats.reductionBuilds = _stats.total(PtexStats::reductionBuilds);
+    stats.bytesCompressed = _stats.total(PtexStats::bytesCompressed);
+    stats.bytesDecompressed = _stats.total(PtexStats::bytesDecompressed);
+    stats.inflateTime = _stats.total(PtexStats::inflateTime);
+    stats.lockWaitTime = _stats.total(PtexStats::lockWaitTime);
+    _stats.totals(PtexStats::inflateLatency, stats.inflateLatency);
+    _stats.totals(PtexStats::lockWaitLatency, stats.lockWaitLatency);
 }
 
 PTEX_NAMESPACE_END
@@ -105,15 +105,74 @@ public:
 
 class PtexReaderCache;
 
+/** Filter shared through the cache (see PtexFilter::getFilter(PtexCache*, ...)).
+    Forwards to a filter owned by the cached reader, so release() is a no-op. */
+class PtexCachedFilter : public PtexFilter
+{
+    PtexFilter* _filter;
+    PtexCachedFilter* _next;
+
+public:
+    PtexCachedFilter(PtexTexture* tx, const PtexFilter::Options& opts, PtexCachedFilter* next)
+        : PtexFilter(tx, opts), _filter(PtexFilter::getFilter(tx, opts)), _next(next) {}
+    ~PtexCachedFilter() { if (_filter) _filter->release(); }
+
+    PtexCachedFilter* next() const { return _next; }
+
+    // opts must be normalized (see PtexCachedReader::getFilter)
+    bool matches(const PtexFilter::Options& opts) const
+    {
+        return _options.filter == opts.filter && _options.lerp == opts.lerp &&
+            _options.sharpness == opts.sharpness && _options.noedgeblend == opts.noedgeblend;
+    }
+
+    virtual void release() {}
+    virtual void eval(float* result, int firstchan, int nchannels,
+                      int faceid, float u, float v, float uw1, float vw1, float uw2, float vw2,
+                      float width, float blur)
+    {
+        _filter->eval(result, firstchan, nchannels, faceid, u, v, uw1, vw1, uw2, vw2, width, blur);
+    }
+    virtual void evalBatch(float* result, int resultStride, int firstchan, int nchannels,
+                           int n, const int* faceid, const float* u, const float* v,
+                           const float* uw1, const float* vw1, const float* uw2, const float* vw2,
+                           float width, float blur)
+    {
+        _filter->evalBatch(result, resultStride, firstchan, nchannels, n, faceid, u, v,
+                           uw1, vw1, uw2, vw2, width, blur);
+    }
+    virtual void evalDeriv(float* result, float* dresultdu, float* dresultdv,
+                           int firstchan, int nchannels, int faceid, float u, float v,
+                           float uw1, float vw1, float uw2, float vw2, float width, float blur)
+    {
+        _filter->evalDeriv(result, dresultdu, dresultdv, firstchan, nchannels, faceid, u, v,
+                           uw1, vw1, uw2, vw2, width, blur);
+    }
+    virtual void evalMulti(int ntextures, PtexTexture* const* textures, float* const* results,
+                           const int* firstchans, const int* nchannels,
+                           int faceid, float u, float v,
+                           float uw1, float vw1, float uw2, float vw2,
+                           float width, float blur)
+    {
+        _filter->evalMulti(ntextures, textures, results, firstchans, nchannels, faceid, u, v,
+                           uw1, vw1, uw2, vw2, width, blur);
+    }
+};
+
 class PtexCachedReader : public PtexReader
 {
     PtexReaderCache* _cache;
+    int _shard;
     volatile int32_t _refCount;
     size_t _memUsedAccountedFor;
     size_t _opensAccountedFor;
     size_t _blockReadsAccountedFor;
+    bool _protected;                  // reused file (policy_2q only)
+    bool _probationEvicted;           // data was freed while on probation (policy_2q only)
     PtexLruItem _openFilesItem;
     PtexLruItem _activeFilesItem;
+    PtexCachedFilter* volatile _filters; // shared filters, most recently created first
+    Mutex _filtersLock;                 // serializes filter creation
     friend class PtexReaderCache;
 
     bool trylock()
@@ -126,14 +185,34 @@ class PtexCachedReader : public PtexReader
         AtomicStore(&_refCount, 0);
     }
 
+    void freeFilters()
+    {
+        while (_filters) {
+            PtexCachedFilter* next = _filters->next();
+            delete _filters;
+            _filters = next;
+        }
+    }
+
 public:
-    PtexCachedReader(bool premultiply, PtexInputHandler* inputHandler, PtexErrorHandler* errorHandler, PtexReaderCache* cache)
-        : PtexReader(premultiply, inputHandler, errorHandler), _cache(cache), _refCount(1),
-          _memUsedAccountedFor(0), _opensAccountedFor(0), _blockReadsAccountedFor(0)
+    PtexCachedReader(bool premultiply, PtexInputHandler* inputHandler, PtexErrorHandler* errorHandler,
+                     bool memoryMapped, PtexReaderCache* cache, int shard, const volatile uint32_t* useClock,
+                     PtexStats* stats)
+        : PtexReader(premultiply, inputHandler, errorHandler, memoryMapped), _cache(cache), _shard(shard), _refCount(1),
+          _memUsedAccountedFor(0), _opensAccountedFor(0), _blockReadsAccountedFor(0),
+          _protected(false), _probationEvicted(false), _filters(0)
+    {
+        setUseClock(useClock);
+        setStats(stats);
+    }
+
+    ~PtexCachedReader()
     {
+        freeFilters();
     }
 
-    ~PtexCachedReader() {}
+    PtexReaderCache* cache() const { return _cache; }
+    PtexFilter* getFilter(const PtexFilter::Options& opts);
 
     void ref() {
         while (1) {
@@ -149,6 +228,10 @@ public:
 
     virtual void release();
 
+    // a queued prefetch holds a ref so the file isn't pruned or purged underneath it
+    virtual void beginPrefetch() { ref(); PtexReader::beginPrefetch(); }
+    virtual void endPrefetch() { release(); PtexReader::endPrefetch(); }
+
     bool tryPrune(size_t& memUsedChange) {
         if (trylock()) {
             prune();
@@ -159,9 +242,22 @@ public:
         return false;
     }
 
+    bool tryPruneFaces(uint32_t cutoff, size_t& memUsedChange) {
+        if (trylock()) {
+            pruneFaces(cutoff);
+            memUsedChange = getMemUsedChange();
+            unlock();
+            return true;
+        }
+        return false;
+    }
+
     bool tryPurge(size_t& memUsedChange) {
         if (trylock()) {
             purge();
+            // the filters were built for the file as it was opened; the file may change on disk
+            // before it is reopened, and no one can be using them while the reader is locked
+            freeFilters();
             memUsedChange = getMemUsedChange();
             unlock();
             return true;
@@ -197,19 +293,19 @@ public:
 class PtexReaderCache : public PtexCache
 {
 public:
-    PtexReaderCache(int maxFiles, size_t maxMem, bool premultiply, PtexInputHandler* inputHandler, PtexErrorHandler* errorHandler)
+    PtexReaderCache(int maxFiles, size_t maxMem, bool premultiply, PtexInputHandler* inputHandler, PtexErrorHandler* errorHandler,
+                    bool memoryMapped, Policy policy)
         : _maxFiles(maxFiles), _maxMem(maxMem), _io(inputHandler), _err(errorHandler), _premultiply(premultiply),
-          _memUsed(sizeof(*this)), _filesOpen(0), _mruList(&_mruLists[0]), _prevMruList(&_mruLists[1]),
-          _peakMemUsed(0), _peakFilesOpen(0), _fileOpens(0), _blockReads(0)
+          _memoryMapped(memoryMapped), _policy(policy),
+          _memUsed(sizeof(*this)), _filesOpen(0), _useClock(0),
+          _peakMemUsed(0), _peakFilesOpen(0)
     {
-        memset((void*)&_mruLists[0], 0, sizeof(_mruLists));
         CACHE_LINE_PAD_INIT(_memUsed); // keep cppcheck happy
         CACHE_LINE_PAD_INIT(_filesOpen);
-        CACHE_LINE_PAD_INIT(_mruLock);
+        CACHE_LINE_PAD_INIT(_useClock);
     }
 
-    ~PtexReaderCache()
-    {}
+    ~PtexReaderCache();
 
     virtual void release() { delete this; }
 
@@ -247,6 +343,8 @@ public:
     virtual void purge(const char* /*filename*/);
     virtual void purgeAll();
     virtual void getStats(Stats& stats);
+    virtual Policy getPolicy() { return _policy; }
+    virtual void getDetailedStats(DetailedStats& stats);
 
     void purge(PtexCachedReader* reader);
 
@@ -265,16 +363,84 @@ public:
     void logRecentlyUsed(PtexCachedReader* reader);
 
 private:
+    /* Mru slots per shard.  Readers in the mru lists are not yet in the lru
+       lists and can't be pruned, so the total (numShards * numMruFiles) is
+       kept close to the 50 slots of the single, unsharded list. */
+    static const int numMruFiles = 4;
+    struct MruList {
+        volatile int next;
+        PtexCachedReader* volatile files[numMruFiles];
+    };
+
+    /* Files are divided among shards by filename hash.  Each shard has its own
+       mru buffers, lru lists, and resource accounting so that threads releasing
+       unrelated files don't contend for the same mru list and lock.  The global
+       totals are kept in sync with the shards.  The file limit is enforced by
+       closing files in the shard being processed first and then borrowing
+       from other shards that are over their share; the memory limit is
+       enforced by evicting the least recently used faces across all shards.
+       With policy_2q, files that haven't been reused are kept on a separate
+       probation list and are pruned before the protected (reused) files;
+       protectedMemUsed tracks the memory accounted for by protected files so
+       their share can be capped. */
+    static const int numShards = 16;
+    typedef PtexLruList<PtexCachedReader, &PtexCachedReader::_activeFilesItem> ActiveList;
+    struct Shard {
+        Mutex mruLock;
+        MruList mruLists[2];
+        MruList* volatile mruList;
+        MruList* volatile prevMruList;
+        PtexLruList<PtexCachedReader, &PtexCachedReader::_openFilesItem> openFiles;
+        ActiveList activeFiles;
+        ActiveList protectedFiles;
+        volatile size_t memUsed;
+        volatile size_t protectedMemUsed;
+        volatile size_t filesOpen;
+        size_t fileOpens;
+        size_t blockReads;
+        char pad[CACHE_LINE_SIZE];
+
+        Shard() : mruList(&mruLists[0]), prevMruList(&mruLists[1]),
+                  memUsed(0), protectedMemUsed(0), filesOpen(0), fileOpens(0), blockReads(0)
+        {
+            memset((void*)&mruLists[0], 0, sizeof(mruLists));
+            memset(pad, 0, sizeof(pad)); // keep cppcheck happy
+        }
+    };
+
     struct Purger {
-        size_t memUsedChangeTotal;
-        Purger() : memUsedChangeTotal(0) {}
-        void operator() (PtexCachedReader* reader);
+        PtexReaderCache* cache;
+        Purger(PtexReaderCache* cache) : cache(cache) {}
+        void operator() (PtexCachedReader* reader) { cache->purge(reader); }
+    };
+
+    struct PrefetchCanceller {
+        void operator() (PtexCachedReader* reader) { reader->cancelPrefetches(); }
     };
 
     bool findFile(const char*& filename, std::string& buffer, Ptex::String& error);
-    void processMru();
-    void pruneFiles();
-    void pruneData();
+    void adjustMemUsed(Shard& shard, size_t amount) {
+        if (amount) AtomicAdd(&shard.memUsed, amount);
+        adjustMemUsed(amount);
+    }
+    void adjustProtectedMemUsed(Shard& shard, size_t amount) {
+        if (amount) AtomicAdd(&shard.protectedMemUsed, amount);
+    }
+    size_t protectedMemUsed() const {
+        size_t total = 0;
+        for (int i = 0; i < numShards; i++) total += _shards[i].protectedMemUsed;
+        return total;
+    }
+    void adjustFilesOpen(Shard& shard, size_t amount) {
+        if (amount) AtomicAdd(&shard.filesOpen, amount);
+        adjustFilesOpen(amount);
+    }
+    void processMru(Shard& shard);
+    void pruneFiles(Shard& shard);
+    void pruneData(Shard& shard);
+    void pruneList(Shard& shard, bool protectedFiles, bool protectedShare, size_t limit, uint32_t now);
+    size_t closeFiles(Shard& shard, size_t count);
+    size_t freeData(Shard& shard, bool protectedFiles, size_t amount, uint32_t cutoff, bool all);
     size_t _maxFiles;
     size_t _maxMem;
     PtexInputHandler* _io;
@@ -284,26 +450,16 @@ private:
     typedef PtexHashMap<StringKey,PtexCachedReader*> FileMap;
     FileMap _files;
     bool _premultiply;
+    bool _memoryMapped;
+    Policy _policy;
     volatile size_t _memUsed; CACHE_LINE_PAD(_memUsed,size_t);
     volatile size_t _filesOpen; CACHE_LINE_PAD(_filesOpen,size_t);
-    Mutex _mruLock; CACHE_LINE_PAD(_mruLock,Mutex);
-
-    static const int numMruFiles = 50;
-    struct MruList {
-        volatile int next;
-        PtexCachedReader* volatile files[numMruFiles];
-    };
-    MruList _mruLists[2];
-    MruList* volatile _mruList;
-    MruList* volatile _prevMruList;
-
-    PtexLruList<PtexCachedReader, &PtexCachedReader::_openFilesItem> _openFiles;
-    PtexLruList<PtexCachedReader, &PtexCachedReader::_activeFilesItem> _activeFiles;
+    volatile uint32_t _useClock; CACHE_LINE_PAD(_useClock,uint32_t); // advanced once per mru update
+    Shard _shards[numShards];
+    PtexStats _stats;
 
     size_t _peakMemUsed;
     size_t _peakFilesOpen;
-    size_t _fileOpens;
-    size_t _blockReads;
 };
 
 PTEX_NAMESPACE_END
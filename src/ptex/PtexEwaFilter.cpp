@@ -0,0 +1,303 @@
+/*
+PTEX SOFTWARE
+Copyright 2014 Disney Enterprises, Inc.  All rights reserved
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+  * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+  * Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+  * The names "Disney", "Walt Disney Pictures", "Walt Disney Animation
+    Studios" or the names of its contributors may NOT be used to
+    endorse or promote products derived from this software without
+    specific prior written permission from Walt Disney Pictures.
+
+Disclaimer: THIS SOFTWARE IS PROVIDED BY WALT DISNEY PICTURES AND
+CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING,
+BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE, NONINFRINGEMENT AND TITLE ARE DISCLAIMED.
+IN NO EVENT SHALL WALT DISNEY PICTURES, THE COPYRIGHT HOLDER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND BASED ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+*/
+
+#include "PtexPlatform.h"
+#include <cmath>
+#include <assert.h>
+
+#include "PtexEwaFilter.h"
+#include "PtexEwaKernel.h"
+#include "PtexTriangleKernel.h"
+#include "PtexUtils.h"
+
+namespace {
+    inline float squared(float x) { return x*x; }
+
+    // max number of edges a kernel may be carried across (enough to reach a corner face
+    // through a main face / subface transition)
+    const int MaxEdgeDepth = 3;
+}
+
+PTEX_NAMESPACE_BEGIN
+
+void PtexEwaFilter::eval(float* result, int firstChan, int nChannels,
+                         int faceid, float u, float v,
+                         float uw1, float vw1, float uw2, float vw2,
+                         float width, float blur)
+{
+    // init
+    if (!_tx || nChannels <= 0) return;
+    if (faceid < 0 || faceid >= _tx->numFaces()) return;
+    EvalContext ctx;
+    ctx.firstChanOffset = firstChan*DataSize(_dt);
+    ctx.nchan = PtexUtils::min(nChannels, _ntxchan-firstChan);
+
+    // get face info
+    const FaceInfo& f = _tx->getFaceInfo(faceid);
+
+    // if neighborhood is constant, just return constant value of face
+    if (f.isNeighborhoodConstant()) {
+        PtexPtr<PtexFaceData> data ( _tx->getData(faceid, 0) );
+        if (data) {
+            char* d = (char*) data->getData() + ctx.firstChanOffset;
+            Ptex::ConvertToFloat(result, d, _dt, ctx.nchan);
+        }
+        return;
+    }
+
+    // handle border modes
+    bool return_black = false;
+
+    switch (_uMode) {
+    case m_clamp: u = PtexUtils::clamp(u, 0.0f, 1.0f); break;
+    case m_periodic: u = u-PtexUtils::floor(u); break;
+    case m_black: if (u <= -1.0f || u >= 2.0f) return_black = true; break;
+    }
+
+    switch (_vMode) {
+    case m_clamp: v = PtexUtils::clamp(v, 0.0f, 1.0f); break;
+    case m_periodic: v = v-PtexUtils::floor(v); break;
+    case m_black: if (v <= -1.0f || v >= 2.0f) return_black = true; break;
+    }
+
+    if (return_black) {
+        memset(result, 0, sizeof(float)*ctx.nchan);
+        return;
+    }
+
+    // build kernel
+    PtexEwaKernel k;
+    buildKernel(k, u, v, uw1, vw1, uw2, vw2, width, blur, f.res);
+
+    // accumulate the weight as we apply
+    ctx.weight = 0;
+
+    // allocate temporary result
+    ctx.result = (float*) alloca(sizeof(float)*ctx.nchan);
+    memset(ctx.result, 0, sizeof(float)*ctx.nchan);
+
+    // apply to faces
+    splitAndApply(ctx, k, faceid, f, 0);
+
+    // normalize (both for data type and cumulative kernel weight applied)
+    // and output result
+    if (ctx.weight > 0) {
+        float scale = 1.0f / (ctx.weight * OneValue(_dt));
+        for (int i = 0; i < ctx.nchan; i++) result[i] = float(ctx.result[i] * scale);
+    }
+    else memset(result, 0, sizeof(float)*ctx.nchan);
+}
+
+
+void PtexEwaFilter::buildKernel(PtexEwaKernel& k, float u, float v,
+                                float uw1, float vw1, float uw2, float vw2,
+                                float width, float blur, Res faceRes)
+{
+    // compute ellipse coefficients, A*u^2 + B*u*v + C*v^2 == AC - B^2/4
+    float scaleAC = 0.25f * width*width;
+    float scaleB = -2.0f * scaleAC;
+    float A = (vw1*vw1 + vw2*vw2) * scaleAC;
+    float B = (uw1*vw1 + uw2*vw2) * scaleB;
+    float C = (uw1*uw1 + uw2*uw2) * scaleAC;
+
+    // compute min blur for eccentricity clamping
+    const float maxEcc = 15.0f; // max eccentricity
+    const float eccRatio = (maxEcc*maxEcc + 1.0f) / (maxEcc*maxEcc - 1.0f);
+    float X = sqrtf(squared(A - C) + squared(B));
+    float b_e = 0.5f * (eccRatio * X - (A + C));
+
+    // compute min blur for texel clamping
+    // (ensure that ellipse is no smaller than a texel along u and v)
+    float b_tu = squared(0.5f / (float)faceRes.u());
+    float b_tv = squared(0.5f / (float)faceRes.v());
+
+    // add blur (C holds the u extent and A the v extent)
+    float b_b = 0.25f * blur * blur;
+    float b = PtexUtils::max(b_b, b_e);
+    A += PtexUtils::max(b, b_tv);
+    C += PtexUtils::max(b, b_tu);
+
+    // compute minor radius
+    X = sqrtf(squared(A - C) + squared(B));
+    float m = sqrtf(2.0f*(A*C - 0.25f*B*B) / (A + C + X));
+
+    // choose desired resolution
+    int reslog2 = PtexUtils::max(0, PtexUtils::calcResFromWidth(2.0f*m));
+
+    // scale by kernel width
+    float scale = PtexTriangleKernelWidth * PtexTriangleKernelWidth;
+    A *= scale;
+    B *= scale;
+    C *= scale;
+
+    // find u,v extents
+    float uw = PtexUtils::min(sqrtf(C), 1.0f);
+    float vw = PtexUtils::min(sqrtf(A), 1.0f);
+
+    // normalize coefficients so that Q == 1 at the edge of the kernel
+    float Finv = 1.0f / (A*C - 0.25f*B*B);
+
+    // init kernel
+    k.set((int8_t)reslog2, u, v, u-uw, v-vw, u+uw, v+vw, A*Finv, B*Finv, C*Finv);
+}
+
+
+void PtexEwaFilter::splitAndApply(EvalContext& ctx, PtexEwaKernel& k,
+                                  int faceid, const Ptex::FaceInfo& f, int depth)
+{
+    // split off the parts of the kernel beyond each edge; the corners go with the
+    // u splits and are split again as needed in the adjacent face
+    PtexEwaKernel ka;
+    if (k.u1 < 0) {
+        k.splitL(ka);
+        applyAcrossEdge(ctx, ka, faceid, f, e_left, depth);
+    }
+    if (k.u2 > 1) {
+        k.splitR(ka);
+        applyAcrossEdge(ctx, ka, faceid, f, e_right, depth);
+    }
+    if (k.v1 < 0) {
+        k.splitB(ka);
+        applyAcrossEdge(ctx, ka, faceid, f, e_bottom, depth);
+    }
+    if (k.v2 > 1) {
+        k.splitT(ka);
+        applyAcrossEdge(ctx, ka, faceid, f, e_top, depth);
+    }
+
+    // apply to local face
+    apply(ctx, k, faceid, f);
+}
+
+
+void PtexEwaFilter::applyAcrossEdge(EvalContext& ctx, PtexEwaKernel& k,
+                                    int faceid, const Ptex::FaceInfo& f, int eid, int depth)
+{
+    int afid = f.adjface(eid), aeid = f.adjedge(eid);
+    if (afid < 0) {
+        // at a border, the kernel is renormalized over the remaining texels
+        // except in black mode where the missing texels count as black
+        BorderMode mode = (eid == e_left || eid == e_right) ? _uMode : _vMode;
+        if (mode == m_black) applyBlack(ctx, k, f);
+        return;
+    }
+    if (_options.noedgeblend || depth >= MaxEdgeDepth) return;
+
+    // map kernel into adjacent face coords, adjusting the scale for face/subface boundaries
+    const Ptex::FaceInfo& af = _tx->getFaceInfo(afid);
+    bool fIsSubface = f.isSubface(), afIsSubface = af.isSubface();
+    if (fIsSubface == afIsSubface) {
+        k.reorient(eid, aeid, 1.0f, -1.0f);
+    }
+    else if (afIsSubface) {
+        // main face to subface transition
+        // the adjacent face is the primary subface which covers the first half of
+        // the edge; the part over the secondary subface gets split again
+        k.reorient(eid, aeid, 1.0f, -2.0f);
+    }
+    else {
+        // subface to main face transition
+        // the primary subface (the one the main face points to) covers the first half of the edge
+        bool primary = (af.adjface(aeid) == faceid);
+        k.reorient(eid, aeid, primary ? 0.5f : 1.0f, -0.5f);
+    }
+    splitAndApply(ctx, k, afid, af, depth + 1);
+}
+
+
+void PtexEwaFilter::applyBlack(EvalContext& ctx, PtexEwaKernel& k, const Ptex::FaceInfo& f)
+{
+    // accumulate the weight of the texels beyond the edge with a value of zero
+    Res res((int8_t)PtexUtils::min(int(k.reslog2), int(f.res.ulog2)),
+            (int8_t)PtexUtils::min(int(k.reslog2), int(f.res.vlog2)));
+    PtexTriangleKernelIter ki;
+    k.getIterator(ki, res);
+    if (!ki.valid) return;
+
+    int size = DataSize(_dt) * ctx.nchan;
+    void* black = alloca(size);
+    memset(black, 0, size);
+    ki.applyConst(ctx.result, black, _dt, ctx.nchan);
+    ctx.weight += ki.weight;
+}
+
+
+void PtexEwaFilter::apply(EvalContext& ctx, PtexEwaKernel& k, int faceid, const Ptex::FaceInfo& f)
+{
+    // clamp kernel extent and resolution to face
+    k.clampExtent();
+    Res res((int8_t)PtexUtils::min(int(k.reslog2), int(f.res.ulog2)),
+            (int8_t)PtexUtils::min(int(k.reslog2), int(f.res.vlog2)));
+
+    // build kernel iterator
+    PtexTriangleKernelIter ki;
+    k.getIterator(ki, res);
+    if (!ki.valid) return;
+
+    // get face data, and apply
+    PtexPtr<PtexFaceData> dh ( _tx->getData(faceid, res) );
+    if (!dh) return;
+
+    bool tanvecMode = (_efm == efm_tanvec) && (ctx.nchan >= 2) && (k.rot > 0);
+    if (!tanvecMode) {
+        applyIter(ctx, ki, dh);
+        return;
+    }
+
+    // apply to temporary result, then rotate tangent-space vector data and update main result
+    float* result = ctx.result;
+    ctx.result = (float*) alloca(sizeof(float)*ctx.nchan);
+    memset(ctx.result, 0, sizeof(float)*ctx.nchan);
+    applyIter(ctx, ki, dh);
+
+    switch (k.rot) {
+        case 1:
+            result[0] -= ctx.result[1];
+            result[1] += ctx.result[0];
+            break;
+        case 2:
+            result[0] -= ctx.result[0];
+            result[1] -= ctx.result[1];
+            break;
+        case 3:
+            result[0] += ctx.result[1];
+            result[1] -= ctx.result[0];
+            break;
+    }
+    for (int i = 2; i < ctx.nchan; i++) result[i] += ctx.result[i];
+    ctx.result = result;
+}
+
+PTEX_NAMESPACE_END
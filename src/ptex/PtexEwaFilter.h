@@ -0,0 +1,104 @@
+#ifndef PtexEwaFilter_h
+#define PtexEwaFilter_h
+
+/*
+PTEX SOFTWARE
+Copyright 2014 Disney Enterprises, Inc.  All rights reserved
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+  * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+  * Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+  * The names "Disney", "Walt Disney Pictures", "Walt Disney Animation
+    Studios" or the names of its contributors may NOT be used to
+    endorse or promote products derived from this software without
+    specific prior written permission from Walt Disney Pictures.
+
+Disclaimer: THIS SOFTWARE IS PROVIDED BY WALT DISNEY PICTURES AND
+CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING,
+BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE, NONINFRINGEMENT AND TITLE ARE DISCLAIMED.
+IN NO EVENT SHALL WALT DISNEY PICTURES, THE COPYRIGHT HOLDER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND BASED ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+*/
+
+#include "Ptexture.h"
+#include "PtexTriangleFilter.h"
+
+PTEX_NAMESPACE_BEGIN
+
+class PtexEwaKernel;
+
+/** Elliptical weighted average (EWA) filter for quad meshes.
+
+    The filter footprint is an ellipse derived from the two footprint
+    vectors rather than their axis-aligned bounding box, and the mipmap
+    level is chosen from the minor axis.  Diagonal and anisotropic
+    footprints are therefore sharper and touch fewer texels than with
+    the separable filters.  Texels are weighted with the same gaussian
+    (and row iterator) as the triangle filter.
+
+    Kernels extending past a face edge are split and the remainder is
+    mapped into the adjacent face (including main face / subface
+    transitions).  Corner faces are reached by crossing two edges in
+    turn, which approximates the corner neighborhood at extraordinary
+    vertices.  Since the weight actually applied is accumulated, parts
+    of the kernel that are dropped are implicitly renormalized.
+*/
+class PtexEwaFilter : public PtexTriangleFilter
+{
+ public:
+    PtexEwaFilter(PtexTexture* tx, const PtexFilter::Options& opts ) :
+        PtexTriangleFilter(tx, opts),
+        _uMode(tx->uBorderMode()), _vMode(tx->vBorderMode()),
+        _efm(tx->edgeFilterMode()) {}
+    virtual void eval(float* result, int firstchan, int nchannels,
+                      int faceid, float u, float v,
+                      float uw1, float vw1, float uw2, float vw2,
+                      float width, float blur);
+
+    /** Derivatives use the generic finite difference version; the
+        triangle filter's analytic derivatives don't apply to EWA kernels. */
+    virtual void evalDeriv(float* result, float* dresultdu, float* dresultdv,
+                           int firstchan, int nchannels, int faceid, float u, float v,
+                           float uw1, float vw1, float uw2, float vw2,
+                           float width, float blur)
+    {
+        PtexFilter::evalDeriv(result, dresultdu, dresultdv, firstchan, nchannels, faceid, u, v,
+                              uw1, vw1, uw2, vw2, width, blur);
+    }
+
+ protected:
+    void buildKernel(PtexEwaKernel& k, float u, float v,
+                     float uw1, float vw1, float uw2, float vw2,
+                     float width, float blur, Res faceRes);
+
+    void splitAndApply(EvalContext& ctx, PtexEwaKernel& k, int faceid, const Ptex::FaceInfo& f, int depth);
+    void applyAcrossEdge(EvalContext& ctx, PtexEwaKernel& k,
+                         int faceid, const Ptex::FaceInfo& f, int eid, int depth);
+    void applyBlack(EvalContext& ctx, PtexEwaKernel& k, const Ptex::FaceInfo& f);
+    void apply(EvalContext& ctx, PtexEwaKernel& k, int faceid, const Ptex::FaceInfo& f);
+
+    virtual ~PtexEwaFilter() {}
+
+    BorderMode _uMode, _vMode;  // border modes (clamp,black,periodic)
+    EdgeFilterMode _efm;        // edge filter mode (rotate when kernel is rotated or not)
+};
+
+PTEX_NAMESPACE_END
+
+#endif
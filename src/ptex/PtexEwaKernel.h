@@ -0,0 +1,179 @@
+#ifndef PtexEwaKernel_h
+#define PtexEwaKernel_h
+
+/*
+PTEX SOFTWARE
+Copyright 2014 Disney Enterprises, Inc.  All rights reserved
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+  * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+  * Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+  * The names "Disney", "Walt Disney Pictures", "Walt Disney Animation
+    Studios" or the names of its contributors may NOT be used to
+    endorse or promote products derived from this software without
+    specific prior written permission from Walt Disney Pictures.
+
+Disclaimer: THIS SOFTWARE IS PROVIDED BY WALT DISNEY PICTURES AND
+CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING,
+BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE, NONINFRINGEMENT AND TITLE ARE DISCLAIMED.
+IN NO EVENT SHALL WALT DISNEY PICTURES, THE COPYRIGHT HOLDER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND BASED ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+*/
+
+#include <assert.h>
+#include "Ptexture.h"
+#include "PtexUtils.h"
+#include "PtexTriangleKernel.h"
+
+PTEX_NAMESPACE_BEGIN
+
+/// EWA filter kernel for quad faces (in normalized face coords)
+class PtexEwaKernel {
+ public:
+    int8_t reslog2;             // desired resolution (before clamping to face res)
+    int rot;                    // accumulated rotation from the starting face (in quarter turns)
+    float u, v;                 // uv filter center
+    float u1, v1;               // uv lower bounds
+    float u2, v2;               // uv upper bounds
+    float A,B,C;                // ellipse coefficients (Q = A*u^2 + B*u*v + C*v^2 == 1 at kernel edge)
+
+    void set(int8_t reslog2Val, float uVal, float vVal,
+             float u1Val, float v1Val, float u2Val, float v2Val,
+             float AVal, float BVal, float CVal)
+    {
+        reslog2 = reslog2Val;
+        rot = 0;
+        u = uVal; v = vVal;
+        u1 = u1Val; v1 = v1Val;
+        u2 = u2Val; v2 = v2Val;
+        A = AVal; B = BVal; C = CVal;
+    }
+
+    // split off the part of the kernel beyond each edge into ka
+    void splitL(PtexEwaKernel& ka) { ka = *this; u1 = 0; ka.u2 = 0; }
+    void splitR(PtexEwaKernel& ka) { ka = *this; u2 = 1; ka.u1 = 1; }
+    void splitB(PtexEwaKernel& ka) { ka = *this; v1 = 0; ka.v2 = 0; }
+    void splitT(PtexEwaKernel& ka) { ka = *this; v2 = 1; ka.v1 = 1; }
+
+    void clampExtent()
+    {
+        u1 = PtexUtils::max(u1, 0.0f);
+        v1 = PtexUtils::max(v1, 0.0f);
+        u2 = PtexUtils::min(u2, 1.0f);
+        v2 = PtexUtils::min(v2, 1.0f);
+    }
+
+    /** Map the kernel across edge eid into the coords of the adjacent face (across its edge aeid).
+
+        Points are mapped via the edge frames of the two faces: the
+        position along the shared edge, t, is mapped to toffset +
+        tscale*t and the distance from the edge is scaled by tscale.
+        For faces of the same size, toffset = 1 and tscale = -1;
+        transitions between main faces and subfaces also scale the
+        kernel by 2 or 1/2.
+     */
+    void reorient(int eid, int aeid, float toffset, float tscale)
+    {
+        // map center and extent
+        float cu = u, cv = v;
+        mapPoint(eid, aeid, toffset, tscale, u, v);
+        float bu[4] = { u1, u2, u1, u2 }, bv[4] = { v1, v1, v2, v2 };
+        for (int i = 0; i < 4; i++) mapPoint(eid, aeid, toffset, tscale, bu[i], bv[i]);
+        u1 = PtexUtils::min(PtexUtils::min(bu[0], bu[1]), PtexUtils::min(bu[2], bu[3]));
+        u2 = PtexUtils::max(PtexUtils::max(bu[0], bu[1]), PtexUtils::max(bu[2], bu[3]));
+        v1 = PtexUtils::min(PtexUtils::min(bv[0], bv[1]), PtexUtils::min(bv[2], bv[3]));
+        v2 = PtexUtils::max(PtexUtils::max(bv[0], bv[1]), PtexUtils::max(bv[2], bv[3]));
+
+        // the map is a scaled rotation by quarter turns; find its linear part, L, from the
+        // images of the unit vectors and transform the ellipse by the inverse: Q' = Linv^T Q Linv
+        float xu = cu + 1.0f, xv = cv, yu = cu, yv = cv + 1.0f;
+        mapPoint(eid, aeid, toffset, tscale, xu, xv);
+        mapPoint(eid, aeid, toffset, tscale, yu, yv);
+        float l00 = xu - u, l10 = xv - v, l01 = yu - u, l11 = yv - v;
+        float dinv = 1.0f / (l00*l11 - l01*l10);
+        float i00 = l11*dinv, i01 = -l01*dinv, i10 = -l10*dinv, i11 = l00*dinv;
+        float Bh = 0.5f*B;
+        float Ap = A*i00*i00 + 2.0f*Bh*i00*i10 + C*i10*i10;
+        float Bp = 2.0f*(A*i00*i01 + Bh*(i00*i11 + i10*i01) + C*i10*i11);
+        float Cp = A*i01*i01 + 2.0f*Bh*i01*i11 + C*i11*i11;
+        A = Ap; B = Bp; C = Cp;
+
+        rot = (rot + eid - aeid + 6) % 4;
+    }
+
+    void getIterator(PtexTriangleKernelIter& ki, Res res)
+    {
+        // quad rows are iterated with the triangle iterator with the w bounds disabled
+        const int wmax = 1<<28;
+        int resu = res.u(), resv = res.v();
+        float scaleu = (float)resu, scalev = (float)resv;
+        ki.rowlen = resu;
+        ki.u = u * scaleu - 0.5f;
+        ki.v = v * scalev - 0.5f;
+        ki.u1 = int(PtexUtils::ceil(u1 * scaleu - 0.5f));
+        ki.v1 = int(PtexUtils::ceil(v1 * scalev - 0.5f));
+        ki.u2 = int(PtexUtils::ceil(u2 * scaleu - 0.5f));
+        ki.v2 = int(PtexUtils::ceil(v2 * scalev - 0.5f));
+        ki.w1 = -wmax;
+        ki.w2 = wmax;
+
+        // convert coefficients to texel units, and weight by texel area
+        ki.A = A / (scaleu*scaleu);
+        ki.B = B / (scaleu*scalev);
+        ki.C = C / (scalev*scalev);
+        ki.wscale = 1.0f / (scaleu*scalev);
+        ki.valid = (ki.u2 > ki.u1 && ki.v2 > ki.v1);
+        ki.weight = 0;
+    }
+
+ private:
+    // position along edge (in ccw direction), t, and distance outside of edge, s
+    static void toEdge(int eid, float u, float v, float& t, float& s)
+    {
+        switch (eid & 3) {
+        case e_bottom: t = u;        s = -v;       break;
+        case e_right:  t = v;        s = u - 1.0f; break;
+        case e_top:    t = 1.0f - u; s = v - 1.0f; break;
+        case e_left:   t = 1.0f - v; s = -u;       break;
+        }
+    }
+
+    static void fromEdge(int eid, float t, float s, float& u, float& v)
+    {
+        switch (eid & 3) {
+        case e_bottom: u = t;        v = -s;       break;
+        case e_right:  v = t;        u = 1.0f + s; break;
+        case e_top:    u = 1.0f - t; v = 1.0f + s; break;
+        case e_left:   v = 1.0f - t; u = -s;       break;
+        }
+    }
+
+    static void mapPoint(int eid, int aeid, float toffset, float tscale, float& u, float& v)
+    {
+        // adjacent faces run along the shared edge in opposite directions, and the
+        // outside of one face is the inside of the other (hence tscale < 0)
+        float t, s;
+        toEdge(eid, u, v, t, s);
+        fromEdge(aeid, toffset + tscale * t, tscale * s, u, v);
+    }
+};
+
+PTEX_NAMESPACE_END
+
+#endif
@@ -35,8 +35,10 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
 
 #include "PtexPlatform.h"
 #include "Ptexture.h"
+#include "PtexEwaFilter.h"
 #include "PtexSeparableFilter.h"
 #include "PtexSeparableKernel.h"
+#include "PtexSimd.h"
 #include "PtexTriangleFilter.h"
 
 PTEX_NAMESPACE_BEGIN
@@ -45,24 +47,38 @@ PTEX_NAMESPACE_BEGIN
 class PtexPointFilter : public PtexFilter
 {
  public:
-    PtexPointFilter(PtexTexture* tx) : _tx(tx) {}
+    PtexPointFilter(PtexTexture* tx, const PtexFilter::Options& opts) : PtexFilter(tx, opts) {}
     virtual void release() { delete this; }
     virtual void eval(float* result, int firstchan, int nchannels,
                       int faceid, float u, float v,
                       float /*uw1*/, float /*vw1*/, float /*uw2*/, float /*vw2*/,
                       float /*width*/, float /*blur*/)
     {
-        if (!_tx || nchannels <= 0) return;
-        if (faceid < 0 || faceid >= _tx->numFaces()) return;
-        const FaceInfo& f = _tx->getFaceInfo(faceid);
+        sample(_tx, result, firstchan, nchannels, faceid, u, v);
+    }
+
+    virtual void evalMulti(int ntextures, PtexTexture* const* textures, float* const* results,
+                           const int* firstchans, const int* nchannels,
+                           int faceid, float u, float v,
+                           float /*uw1*/, float /*vw1*/, float /*uw2*/, float /*vw2*/,
+                           float /*width*/, float /*blur*/)
+    {
+        for (int i = 0; i < ntextures; i++)
+            sample(textures[i], results[i], firstchans[i], nchannels[i], faceid, u, v);
+    }
+
+ private:
+    static void sample(PtexTexture* tx, float* result, int firstchan, int nchannels,
+                       int faceid, float u, float v)
+    {
+        if (!tx || nchannels <= 0) return;
+        if (faceid < 0 || faceid >= tx->numFaces()) return;
+        const FaceInfo& f = tx->getFaceInfo(faceid);
         int resu = f.res.u(), resv = f.res.v();
         int ui = PtexUtils::clamp(int(u*(float)resu), 0, resu-1);
         int vi = PtexUtils::clamp(int(v*(float)resv), 0, resv-1);
-        _tx->getPixel(faceid, ui, vi, result, firstchan, nchannels);
+        tx->getPixel(faceid, ui, vi, result, firstchan, nchannels);
     }
-
- private:
-    PtexTexture* _tx;
 };
 
 
@@ -70,16 +86,33 @@ class PtexPointFilter : public PtexFilter
 class PtexPointFilterTri : public PtexFilter
 {
  public:
-    PtexPointFilterTri(PtexTexture* tx) : _tx(tx) {}
+    PtexPointFilterTri(PtexTexture* tx, const PtexFilter::Options& opts) : PtexFilter(tx, opts) {}
     virtual void release() { delete this; }
     virtual void eval(float* result, int firstchan, int nchannels,
                       int faceid, float u, float v,
                       float /*uw1*/, float /*vw1*/, float /*uw2*/, float /*vw2*/,
                       float /*width*/, float /*blur*/)
     {
-        if (!_tx || nchannels <= 0) return;
-        if (faceid < 0 || faceid >= _tx->numFaces()) return;
-        const FaceInfo& f = _tx->getFaceInfo(faceid);
+        sample(_tx, result, firstchan, nchannels, faceid, u, v);
+    }
+
+    virtual void evalMulti(int ntextures, PtexTexture* const* textures, float* const* results,
+                           const int* firstchans, const int* nchannels,
+                           int faceid, float u, float v,
+                           float /*uw1*/, float /*vw1*/, float /*uw2*/, float /*vw2*/,
+                           float /*width*/, float /*blur*/)
+    {
+        for (int i = 0; i < ntextures; i++)
+            sample(textures[i], results[i], firstchans[i], nchannels[i], faceid, u, v);
+    }
+
+ private:
+    static void sample(PtexTexture* tx, float* result, int firstchan, int nchannels,
+                       int faceid, float u, float v)
+    {
+        if (!tx || nchannels <= 0) return;
+        if (faceid < 0 || faceid >= tx->numFaces()) return;
+        const FaceInfo& f = tx->getFaceInfo(faceid);
         int res = f.res.u();
         int resm1 = res - 1;
         float ut = u * (float)res, vt = v * (float)res;
@@ -89,16 +122,13 @@ class PtexPointFilterTri : public PtexFilter
 
         if (uf + vf <= 1.0f) {
             // "even" triangles are stored in lower-left half-texture
-            _tx->getPixel(faceid, ui, vi, result, firstchan, nchannels);
+            tx->getPixel(faceid, ui, vi, result, firstchan, nchannels);
         }
         else {
             // "odd" triangles are stored in upper-right half-texture
-            _tx->getPixel(faceid, resm1-vi, resm1-ui, result, firstchan, nchannels);
+            tx->getPixel(faceid, resm1-vi, resm1-ui, result, firstchan, nchannels);
         }
     }
-
- private:
-    PtexTexture* _tx;
 };
 
 
@@ -113,19 +143,20 @@ class PtexPointFilterTri : public PtexFilter
     Hermite smoothstep is used to interpolate the two nearest 2 samples
     along the affected axis (or axes).
 */
+template<class Kernel>
 class PtexWidth4Filter : public PtexSeparableFilter
 {
  public:
-    typedef float KernelFn(float x, const float* c);
-
-    PtexWidth4Filter(PtexTexture* tx, const PtexFilter::Options& opts, KernelFn k, const float* c = 0)
-        : PtexSeparableFilter(tx, opts), _k(k), _c(c) {}
+    PtexWidth4Filter(PtexTexture* tx, const PtexFilter::Options& opts, const Kernel& k = Kernel())
+        : PtexSeparableFilter(tx, opts), _k(k) {}
 
     virtual void buildKernel(PtexSeparableKernel& k, float u, float v, float uw, float vw,
                              Res faceRes)
     {
-        buildKernelAxis(k.res.ulog2, k.u, k.uw, k.ku, u, uw, faceRes.ulog2);
-        buildKernelAxis(k.res.vlog2, k.v, k.vw, k.kv, v, vw, faceRes.vlog2);
+        float* kud = k.deriv ? k.ku + PtexSeparableKernel::kmax : 0;
+        float* kvd = k.deriv ? k.kv + PtexSeparableKernel::kmax : 0;
+        buildKernelAxis(k.res.ulog2, k.u, k.uw, k.ku, kud, u, uw, faceRes.ulog2);
+        buildKernelAxis(k.res.vlog2, k.v, k.vw, k.kv, kvd, v, vw, faceRes.vlog2);
     }
 
  private:
@@ -138,10 +169,17 @@ class PtexWidth4Filter : public PtexSeparableFilter
         return x < 1.0f ? (2.0f*x-3.0f)*x*x+1.0f : 0.0f;
     }
 
-    void buildKernelAxis(int8_t& k_ureslog2, int& k_u, int& k_uw, float* ku,
+    float blurDeriv(float x)
+    {
+        // derivative of blur(x)
+        return PtexUtils::abs(x) < 1.0f ? 6.0f*x*(PtexUtils::abs(x)-1.0f) : 0.0f;
+    }
+
+    void buildKernelAxis(int8_t& k_ureslog2, int& k_u, int& k_uw, float* ku, float* kd,
                          float u, float uw, int f_ureslog2)
     {
         // build 1 axis (note: "u" labels may repesent either u or v axis)
+        // if kd is given, the derivatives of the weights with respect to u are also computed
 
         // clamp filter width to no smaller than a texel
         uw = PtexUtils::max(uw, PtexUtils::reciprocalPow2(f_ureslog2));
@@ -171,9 +209,15 @@ class PtexWidth4Filter : public PtexSeparableFilter
                     // spread the filter gradually to approach the next-lower-res width
                     // at uw = .5, s = 1.0; at uw = 1, s = 0.8
                     float s = 1.0f/(uw + .75f);
-                    float ka = _k(xa, _c), kb = _k(xb, _c), kc = blur(xc*s);
+                    float ka = _k(xa), kb = _k(xb), kc = blur(xc*s);
                     ku[i] = ka * lerp1 + kc * lerp2;
                     ku[i+1] = kb * lerp1 + kc * lerp2;
+                    if (kd) {
+                        // dxa/du = dxb/du = -4, dxc/du = -2
+                        float dc = blurDeriv(xc*s) * s * -2.0f * lerp2;
+                        kd[i] = _k.deriv(xa) * -4.0f * lerp1 + dc;
+                        kd[i+1] = _k.deriv(xb) * -4.0f * lerp1 + dc;
+                    }
                 }
                 return;
             }
@@ -191,6 +235,13 @@ class PtexWidth4Filter : public PtexSeparableFilter
                     float ka = blur(xa*s), kb = blur(xb*s), kc = blur(xc*s);
                     ku[i] = ka * lerp1 + kc * lerp2;
                     ku[i+1] = kb * lerp1 + kc * lerp2;
+                    if (kd) {
+                        // dxa/du = dxb/du = dxc/du = -2
+                        float ds = s * -2.0f;
+                        float dc = blurDeriv(xc*s) * ds * lerp2;
+                        kd[i] = blurDeriv(xa*s) * ds * lerp1 + dc;
+                        kd[i+1] = blurDeriv(xb*s) * ds * lerp1 + dc;
+                    }
                 }
                 return;
             }
@@ -204,6 +255,10 @@ class PtexWidth4Filter : public PtexSeparableFilter
                 k_u = int(ui);
                 ku[0] = blur(upix-ui);
                 ku[1] = 1-ku[0];
+                if (kd) {
+                    kd[0] = blurDeriv(upix-ui);
+                    kd[1] = -kd[0];
+                }
                 return;
             }
         }
@@ -227,33 +282,98 @@ class PtexWidth4Filter : public PtexSeparableFilter
 
             // compute kernel weights
             float step = 1.0f/uwpix, x1 = ((float)u1-upix)*(float)step;
-            for (int i = 0; i < k_uw; i+=2) {
-                float xa = x1 + (float)i*step, xb = xa + step, xc = (xa+xb)*0.5f;
-                float ka = _k(xa, _c), kb = _k(xb, _c), kc = _k(xc, _c);
-                ku[i] = ka * lerp1 + kc * lerp2;
-                ku[i+1] = kb * lerp1 + kc * lerp2;
-            }
+            buildLerpTaps(ku, k_uw, x1, step, lerp1, lerp2);
+            if (kd) buildLerpDerivTaps(kd, k_uw, x1, step, lerp1, lerp2, -1.0f/uw);
         }
         else {
             k_u = u1;
             k_uw = u2-u1;
             // compute kernel weights
             float x1 = ((float)u1-upix)/uwpix, step = 1.0f/uwpix;
-            for (int i = 0; i < k_uw; i++) ku[i] = _k(x1 + (float)i*step, _c);
+            buildTaps(ku, k_uw, x1, step);
+            if (kd) buildDerivTaps(kd, k_uw, x1, step, -1.0f/uw);
+        }
+    }
+
+    // derivative taps of buildTaps/buildLerpTaps, where dxdu is the derivative of the
+    // kernel position with respect to u (only needed by evalDeriv, so not vectorized)
+    void buildDerivTaps(float* kd, int n, float x1, float step, float dxdu)
+    {
+        for (int i = 0; i < n; i++) kd[i] = _k.deriv(x1 + (float)i*step) * dxdu;
+    }
+
+    void buildLerpDerivTaps(float* kd, int n, float x1, float step, float lerp1, float lerp2, float dxdu)
+    {
+        for (int i = 0; i < n; i+=2) {
+            float xa = x1 + (float)i*step, xb = xa + step, xc = (xa+xb)*0.5f;
+            float dc = _k.deriv(xc) * lerp2;
+            kd[i] = (_k.deriv(xa) * lerp1 + dc) * dxdu;
+            kd[i+1] = (_k.deriv(xb) * lerp1 + dc) * dxdu;
+        }
+    }
+
+#ifdef PTEX_SIMD
+    // tap builders evaluate the kernel for 4 taps at a time; the tap positions and
+    // weights are computed with the same operations as the scalar versions
+
+    void buildTaps(float* ku, int n, float x1, float step)
+    {
+        using namespace PtexSimd;
+        float tmp[PtexSeparableKernel::kmax+3];
+        float4 vx1 = splat(x1), vstep = splat(step);
+        for (int i = 0; i < n; i += 4) {
+            float4 x = vx1 + set(float(i), float(i+1), float(i+2), float(i+3)) * vstep;
+            store(tmp+i, _k(x));
         }
+        memcpy(ku, tmp, sizeof(float)*n);
     }
 
-    KernelFn* _k;               // kernel function
-    const float* _c;            // kernel coefficients (if any)
+    void buildLerpTaps(float* ku, int n, float x1, float step, float lerp1, float lerp2)
+    {
+        using namespace PtexSimd;
+        float ta[PtexSeparableKernel::kmax/2+3], tb[PtexSeparableKernel::kmax/2+3];
+        float4 vx1 = splat(x1), vstep = splat(step), vhalf = splat(0.5f);
+        float4 vlerp1 = splat(lerp1), vlerp2 = splat(lerp2);
+        int npairs = n/2;
+        for (int j = 0; j < npairs; j += 4) {
+            int i = 2*j;
+            float4 xa = vx1 + set(float(i), float(i+2), float(i+4), float(i+6)) * vstep;
+            float4 xb = xa + vstep, xc = (xa+xb) * vhalf;
+            float4 kc = _k(xc) * vlerp2;
+            store(ta+j, _k(xa) * vlerp1 + kc);
+            store(tb+j, _k(xb) * vlerp1 + kc);
+        }
+        for (int j = 0; j < npairs; j++) {
+            ku[2*j] = ta[j];
+            ku[2*j+1] = tb[j];
+        }
+    }
+#else
+    void buildTaps(float* ku, int n, float x1, float step)
+    {
+        for (int i = 0; i < n; i++) ku[i] = _k(x1 + (float)i*step);
+    }
+
+    void buildLerpTaps(float* ku, int n, float x1, float step, float lerp1, float lerp2)
+    {
+        for (int i = 0; i < n; i+=2) {
+            float xa = x1 + (float)i*step, xb = xa + step, xc = (xa+xb)*0.5f;
+            float ka = _k(xa), kb = _k(xb), kc = _k(xc);
+            ku[i] = ka * lerp1 + kc * lerp2;
+            ku[i+1] = kb * lerp1 + kc * lerp2;
+        }
+    }
+#endif
+
+    Kernel _k;                  // kernel function
 };
 
 
-/** Separable bicubic filter */
-class PtexBicubicFilter : public PtexWidth4Filter
+/** Bicubic kernel function for a given sharpness */
+class PtexBicubicKernel
 {
  public:
-    PtexBicubicFilter(PtexTexture* tx, const PtexFilter::Options& opts, float sharpness)
-        : PtexWidth4Filter(tx, opts, kernelFn, _coeffs)
+    PtexBicubicKernel(float sharpness)
     {
         // compute Cubic filter coefficients:
         // abs(x) < 1:
@@ -274,32 +394,84 @@ class PtexBicubicFilter : public PtexWidth4Filter
         _coeffs[6] = 2.0f - float(2.0/3.0) * B;
     }
 
- private:
-    static float kernelFn(float x, const float* c)
+    float operator()(float x) const
     {
+        const float* c = _coeffs;
         x = PtexUtils::abs(x);
         if (x < 1.0f)      return (c[0]*x + c[1])*x*x + c[2];
         else if (x < 2.0f) return ((c[3]*x + c[4])*x + c[5])*x + c[6];
         else               return 0.0f;
     }
 
+    float deriv(float x) const
+    {
+        const float* c = _coeffs;
+        float sign = x < 0.0f ? -1.0f : 1.0f;
+        x = PtexUtils::abs(x);
+        if (x < 1.0f)      return sign * (3.0f*c[0]*x + 2.0f*c[1])*x;
+        else if (x < 2.0f) return sign * ((3.0f*c[3]*x + 2.0f*c[4])*x + c[5]);
+        else               return 0.0f;
+    }
+
+#ifdef PTEX_SIMD
+    PtexSimd::float4 operator()(PtexSimd::float4 x) const
+    {
+        using namespace PtexSimd;
+        const float* c = _coeffs;
+        x = abs(x);
+        float4 inner = (splat(c[0])*x + splat(c[1]))*x*x + splat(c[2]);
+        float4 outer = ((splat(c[3])*x + splat(c[4]))*x + splat(c[5]))*x + splat(c[6]);
+        return select(lessThan(x, splat(1.0f)), inner,
+                      select(lessThan(x, splat(2.0f)), outer, zero()));
+    }
+#endif
+
+ private:
     float _coeffs[7]; // filter coefficients for current sharpness
 };
 
 
-
-/** Separable gaussian filter */
-class PtexGaussianFilter : public PtexWidth4Filter
+/** Separable bicubic filter */
+class PtexBicubicFilter : public PtexWidth4Filter<PtexBicubicKernel>
 {
  public:
-    PtexGaussianFilter(PtexTexture* tx, const PtexFilter::Options& opts)
-        : PtexWidth4Filter(tx, opts, kernelFn) {}
+    PtexBicubicFilter(PtexTexture* tx, const PtexFilter::Options& opts, float sharpness)
+        : PtexWidth4Filter<PtexBicubicKernel>(tx, opts, PtexBicubicKernel(sharpness)) {}
+};
 
- private:
-    static float kernelFn(float x, const float*)
+
+
+/** Gaussian kernel function */
+class PtexGaussianKernel
+{
+ public:
+    float operator()(float x) const
     {
         return (float)exp(-2.0f*x*x);
     }
+
+    float deriv(float x) const
+    {
+        return -4.0f*x*(float)exp(-2.0f*x*x);
+    }
+
+#ifdef PTEX_SIMD
+    PtexSimd::float4 operator()(PtexSimd::float4 x) const
+    {
+        // taps are within a few texels of the center, well inside fastExp's range
+        using namespace PtexSimd;
+        return fastExp(splat(-2.0f)*x*x);
+    }
+#endif
+};
+
+
+/** Separable gaussian filter */
+class PtexGaussianFilter : public PtexWidth4Filter<PtexGaussianKernel>
+{
+ public:
+    PtexGaussianFilter(PtexTexture* tx, const PtexFilter::Options& opts)
+        : PtexWidth4Filter<PtexGaussianKernel>(tx, opts) {}
 };
 
 
@@ -352,6 +524,10 @@ class PtexBoxFilter : public PtexSeparableFilter
         // compute kernel weights along u and v directions
         computeWeights(k.ku, k.uw, 1.0f-(u1-u1floor), 1.0f-(u2ceil-u2));
         computeWeights(k.kv, k.vw, 1.0f-(v1-v1floor), 1.0f-(v2ceil-v2));
+        if (k.deriv) {
+            computeDerivWeights(k.ku + PtexSeparableKernel::kmax, k.uw, (float)k.res.u());
+            computeDerivWeights(k.kv + PtexSeparableKernel::kmax, k.vw, (float)k.res.v());
+        }
     }
 
  private:
@@ -368,6 +544,19 @@ class PtexBoxFilter : public PtexSeparableFilter
             kernel[size-1] = f2;
         }
     }
+
+    void computeDerivWeights(float* kernel, int size, float res)
+    {
+        // derivatives of the end weights (the box edges move res texels per unit of u)
+        if (size == 1) {
+            kernel[0] = 0.0f;
+        }
+        else {
+            kernel[0] = -res;
+            for (int i = 1; i < size-1; i++) kernel[i] = 0.0f;
+            kernel[size-1] = res;
+        }
+    }
 };
 
 
@@ -412,16 +601,83 @@ class PtexBilinearFilter : public PtexSeparableFilter
         k.ku[1] = ufrac;
         k.kv[0] = 1.0f - vfrac;
         k.kv[1] = vfrac;
+        if (k.deriv) {
+            float* kud = k.ku + PtexSeparableKernel::kmax;
+            float* kvd = k.kv + PtexSeparableKernel::kmax;
+            kud[0] = -(float)k.res.u();
+            kud[1] = (float)k.res.u();
+            kvd[0] = -(float)k.res.v();
+            kvd[1] = (float)k.res.v();
+        }
     }
 };
 
 
+void PtexFilter::evalBatch(float* result, int resultStride, int firstchan, int nchannels,
+                           int n, const int* faceid, const float* u, const float* v,
+                           const float* uw1, const float* vw1, const float* uw2, const float* vw2,
+                           float width, float blur)
+{
+    // generic version: evaluate queries one at a time through a temp buffer
+    if (nchannels <= 0) return;
+    float* tmp = (float*) alloca(sizeof(float)*nchannels);
+    for (int i = 0; i < n; i++) {
+        for (int c = 0; c < nchannels; c++) tmp[c] = result[c*resultStride + i];
+        eval(tmp, firstchan, nchannels, faceid[i], u[i], v[i], uw1[i], vw1[i], uw2[i], vw2[i],
+             width, blur);
+        for (int c = 0; c < nchannels; c++) result[c*resultStride + i] = tmp[c];
+    }
+}
+
+
+void PtexFilter::evalDeriv(float* result, float* dresultdu, float* dresultdv,
+                           int firstchan, int nchannels, int faceid, float u, float v,
+                           float uw1, float vw1, float uw2, float vw2, float width, float blur)
+{
+    // generic version: forward differences, stepping a quarter of the filter footprint
+    if (nchannels <= 0) return;
+    float du = 0.25f * ((PtexUtils::abs(uw1) + PtexUtils::abs(uw2)) * width + blur);
+    float dv = 0.25f * ((PtexUtils::abs(vw1) + PtexUtils::abs(vw2)) * width + blur);
+    du = PtexUtils::max(du, 1e-3f);
+    dv = PtexUtils::max(dv, 1e-3f);
+
+    // (results are left unchanged for an invalid face, which gives zero derivatives)
+    eval(result, firstchan, nchannels, faceid, u, v, uw1, vw1, uw2, vw2, width, blur);
+    memcpy(dresultdu, result, sizeof(float)*nchannels);
+    memcpy(dresultdv, result, sizeof(float)*nchannels);
+    eval(dresultdu, firstchan, nchannels, faceid, u+du, v, uw1, vw1, uw2, vw2, width, blur);
+    eval(dresultdv, firstchan, nchannels, faceid, u, v+dv, uw1, vw1, uw2, vw2, width, blur);
+    for (int c = 0; c < nchannels; c++) {
+        dresultdu[c] = (dresultdu[c] - result[c]) / du;
+        dresultdv[c] = (dresultdv[c] - result[c]) / dv;
+    }
+}
+
+
+void PtexFilter::evalMulti(int ntextures, PtexTexture* const* textures, float* const* results,
+                           const int* firstchans, const int* nchannels,
+                           int faceid, float u, float v,
+                           float uw1, float vw1, float uw2, float vw2, float width, float blur)
+{
+    // generic version: filter each texture separately with this filter's options
+    for (int i = 0; i < ntextures; i++) {
+        if (!textures[i]) continue;
+        if (textures[i] == _tx) {
+            eval(results[i], firstchans[i], nchannels[i], faceid, u, v, uw1, vw1, uw2, vw2, width, blur);
+            continue;
+        }
+        PtexPtr<PtexFilter> f(getFilter(textures[i], _options));
+        f->eval(results[i], firstchans[i], nchannels[i], faceid, u, v, uw1, vw1, uw2, vw2, width, blur);
+    }
+}
+
+
 PtexFilter* PtexFilter::getFilter(PtexTexture* tex, const PtexFilter::Options& opts)
 {
     switch (tex->meshType()) {
     case Ptex::mt_quad:
         switch (opts.filter) {
-        case f_point:       return new PtexPointFilter(tex);
+        case f_point:       return new PtexPointFilter(tex, opts);
         case f_bilinear:    return new PtexBilinearFilter(tex, opts);
         default:
         case f_box:         return new PtexBoxFilter(tex, opts);
@@ -430,12 +686,13 @@ PtexFilter* PtexFilter::getFilter(PtexTexture* tex, const PtexFilter::Options& o
         case f_bspline:     return new PtexBicubicFilter(tex, opts, 0.f);
         case f_catmullrom:  return new PtexBicubicFilter(tex, opts, 1.f);
         case f_mitchell:    return new PtexBicubicFilter(tex, opts, 2.f/3.f);
+        case f_ewa:         return new PtexEwaFilter(tex, opts);
         }
         break;
 
     case Ptex::mt_triangle:
         switch (opts.filter) {
-        case f_point:       return new PtexPointFilterTri(tex);
+        case f_point:       return new PtexPointFilterTri(tex, opts);
         default:            return new PtexTriangleFilter(tex, opts);
         }
         break;
@@ -35,6 +35,13 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
 
 #include <cmath>
 #include "PtexHalf.h"
+#include "PtexSimd.h"
+
+// without compile-time F16C on x86, select the F16C conversion at run time
+#if defined(PTEX_SIMD_SSE2) && !defined(__F16C__) && defined(__GNUC__)
+#  define PTEX_F16C_DISPATCH 1
+#  include <immintrin.h>
+#endif
 
 PTEX_NAMESPACE_BEGIN
 
@@ -61,4 +68,45 @@ uint16_t PtexHalf::fromFloat_except(uint32_t i)
         return (uint16_t)(s|0x7c00);
 }
 
+#ifdef PTEX_F16C_DISPATCH
+namespace {
+    bool hasF16C()
+    {
+        static const bool result = __builtin_cpu_supports("f16c");
+        return result;
+    }
+
+    __attribute__((target("f16c")))
+    int toFloatF16C(float* dst, const PtexHalf* src, int n)
+    {
+        int i = 0;
+        for (; i + 4 <= n; i += 4)
+            _mm_storeu_ps(dst + i, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)(src + i))));
+        return i;
+    }
+}
+#endif
+
+
+void PtexHalf::toFloat(float* dst, const PtexHalf* src, int n)
+{
+    int i = 0;
+#if defined(PTEX_F16C_DISPATCH)
+    if (hasF16C()) i = toFloatF16C(dst, src, n);
+#elif defined(PTEX_SIMD)
+    for (; i + 4 <= n; i += 4) PtexSimd::store(dst + i, PtexSimd::load(src + i));
+#endif
+    for (; i < n; i++) dst[i] = toFloat(src[i].bits);
+}
+
+
+void PtexHalf::fromFloat(PtexHalf* dst, const float* src, int n)
+{
+    int i = 0;
+#ifdef PTEX_SIMD
+    for (; i + 4 <= n; i += 4) PtexSimd::store(dst + i, PtexSimd::load(src + i));
+#endif
+    for (; i < n; i++) dst[i].bits = fromFloat(src[i]);
+}
+
 PTEX_NAMESPACE_END
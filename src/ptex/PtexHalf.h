@@ -112,6 +112,12 @@ struct PtexHalf {
         return fromFloat_except(u.i);
     }
 
+    /// Convert an array of n values to float (using SIMD where available)
+    PTEXAPI static void toFloat(float* dst, const PtexHalf* src, int n);
+
+    /// Convert an array of n floats to half (using SIMD where available)
+    PTEXAPI static void fromFloat(PtexHalf* dst, const float* src, int n);
+
  private:
     PTEXAPI static uint16_t fromFloat_except(uint32_t val);
 #ifndef DOXYGEN
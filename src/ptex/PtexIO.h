@@ -114,6 +114,7 @@ const int IBuffSize = 8192;         // default input buffer size
 const int BlockSize = 16384;        // target block size for file I/O
 const int TileSize  = 65536;        // target tile size (uncompressed)
 const int AllocaMax = 16384;        // max size for using alloca
+const int CoalesceMax = 1048576;    // max size of a coalesced multi-block read
 const int MetaDataThreshold = 1024; // cutoff for large meta data
 
 inline bool LittleEndian() {
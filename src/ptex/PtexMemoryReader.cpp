@@ -56,6 +56,13 @@ namespace {
 
 PTEX_NAMESPACE_BEGIN
 
+PtexTexture* PtexTexture::open(const char* path, Ptex::String& error, bool premultiply,
+                               bool /*memoryMapped*/)
+{
+    return open(path, error, premultiply);
+}
+
+
 PtexTexture* PtexTexture::open(const char* path, Ptex::String& error, bool premultiply)
 {
     PtexMemoryReader* reader = new PtexMemoryReader(premultiply, (PtexInputHandler*) 0, (PtexErrorHandler*) 0);
@@ -688,14 +695,12 @@ void PtexMemoryReader::readFaceData(FilePos pos, FaceDataHeader fdh, Res res, in
             bool useNew = unpackedSize > AllocaMax;
             char* tmp = useNew ? new char [unpackedSize] : (char*) alloca(unpackedSize);
             readZipBlock(tmp, fdh.blocksize(), unpackedSize);
-            if (fdh.encoding() == enc_diffzipped)
-                PtexUtils::decodeDifference(tmp, unpackedSize, datatype());
-            PtexUtils::interleave(tmp, uw * DataSize(datatype()), uw, vw,
-                                  pf->data(), uw * _pixelsize,
-                                  datatype(), _header.nchannels);
-            if (levelid==0 && _premultiply && _header.hasAlpha())
-                PtexUtils::multalpha(pf->data(), npixels, datatype(),
-                                     _header.nchannels, _header.alphachan);
+            // alpha is premultiplied as the face is interleaved
+            bool premult = levelid==0 && _premultiply && _header.hasAlpha();
+            PtexUtils::decodeInterleave(tmp, uw, vw, pf->data(), uw * _pixelsize,
+                                        datatype(), _header.nchannels,
+                                        fdh.encoding() == enc_diffzipped,
+                                        premult ? _header.alphachan : -1);
             if (useNew) delete [] tmp;
         }
         break;
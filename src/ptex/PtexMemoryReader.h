@@ -145,6 +145,12 @@ public:
     virtual void getData(int faceid, void* buffer, int stride, Res res);
     virtual PtexFaceData* getData(int faceid);
     virtual PtexFaceData* getData(int faceid, Res res);
+    virtual void getData(const int* faceids, int nfaces, void* const* buffers, const int* strides,
+                         bool /*parallel*/=false)
+    {
+        for (int i = 0; i < nfaces; i++)
+            getData(faceids[i], buffers[i], strides ? strides[i] : 0);
+    }
     virtual void getPixel(int faceid, int u, int v,
 			  float* result, int firstchan, int nchannels);
     virtual void getPixel(int faceid, int u, int v,
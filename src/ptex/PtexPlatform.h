@@ -65,6 +65,10 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
 #include <alloca.h>
 #include <string.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifdef __APPLE__
 #include <os/lock.h>
@@ -92,7 +96,8 @@ typedef off_t FilePos;
 PTEX_NAMESPACE_BEGIN
 
 /*
- * Mutex
+ * Mutex, SpinLock, and Condition (a condition variable paired with its own mutex;
+ * wait() must be called with the lock held)
  */
 
 #ifdef WINDOWS
@@ -119,6 +124,20 @@ private:
     CRITICAL_SECTION _spinlock;
 };
 
+class Condition {
+public:
+    Condition()    { InitializeCriticalSection(&_mutex); InitializeConditionVariable(&_cond); }
+    ~Condition()   { DeleteCriticalSection(&_mutex); }
+    void lock()    { EnterCriticalSection(&_mutex); }
+    void unlock()  { LeaveCriticalSection(&_mutex); }
+    void wait()    { SleepConditionVariableCS(&_cond, &_mutex, INFINITE); }
+    void signal()  { WakeConditionVariable(&_cond); }
+    void broadcast() { WakeAllConditionVariable(&_cond); }
+private:
+    CRITICAL_SECTION _mutex;
+    CONDITION_VARIABLE _cond;
+};
+
 #else
 // assume linux/unix/posix
 
@@ -156,6 +175,20 @@ private:
     pthread_spinlock_t _spinlock;
 };
 #endif // __APPLE__
+
+class Condition {
+public:
+    Condition()    { pthread_mutex_init(&_mutex, 0); pthread_cond_init(&_cond, 0); }
+    ~Condition()   { pthread_cond_destroy(&_cond); pthread_mutex_destroy(&_mutex); }
+    void lock()    { pthread_mutex_lock(&_mutex); }
+    void unlock()  { pthread_mutex_unlock(&_mutex); }
+    void wait()    { pthread_cond_wait(&_cond, &_mutex); }
+    void signal()  { pthread_cond_signal(&_cond); }
+    void broadcast() { pthread_cond_broadcast(&_cond); }
+private:
+    pthread_mutex_t _mutex;
+    pthread_cond_t _cond;
+};
 #endif
 
 /*
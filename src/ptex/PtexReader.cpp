@@ -37,10 +37,16 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
 #include <iostream>
 #include <sstream>
 #include <stdio.h>
+#include <algorithm>
 
 #include "Ptexture.h"
 #include "PtexUtils.h"
 #include "PtexReader.h"
+#include "PtexThreadPool.h"
+
+#ifdef PTEX_USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
 
 namespace {
     class TempErrorHandler : public PtexErrorHandler
@@ -52,13 +58,93 @@ namespace {
         }
         const std::string& getErrorString() const { return _error; }
     };
+
+    // use clock for readers that aren't managed by a cache (never advances)
+    const volatile uint32_t noUseClock = 0;
+
+    /* Inflate stream and compressed-data scratch buffer, one per thread.
+       Shared by all readers so that decompression doesn't need the
+       per-file read lock and files can be opened and closed without
+       reallocating zlib state.  The scratch buffer has a fixed size that
+       holds any compressed tile; larger blocks (e.g. untiled faces, level
+       headers) get a buffer of their own so the per-thread memory stays
+       bounded. */
+    class InflateContext
+    {
+        z_stream_s _zstream;
+#ifdef PTEX_USE_LIBDEFLATE
+        libdeflate_decompressor* _decompressor;
+#endif
+        char _scratch[Ptex::TileSize];
+    public:
+        InflateContext()
+        {
+            memset(&_zstream, 0, sizeof(_zstream));
+            inflateInit(&_zstream);
+#ifdef PTEX_USE_LIBDEFLATE
+            _decompressor = libdeflate_alloc_decompressor();
+#endif
+        }
+        ~InflateContext()
+        {
+            inflateEnd(&_zstream);
+#ifdef PTEX_USE_LIBDEFLATE
+            libdeflate_free_decompressor(_decompressor);
+#endif
+        }
+
+        z_stream_s& stream() { return _zstream; }
+
+        /* Decompress a complete zlib block held in memory with a single call.
+           Returns the number of bytes written to dst, or -1 if the data is corrupt
+           (or doesn't fit in dst). */
+        int inflateBlock(const void* src, int zipsize, void* dst, int unzipsize)
+        {
+#ifdef PTEX_USE_LIBDEFLATE
+            size_t total = 0;
+            if (libdeflate_zlib_decompress(_decompressor, src, size_t(zipsize),
+                                           dst, size_t(unzipsize), &total) != LIBDEFLATE_SUCCESS)
+                return -1;
+            return int(total);
+#else
+            _zstream.next_in = (Bytef*) src;
+            _zstream.avail_in = zipsize;
+            _zstream.next_out = (Bytef*) dst;
+            _zstream.avail_out = unzipsize;
+            int zresult = inflate(&_zstream, Z_FINISH);
+            int total = (int)_zstream.total_out;
+            inflateReset(&_zstream);
+            return zresult == Z_STREAM_END ? total : -1;
+#endif
+        }
+
+        /* Returns the scratch buffer, or null if size doesn't fit in it. */
+        char* scratch(int size)
+        {
+            return size <= int(sizeof(_scratch)) ? _scratch : 0;
+        }
+    };
+
+    InflateContext& threadInflateContext()
+    {
+        static thread_local InflateContext context;
+        return context;
+    }
 }
 
 PTEX_NAMESPACE_BEGIN
 
 PtexTexture* PtexTexture::open(const char* path, Ptex::String& error, bool premultiply)
 {
-    PtexReader* reader = new PtexReader(premultiply, (PtexInputHandler*) 0, (PtexErrorHandler*) 0);
+    return open(path, error, premultiply, false);
+}
+
+
+PtexTexture* PtexTexture::open(const char* path, Ptex::String& error, bool premultiply,
+                               bool memoryMapped)
+{
+    PtexReader* reader = new PtexReader(premultiply, (PtexInputHandler*) 0, (PtexErrorHandler*) 0,
+                                        memoryMapped);
     bool ok = reader->open(path, error);
     if (!ok) {
         reader->release();
@@ -68,30 +154,40 @@ PtexTexture* PtexTexture::open(const char* path, Ptex::String& error, bool premu
 }
 
 
-PtexReader::PtexReader(bool premultiply, PtexInputHandler* io, PtexErrorHandler* err)
-    : _io(io ? io : &_defaultIo),
+PtexReader::PtexReader(bool premultiply, PtexInputHandler* io, PtexErrorHandler* err,
+                       bool memoryMapped)
+    : _io(io ? io : memoryMapped ? (PtexInputHandler*)&_mappedIo : &_defaultIo),
       _err(err),
       _premultiply(premultiply),
       _ok(true),
       _needToOpen(true),
       _pendingPurge(false),
+      _readAt(false),
+      _fpRefs(0),
       _fp(0),
       _pos(0),
       _pixelsize(0),
       _constdata(0),
       _metadata(0),
       _hasEdits(false),
+      _reductionsLastUse(0),
+      _reductionsMemUsed(0),
+      _useClock(&noUseClock),
+      _stats(0),
       _baseMemUsed(sizeof(*this)),
       _memUsed(_baseMemUsed),
       _opens(0),
-      _blockReads(0)
+      _blockReads(0),
+      _prefetchesPending(0),
+      _prefetchCancelled(false)
 {
-    memset(&_zstream, 0, sizeof(_zstream));
+    _readAt = _io->supportsReadAt();
 }
 
 
 PtexReader::~PtexReader()
 {
+    cancelPrefetches();
     closeFP();
     if (_constdata) delete [] _constdata;
     if (_metadata) delete _metadata;
@@ -108,10 +204,66 @@ void PtexReader::prune()
         if (*i) { delete *i; *i = 0; }
     }
     _reductions.clear();
+    _reductionsMemUsed = 0;
     _memUsed = _baseMemUsed;
 }
 
 
+void PtexReader::pruneFaces(uint32_t cutoff)
+{
+    // free face data that hasn't been used since the cutoff time;
+    // the caller must guarantee that the reader isn't in use
+    size_t memFreed = 0;
+    bool tiledFaceFreed = false;
+    for (std::vector<Level*>::iterator i = _levels.begin(); i != _levels.end(); ++i) {
+        Level* level = *i;
+        if (!level) continue;
+        for (std::vector<FaceData*>::iterator f = level->faces.begin(); f != level->faces.end(); ++f) {
+            FaceData* face = *f;
+            if (!face) continue;
+            bool empty = true;
+            if (face->isTiled()) {
+                memFreed += static_cast<TiledFace*>(face)->pruneTiles(cutoff, empty);
+            }
+            size_t faceMemUsed = face->memUsed();
+            if (empty && faceMemUsed && !face->usedSince(cutoff)) {
+                if (face->isTiled()) tiledFaceFreed = true;
+                memFreed += faceMemUsed;
+                delete face;
+                *f = 0;
+            }
+        }
+    }
+
+    // dynamic reductions are freed as a group (tiled reductions refer to their source faces)
+    if (_reductionsMemUsed && (tiledFaceFreed || int32_t(_reductionsLastUse - cutoff) < 0)) {
+        _reductions.clear();
+        memFreed += _reductionsMemUsed;
+        _reductionsMemUsed = 0;
+    }
+    _memUsed -= memFreed;
+}
+
+
+size_t PtexReader::TiledFace::pruneTiles(uint32_t cutoff, bool& empty)
+{
+    size_t memFreed = 0;
+    empty = true;
+    for (std::vector<FaceData*>::iterator i = _tiles.begin(); i != _tiles.end(); ++i) {
+        FaceData* tile = *i;
+        if (!tile) continue;
+        size_t tileMemUsed = tile->memUsed();
+        if (tileMemUsed && !tile->usedSince(cutoff)) {
+            memFreed += tileMemUsed;
+            delete tile;
+            *i = 0;
+        }
+        else empty = false;
+    }
+    return memFreed;
+}
+
+
 void PtexReader::purge()
 {
     // free all dynamic data
@@ -220,20 +372,45 @@ bool PtexReader::tryClose()
 {
     if (_fp) {
         if (!readlock.trylock()) return false;
+        // can't close while positional reads are in flight
+        if (!AtomicCompareAndSwap(&_fpRefs, 0, -1)) {
+            readlock.unlock();
+            return false;
+        }
         closeFP();
+        AtomicStore(&_fpRefs, 0);
         readlock.unlock();
     }
     return true;
 }
 
 
+bool PtexReader::acquireFP()
+{
+    while (1) {
+        int32_t refs = _fpRefs;
+        if (refs >= 0 && _fp) {
+            if (AtomicCompareAndSwap(&_fpRefs, refs, refs+1)) {
+                if (_fp) return true;
+                // file was closed after we checked, drop ref and reopen
+                releaseFP();
+            }
+        }
+        else {
+            // file is closed (or being closed), reopen under the read lock
+            PtexStats::AutoMutex locker(readlock, _stats);
+            if (!_fp && !reopenFP()) return false;
+        }
+    }
+}
+
+
 void PtexReader::closeFP()
 {
     if (_fp) {
         _io->close(_fp);
         _fp = 0;
     }
-    inflateEnd(&_zstream);
 }
 
 
@@ -264,6 +441,71 @@ bool PtexReader::reopenFP()
 }
 
 
+PtexInputHandler::Handle PtexReader::MappedInputHandler::open(const char* path)
+{
+    MappedFile* mf = 0;
+#ifdef WINDOWS
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return 0;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) { CloseHandle(file); return 0; }
+    HANDLE mapping = 0;
+    void* data = 0;
+    if (size.QuadPart > 0) {
+        mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping) data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!data) {
+            if (mapping) CloseHandle(mapping);
+            CloseHandle(file);
+            return 0;
+        }
+    }
+    // the mapping keeps the file open, so the file handle can be closed now
+    CloseHandle(file);
+    mf = new MappedFile;
+    mf->data = (char*) data;
+    mf->size = size_t(size.QuadPart);
+    mf->mapping = mapping;
+#else
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) != 0) { ::close(fd); return 0; }
+    void* data = 0;
+    if (statbuf.st_size > 0) {
+        data = mmap(0, size_t(statbuf.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) { ::close(fd); return 0; }
+    }
+    // the mapping keeps the file open, so the descriptor can be closed now
+    ::close(fd);
+    mf = new MappedFile;
+    mf->data = (char*) data;
+    mf->size = size_t(statbuf.st_size);
+#endif
+    mf->pos = 0;
+    return (Handle) mf;
+}
+
+
+bool PtexReader::MappedInputHandler::close(Handle handle)
+{
+    MappedFile* mf = (MappedFile*)handle;
+    if (!mf) return false;
+    bool ok = true;
+    if (mf->data) {
+#ifdef WINDOWS
+        ok = UnmapViewOfFile(mf->data) != 0;
+        CloseHandle(mf->mapping);
+#else
+        ok = munmap(mf->data, mf->size) == 0;
+#endif
+    }
+    delete mf;
+    return ok;
+}
+
+
 const Ptex::FaceInfo& PtexReader::getFaceInfo(int faceid)
 {
     if (faceid >= 0 && uint32_t(faceid) < _faceinfo.size())
@@ -361,7 +603,7 @@ PtexReader::MetaData::getEntry(int index)
         // not present, must read from file
 
         // get read lock and make sure we still need to read
-        AutoMutex locker(_reader->readlock);
+        PtexStats::AutoMutex locker(_reader->readlock, _reader->_stats);
         if (e->lmdData) {
             return e;
         }
@@ -381,7 +623,7 @@ PtexReader::MetaData::getEntry(int index)
 void PtexReader::readMetaData()
 {
     // get read lock and make sure we still need to read
-    AutoMutex locker(readlock);
+    PtexStats::AutoMutex locker(readlock, _stats);
     if (_metadata) {
         return;
     }
@@ -563,31 +805,102 @@ bool PtexReader::readBlock(void* data, int size, bool reporterror)
 bool PtexReader::readZipBlock(void* data, int zipsize, int unzipsize)
 {
     if (zipsize < 0 || unzipsize < 0) return false;
-    if (!_zstream.state) {
-        inflateInit(&_zstream);
+    PtexStats::Timer timer(_stats, PtexStats::inflateTime, PtexStats::inflateLatency);
+    logStat(PtexStats::bytesCompressed, zipsize);
+    logStat(PtexStats::bytesDecompressed, unzipsize);
+    InflateContext& context = threadInflateContext();
+
+    // if the compressed block is resident in memory (e.g. memory mapped),
+    // decode it in one call without staging it through a read buffer
+    const void* src = _fp ? _io->map(_fp, _pos, zipsize) : 0;
+    if (src) {
+        _pos += zipsize;
+        _io->seek(_fp, _pos);
+        int total = context.inflateBlock(src, zipsize, data, unzipsize);
+        if (total < 0) {
+            setError("PtexReader error: unzip failed, file corrupt");
+            return 0;
+        }
+        return total == unzipsize;
     }
 
-    void* buff = alloca(BlockSize);
-    _zstream.next_out = (Bytef*) data;
-    _zstream.avail_out = unzipsize;
+    z_stream_s& zstream = context.stream();
+    zstream.next_out = (Bytef*) data;
+    zstream.avail_out = unzipsize;
 
+    void* buff = alloca(BlockSize);
     while (1) {
         int size = (zipsize < BlockSize) ? zipsize : BlockSize;
         zipsize -= size;
         if (!readBlock(buff, size)) break;
-        _zstream.next_in = (Bytef*) buff;
-        _zstream.avail_in = size;
-        int zresult = inflate(&_zstream, zipsize ? Z_NO_FLUSH : Z_FINISH);
+        zstream.next_in = (Bytef*) buff;
+        zstream.avail_in = size;
+        int zresult = inflate(&zstream, zipsize ? Z_NO_FLUSH : Z_FINISH);
         if (zresult == Z_STREAM_END) break;
         if (zresult != Z_OK) {
             setError("PtexReader error: unzip failed, file corrupt");
-            inflateReset(&_zstream);
+            inflateReset(&zstream);
             return 0;
         }
     }
 
-    int total = (int)_zstream.total_out;
-    inflateReset(&_zstream);
+    int total = (int)zstream.total_out;
+    inflateReset(&zstream);
+    return total == unzipsize;
+}
+
+
+bool PtexReader::readBlockAt(FilePos pos, void* data, int size)
+{
+    if (!_readAt) {
+        // share the file cursor under the read lock
+        PtexStats::AutoMutex locker(readlock, _stats);
+        if (!_fp && !reopenFP()) return false;
+        if (pos != _pos) {
+            _io->seek(_fp, pos);
+            _pos = pos;
+        }
+        return readBlock(data, size);
+    }
+
+    // caller holds a file ref (see acquireFP)
+    if (size < 0) return false;
+    if ((int)_io->readAt(_fp, pos, data, size) == size) return true;
+    setError("PtexReader error: read failed (EOF)");
+    return false;
+}
+
+
+bool PtexReader::readZipBlockAt(FilePos pos, void* data, int zipsize, int unzipsize, const void* resident)
+{
+    if (zipsize < 0 || unzipsize < 0) return false;
+    PtexStats::Timer timer(_stats, PtexStats::inflateTime, PtexStats::inflateLatency);
+    logStat(PtexStats::bytesCompressed, zipsize);
+    logStat(PtexStats::bytesDecompressed, unzipsize);
+    InflateContext& context = threadInflateContext();
+
+    // use the compressed bytes in place if resident, otherwise read them in;
+    // either way, the inflate happens without holding the read lock
+    const void* src = resident ? resident : _readAt ? _io->map(_fp, pos, zipsize) : 0;
+    char* buff = 0;
+    bool useNew = false;
+    if (!src) {
+        buff = context.scratch(zipsize);
+        useNew = !buff;
+        if (useNew) buff = new char [zipsize];
+        if (!readBlockAt(pos, buff, zipsize)) {
+            if (useNew) delete [] buff;
+            return false;
+        }
+        src = buff;
+    }
+
+    int total = context.inflateBlock(src, zipsize, data, unzipsize);
+    if (useNew) delete [] buff;
+    if (total < 0) {
+        setError("PtexReader error: unzip failed, file corrupt");
+        return false;
+    }
     return total == unzipsize;
 }
 
@@ -595,7 +908,7 @@ bool PtexReader::readZipBlock(void* data, int zipsize, int unzipsize)
 void PtexReader::readLevel(int levelid, Level*& level)
 {
     // get read lock and make sure we still need to read
-    AutoMutex locker(readlock);
+    PtexStats::AutoMutex locker(readlock, _stats);
     if (level) {
         return;
     }
@@ -639,25 +952,49 @@ void PtexReader::TiledFace::readTile(int tile, FaceData*& data)
 
 
 void PtexReader::readFaceData(FilePos pos, FaceDataHeader fdh, Res res, int levelid,
-                              FaceData*& face)
+                              FaceData*& face, const char* resident)
 {
-    AutoMutex locker(readlock);
+    // only loads of faces that hash to the same lock are serialized;
+    // the read lock is taken just long enough to read from the file cursor
+    // (or not at all when the IO handler supports positional reads)
+    PtexStats::AutoMutex locker(faceLock(pos), _stats);
     if (face) {
         return;
     }
 
-    // keep new face local until fully initialized
     FaceData* newface = 0;
     size_t newMemUsed = 0;
+    if (resident) {
+        // block was already read by the caller
+        newface = decodeFaceData(pos, fdh, res, levelid, newMemUsed, resident);
+    }
+    else if (!_readAt || acquireFP()) {
+        logBlockRead();
+        newface = decodeFaceData(pos, fdh, res, levelid, newMemUsed, 0);
+        if (_readAt) releaseFP();
+    }
+    if (!newface) newface = errorData();
+
+    AtomicStore(&face, newface);
+    increaseMemUsed(newMemUsed);
+}
+
+
+PtexReader::FaceData* PtexReader::decodeFaceData(FilePos pos, FaceDataHeader fdh, Res res, int levelid,
+                                                 size_t& newMemUsed, const char* resident)
+{
+    // tiled faces read their tile headers from the file (they're never resident)
+    // keep new face local until fully initialized
+    FaceData* newface = 0;
 
-    seek(pos);
     switch (fdh.encoding()) {
     case enc_constant:
         {
             ConstantFace* cf = new ConstantFace(_pixelsize);
             newface = cf;
             newMemUsed = sizeof(ConstantFace) + _pixelsize;
-            readBlock(cf->data(), _pixelsize);
+            if (resident) memcpy(cf->data(), resident, _pixelsize);
+            else readBlockAt(pos, cf->data(), _pixelsize);
             if (levelid==0 && _premultiply && _header.hasAlpha())
                 PtexUtils::multalpha(cf->data(), 1, datatype(),
                                      _header.nchannels, _header.alphachan);
@@ -666,14 +1003,16 @@ void PtexReader::readFaceData(FilePos pos, FaceDataHeader fdh, Res res, int leve
     case enc_tiled:
         {
             Res tileres;
-            readBlock(&tileres, sizeof(tileres));
+            readBlockAt(pos, &tileres, sizeof(tileres));
+            pos += sizeof(tileres);
             uint32_t tileheadersize;
-            readBlock(&tileheadersize, sizeof(tileheadersize));
+            readBlockAt(pos, &tileheadersize, sizeof(tileheadersize));
+            pos += sizeof(tileheadersize);
             TiledFace* tf = new TiledFace(this, res, tileres, levelid);
             newface = tf;
             newMemUsed = tf->memUsed();
-            readZipBlock(&tf->_fdh[0], tileheadersize, FaceDataHeaderSize * tf->_ntiles);
-            computeOffsets(tell(), tf->_ntiles, &tf->_fdh[0], &tf->_offsets[0]);
+            readZipBlockAt(pos, &tf->_fdh[0], tileheadersize, FaceDataHeaderSize * tf->_ntiles);
+            computeOffsets(pos + tileheadersize, tf->_ntiles, &tf->_fdh[0], &tf->_offsets[0]);
         }
         break;
     case enc_zipped:
@@ -687,24 +1026,19 @@ void PtexReader::readFaceData(FilePos pos, FaceDataHeader fdh, Res res, int leve
             newMemUsed = sizeof(PackedFace) + unpackedSize;
             bool useNew = unpackedSize > AllocaMax;
             char* tmp = useNew ? new char [unpackedSize] : (char*) alloca(unpackedSize);
-            readZipBlock(tmp, fdh.blocksize(), unpackedSize);
-            if (fdh.encoding() == enc_diffzipped)
-                PtexUtils::decodeDifference(tmp, unpackedSize, datatype());
-            PtexUtils::interleave(tmp, uw * DataSize(datatype()), uw, vw,
-                                  pf->data(), uw * _pixelsize,
-                                  datatype(), _header.nchannels);
-            if (levelid==0 && _premultiply && _header.hasAlpha())
-                PtexUtils::multalpha(pf->data(), npixels, datatype(),
-                                     _header.nchannels, _header.alphachan);
+            readZipBlockAt(pos, tmp, fdh.blocksize(), unpackedSize, resident);
+            // alpha is premultiplied as the face is interleaved
+            bool premult = levelid==0 && _premultiply && _header.hasAlpha();
+            PtexUtils::decodeInterleave(tmp, uw, vw, pf->data(), uw * _pixelsize,
+                                        datatype(), _header.nchannels,
+                                        fdh.encoding() == enc_diffzipped,
+                                        premult ? _header.alphachan : -1);
             if (useNew) delete [] tmp;
         }
         break;
     }
 
-    if (!newface) newface = errorData();
-
-    AtomicStore(&face, newface);
-    increaseMemUsed(newMemUsed);
+    return newface;
 }
 
 
@@ -764,6 +1098,160 @@ void PtexReader::getData(int faceid, void* buffer, int stride, Res res)
 }
 
 
+void PtexReader::getData(const int* faceids, int nfaces, void* const* buffers, const int* strides,
+                         bool parallel)
+{
+    if (_ok && nfaces > 0) {
+        // find faces whose data blocks still need to be read
+        std::vector<std::pair<FilePos, int> > blocks;
+        Level* level = 0;
+        for (int i = 0; i < nfaces; i++) {
+            int faceid = faceids[i];
+            if (faceid < 0 || size_t(faceid) >= _header.nfaces) continue;
+            const FaceInfo& fi = _faceinfo[faceid];
+            if (fi.isConstant() || fi.res == 0) continue;
+            if (!level) level = getLevel(0);
+            if (level->faces[faceid] || level->fdh[faceid].encoding() == enc_tiled) continue;
+            blocks.push_back(std::make_pair(level->offsets[faceid], faceid));
+        }
+
+        // read blocks in file order, coalescing adjacent blocks into a single read
+        std::sort(blocks.begin(), blocks.end());
+        std::vector<int> run;
+        FilePos runend = 0;
+        int runsize = 0;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            FilePos pos = blocks[i].first;
+            int faceid = blocks[i].second;
+            if (i && pos == blocks[i-1].first) continue; // duplicate face
+            int size = level->fdh[faceid].blocksize();
+            if (!run.empty() && (pos != runend || runsize + size > CoalesceMax)) {
+                readFaceRun(level, &run[0], int(run.size()), parallel);
+                run.clear();
+                runsize = 0;
+            }
+            run.push_back(faceid);
+            runend = pos + size;
+            runsize += size;
+        }
+        if (!run.empty()) readFaceRun(level, &run[0], int(run.size()), parallel);
+    }
+
+    // copy out (tiled faces and anything that failed above are read here)
+    for (int i = 0; i < nfaces; i++)
+        getData(faceids[i], buffers[i], strides ? strides[i] : 0);
+}
+
+
+class PtexReader::DecodeTask : public PtexThreadPool::Task
+{
+public:
+    /* Faces of a coalesced run, shared by the calling thread and worker tasks.
+       Deleted by whoever drops the last ref, so tasks that start after the
+       caller has returned don't touch the (gone) run data. */
+    struct Run {
+        PtexReader* reader;
+        Level* level;
+        const int* faceids;
+        int nfaces;
+        FilePos pos;
+        const char* data;
+        volatile int32_t next;
+        volatile int32_t refs;
+        Condition finished;     // guards done, signaled when the last face is decoded
+        int32_t done;
+
+        bool decodeNext()
+        {
+            int32_t i = AtomicIncrement(&next) - 1;
+            if (i >= nfaces) return false;
+            decodeFace(reader, level, faceids[i], pos, data);
+            AutoCondition lock(finished);
+            if (++done == nfaces) finished.broadcast();
+            return true;
+        }
+
+        void waitDone()
+        {
+            AutoCondition lock(finished);
+            while (done < nfaces) finished.wait();
+        }
+
+        void unref() { if (AtomicDecrement(&refs) == 0) delete this; }
+    };
+
+    DecodeTask(Run* run) : _run(run) {}
+
+    virtual void run()
+    {
+        while (_run->decodeNext()) {}
+        _run->unref();
+    }
+
+    static void decodeFace(PtexReader* reader, Level* level, int faceid, FilePos runpos, const char* rundata)
+    {
+        FilePos pos = level->offsets[faceid];
+        reader->readFaceData(pos, level->fdh[faceid], reader->_faceinfo[faceid].res, 0,
+                             level->faces[faceid], rundata + (pos - runpos));
+    }
+
+private:
+    Run* _run;
+};
+
+
+void PtexReader::readFaceRun(Level* level, const int* faceids, int nfaces, bool parallel)
+{
+    if (nfaces == 1) {
+        int faceid = faceids[0];
+        readFaceData(level->offsets[faceid], level->fdh[faceid], _faceinfo[faceid].res, 0,
+                     level->faces[faceid]);
+        return;
+    }
+
+    FilePos pos = level->offsets[faceids[0]];
+    int last = faceids[nfaces-1];
+    int size = int(level->offsets[last] + level->fdh[last].blocksize() - pos);
+    if (_readAt && !acquireFP()) return;
+
+    // read all the blocks at once (or use them in place if resident)
+    logBlockRead();
+    const char* data = _readAt ? (const char*) _io->map(_fp, pos, size) : 0;
+    std::vector<char> buffer;
+    if (!data) {
+        buffer.resize(size);
+        if (readBlockAt(pos, &buffer[0], size)) data = &buffer[0];
+    }
+
+    if (data) {
+        int ntasks = parallel ? PtexUtils::min(PtexThreadPool::instance().numThreads(), nfaces-1) : 0;
+        if (ntasks > 0) {
+            DecodeTask::Run* run = new DecodeTask::Run;
+            run->reader = this;
+            run->level = level;
+            run->faceids = faceids;
+            run->nfaces = nfaces;
+            run->pos = pos;
+            run->data = data;
+            run->next = 0;
+            run->done = 0;
+            run->refs = ntasks + 1;
+            for (int i = 0; i < ntasks; i++)
+                PtexThreadPool::instance().enqueue(new DecodeTask(run));
+            // help out, then wait for faces claimed by workers
+            while (run->decodeNext()) {}
+            run->waitDone();
+            run->unref();
+        }
+        else {
+            for (int i = 0; i < nfaces; i++)
+                DecodeTask::decodeFace(this, level, faceids[i], pos, data);
+        }
+    }
+    if (_readAt) releaseFP();
+}
+
+
 PtexFaceData* PtexReader::getData(int faceid)
 {
     if (!_ok || faceid < 0 || size_t(faceid) >= _header.nfaces) {
@@ -825,9 +1313,12 @@ PtexFaceData* PtexReader::getData(int faceid, Res res)
     }
 
     // dynamic reduction required - look in dynamic reduction cache
+    uint32_t now = useClock();
+    if (_reductionsLastUse != now) _reductionsLastUse = now;
     ReductionKey key(faceid, res);
     FaceData* face = _reductions.get(key);
     if (face) {
+        logStat(PtexStats::reductionHits);
         return face;
     }
 
@@ -884,7 +1375,8 @@ PtexFaceData* PtexReader::getData(int faceid, Res res)
         delete newface;
     }
     else {
-        increaseMemUsed(newMemUsed + tableNewMemUsed);
+        logStat(PtexStats::reductionBuilds);
+        increaseReductionsMemUsed(newMemUsed + tableNewMemUsed);
     }
     return face;
 }
@@ -945,6 +1437,91 @@ void PtexReader::getPixel(int faceid, int u, int v,
 }
 
 
+class PtexReader::PrefetchTask : public PtexThreadPool::Task
+{
+public:
+    PrefetchTask(PtexReader* reader, int faceid, Res res)
+        : _reader(reader), _faceid(faceid), _res(res) {}
+
+    virtual void run()
+    {
+        if (!_reader->_prefetchCancelled) _reader->loadFace(_faceid, _res);
+        _reader->endPrefetch();
+    }
+
+private:
+    PtexReader* _reader;
+    int _faceid;
+    Res _res;
+};
+
+
+void PtexReader::prefetch(int faceid, Res res)
+{
+    if (!_ok || _needToOpen || _prefetchCancelled ||
+        faceid < 0 || size_t(faceid) >= _header.nfaces) return;
+
+    // constant data is loaded with the file
+    const FaceInfo& fi = _faceinfo[faceid];
+    if (fi.isConstant() || fi.res == 0 || res == 0) return;
+
+    // clamp to the face res (enlargements aren't supported)
+    if (res.ulog2 > fi.res.ulog2) res.ulog2 = fi.res.ulog2;
+    if (res.vlog2 > fi.res.vlog2) res.vlog2 = fi.res.vlog2;
+    if (res.ulog2 < 0 || res.vlog2 < 0) return;
+    if (_header.meshtype == mt_triangle &&
+        fi.res.ulog2 - res.ulog2 != fi.res.vlog2 - res.vlog2) return;
+
+    beginPrefetch();
+    PtexThreadPool::instance().enqueue(new PrefetchTask(this, faceid, res));
+}
+
+
+void PtexReader::prefetch(const int* faceids, int nfaces)
+{
+    for (int i = 0; i < nfaces; i++) {
+        int faceid = faceids[i];
+        if (faceid >= 0 && size_t(faceid) < _faceinfo.size())
+            prefetch(faceid, _faceinfo[faceid].res);
+    }
+}
+
+
+void PtexReader::loadFace(int faceid, Res res)
+{
+    // getData publishes the level and face (via AtomicStore) exactly as a demand load would
+    PtexPtr<PtexFaceData> data ( getData(faceid, res) );
+    if (data->isTiled()) {
+        for (int i = 0, ntiles = data->res().ntiles(data->tileRes()); i < ntiles; i++) {
+            PtexPtr<PtexFaceData> tile ( data->getTile(i) );
+        }
+    }
+}
+
+
+void PtexReader::beginPrefetch()
+{
+    AutoCondition lock(_prefetchDone);
+    _prefetchesPending++;
+}
+
+
+void PtexReader::endPrefetch()
+{
+    AutoCondition lock(_prefetchDone);
+    if (--_prefetchesPending == 0) _prefetchDone.broadcast();
+}
+
+
+void PtexReader::cancelPrefetches()
+{
+    // queued tasks will skip their loads; wait for them to drain
+    _prefetchCancelled = true;
+    AutoCondition lock(_prefetchDone);
+    while (_prefetchesPending) _prefetchDone.wait();
+}
+
+
 PtexReader::FaceData*
 PtexReader::PackedFace::reduce(PtexReader* r, Res newres, PtexUtils::ReduceFn reducefn,
                                size_t& newMemUsed)
@@ -1116,8 +1693,10 @@ PtexFaceData* PtexReader::TiledReducedFace::getTile(int tile)
 {
     FaceData*& face = _tiles[tile];
     if (face) {
+        _reader->logStat(PtexStats::tileHits);
         return face;
     }
+    _reader->logStat(PtexStats::tileMisses);
 
     // first, get all parent tiles for this tile
     // and check if they are constant (with the same value)
@@ -1180,7 +1759,7 @@ PtexFaceData* PtexReader::TiledReducedFace::getTile(int tile)
         delete newface;
     }
     else {
-        _reader->increaseMemUsed(newMemUsed);
+        _reader->increaseReductionsMemUsed(newMemUsed);
     }
 
     return face;
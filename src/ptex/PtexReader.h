@@ -46,21 +46,25 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
 #include "PtexUtils.h"
 
 #include "PtexHashMap.h"
+#include "PtexStats.h"
 
 PTEX_NAMESPACE_BEGIN
 
 class PtexReader : public PtexTexture {
 public:
-    PtexReader(bool premultiply, PtexInputHandler* inputHandler, PtexErrorHandler* errorHandler);
+    PtexReader(bool premultiply, PtexInputHandler* inputHandler, PtexErrorHandler* errorHandler,
+               bool memoryMapped=false);
     virtual ~PtexReader();
     virtual void release() { delete this; }
     bool needToOpen() const { return _needToOpen; }
     bool open(const char* path, Ptex::String& error);
     void prune();
+    void pruneFaces(uint32_t cutoff);
     void purge();
     void setPendingPurge() { _pendingPurge = true; }
     bool pendingPurge() const { return _pendingPurge; }
     bool tryClose();
+    void cancelPrefetches();
     bool ok() const { return _ok; }
     bool isOpen() { return _fp; }
     void invalidate() {
@@ -69,6 +73,14 @@ public:
     }
 
     void increaseMemUsed(size_t amount) { if (amount) AtomicAdd(&_memUsed, amount); }
+    void increaseReductionsMemUsed(size_t amount)
+    {
+        if (amount) { AtomicAdd(&_reductionsMemUsed, amount); AtomicAdd(&_memUsed, amount); }
+    }
+    void setUseClock(const volatile uint32_t* clock) { _useClock = clock; }
+    void setStats(PtexStats* stats) { _stats = stats; }
+    void logStat(PtexStats::Counter counter, uint64_t amount=1) { if (_stats) _stats->add(counter, amount); }
+    uint32_t useClock() const { return *_useClock; }
     void logOpen() { AtomicIncrement(&_opens); }
     void logBlockRead() { AtomicIncrement(&_blockReads); }
 
@@ -102,6 +114,8 @@ public:
     virtual const Ptex::FaceInfo& getFaceInfo(int faceid);
     virtual void getData(int faceid, void* buffer, int stride);
     virtual void getData(int faceid, void* buffer, int stride, Res res);
+    virtual void getData(const int* faceids, int nfaces, void* const* buffers, const int* strides,
+                         bool parallel=false);
     virtual PtexFaceData* getData(int faceid);
     virtual PtexFaceData* getData(int faceid, Res res);
     virtual void getPixel(int faceid, int u, int v,
@@ -109,6 +123,8 @@ public:
     virtual void getPixel(int faceid, int u, int v,
 			  float* result, int firstchan, int nchannels,
 			  Ptex::Res res);
+    virtual void prefetch(int faceid, Res res);
+    virtual void prefetch(const int* faceids, int nfaces);
 
     DataType datatype() const { return DataType(_header.datatype); }
     int nchannels() const { return _header.nchannels; }
@@ -365,13 +381,19 @@ public:
     class FaceData : public PtexFaceData {
     public:
         FaceData(Res resArg)
-            : _res(resArg) {}
+            : _res(resArg), _lastUse(0) {}
         virtual ~FaceData() {}
         virtual void release() { }
         virtual Ptex::Res res() { return _res; }
         virtual FaceData* reduce(PtexReader*, Res newres, PtexUtils::ReduceFn, size_t& newMemUsed) = 0;
+        // memory accounted for this face (not including tiles)
+        virtual size_t memUsed() = 0;
+        // record use at the given clock time (only written when it changes to avoid cache line traffic)
+        void touch(uint32_t now) { if (_lastUse != now) _lastUse = now; }
+        bool usedSince(uint32_t time) const { return int32_t(_lastUse - time) >= 0; }
     protected:
         Res _res;
+        volatile uint32_t _lastUse;
     };
 
     class PackedFace : public FaceData {
@@ -390,6 +412,7 @@ public:
         virtual Ptex::Res tileRes() { return _res; }
         virtual PtexFaceData* getTile(int) { return 0; }
         virtual FaceData* reduce(PtexReader*, Res newres, PtexUtils::ReduceFn, size_t& newMemUsed);
+        virtual size_t memUsed() { return sizeof(PackedFace) + _pixelsize * _res.size(); }
 
     protected:
         virtual ~PackedFace() { delete [] _data; }
@@ -405,6 +428,7 @@ public:
         virtual bool isConstant() { return true; }
         virtual void getPixel(int, int, void* result) { memcpy(result, _data, _pixelsize); }
         virtual FaceData* reduce(PtexReader*, Res newres, PtexUtils::ReduceFn, size_t& newMemUsed);
+        virtual size_t memUsed() { return sizeof(ConstantFace) + _pixelsize; }
     };
 
     class ErrorFace : public ConstantFace {
@@ -416,6 +440,7 @@ public:
             memcpy(_data, errorPixel, pixelsize);
         }
         virtual void release() { if (_deleteOnRelease) delete this; }
+        virtual size_t memUsed() { return 0; } // not accounted for (and never evicted)
     };
 
     class TiledFaceBase : public FaceData {
@@ -479,11 +504,14 @@ public:
         virtual PtexFaceData* getTile(int tile)
         {
             FaceData*& f = _tiles[tile];
-            if (!f) readTile(tile, f);
+            if (f) _reader->logStat(PtexStats::tileHits);
+            else { _reader->logStat(PtexStats::tileMisses); readTile(tile, f); }
+            f->touch(_reader->useClock());
             return f;
         }
         void readTile(int tile, FaceData*& data);
-        size_t memUsed() {
+        size_t pruneTiles(uint32_t cutoff, bool& empty);
+        virtual size_t memUsed() {
             return sizeof(*this) + baseExtraMemUsed() + _fdh.size() * (sizeof(_fdh[0]) + sizeof(_offsets[0]));
         }
 
@@ -509,7 +537,7 @@ public:
         }
         virtual PtexFaceData* getTile(int tile);
 
-        size_t memUsed() { return sizeof(*this) + baseExtraMemUsed(); }
+        virtual size_t memUsed() { return sizeof(*this) + baseExtraMemUsed(); }
 
     protected:
         TiledFaceBase* _parentface;
@@ -543,6 +571,16 @@ public:
 
 
 protected:
+    class PrefetchTask;
+    friend class PrefetchTask;
+    class DecodeTask;
+    friend class DecodeTask;
+
+    // keep reader valid while a prefetch is queued (overridden by the cache to hold a ref)
+    virtual void beginPrefetch();
+    virtual void endPrefetch();
+    void loadFace(int faceid, Res res);
+
     void setError(const char* error)
     {
         std::string msg = error;
@@ -567,8 +605,13 @@ protected:
 
     void closeFP();
     bool reopenFP();
+    bool acquireFP();
+    void releaseFP() { AtomicDecrement(&_fpRefs); }
+    Mutex& faceLock(FilePos pos) { return _faceLocks[(pos >> 4) % numFaceLocks]; }
     bool readBlock(void* data, int size, bool reportError=true);
     bool readZipBlock(void* data, int zipsize, int unzipsize);
+    bool readBlockAt(FilePos pos, void* data, int size);
+    bool readZipBlockAt(FilePos pos, void* data, int zipsize, int unzipsize, const void* resident=0);
     Level* getLevel(int levelid)
     {
         Level*& level = _levels[levelid];
@@ -580,7 +623,9 @@ protected:
     FaceData* getFace(int levelid, Level* level, int faceid, Res res)
     {
         FaceData*& face = level->faces[faceid];
-        if (!face) readFace(levelid, level, faceid, res);
+        if (face) logStat(PtexStats::faceHits);
+        else { logStat(PtexStats::faceMisses); readFace(levelid, level, faceid, res); }
+        face->touch(useClock());
         return face;
     }
 
@@ -589,7 +634,11 @@ protected:
     void readConstData();
     void readLevel(int levelid, Level*& level);
     void readFace(int levelid, Level* level, int faceid, Res res);
-    void readFaceData(FilePos pos, FaceDataHeader fdh, Res res, int levelid, FaceData*& face);
+    void readFaceData(FilePos pos, FaceDataHeader fdh, Res res, int levelid, FaceData*& face,
+                      const char* resident=0);
+    FaceData* decodeFaceData(FilePos pos, FaceDataHeader fdh, Res res, int levelid, size_t& newMemUsed,
+                             const char* resident);
+    void readFaceRun(Level* level, const int* faceids, int nfaces, bool parallel);
     void readMetaData();
     void readMetaDataBlock(MetaData* metadata, FilePos pos, int zipsize, int memsize, size_t& metaDataMemUsed);
     void readLargeMetaDataHeaders(MetaData* metadata, FilePos pos, int zipsize, int memsize, size_t& metaDataMemUsed);
@@ -632,6 +681,23 @@ protected:
         virtual size_t read(void* bufferArg, size_t size, Handle handle) {
             return fread(bufferArg, size, 1, (FILE*)handle) == 1 ? size : 0;
         }
+#ifdef WINDOWS
+        // positional reads on windows move the file pointer underneath stdio
+        virtual bool supportsReadAt() { return false; }
+#else
+        virtual bool supportsReadAt() { return true; }
+        virtual size_t readAt(Handle handle, int64_t pos, void* bufferArg, size_t size) {
+            int fd = fileno((FILE*)handle);
+            size_t total = 0;
+            while (total < size) {
+                ssize_t result = pread(fd, (char*)bufferArg + total, size - total, off_t(pos + total));
+                if (result < 0 && errno == EINTR) continue;
+                if (result <= 0) break;
+                total += size_t(result);
+            }
+            return total;
+        }
+#endif
         virtual bool close(Handle handle) {
             bool ok = handle && (fclose((FILE*)handle) == 0);
             if (buffer) { delete [] buffer; buffer = 0; }
@@ -640,14 +706,63 @@ protected:
         virtual const char* lastError() { return strerror(errno); }
     };
 
+    class MappedInputHandler : public PtexInputHandler
+    {
+        struct MappedFile {
+            char* data;
+            size_t size;
+            int64_t pos;
+#ifdef WINDOWS
+            HANDLE mapping;
+#endif
+        };
+     public:
+        virtual Handle open_stream(const unsigned char *bytes, const size_t num_bytes) {
+            // not used.
+            (void)bytes;
+            (void)num_bytes;
+            return nullptr;
+        }
+        virtual Handle open(const char* path);
+        virtual void seek(Handle handle, int64_t pos) { ((MappedFile*)handle)->pos = pos; }
+        virtual size_t read(void* bufferArg, size_t size, Handle handle) {
+            MappedFile* mf = (MappedFile*)handle;
+            const void* src = map(handle, mf->pos, size);
+            if (!src) return 0;
+            memcpy(bufferArg, src, size);
+            mf->pos += size;
+            return size;
+        }
+        virtual bool supportsReadAt() { return true; }
+        virtual size_t readAt(Handle handle, int64_t pos, void* bufferArg, size_t size) {
+            const void* src = map(handle, pos, size);
+            if (!src) return 0;
+            memcpy(bufferArg, src, size);
+            return size;
+        }
+        virtual const void* map(Handle handle, int64_t pos, size_t size) {
+            MappedFile* mf = (MappedFile*)handle;
+            if (pos < 0 || uint64_t(pos) > mf->size || size > mf->size - size_t(pos)) return 0;
+            return mf->data + pos;
+        }
+        virtual bool close(Handle handle);
+        virtual const char* lastError() { return strerror(errno); }
+    };
+
+    static const int numFaceLocks = 8;
+
     Mutex readlock;
+    Mutex _faceLocks[numFaceLocks];   // serialize loads of a given face
     DefaultInputHandler _defaultIo;   // Default IO handler
+    MappedInputHandler _mappedIo;     // Memory-mapped IO handler
     PtexInputHandler* _io;            // IO handler
     PtexErrorHandler* _err;           // Error handler
     bool _premultiply;                // true if reader should premultiply the alpha chan
     bool _ok;                         // flag set to false if open or read error occurred
     bool _needToOpen;                 // true if file needs to be opened (or reopened after a purge)
     bool _pendingPurge;               // true if a purge attempt was made but file was busy
+    bool _readAt;                     // true if the IO handler supports positional reads
+    volatile int32_t _fpRefs;         // positional reads in flight (-1 while closing)
     PtexInputHandler::Handle _fp;     // file pointer
     FilePos _pos;                     // current seek position
     std::string _path;                // current file path
@@ -717,13 +832,19 @@ protected:
     };
     typedef PtexHashMap<ReductionKey, FaceData*> ReductionMap;
     ReductionMap _reductions;
+    volatile uint32_t _reductionsLastUse;
+    volatile size_t _reductionsMemUsed;
     std::vector<char> _errorPixel; // referenced by errorData()
 
-    z_stream_s _zstream;
+    const volatile uint32_t* _useClock; // time source for face use (see pruneFaces)
+    PtexStats* _stats;                  // usage stats (if collected)
     size_t _baseMemUsed;
     volatile size_t _memUsed;
     volatile size_t _opens;
     volatile size_t _blockReads;
+    Condition _prefetchDone;              // guards _prefetchesPending, signaled when it reaches zero
+    int32_t _prefetchesPending;           // queued prefetch tasks referring to this reader
+    volatile bool _prefetchCancelled;     // set when reader is being destroyed
 };
 
 PTEX_NAMESPACE_END
@@ -34,6 +34,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
 */
 
 #include "PtexPlatform.h"
+#include <algorithm>
 #include <cmath>
 #include <assert.h>
 
@@ -44,6 +45,13 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
 
 PTEX_NAMESPACE_BEGIN
 
+/** A kernel piece, split across edges as needed, ready to apply to a face. */
+struct PtexSeparableFilter::KernelPiece {
+    int faceid;
+    PtexSeparableKernel k;
+};
+
+
 void PtexSeparableFilter::eval(float* result, int firstChan, int nChannels,
                                int faceid, float u, float v,
                                float uw1, float vw1, float uw2, float vw2,
@@ -52,20 +60,290 @@ void PtexSeparableFilter::eval(float* result, int firstChan, int nChannels,
     // init
     if (!_tx || nChannels <= 0) return;
     if (faceid < 0 || faceid >= _tx->numFaces()) return;
-    _firstChanOffset = firstChan*DataSize(_dt);
-    _nchan = PtexUtils::min(nChannels, _ntxchan-firstChan);
+    EvalContext ctx(_tx, _dt, _ntxchan, _efm, firstChan, nChannels);
 
     // get face info
     const FaceInfo& f = _tx->getFaceInfo(faceid);
 
+    // build kernel (result is output directly if no kernel is needed)
+    PtexSeparableKernel k;
+    if (!buildLookupKernel(ctx, k, result, faceid, f, u, v, uw1, vw1, uw2, vw2, width, blur)) return;
+    ctx.weight = k.weight();
+
+    // allocate temporary result
+    ctx.result = (float*) alloca(sizeof(float)*ctx.nchan);
+    memset(ctx.result, 0, sizeof(float)*ctx.nchan);
+
+    // apply to faces
+    splitAndApply(ctx, k, faceid, f);
+
+    // normalize (both for data type and cumulative kernel weight applied)
+    // and output result
+    float scale = 1.0f / (ctx.weight * OneValue(_dt));
+    for (int i = 0; i < ctx.nchan; i++) result[i] = float(ctx.result[i] * scale);
+}
+
+
+void PtexSeparableFilter::evalDeriv(float* result, float* dresultdu, float* dresultdv,
+                                    int firstChan, int nChannels, int faceid, float u, float v,
+                                    float uw1, float vw1, float uw2, float vw2,
+                                    float width, float blur)
+{
+    // init
+    if (!_tx || nChannels <= 0) return;
+    if (faceid < 0 || faceid >= _tx->numFaces()) return;
+    EvalContext ctx(_tx, _dt, _ntxchan, _efm, firstChan, nChannels);
+
+    // get face info
+    const FaceInfo& f = _tx->getFaceInfo(faceid);
+
+    // build kernel with derivative weights
+    // (result is output directly if no kernel is needed, and doesn't vary with u,v)
+    PtexSeparableKernel k;
+    k.deriv = 1;
+    if (!buildLookupKernel(ctx, k, result, faceid, f, u, v, uw1, vw1, uw2, vw2, width, blur)) {
+        memset(dresultdu, 0, sizeof(float)*ctx.nchan);
+        memset(dresultdv, 0, sizeof(float)*ctx.nchan);
+        return;
+    }
+    ctx.weight = k.weight();
+    k.weightDeriv(ctx.weightDu, ctx.weightDv);
+
+    // allocate temporary results
+    ctx.result = (float*) alloca(sizeof(float)*ctx.nchan*3);
+    memset(ctx.result, 0, sizeof(float)*ctx.nchan*3);
+    ctx.resultDu = ctx.result + ctx.nchan;
+    ctx.resultDv = ctx.resultDu + ctx.nchan;
+
+    // apply to faces
+    splitAndApply(ctx, k, faceid, f);
+
+    // normalize and output result; the derivatives account for the change in
+    // cumulative weight: d(r/w) = (dr - (r/w)*dw) / w
+    float scale = 1.0f / (ctx.weight * OneValue(_dt));
+    float wu = ctx.weightDu / ctx.weight, wv = ctx.weightDv / ctx.weight;
+    for (int i = 0; i < ctx.nchan; i++) {
+        result[i] = float(ctx.result[i] * scale);
+        dresultdu[i] = ctx.resultDu[i] * scale - result[i] * wu;
+        dresultdv[i] = ctx.resultDv[i] * scale - result[i] * wv;
+    }
+}
+
+
+void PtexSeparableFilter::evalMulti(int ntextures, PtexTexture* const* textures, float* const* results,
+                                    const int* firstchans, const int* nchannels,
+                                    int faceid, float u, float v,
+                                    float uw1, float vw1, float uw2, float vw2,
+                                    float width, float blur)
+{
+    // init
+    if (!_tx || ntextures <= 0) return;
+    if (faceid < 0 || faceid >= _tx->numFaces()) return;
+    const FaceInfo& f = _tx->getFaceInfo(faceid);
+
+    // find the textures that can share this texture's kernel (evaluating the rest separately)
+    int* shared = (int*) alloca(sizeof(int)*ntextures);
+    int nshared = 0, maxchan = 0;
+    for (int i = 0; i < ntextures; i++) {
+        PtexTexture* tx = textures[i];
+        if (!tx || nchannels[i] <= 0) continue;
+        if (tx != _tx && !sharesTopology(tx, faceid, f)) {
+            PtexPtr<PtexFilter> filter(getFilter(tx, _options));
+            filter->eval(results[i], firstchans[i], nchannels[i], faceid, u, v,
+                         uw1, vw1, uw2, vw2, width, blur);
+            continue;
+        }
+
+        // if neighborhood is constant, just return constant value of face
+        if (tx->getFaceInfo(faceid).isNeighborhoodConstant()) {
+            EvalContext tctx(tx, tx->dataType(), tx->numChannels(), tx->edgeFilterMode(),
+                             firstchans[i], nchannels[i]);
+            PtexPtr<PtexFaceData> data ( tx->getData(faceid, 0) );
+            if (data && tctx.nchan > 0) {
+                char* d = (char*) data->getData() + tctx.firstChanOffset;
+                Ptex::ConvertToFloat(results[i], d, tctx.dt, tctx.nchan);
+            }
+            continue;
+        }
+        shared[nshared++] = i;
+        maxchan = PtexUtils::max(maxchan, nchannels[i]);
+    }
+    if (!nshared) return;
+
+    // build the kernel and split it across edges once, recording the pieces
+    KernelPiece pieces[MaxPieces];
+    EvalContext ctx(_tx, _dt, _ntxchan, _efm, 0, 0);
+    ctx.pieces = pieces;
+    PtexSeparableKernel k;
+    if (!buildLookupKernel(ctx, k, results[shared[0]], faceid, f, u, v, uw1, vw1, uw2, vw2, width, blur)) {
+        // (only the black border mode gets here, as constant neighborhoods were handled above)
+        for (int j = 0; j < nshared; j++) {
+            int i = shared[j];
+            int nchan = PtexUtils::min(nchannels[i], textures[i]->numChannels()-firstchans[i]);
+            if (nchan > 0) memset(results[i], 0, sizeof(float)*nchan);
+        }
+        return;
+    }
+    ctx.weight = k.weight();
+    PtexSeparableKernel korig(k);
+    splitAndApply(ctx, k, faceid, f);
+
+    // apply the pieces to each texture
+    float* tmp = (float*) alloca(sizeof(float)*maxchan);
+    for (int j = 0; j < nshared; j++) {
+        int i = shared[j];
+        PtexTexture* tx = textures[i];
+        EvalContext tctx(tx, tx->dataType(), tx->numChannels(), tx->edgeFilterMode(),
+                         firstchans[i], nchannels[i]);
+        if (tctx.nchan <= 0) continue;
+        tctx.result = tmp;
+        memset(tctx.result, 0, sizeof(float)*tctx.nchan);
+        if (ctx.npieces <= MaxPieces) {
+            tctx.weight = ctx.weight;
+            for (int p = 0; p < ctx.npieces; p++) {
+                PtexSeparableKernel kp(pieces[p].k);
+                applyToFace(tctx, kp, pieces[p].faceid, tx->getFaceInfo(pieces[p].faceid).res);
+            }
+        }
+        else {
+            // too many pieces to record (many corner faces): split again for each texture
+            PtexSeparableKernel kt(korig);
+            tctx.weight = kt.weight();
+            splitAndApply(tctx, kt, faceid, f);
+        }
+
+        // normalize (both for data type and cumulative kernel weight applied)
+        // and output result
+        float scale = 1.0f / (tctx.weight * OneValue(tctx.dt));
+        for (int c = 0; c < tctx.nchan; c++) results[i][c] = float(tctx.result[c] * scale);
+    }
+}
+
+
+bool PtexSeparableFilter::sharesTopology(PtexTexture* tx, int faceid, const FaceInfo& f)
+{
+    // (only the lookup face's adjacency is compared; the rest of the mesh is assumed to match)
+    if (tx->numFaces() != _tx->numFaces() || tx->meshType() != _tx->meshType() ||
+        tx->uBorderMode() != _uMode || tx->vBorderMode() != _vMode) return false;
+    const FaceInfo& tf = tx->getFaceInfo(faceid);
+    return tf.isSubface() == f.isSubface() && tf.adjedges == f.adjedges &&
+        memcmp(tf.adjfaces, f.adjfaces, sizeof(f.adjfaces)) == 0;
+}
+
+
+void PtexSeparableFilter::evalBatch(float* result, int resultStride, int firstChan, int nChannels,
+                                    int n, const int* faceids, const float* u, const float* v,
+                                    const float* uw1, const float* vw1, const float* uw2, const float* vw2,
+                                    float width, float blur)
+{
+    // init
+    if (!_tx || nChannels <= 0) return;
+    EvalContext ctx(_tx, _dt, _ntxchan, _efm, firstChan, nChannels);
+
+    // evaluate in fixed-size chunks so per-query state can live on the stack
+    for (int start = 0; start < n; start += BatchMax) {
+        int count = PtexUtils::min(n - start, int(BatchMax));
+        evalChunk(ctx, result + start, resultStride, count, faceids + start, u + start, v + start,
+                  uw1 + start, vw1 + start, uw2 + start, vw2 + start, width, blur);
+    }
+}
+
+
+void PtexSeparableFilter::evalChunk(EvalContext& ctx, float* result, int resultStride,
+                                    int n, const int* faceids, const float* u, const float* v,
+                                    const float* uw1, const float* vw1, const float* uw2, const float* vw2,
+                                    float width, float blur)
+{
+    enum { q_invalid, q_done, q_kernel };
+    PtexSeparableKernel kernels[BatchMax];
+    float weights[BatchMax];
+    uint8_t state[BatchMax];
+    uint64_t inface[BatchMax];  // sort keys (faceid, res, query) for kernels within a single face
+    uint8_t split[BatchMax];    // queries with kernels that span an edge
+    int ninface = 0, nsplit = 0;
+
+    // per-query results are accumulated in a temp buffer and scattered at the end
+    float* results = (float*) alloca(sizeof(float)*ctx.nchan*n);
+
+    // build all kernels and set aside the ones that can be applied to a single face
+    int nfaces = _tx->numFaces();
+    for (int i = 0; i < n; i++) {
+        int faceid = faceids[i];
+        state[i] = q_invalid;
+        if (faceid < 0 || faceid >= nfaces) continue;
+        state[i] = q_done;
+        const FaceInfo& f = _tx->getFaceInfo(faceid);
+        PtexSeparableKernel& k = kernels[i];
+        float* r = results + i*ctx.nchan;
+        if (!buildLookupKernel(ctx, k, r, faceid, f, u[i], v[i], uw1[i], vw1[i], uw2[i], vw2[i],
+                               width, blur)) continue;
+        state[i] = q_kernel;
+        weights[i] = k.weight();
+        memset(r, 0, sizeof(float)*ctx.nchan);
+
+        bool needSplit = k.u < 0 || k.u + k.uw > k.res.u() || k.v < 0 || k.v + k.vw > k.res.v();
+        if (needSplit && !_options.noedgeblend) {
+            split[nsplit++] = uint8_t(i);
+            continue;
+        }
+        if (needSplit) mergeToFace(k);
+
+        // downres now so that queries are grouped by the res actually fetched
+        while (k.res.u() > f.res.u()) k.downresU();
+        while (k.res.v() > f.res.v()) k.downresV();
+        inface[ninface++] = (uint64_t(uint32_t(faceid)) << 24) | (uint64_t(k.res.val()) << 8) | uint64_t(i);
+    }
+
+    // apply single-face kernels, fetching the data for each face and res only once
+    std::sort(inface, inface + ninface);
+    for (int j = 0; j < ninface; ) {
+        uint64_t group = inface[j] >> 8;
+        int i0 = int(inface[j] & 0xff);
+        PtexPtr<PtexFaceData> dh ( _tx->getData(faceids[i0], kernels[i0].res) );
+        for (; j < ninface && (inface[j] >> 8) == group; j++) {
+            int i = int(inface[j] & 0xff);
+            if (!dh) continue;
+            ctx.result = results + i*ctx.nchan;
+            applyData(ctx, kernels[i], dh);
+        }
+    }
+
+    // apply kernels that span edges
+    for (int j = 0; j < nsplit; j++) {
+        int i = split[j];
+        ctx.result = results + i*ctx.nchan;
+        ctx.weight = weights[i];
+        splitAndApply(ctx, kernels[i], faceids[i], _tx->getFaceInfo(faceids[i]));
+        weights[i] = ctx.weight; // corner handling may adjust the weight
+    }
+
+    // normalize and output results
+    for (int i = 0; i < n; i++) {
+        if (state[i] == q_invalid) continue;
+        float* r = results + i*ctx.nchan;
+        if (state[i] == q_kernel) {
+            float scale = 1.0f / (weights[i] * OneValue(_dt));
+            for (int c = 0; c < ctx.nchan; c++) r[c] = float(r[c] * scale);
+        }
+        for (int c = 0; c < ctx.nchan; c++) result[c*resultStride + i] = r[c];
+    }
+}
+
+
+bool PtexSeparableFilter::buildLookupKernel(EvalContext& ctx, PtexSeparableKernel& k, float* result,
+                                            int faceid, const FaceInfo& f, float u, float v,
+                                            float uw1, float vw1, float uw2, float vw2,
+                                            float width, float blur)
+{
     // if neighborhood is constant, just return constant value of face
-    if (f.isNeighborhoodConstant()) {
+    // (unless recording kernel pieces for evalMulti, which checks each texture itself)
+    if (f.isNeighborhoodConstant() && !ctx.pieces) {
         PtexPtr<PtexFaceData> data ( _tx->getData(faceid, 0) );
         if (data) {
-            char* d = (char*) data->getData() + _firstChanOffset;
-            Ptex::ConvertToFloat(result, d, _dt, _nchan);
+            char* d = (char*) data->getData() + ctx.firstChanOffset;
+            Ptex::ConvertToFloat(result, d, _dt, ctx.nchan);
         }
-        return;
+        return false;
     }
 
     // find filter width as bounding box of vectors w1 and w2
@@ -74,25 +352,27 @@ void PtexSeparableFilter::eval(float* result, int firstChan, int nChannels,
     // handle border modes
     bool return_black = false;
 
+    // (derivatives are zero along an axis where the lookup is clamped)
+    float dscaleu = 1.0f, dscalev = 1.0f;
+
     switch (_uMode) {
-    case m_clamp: u = PtexUtils::clamp(u, 0.0f, 1.0f); break;
+    case m_clamp: if (u < 0.0f || u > 1.0f) dscaleu = 0; u = PtexUtils::clamp(u, 0.0f, 1.0f); break;
     case m_periodic: u = u-PtexUtils::floor(u); break;
     case m_black: if (u <= -1.0f || u >= 2.0f) return_black = true; break;
     }
 
     switch (_vMode) {
-    case m_clamp: v = PtexUtils::clamp(v, 0.0f, 1.0f); break;
+    case m_clamp: if (v < 0.0f || v > 1.0f) dscalev = 0; v = PtexUtils::clamp(v, 0.0f, 1.0f); break;
     case m_periodic: v = v-PtexUtils::floor(v); break;
     case m_black: if (v <= -1.0f || v >= 2.0f) return_black = true; break;
     }
 
     if (return_black) {
-        memset(result, 0, sizeof(float)*_nchan);
-        return;
+        memset(result, 0, sizeof(float)*ctx.nchan);
+        return false;
     }
 
     // build kernel
-    PtexSeparableKernel k;
     if (f.isSubface()) {
         // for a subface, build the kernel as if it were on a main face and then downres
         uw = uw * width + blur * 2.0f;
@@ -102,48 +382,43 @@ void PtexSeparableFilter::eval(float* result, int firstChan, int nChannels,
         if (k.res.ulog2 == 0) k.upresU();
         if (k.res.vlog2 == 0) k.upresV();
         k.res.ulog2--; k.res.vlog2--;
+        dscaleu *= 0.5f; dscalev *= 0.5f;
     }
     else {
         uw = uw * width + blur;
         vw = vw * width + blur;
         buildKernel(k, u, v, uw, vw, f.res);
     }
+    if (k.deriv) k.scaleDeriv(dscaleu, dscalev);
     k.stripZeros();
 
     // check kernel (debug only)
     assert(k.uw > 0 && k.vw > 0);
     assert(k.uw <= PtexSeparableKernel::kmax && k.vw <= PtexSeparableKernel::kmax);
-    _weight = k.weight();
-
-    // allocate temporary result
-    _result = (float*) alloca(sizeof(float)*_nchan);
-    memset(_result, 0, sizeof(float)*_nchan);
-
-    // apply to faces
-    splitAndApply(k, faceid, f);
+    return true;
+}
 
-    // normalize (both for data type and cumulative kernel weight applied)
-    // and output result
-    float scale = 1.0f / (_weight * OneValue(_dt));
-    for (int i = 0; i < _nchan; i++) result[i] = float(_result[i] * scale);
 
-    // clear temp result
-    _result = 0;
+void PtexSeparableFilter::mergeToFace(PtexSeparableKernel& k)
+{
+    // fold any part of the kernel beyond the face edges back onto the face
+    if (k.u+k.uw > k.res.u()) k.mergeR(_uMode);
+    if (k.u < 0) k.mergeL(_uMode);
+    if (k.v+k.vw > k.res.v()) k.mergeT(_vMode);
+    if (k.v < 0) k.mergeB(_vMode);
 }
 
 
-void PtexSeparableFilter::splitAndApply(PtexSeparableKernel& k, int faceid, const Ptex::FaceInfo& f)
+void PtexSeparableFilter::splitAndApply(EvalContext& ctx, PtexSeparableKernel& k,
+                                        int faceid, const Ptex::FaceInfo& f)
 {
     // do we need to split? (i.e. does kernel span an edge?)
     bool splitR = (k.u+k.uw > k.res.u()), splitL = (k.u < 0);
     bool splitT = (k.v+k.vw > k.res.v()), splitB = (k.v < 0);
 
     if (_options.noedgeblend) {
-        if (splitR) k.mergeR(_uMode);
-        if (splitL) k.mergeL(_uMode);
-        if (splitT) k.mergeT(_vMode);
-        if (splitB) k.mergeB(_vMode);
-        apply(k, faceid, f);
+        mergeToFace(k);
+        apply(ctx, k, faceid, f);
         return;
     }
 
@@ -155,18 +430,18 @@ void PtexSeparableFilter::splitAndApply(PtexSeparableKernel& k, int faceid, cons
                 if (splitT) {
                     if (f.adjface(e_top) >= 0) {
                         ka.splitT(kc);
-                        applyToCorner(kc, faceid, f, e_top);
+                        applyToCorner(ctx, kc, faceid, f, e_top);
                     }
                     else ka.mergeT(_vMode);
                 }
                 if (splitB) {
                     if (f.adjface(e_bottom) >= 0) {
                         ka.splitB(kc);
-                        applyToCorner(kc, faceid, f, e_right);
+                        applyToCorner(ctx, kc, faceid, f, e_right);
                     }
                     else ka.mergeB(_vMode);
                 }
-                applyAcrossEdge(ka, faceid, f, e_right);
+                applyAcrossEdge(ctx, ka, faceid, f, e_right);
             }
             else k.mergeR(_uMode);
         }
@@ -176,43 +451,43 @@ void PtexSeparableFilter::splitAndApply(PtexSeparableKernel& k, int faceid, cons
                 if (splitT) {
                     if (f.adjface(e_top) >= 0) {
                         ka.splitT(kc);
-                        applyToCorner(kc, faceid, f, e_left);
+                        applyToCorner(ctx, kc, faceid, f, e_left);
                     }
                     else ka.mergeT(_vMode);
                 }
                 if (splitB) {
                     if (f.adjface(e_bottom) >= 0) {
                         ka.splitB(kc);
-                        applyToCorner(kc, faceid, f, e_bottom);
+                        applyToCorner(ctx, kc, faceid, f, e_bottom);
                     }
                     else ka.mergeB(_vMode);
                 }
-                applyAcrossEdge(ka, faceid, f, e_left);
+                applyAcrossEdge(ctx, ka, faceid, f, e_left);
             }
             else k.mergeL(_uMode);
         }
         if (splitT) {
             if (f.adjface(e_top) >= 0) {
                 k.splitT(ka);
-                applyAcrossEdge(ka, faceid, f, e_top);
+                applyAcrossEdge(ctx, ka, faceid, f, e_top);
             }
             else k.mergeT(_vMode);
         }
         if (splitB) {
             if (f.adjface(e_bottom) >= 0) {
                 k.splitB(ka);
-                applyAcrossEdge(ka, faceid, f, e_bottom);
+                applyAcrossEdge(ctx, ka, faceid, f, e_bottom);
             }
             else k.mergeB(_vMode);
         }
     }
 
     // do local face
-    apply(k, faceid, f);
+    apply(ctx, k, faceid, f);
 }
 
 
-void PtexSeparableFilter::applyAcrossEdge(PtexSeparableKernel& k,
+void PtexSeparableFilter::applyAcrossEdge(EvalContext& ctx, PtexSeparableKernel& k,
                                           int faceid, const Ptex::FaceInfo& f, int eid)
 {
     int afid = f.adjface(eid), aeid = f.adjedge(eid);
@@ -249,12 +524,12 @@ void PtexSeparableFilter::applyAcrossEdge(PtexSeparableKernel& k,
 
     // rotate and apply (resplit if going to a subface)
     k.rotate(rot);
-    if (afIsSubface) splitAndApply(k, afid, *af);
-    else apply(k, afid, *af);
+    if (afIsSubface) splitAndApply(ctx, k, afid, *af);
+    else apply(ctx, k, afid, *af);
 }
 
 
-void PtexSeparableFilter::applyToCorner(PtexSeparableKernel& k, int faceid,
+void PtexSeparableFilter::applyToCorner(EvalContext& ctx, PtexSeparableKernel& k, int faceid,
                                         const Ptex::FaceInfo& f, int eid)
 {
     // traverse clockwise around corner vertex and gather corner faces
@@ -298,7 +573,7 @@ void PtexSeparableFilter::applyToCorner(PtexSeparableKernel& k, int faceid,
             bool primary = (i==1);
             k.adjustSubfaceToMain(eid + primary * 2);
             k.rotate(eid - aeid + 3 - primary);
-            splitAndApply(k, afid, *af);
+            splitAndApply(ctx, k, afid, *af);
             return;
         }
         prevIsSubface = isSubface;
@@ -306,29 +581,44 @@ void PtexSeparableFilter::applyToCorner(PtexSeparableKernel& k, int faceid,
 
     if (numCorners == 1) {
         // regular case (valence 4)
-        applyToCornerFace(k, f, eid, cfaceId[1], *cface[1], cedgeId[1]);
+        applyToCornerFace(ctx, k, f, eid, cfaceId[1], *cface[1], cedgeId[1]);
     }
     else if (numCorners > 1) {
         // valence 5+, make kernel symmetric and apply equally to each face
         // first, rotate to standard orientation, u=v=0
         k.rotate(eid + 2);
+        dropDeriv(ctx, k); // the symmetric kernel doesn't follow the lookup position
         float initialWeight = k.weight();
         float newWeight = k.makeSymmetric(initialWeight);
         for (int i = 1; i <= numCorners; i++) {
             PtexSeparableKernel kc = k;
-            applyToCornerFace(kc, f, 2, cfaceId[i], *cface[i], cedgeId[i]);
+            applyToCornerFace(ctx, kc, f, 2, cfaceId[i], *cface[i], cedgeId[i]);
         }
         // adjust weight for symmetrification and for additional corners
-        _weight += newWeight * (float)numCorners - initialWeight;
+        ctx.weight += newWeight * (float)numCorners - initialWeight;
     }
     else {
         // valence 2 or 3, ignore corner face (just adjust weight)
-        _weight -= k.weight();
+        dropDeriv(ctx, k);
+        ctx.weight -= k.weight();
     }
 }
 
 
-void PtexSeparableFilter::applyToCornerFace(PtexSeparableKernel& k, const Ptex::FaceInfo& f, int eid,
+void PtexSeparableFilter::dropDeriv(EvalContext& ctx, PtexSeparableKernel& k)
+{
+    // remove the kernel's derivative weights from the cumulative derivative weights
+    if (!k.deriv) return;
+    float du, dv;
+    k.weightDeriv(du, dv);
+    ctx.weightDu -= du;
+    ctx.weightDv -= dv;
+    k.clearDeriv();
+}
+
+
+void PtexSeparableFilter::applyToCornerFace(EvalContext& ctx, PtexSeparableKernel& k,
+                                            const Ptex::FaceInfo& f, int eid,
                                             int cfid, const Ptex::FaceInfo& cf, int ceid)
 {
     // adjust uv coord and res for face/subface boundary
@@ -340,40 +630,70 @@ void PtexSeparableFilter::applyToCornerFace(PtexSeparableKernel& k, const Ptex::
 
     // rotate and apply (resplit if going to a subface)
     k.rotate(eid - ceid + 2);
-    if (cfIsSubface) splitAndApply(k, cfid, cf);
-    else apply(k, cfid, cf);
+    if (cfIsSubface) splitAndApply(ctx, k, cfid, cf);
+    else apply(ctx, k, cfid, cf);
 }
 
 
-void PtexSeparableFilter::apply(PtexSeparableKernel& k, int faceid, const Ptex::FaceInfo& f)
+void PtexSeparableFilter::apply(EvalContext& ctx, PtexSeparableKernel& k, int faceid, const Ptex::FaceInfo& f)
 {
     assert(k.u >= 0 && k.u + k.uw <= k.res.u());
     assert(k.v >= 0 && k.v + k.vw <= k.res.v());
 
     if (k.uw <= 0 || k.vw <= 0) return;
 
+    // when recording for evalMulti, keep the piece to apply to each texture later
+    if (ctx.pieces) {
+        if (ctx.npieces < MaxPieces) {
+            ctx.pieces[ctx.npieces].faceid = faceid;
+            ctx.pieces[ctx.npieces].k = k;
+        }
+        ctx.npieces++;
+        return;
+    }
+
+    // (f is from _tx, which may have different face res than the texture being applied)
+    applyToFace(ctx, k, faceid, ctx.tx == _tx ? f.res : ctx.tx->getFaceInfo(faceid).res);
+}
+
+
+void PtexSeparableFilter::applyToFace(EvalContext& ctx, PtexSeparableKernel& k, int faceid, Res faceRes)
+{
     // downres kernel if needed
-    while (k.res.u() > f.res.u()) k.downresU();
-    while (k.res.v() > f.res.v()) k.downresV();
+    while (k.res.u() > faceRes.u()) k.downresU();
+    while (k.res.v() > faceRes.v()) k.downresV();
 
     // get face data, and apply
-    PtexPtr<PtexFaceData> dh ( _tx->getData(faceid, k.res) );
-    if (!dh) return;
+    PtexPtr<PtexFaceData> dh ( ctx.tx->getData(faceid, k.res) );
+    if (dh) applyData(ctx, k, dh);
+}
 
+
+void PtexSeparableFilter::applyData(EvalContext& ctx, PtexSeparableKernel& k, PtexFaceData* dh)
+{
     if (dh->isConstant()) {
-        k.applyConst(_result, (char*)dh->getData()+_firstChanOffset, _dt, _nchan);
+        applyConstData(ctx, k, (char*)dh->getData()+ctx.firstChanOffset);
         return;
     }
 
-    // allocate temporary result for tanvec mode (if needed)
-    bool tanvecMode = (_efm == efm_tanvec) && (_nchan >= 2) && (k.rot > 0);
-    float* result = tanvecMode ? (float*) alloca(sizeof(float)*_nchan) : _result;
-    if (tanvecMode) memset(result, 0, sizeof(float)*_nchan);
+    // allocate temporary results for tanvec mode (if needed)
+    bool tanvecMode = (ctx.efm == efm_tanvec) && (ctx.nchan >= 2) && (k.rot > 0);
+    EvalContext tctx = ctx;
+    if (tanvecMode) {
+        int nresults = ctx.resultDu ? 3 : 1;
+        tctx.result = (float*) alloca(sizeof(float)*ctx.nchan*nresults);
+        memset(tctx.result, 0, sizeof(float)*ctx.nchan*nresults);
+        if (ctx.resultDu) {
+            tctx.resultDu = tctx.result + ctx.nchan;
+            tctx.resultDv = tctx.resultDu + ctx.nchan;
+        }
+    }
 
     if (dh->isTiled()) {
         Ptex::Res tileres = dh->tileRes();
         PtexSeparableKernel kt;
         kt.res = tileres;
+        kt.deriv = k.deriv;
         int tileresu = tileres.u();
         int tileresv = tileres.v();
         int ntilesu = k.res.u() / tileresu;
@@ -390,39 +710,67 @@ void PtexSeparableFilter::apply(PtexSeparableKernel& k, int faceid, const Ptex::
                 PtexPtr<PtexFaceData> th ( dh->getTile(tilev * ntilesu + tileu) );
                 if (th) {
                     if (th->isConstant())
-                        kt.applyConst(result, (char*)th->getData()+_firstChanOffset, _dt, _nchan);
+                        applyConstData(tctx, kt, (char*)th->getData()+ctx.firstChanOffset);
                     else
-                        kt.apply(result, (char*)th->getData()+_firstChanOffset, _dt, _nchan, _ntxchan);
+                        applyKernel(tctx, kt, (char*)th->getData()+ctx.firstChanOffset);
                 }
             }
         }
     }
     else {
-        k.apply(result, (char*)dh->getData()+_firstChanOffset, _dt, _nchan, _ntxchan);
+        applyKernel(tctx, k, (char*)dh->getData()+ctx.firstChanOffset);
     }
 
     if (tanvecMode) {
         // rotate tangent-space vector data and update main result
-        switch (k.rot) {
-            case 0: // rot==0 included for completeness, but tanvecMode should be false in this case
-                _result[0] += result[0];
-                _result[1] += result[1];
-                break;
-            case 1:
-                _result[0] -= result[1];
-                _result[1] += result[0];
-                break;
-            case 2:
-                _result[0] -= result[0];
-                _result[1] -= result[1];
-                break;
-            case 3:
-                _result[0] += result[1];
-                _result[1] -= result[0];
-                break;
+        addRotated(ctx.result, tctx.result, k.rot, ctx.nchan);
+        if (ctx.resultDu) {
+            addRotated(ctx.resultDu, tctx.resultDu, k.rot, ctx.nchan);
+            addRotated(ctx.resultDv, tctx.resultDv, k.rot, ctx.nchan);
         }
-        for (int i = 2; i < _nchan; i++) _result[i] += result[i];
     }
 }
 
+
+void PtexSeparableFilter::applyKernel(const EvalContext& ctx, PtexSeparableKernel& k, void* data)
+{
+    if (ctx.resultDu)
+        k.applyDeriv(ctx.result, ctx.resultDu, ctx.resultDv, data, ctx.dt, ctx.nchan, ctx.ntxchan);
+    else
+        k.apply(ctx.result, data, ctx.dt, ctx.nchan, ctx.ntxchan);
+}
+
+
+void PtexSeparableFilter::applyConstData(const EvalContext& ctx, PtexSeparableKernel& k, void* data)
+{
+    if (ctx.resultDu)
+        k.applyConstDeriv(ctx.result, ctx.resultDu, ctx.resultDv, data, ctx.dt, ctx.nchan);
+    else
+        k.applyConst(ctx.result, data, ctx.dt, ctx.nchan);
+}
+
+
+void PtexSeparableFilter::addRotated(float* dst, const float* src, int rot, int nchan)
+{
+    switch (rot) {
+        case 0: // rot==0 included for completeness, but tanvecMode should be false in this case
+            dst[0] += src[0];
+            dst[1] += src[1];
+            break;
+        case 1:
+            dst[0] -= src[1];
+            dst[1] += src[0];
+            break;
+        case 2:
+            dst[0] -= src[0];
+            dst[1] -= src[1];
+            break;
+        case 3:
+            dst[0] += src[1];
+            dst[1] -= src[0];
+            break;
+    }
+    for (int i = 2; i < nchan; i++) dst[i] += src[i];
+}
+
 PTEX_NAMESPACE_END
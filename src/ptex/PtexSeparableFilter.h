@@ -37,6 +37,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
 */
 
 #include "Ptexture.h"
+#include "PtexUtils.h"
 
 PTEX_NAMESPACE_BEGIN
 
@@ -50,37 +51,86 @@ class PtexSeparableFilter : public PtexFilter
                       int faceid, float u, float v,
                       float uw1, float vw1, float uw2, float vw2,
                       float width, float blur);
+    virtual void evalBatch(float* result, int resultStride, int firstchan, int nchannels,
+                           int n, const int* faceid, const float* u, const float* v,
+                           const float* uw1, const float* vw1, const float* uw2, const float* vw2,
+                           float width, float blur);
+    virtual void evalDeriv(float* result, float* dresultdu, float* dresultdv,
+                           int firstchan, int nchannels, int faceid, float u, float v,
+                           float uw1, float vw1, float uw2, float vw2,
+                           float width, float blur);
+    virtual void evalMulti(int ntextures, PtexTexture* const* textures, float* const* results,
+                           const int* firstchans, const int* nchannels,
+                           int faceid, float u, float v,
+                           float uw1, float vw1, float uw2, float vw2,
+                           float width, float blur);
 
  protected:
+    static const int BatchMax = 64; // max queries evaluated together by evalBatch
+    static const int MaxPieces = 16; // max kernel pieces recorded by evalMulti
+    struct KernelPiece;
+
+    /** Per-lookup evaluation state.  This lives on the stack of eval (and
+        evalBatch) rather than in the filter, so that one filter can be
+        shared by any number of threads. */
+    struct EvalContext {
+        PtexTexture* tx;        // texture the data is read from (differs from _tx in evalMulti)
+        DataType dt;            // data type of tx
+        int ntxchan;            // number of channels in tx
+        EdgeFilterMode efm;     // edge filter mode of tx
+        float* result;          // temp result
+        float* resultDu;        // temp derivative results (evalDeriv only)
+        float* resultDv;
+        float weight;           // accumulated weight of data in result
+        float weightDu;         // accumulated derivative weights (evalDeriv only)
+        float weightDv;
+        int firstChanOffset;    // byte offset of first channel to eval
+        int nchan;              // number of channels to eval
+        KernelPiece* pieces;    // if set, kernel pieces are recorded here instead of applied (evalMulti)
+        int npieces;            // number of pieces (exceeds MaxPieces if they didn't all fit)
+        EvalContext(PtexTexture* txVal, DataType dtVal, int ntxchanVal, EdgeFilterMode efmVal,
+                    int firstChan, int nChannels)
+            : tx(txVal), dt(dtVal), ntxchan(ntxchanVal), efm(efmVal),
+              result(0), resultDu(0), resultDv(0), weight(0), weightDu(0), weightDv(0),
+              firstChanOffset(firstChan*DataSize(dtVal)),
+              nchan(PtexUtils::min(nChannels, ntxchanVal-firstChan)),
+              pieces(0), npieces(0) {}
+    };
+
     PtexSeparableFilter(PtexTexture* tx, const PtexFilter::Options& opts ) :
-        _tx(tx), _options(opts), _result(0), _weight(0),
-        _firstChanOffset(0), _nchan(0), _ntxchan(_tx->numChannels()),
+        PtexFilter(tx, opts), _ntxchan(tx->numChannels()),
         _dt(tx->dataType()), _uMode(tx->uBorderMode()), _vMode(tx->vBorderMode()),
-        _efm(tx->edgeFilterMode())
-    {
-        // if caller was compiled with older version of struct, set default for new opts
-        if (_options.__structSize < (char*)&_options.noedgeblend - (char*)&_options) {
-            _options.noedgeblend = 0;
-        }
-    }
+        _efm(tx->edgeFilterMode()) {}
     virtual ~PtexSeparableFilter() {}
 
     virtual void buildKernel(PtexSeparableKernel& k, float u, float v, float uw, float vw,
                              Res faceRes) = 0;
 
-    void splitAndApply(PtexSeparableKernel& k, int faceid, const Ptex::FaceInfo& f);
-    void applyAcrossEdge(PtexSeparableKernel& k, int faceid, const Ptex::FaceInfo& f, int eid);
-    void applyToCorner(PtexSeparableKernel& k, int faceid, const Ptex::FaceInfo& f, int eid);
-    void applyToCornerFace(PtexSeparableKernel& k, const Ptex::FaceInfo& f, int eid,
+    bool buildLookupKernel(EvalContext& ctx, PtexSeparableKernel& k, float* result,
+                           int faceid, const Ptex::FaceInfo& f, float u, float v,
+                           float uw1, float vw1, float uw2, float vw2,
+                           float width, float blur);
+    void evalChunk(EvalContext& ctx, float* result, int resultStride,
+                   int n, const int* faceid, const float* u, const float* v,
+                   const float* uw1, const float* vw1, const float* uw2, const float* vw2,
+                   float width, float blur);
+    void mergeToFace(PtexSeparableKernel& k);
+    void splitAndApply(EvalContext& ctx, PtexSeparableKernel& k, int faceid, const Ptex::FaceInfo& f);
+    void applyAcrossEdge(EvalContext& ctx, PtexSeparableKernel& k,
+                         int faceid, const Ptex::FaceInfo& f, int eid);
+    void applyToCorner(EvalContext& ctx, PtexSeparableKernel& k,
+                       int faceid, const Ptex::FaceInfo& f, int eid);
+    void applyToCornerFace(EvalContext& ctx, PtexSeparableKernel& k, const Ptex::FaceInfo& f, int eid,
                            int cfaceid, const Ptex::FaceInfo& cf, int ceid);
-    void apply(PtexSeparableKernel& k, int faceid, const Ptex::FaceInfo& f);
-
-    PtexTexture* _tx;           // texture being evaluated
-    Options _options;           // options
-    float* _result;             // temp result
-    float _weight;              // accumulated weight of data in _result
-    int _firstChanOffset;       // byte offset of first channel to eval
-    int _nchan;                 // number of channels to eval
+    void apply(EvalContext& ctx, PtexSeparableKernel& k, int faceid, const Ptex::FaceInfo& f);
+    void applyToFace(EvalContext& ctx, PtexSeparableKernel& k, int faceid, Res faceRes);
+    bool sharesTopology(PtexTexture* tx, int faceid, const Ptex::FaceInfo& f);
+    void applyData(EvalContext& ctx, PtexSeparableKernel& k, PtexFaceData* dh);
+    void applyKernel(const EvalContext& ctx, PtexSeparableKernel& k, void* data);
+    void applyConstData(const EvalContext& ctx, PtexSeparableKernel& k, void* data);
+    void dropDeriv(EvalContext& ctx, PtexSeparableKernel& k);
+    static void addRotated(float* dst, const float* src, int rot, int nchan);
+
     int _ntxchan;               // number of channels in texture
     DataType _dt;               // data type of texture
     BorderMode _uMode, _vMode;  // border modes (clamp,black,periodic)
@@ -35,6 +35,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
 #include "PtexPlatform.h"
 #include "PtexUtils.h"
 #include "PtexHalf.h"
+#include "PtexSimd.h"
 #include "PtexSeparableKernel.h"
 
 PTEX_NAMESPACE_BEGIN
@@ -100,6 +101,83 @@ namespace {
         }
     }
 
+#ifdef PTEX_SIMD
+    template<class T, int nChan> struct TexelLoad;
+    template<class T> struct TexelLoad<T,3> {
+        PtexSimd::float4 operator()(const T* p) { return PtexSimd::load3(p); }
+    };
+    template<class T> struct TexelLoad<T,4> {
+        PtexSimd::float4 operator()(const T* p) { return PtexSimd::load(p); }
+    };
+
+    // apply to 3..4 channels w/ pixel stride, one texel per vector
+    // (same operation order as Apply/ApplyS so the results are identical)
+    template<class T, int nChan>
+    void ApplyTexels(PtexSeparableKernel& k, float* result, void* data, int /*nChan*/, int nTxChan)
+    {
+        using namespace PtexSimd;
+        int rowlen = k.res.u() * nTxChan;
+        int datalen = k.uw * nTxChan;
+        int rowskip = rowlen - datalen;
+        float* kvp = k.kv;
+        T* p = static_cast<T*>(data) + (k.v * k.res.u() + k.u) * nTxChan;
+        T* pEnd = p + k.vw * rowlen;
+        float4 sum = TexelLoad<float,nChan>()(result);
+        while (p != pEnd)
+        {
+            float* kup = k.ku;
+            T* pRowEnd = p + datalen;
+            float4 rowResult = TexelLoad<T,nChan>()(p) * splat(*kup++);
+            p += nTxChan;
+            while (p != pRowEnd) {
+                rowResult = rowResult + TexelLoad<T,nChan>()(p) * splat(*kup++);
+                p += nTxChan;
+            }
+            sum = sum + rowResult * splat(*kvp++);
+            p += rowskip;
+        }
+        float tmp[4];
+        store(tmp, sum);
+        memcpy(result, tmp, nChan*sizeof(float));
+    }
+
+    // apply to 1 channel w/ pixel stride, four rows per vector
+    template<class T>
+    void ApplyRows(PtexSeparableKernel& k, float* result, void* data, int /*nChan*/, int nTxChan)
+    {
+        using namespace PtexSimd;
+        int rowlen = k.res.u() * nTxChan;
+        float* kvp = k.kv;
+        T* p = static_cast<T*>(data) + (k.v * k.res.u() + k.u) * nTxChan;
+        int vw = k.vw;
+        for (; vw >= 4; vw -= 4) {
+            float* kup = k.ku;
+            T* col = p;
+            float4 rowResult = gather(col, rowlen) * splat(*kup++);
+            for (int i = 1; i < k.uw; i++) {
+                col += nTxChan;
+                rowResult = rowResult + gather(col, rowlen) * splat(*kup++);
+            }
+            // accumulate rows in order
+            float rows[4];
+            store(rows, rowResult);
+            for (int j = 0; j < 4; j++) result[0] += rows[j] * *kvp++;
+            p += 4 * rowlen;
+        }
+        for (; vw > 0; vw--) {
+            float* kup = k.ku;
+            T* col = p;
+            float rowResult = (float)*col * *kup++;
+            for (int i = 1; i < k.uw; i++) {
+                col += nTxChan;
+                rowResult += (float)*col * *kup++;
+            }
+            result[0] += rowResult * *kvp++;
+            p += rowlen;
+        }
+    }
+#endif
+
     // apply to N channels (general case)
     template<class T>
     void ApplyN(PtexSeparableKernel& k, float* result, void* data, int nChan, int nTxChan)
@@ -129,10 +207,70 @@ namespace {
             p += rowskip;
         }
     }
+
+    // apply weights and derivative weights to N channels w/ pixel stride.  The
+    // derivatives along the ku and kv axes are accumulated in resultU and resultV.
+    template<class T>
+    void ApplyDeriv(PtexSeparableKernel& k, float* result, float* resultU, float* resultV,
+                    void* data, int nChan, int nTxChan)
+    {
+        float* rowResult = (float*) alloca(2*nChan*sizeof(float));
+        float* rowResultD = rowResult + nChan;
+        const float* kud = k.ku + PtexSeparableKernel::kmax;
+        const float* kvd = k.kv + PtexSeparableKernel::kmax;
+        int rowlen = k.res.u() * nTxChan;
+        T* row = static_cast<T*>(data) + (k.v * k.res.u() + k.u) * nTxChan;
+        for (int j = 0; j < k.vw; j++, row += rowlen) {
+            T* p = row;
+            PtexUtils::VecMultN<T>()(rowResult, p, nChan, k.ku[0]);
+            PtexUtils::VecMultN<T>()(rowResultD, p, nChan, kud[0]);
+            for (int i = 1; i < k.uw; i++) {
+                p += nTxChan;
+                PtexUtils::VecAccumN<T>()(rowResult, p, nChan, k.ku[i]);
+                PtexUtils::VecAccumN<T>()(rowResultD, p, nChan, kud[i]);
+            }
+            PtexUtils::VecAccumN<float>()(result, rowResult, nChan, k.kv[j]);
+            PtexUtils::VecAccumN<float>()(resultU, rowResultD, nChan, k.kv[j]);
+            PtexUtils::VecAccumN<float>()(resultV, rowResult, nChan, kvd[j]);
+        }
+    }
 }
 
 
+PtexSeparableKernel::ApplyDerivFn
+PtexSeparableKernel::applyDerivFunctions[] = {
+    ApplyDeriv<uint8_t>, ApplyDeriv<uint16_t>, ApplyDeriv<PtexHalf>, ApplyDeriv<float>
+};
+
 
+void PtexSeparableKernel::applyDeriv(float* dst, float* dstDu, float* dstDv, void* data,
+                                     DataType dt, int nChan, int nTxChan)
+{
+    // the ku derivatives are with respect to v if the kernel axes are swapped
+    if (deriv > 0) applyDerivFunctions[dt](*this, dst, dstDu, dstDv, data, nChan, nTxChan);
+    else           applyDerivFunctions[dt](*this, dst, dstDv, dstDu, data, nChan, nTxChan);
+}
+
+
+
+#ifdef PTEX_SIMD
+PtexSeparableKernel::ApplyFn
+PtexSeparableKernel::applyFunctions[] = {
+    // nChan == nTxChan
+    ApplyN<uint8_t>,  ApplyN<uint16_t>,  ApplyN<PtexHalf>,  ApplyN<float>,
+    ApplyRows<uint8_t>, ApplyRows<uint16_t>, ApplyRows<PtexHalf>, ApplyRows<float>,
+    Apply<uint8_t,2>, Apply<uint16_t,2>, Apply<PtexHalf,2>, Apply<float,2>,
+    ApplyTexels<uint8_t,3>, ApplyTexels<uint16_t,3>, ApplyTexels<PtexHalf,3>, ApplyTexels<float,3>,
+    ApplyTexels<uint8_t,4>, ApplyTexels<uint16_t,4>, ApplyTexels<PtexHalf,4>, ApplyTexels<float,4>,
+
+    // nChan != nTxChan (need pixel stride)
+    ApplyN<uint8_t>,   ApplyN<uint16_t>,   ApplyN<PtexHalf>,   ApplyN<float>,
+    ApplyRows<uint8_t>, ApplyRows<uint16_t>, ApplyRows<PtexHalf>, ApplyRows<float>,
+    ApplyS<uint8_t,2>, ApplyS<uint16_t,2>, ApplyS<PtexHalf,2>, ApplyS<float,2>,
+    ApplyTexels<uint8_t,3>, ApplyTexels<uint16_t,3>, ApplyTexels<PtexHalf,3>, ApplyTexels<float,3>,
+    ApplyTexels<uint8_t,4>, ApplyTexels<uint16_t,4>, ApplyTexels<PtexHalf,4>, ApplyTexels<float,4>,
+};
+#else
 PtexSeparableKernel::ApplyFn
 PtexSeparableKernel::applyFunctions[] = {
     // nChan == nTxChan
@@ -149,5 +287,6 @@ PtexSeparableKernel::applyFunctions[] = {
     ApplyS<uint8_t,3>, ApplyS<uint16_t,3>, ApplyS<PtexHalf,3>, ApplyS<float,3>,
     ApplyS<uint8_t,4>, ApplyS<uint16_t,4>, ApplyS<PtexHalf,4>, ApplyS<float,4>,
 };
+#endif
 
 PTEX_NAMESPACE_END
@@ -53,12 +53,20 @@ class PtexSeparableKernel {
     float* ku;                  // kernel weights in u
     float* kv;                  // kernel weights in v
     static const int kmax = 10; // max kernel width
-    float kubuff[kmax];
-    float kvbuff[kmax];
+    float kubuff[2*kmax];
+    float kvbuff[2*kmax];
     int rot;
+    int deriv;                  // derivative weights (see below): 0 = none, 1 = d/du and d/dv,
+                                // -1 = d/dv and d/du (i.e. kernel axes are swapped)
+
+    /* When derivative weights are enabled, the derivative of each weight
+       with respect to the lookup position (along the axis the weights
+       were built for) is stored kmax floats after it, i.e. at ku[i+kmax]
+       and kv[i+kmax], so that they follow the weights through every
+       split, merge, rotation and res change. */
 
     PtexSeparableKernel()
-        : res(0), u(0), v(0), uw(0), vw(0), ku(kubuff), kv(kvbuff), rot(0)
+        : res(0), u(0), v(0), uw(0), vw(0), ku(kubuff), kv(kvbuff), rot(0), deriv(0)
     {
         kubuff[0] = 0; // keep cppcheck happy
         kvbuff[0] = 0;
@@ -66,19 +74,19 @@ class PtexSeparableKernel {
 
     PtexSeparableKernel(const PtexSeparableKernel& k)
     {
-        set(k.res, k.u, k.v, k.uw, k.vw, k.ku, k.kv, k.rot);
+        set(k.res, k.u, k.v, k.uw, k.vw, k.ku, k.kv, k.rot, k.deriv);
     }
 
     PtexSeparableKernel& operator= (const PtexSeparableKernel& k)
     {
-        set(k.res, k.u, k.v, k.uw, k.vw, k.ku, k.kv, k.rot);
+        set(k.res, k.u, k.v, k.uw, k.vw, k.ku, k.kv, k.rot, k.deriv);
         return *this;
     }
 
     void set(Res resVal,
              int uVal, int vVal,
              int uwVal, int vwVal,
-             const float* kuVal, const float* kvVal, int rotVal=0)
+             const float* kuVal, const float* kvVal, int rotVal=0, int derivVal=0)
     {
         assert(uwVal <= kmax && vwVal <= kmax);
         res = resVal;
@@ -88,17 +96,22 @@ class PtexSeparableKernel {
         vw = vwVal;
         memcpy(kubuff, kuVal, sizeof(*ku)*uw);
         memcpy(kvbuff, kvVal, sizeof(*kv)*vw);
+        if (derivVal) {
+            memcpy(kubuff+kmax, kuVal+kmax, sizeof(*ku)*uw);
+            memcpy(kvbuff+kmax, kvVal+kmax, sizeof(*kv)*vw);
+        }
         ku = kubuff;
         kv = kvbuff;
         rot = rotVal;
+        deriv = derivVal;
     }
 
     void stripZeros()
     {
-        while (ku[0] == 0) { ku++; u++; uw--; }
-        while (ku[uw-1] == 0) { uw--; }
-        while (kv[0] == 0) { kv++; v++; vw--; }
-        while (kv[vw-1] == 0) { vw--; }
+        while (ku[0] == 0 && (!deriv || ku[kmax] == 0)) { ku++; u++; uw--; }
+        while (ku[uw-1] == 0 && (!deriv || ku[uw-1+kmax] == 0)) { uw--; }
+        while (kv[0] == 0 && (!deriv || kv[kmax] == 0)) { kv++; v++; vw--; }
+        while (kv[vw-1] == 0 && (!deriv || kv[vw-1+kmax] == 0)) { vw--; }
         assert(uw > 0 && vw > 0);
     }
 
@@ -107,11 +120,37 @@ class PtexSeparableKernel {
         return accumulate(ku, uw) * accumulate(kv, vw);
     }
 
+    // derivatives of weight() with respect to the lookup position
+    void weightDeriv(float& du, float& dv) const
+    {
+        float su = accumulate(ku, uw), sv = accumulate(kv, vw);
+        float wu = accumulate(ku+kmax, uw) * sv, wv = su * accumulate(kv+kmax, vw);
+        if (deriv > 0) { du = wu; dv = wv; }
+        else           { du = wv; dv = wu; }
+    }
+
+    // scale the derivative weights (before any rotation)
+    void scaleDeriv(float su, float sv)
+    {
+        for (int i = 0; i < uw; i++) ku[i+kmax] *= su;
+        for (int i = 0; i < vw; i++) kv[i+kmax] *= sv;
+    }
+
+    // drop the derivative weights (the kernel no longer varies with the lookup position)
+    void clearDeriv()
+    {
+        if (!deriv) return;
+        memset(ku+kmax, 0, sizeof(*ku)*uw);
+        memset(kv+kmax, 0, sizeof(*kv)*vw);
+    }
+
     void mergeL(BorderMode mode)
     {
         int w = -u;
-        if (mode != m_black)
+        if (mode != m_black) {
             ku[w] += accumulate(ku, w);
+            if (deriv) ku[w+kmax] += accumulate(ku+kmax, w);
+        }
         ku += w;
         uw -= w;
         u = 0;
@@ -121,16 +160,20 @@ class PtexSeparableKernel {
     {
         int w = uw + u - res.u();
         float* kp = ku + uw - w;
-        if (mode != m_black)
+        if (mode != m_black) {
             kp[-1] += accumulate(kp, w);
+            if (deriv) kp[kmax-1] += accumulate(kp+kmax, w);
+        }
         uw -= w;
     }
 
     void mergeB(BorderMode mode)
     {
         int w = -v;
-        if (mode != m_black)
+        if (mode != m_black) {
             kv[w] += accumulate(kv, w);
+            if (deriv) kv[w+kmax] += accumulate(kv+kmax, w);
+        }
         kv += w;
         vw -= w;
         v = 0;
@@ -140,8 +183,10 @@ class PtexSeparableKernel {
     {
         int w = vw + v - res.v();
         float* kp = kv + vw - w;
-        if (mode != m_black)
+        if (mode != m_black) {
             kp[-1] += accumulate(kp, w);
+            if (deriv) kp[kmax-1] += accumulate(kp+kmax, w);
+        }
         vw -= w;
     }
 
@@ -153,7 +198,7 @@ class PtexSeparableKernel {
         if (w < uw) {
             // normal case - split off a portion
             //    res  u          v  uw vw  ku  kv
-            k.set(res, res.u()-w, v, w, vw, ku, kv);
+            k.set(res, res.u()-w, v, w, vw, ku, kv, 0, deriv);
 
             // update local
             u = 0;
@@ -176,7 +221,7 @@ class PtexSeparableKernel {
         if (w < uw) {
             // normal case - split off a portion
             //    res  u  v  uw vw  ku           kv
-            k.set(res, 0, v, w, vw, ku + uw - w, kv);
+            k.set(res, 0, v, w, vw, ku + uw - w, kv, 0, deriv);
 
             // update local
             uw -= w;
@@ -196,7 +241,7 @@ class PtexSeparableKernel {
         if (w < vw) {
             // normal case - split off a portion
             //    res  u  v          uw vw  ku  kv
-            k.set(res, u, res.v()-w, uw, w, ku, kv);
+            k.set(res, u, res.v()-w, uw, w, ku, kv, 0, deriv);
 
             // update local
             v = 0;
@@ -218,7 +263,7 @@ class PtexSeparableKernel {
         if (w < vw) {
             // normal case - split off a portion
             //    res  u  v  uw vw  ku  kv
-            k.set(res, u, 0, uw, w, ku, kv + vw - w);
+            k.set(res, u, 0, uw, w, ku, kv + vw - w, 0, deriv);
 
             // update local
             vw -= w;
@@ -235,12 +280,14 @@ class PtexSeparableKernel {
     {
         u = res.u() - u - uw;
         std::reverse(ku, ku+uw);
+        if (deriv) std::reverse(ku+kmax, ku+kmax+uw);
     }
 
     void flipV()
     {
         v = res.v() - v - vw;
         std::reverse(kv, kv+vw);
+        if (deriv) std::reverse(kv+kmax, kv+kmax+vw);
     }
 
     void swapUV()
@@ -249,6 +296,7 @@ class PtexSeparableKernel {
         std::swap(u, v);
         std::swap(uw, vw);
         std::swap(ku, kv);
+        deriv = -deriv;
     }
 
     void rotate(int rotVal)
@@ -312,70 +360,24 @@ class PtexSeparableKernel {
 
     void downresU()
     {
-        float* src = ku;
-        float* dst = ku;
-
-        // skip odd leading sample (if any)
-        if (u & 1) {
-            dst++;
-            src++;
-            uw--;
-        }
-
-        // combine even pairs
-        for (int i = uw/2; i > 0; i--) {
-            *dst++ = src[0] + src[1];
-            src += 2;
-        }
-
-        // copy odd trailing sample (if any)
-        if (uw & 1) {
-            *dst++ = *src++;
-        }
-
-        // update state
+        if (deriv) downresAxis(ku+kmax, u, uw);
+        uw = downresAxis(ku, u, uw);
         u /= 2;
-        uw = int(dst - ku);
         res.ulog2--;
     }
 
     void downresV()
     {
-        float* src = kv;
-        float* dst = kv;
-
-        // skip odd leading sample (if any)
-        if (v & 1) {
-            dst++;
-            src++;
-            vw--;
-        }
-
-        // combine even pairs
-        for (int i = vw/2; i > 0; i--) {
-            *dst++ = src[0] + src[1];
-            src += 2;
-        }
-
-        // copy odd trailing sample (if any)
-        if (vw & 1) {
-            *dst++ = *src++;
-        }
-
-        // update state
+        if (deriv) downresAxis(kv+kmax, v, vw);
+        vw = downresAxis(kv, v, vw);
         v /= 2;
-        vw = int(dst - kv);
         res.vlog2--;
     }
 
     void upresU()
     {
-        float* src = ku + uw-1;
-        float* dst = ku + uw*2-2;
-        for (int i = uw; i > 0; i--) {
-            dst[0] = dst[1] = *src-- / 2;
-            dst -=2;
-        }
+        if (deriv) upresAxis(ku+kmax, uw);
+        upresAxis(ku, uw);
         uw *= 2;
         u *= 2;
         res.ulog2++;
@@ -383,12 +385,8 @@ class PtexSeparableKernel {
 
     void upresV()
     {
-        float* src = kv + vw-1;
-        float* dst = kv + vw*2-2;
-        for (int i = vw; i > 0; i--) {
-            dst[0] = dst[1] = *src-- / 2;
-            dst -=2;
-        }
+        if (deriv) upresAxis(kv+kmax, vw);
+        upresAxis(kv, vw);
         vw *= 2;
         v *= 2;
         res.vlog2++;
@@ -466,17 +464,71 @@ class PtexSeparableKernel {
         PtexUtils::applyConst(weight(), dst, data, dt, nChan);
     }
 
+    // apply the weights and the derivative weights in a single pass over the data
+    void applyDeriv(float* dst, float* dstDu, float* dstDv, void* data, DataType dt, int nChan, int nTxChan);
+
+    void applyConstDeriv(float* dst, float* dstDu, float* dstDv, void* data, DataType dt, int nChan)
+    {
+        float wu, wv;
+        weightDeriv(wu, wv);
+        PtexUtils::applyConst(weight(), dst, data, dt, nChan);
+        PtexUtils::applyConst(wu, dstDu, data, dt, nChan);
+        PtexUtils::applyConst(wv, dstDv, data, dt, nChan);
+    }
+
  private:
     typedef void (*ApplyFn)(PtexSeparableKernel& k, float* dst, void* data, int nChan, int nTxChan);
     typedef void (*ApplyConstFn)(float weight, float* dst, void* data, int nChan);
     static ApplyFn applyFunctions[40];
     static ApplyConstFn applyConstFunctions[20];
+    typedef void (*ApplyDerivFn)(PtexSeparableKernel& k, float* dst, float* dstU, float* dstV,
+                                 void* data, int nChan, int nTxChan);
+    static ApplyDerivFn applyDerivFunctions[4];
     static inline float accumulate(const float* p, int n)
     {
         float result = 0;
         for (const float* e = p + n; p != e; p++) result += *p;
         return result;
     }
+
+    // combine pairs of weights starting at texel offset 'start' for the next lower res;
+    // returns the new width
+    static int downresAxis(float* k, int start, int w)
+    {
+        float* src = k;
+        float* dst = k;
+
+        // skip odd leading sample (if any)
+        if (start & 1) {
+            dst++;
+            src++;
+            w--;
+        }
+
+        // combine even pairs
+        for (int i = w/2; i > 0; i--) {
+            *dst++ = src[0] + src[1];
+            src += 2;
+        }
+
+        // copy odd trailing sample (if any)
+        if (w & 1) {
+            *dst++ = *src++;
+        }
+
+        return int(dst - k);
+    }
+
+    // split each of w weights into two for the next higher res
+    static void upresAxis(float* k, int w)
+    {
+        float* src = k + w-1;
+        float* dst = k + w*2-2;
+        for (int i = w; i > 0; i--) {
+            dst[0] = dst[1] = *src-- / 2;
+            dst -=2;
+        }
+    }
 };
 
 PTEX_NAMESPACE_END
@@ -0,0 +1,385 @@
+#ifndef PtexSimd_h
+#define PtexSimd_h
+
+/*
+PTEX SOFTWARE
+Copyright 2014 Disney Enterprises, Inc.  All rights reserved
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+  * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+  * Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+  * The names "Disney", "Walt Disney Pictures", "Walt Disney Animation
+    Studios" or the names of its contributors may NOT be used to
+    endorse or promote products derived from this software without
+    specific prior written permission from Walt Disney Pictures.
+
+Disclaimer: THIS SOFTWARE IS PROVIDED BY WALT DISNEY PICTURES AND
+CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING,
+BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE, NONINFRINGEMENT AND TITLE ARE DISCLAIMED.
+IN NO EVENT SHALL WALT DISNEY PICTURES, THE COPYRIGHT HOLDER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND BASED ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+*/
+
+/**
+   @file PtexSimd.h
+   @brief Minimal 4-wide float vector used by the filter and image kernels
+
+   SSE2 is used on x86 and NEON on ARM; other targets get a scalar
+   implementation with the same interface (define PTEX_NO_SIMD to force
+   it).  Operations are plain (unfused) multiplies and adds so results
+   match the scalar code lane for lane.
+*/
+
+#include "PtexPlatform.h"
+#include "PtexHalf.h"
+
+#if !defined(PTEX_NO_SIMD)
+#  if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    define PTEX_SIMD_SSE2 1
+#    include <emmintrin.h>
+#    ifdef __F16C__
+#      include <immintrin.h>
+#    endif
+#  elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#    define PTEX_SIMD_NEON 1
+#    include <arm_neon.h>
+#  endif
+#endif
+#if defined(PTEX_SIMD_SSE2) || defined(PTEX_SIMD_NEON)
+#  define PTEX_SIMD 1
+#endif
+
+PTEX_NAMESPACE_BEGIN
+
+namespace PtexSimd {
+
+#if defined(PTEX_SIMD_SSE2)
+
+struct float4 {
+    __m128 v;
+    float4() {}
+    float4(__m128 val) : v(val) {}
+};
+
+inline float4 splat(float f) { return _mm_set1_ps(f); }
+inline float4 zero() { return _mm_setzero_ps(); }
+inline float4 set(float a, float b, float c, float d) { return _mm_setr_ps(a, b, c, d); }
+inline float4 load(const float* p) { return _mm_loadu_ps(p); }
+inline void store(float* p, float4 a) { _mm_storeu_ps(p, a.v); }
+inline float4 operator+(float4 a, float4 b) { return _mm_add_ps(a.v, b.v); }
+inline float4 operator*(float4 a, float4 b) { return _mm_mul_ps(a.v, b.v); }
+inline float4 operator-(float4 a, float4 b) { return _mm_sub_ps(a.v, b.v); }
+inline float4 abs(float4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+inline float4 min(float4 a, float4 b) { return _mm_min_ps(a.v, b.v); }
+
+/// round toward zero (|a| < 2^31)
+inline float4 truncate(float4 a) { return _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v)); }
+
+/// a * 2^n for integral n (result must be a normal float)
+inline float4 ldexp(float4 a, float4 n)
+{
+    __m128i e = _mm_slli_epi32(_mm_cvttps_epi32(n.v), 23);
+    return _mm_castsi128_ps(_mm_add_epi32(_mm_castps_si128(a.v), e));
+}
+
+/// per-lane a < b mask for select()
+inline float4 lessThan(float4 a, float4 b) { return _mm_cmplt_ps(a.v, b.v); }
+
+/// per-lane mask ? a : b
+inline float4 select(float4 mask, float4 a, float4 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+}
+
+inline float4 load(const uint8_t* p)
+{
+    int32_t bits;
+    memcpy(&bits, p, 4);
+    __m128i zero = _mm_setzero_si128();
+    __m128i i16 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bits), zero);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(i16, zero));
+}
+
+inline float4 load(const uint16_t* p)
+{
+    __m128i i16 = _mm_loadl_epi64((const __m128i*)p);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(i16, _mm_setzero_si128()));
+}
+
+inline float4 load(const PtexHalf* p)
+{
+#ifdef __F16C__
+    return _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)p));
+#else
+    return _mm_setr_ps(p[0], p[1], p[2], p[3]);
+#endif
+}
+
+/// store as uint8, rounding toward zero and keeping the low bits like a scalar cast
+inline void store(uint8_t* p, float4 a)
+{
+    __m128i i32 = _mm_and_si128(_mm_cvttps_epi32(a.v), _mm_set1_epi32(0xff));
+    __m128i i16 = _mm_packs_epi32(i32, i32);
+    int32_t bits = _mm_cvtsi128_si32(_mm_packus_epi16(i16, i16));
+    memcpy(p, &bits, 4);
+}
+
+/// store as uint16, rounding toward zero and keeping the low bits like a scalar cast
+inline void store(uint16_t* p, float4 a)
+{
+    // sign-extend to 16 bits so the saturating pack keeps the bits
+    __m128i i32 = _mm_srai_epi32(_mm_slli_epi32(_mm_cvttps_epi32(a.v), 16), 16);
+    _mm_storel_epi64((__m128i*)p, _mm_packs_epi32(i32, i32));
+}
+
+/** Store as half.  Matches PtexHalf::fromFloat bit for bit (which rounds
+    ties away from zero, unlike the F16C instructions); lanes outside of
+    the normal half range are converted with PtexHalf::fromFloat. */
+inline void store(PtexHalf* p, float4 a)
+{
+    __m128i bits = _mm_castps_si128(a.v);
+    __m128i t = _mm_and_si128(bits, _mm_set1_epi32(0x7fffffff));
+    __m128i sign = _mm_and_si128(_mm_srli_epi32(bits, 16), _mm_set1_epi32(0x8000));
+    __m128i normal = _mm_andnot_si128(_mm_cmplt_epi32(t, _mm_set1_epi32(0x38800000)),
+                                      _mm_cmplt_epi32(t, _mm_set1_epi32(0x47800000)));
+    __m128i zero = _mm_cmpeq_epi32(t, _mm_setzero_si128());
+    if (_mm_movemask_epi8(_mm_or_si128(normal, zero)) != 0xffff) {
+        float tmp[4];
+        _mm_storeu_ps(tmp, a.v);
+        for (int i = 0; i < 4; i++) p[i] = tmp[i];
+        return;
+    }
+    __m128i h = _mm_srli_epi32(_mm_add_epi32(t, _mm_set1_epi32(0x1000 - 0x38000000)), 13);
+    h = _mm_and_si128(_mm_or_si128(h, sign), normal);
+    // sign-extend to 16 bits so the saturating pack keeps the bits
+    h = _mm_srai_epi32(_mm_slli_epi32(h, 16), 16);
+    _mm_storel_epi64((__m128i*)p, _mm_packs_epi32(h, h));
+}
+
+#elif defined(PTEX_SIMD_NEON)
+
+struct float4 {
+    float32x4_t v;
+    float4() {}
+    float4(float32x4_t val) : v(val) {}
+};
+
+inline float4 splat(float f) { return vdupq_n_f32(f); }
+inline float4 zero() { return vdupq_n_f32(0); }
+inline float4 set(float a, float b, float c, float d)
+{
+    float tmp[4] = { a, b, c, d };
+    return vld1q_f32(tmp);
+}
+inline float4 load(const float* p) { return vld1q_f32(p); }
+inline void store(float* p, float4 a) { vst1q_f32(p, a.v); }
+inline float4 operator+(float4 a, float4 b) { return vaddq_f32(a.v, b.v); }
+inline float4 operator*(float4 a, float4 b) { return vmulq_f32(a.v, b.v); }
+inline float4 operator-(float4 a, float4 b) { return vsubq_f32(a.v, b.v); }
+inline float4 abs(float4 a) { return vabsq_f32(a.v); }
+inline float4 min(float4 a, float4 b) { return vminq_f32(a.v, b.v); }
+
+/// round toward zero (|a| < 2^31)
+inline float4 truncate(float4 a) { return vcvtq_f32_s32(vcvtq_s32_f32(a.v)); }
+
+/// a * 2^n for integral n (result must be a normal float)
+inline float4 ldexp(float4 a, float4 n)
+{
+    int32x4_t e = vshlq_n_s32(vcvtq_s32_f32(n.v), 23);
+    return vreinterpretq_f32_s32(vaddq_s32(vreinterpretq_s32_f32(a.v), e));
+}
+
+/// per-lane a < b mask for select()
+inline float4 lessThan(float4 a, float4 b) { return vreinterpretq_f32_u32(vcltq_f32(a.v, b.v)); }
+
+/// per-lane mask ? a : b
+inline float4 select(float4 mask, float4 a, float4 b)
+{
+    return vbslq_f32(vreinterpretq_u32_f32(mask.v), a.v, b.v);
+}
+
+inline float4 load(const uint8_t* p)
+{
+    uint32_t bits;
+    memcpy(&bits, p, 4);
+    uint16x8_t i16 = vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(bits)));
+    return vcvtq_f32_u32(vmovl_u16(vget_low_u16(i16)));
+}
+
+inline float4 load(const uint16_t* p)
+{
+    return vcvtq_f32_u32(vmovl_u16(vld1_u16(p)));
+}
+
+inline float4 load(const PtexHalf* p)
+{
+#ifdef __aarch64__
+    return vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(&p[0].bits)));
+#else
+    return set(p[0], p[1], p[2], p[3]);
+#endif
+}
+
+/// store as uint8, rounding toward zero and keeping the low bits like a scalar cast
+inline void store(uint8_t* p, float4 a)
+{
+    uint16x4_t i16 = vmovn_u32(vcvtq_u32_f32(a.v));
+    uint8x8_t i8 = vmovn_u16(vcombine_u16(i16, i16));
+    uint32_t bits = vget_lane_u32(vreinterpret_u32_u8(i8), 0);
+    memcpy(p, &bits, 4);
+}
+
+/// store as uint16, rounding toward zero and keeping the low bits like a scalar cast
+inline void store(uint16_t* p, float4 a) { vst1_u16(p, vmovn_u32(vcvtq_u32_f32(a.v))); }
+
+/** Store as half.  Matches PtexHalf::fromFloat bit for bit (which rounds
+    ties away from zero, unlike fcvtn); lanes outside of the normal half
+    range are converted with PtexHalf::fromFloat. */
+inline void store(PtexHalf* p, float4 a)
+{
+    uint32x4_t bits = vreinterpretq_u32_f32(a.v);
+    uint32x4_t t = vandq_u32(bits, vdupq_n_u32(0x7fffffff));
+    uint32x4_t sign = vandq_u32(vshrq_n_u32(bits, 16), vdupq_n_u32(0x8000));
+    uint32x4_t normal = vandq_u32(vcgeq_u32(t, vdupq_n_u32(0x38800000)),
+                                  vcltq_u32(t, vdupq_n_u32(0x47800000)));
+    uint32x4_t valid = vorrq_u32(normal, vceqq_u32(t, vdupq_n_u32(0)));
+    uint32x2_t v2 = vand_u32(vget_low_u32(valid), vget_high_u32(valid));
+    if ((vget_lane_u32(v2, 0) & vget_lane_u32(v2, 1)) != 0xffffffff) {
+        float tmp[4];
+        vst1q_f32(tmp, a.v);
+        for (int i = 0; i < 4; i++) p[i] = tmp[i];
+        return;
+    }
+    uint32x4_t h = vshrq_n_u32(vaddq_u32(t, vdupq_n_u32(0x1000 - 0x38000000)), 13);
+    h = vandq_u32(vorrq_u32(h, sign), normal);
+    vst1_u16(&p[0].bits, vmovn_u32(h));
+}
+
+#else
+
+struct float4 {
+    float v[4];
+};
+
+inline float4 set(float a, float b, float c, float d)
+{
+    float4 r;
+    r.v[0] = a; r.v[1] = b; r.v[2] = c; r.v[3] = d;
+    return r;
+}
+inline float4 splat(float f) { return set(f, f, f, f); }
+inline float4 zero() { return splat(0); }
+template<typename T> inline float4 load(const T* p) { return set(p[0], p[1], p[2], p[3]); }
+inline void store(float* p, float4 a) { memcpy(p, a.v, sizeof(a.v)); }
+inline void store(PtexHalf* p, float4 a) { for (int i = 0; i < 4; i++) p[i] = a.v[i]; }
+inline void store(uint8_t* p, float4 a) { for (int i = 0; i < 4; i++) p[i] = uint8_t(a.v[i]); }
+inline void store(uint16_t* p, float4 a) { for (int i = 0; i < 4; i++) p[i] = uint16_t(a.v[i]); }
+inline float4 operator+(float4 a, float4 b)
+{
+    return set(a.v[0]+b.v[0], a.v[1]+b.v[1], a.v[2]+b.v[2], a.v[3]+b.v[3]);
+}
+inline float4 operator*(float4 a, float4 b)
+{
+    return set(a.v[0]*b.v[0], a.v[1]*b.v[1], a.v[2]*b.v[2], a.v[3]*b.v[3]);
+}
+inline float4 operator-(float4 a, float4 b)
+{
+    return set(a.v[0]-b.v[0], a.v[1]-b.v[1], a.v[2]-b.v[2], a.v[3]-b.v[3]);
+}
+inline float4 abs(float4 a)
+{
+    return set(fabsf(a.v[0]), fabsf(a.v[1]), fabsf(a.v[2]), fabsf(a.v[3]));
+}
+inline float4 min(float4 a, float4 b)
+{
+    return set(a.v[0] < b.v[0] ? a.v[0] : b.v[0], a.v[1] < b.v[1] ? a.v[1] : b.v[1],
+               a.v[2] < b.v[2] ? a.v[2] : b.v[2], a.v[3] < b.v[3] ? a.v[3] : b.v[3]);
+}
+
+/// round toward zero (|a| < 2^31)
+inline float4 truncate(float4 a)
+{
+    return set(float(int(a.v[0])), float(int(a.v[1])), float(int(a.v[2])), float(int(a.v[3])));
+}
+
+/// a * 2^n for integral n (result must be a normal float)
+inline float4 ldexp(float4 a, float4 n)
+{
+    return set(ldexpf(a.v[0], int(n.v[0])), ldexpf(a.v[1], int(n.v[1])),
+               ldexpf(a.v[2], int(n.v[2])), ldexpf(a.v[3], int(n.v[3])));
+}
+
+/// per-lane a < b mask for select() (lanes are 1 or 0)
+inline float4 lessThan(float4 a, float4 b)
+{
+    return set(a.v[0] < b.v[0], a.v[1] < b.v[1], a.v[2] < b.v[2], a.v[3] < b.v[3]);
+}
+
+/// per-lane mask ? a : b
+inline float4 select(float4 mask, float4 a, float4 b)
+{
+    return set(mask.v[0] != 0 ? a.v[0] : b.v[0], mask.v[1] != 0 ? a.v[1] : b.v[1],
+               mask.v[2] != 0 ? a.v[2] : b.v[2], mask.v[3] != 0 ? a.v[3] : b.v[3]);
+}
+
+#endif
+
+/// round toward negative infinity (|a| < 2^31)
+inline float4 floor(float4 a)
+{
+    float4 t = truncate(a);
+    return t - select(lessThan(a, t), splat(1.0f), zero());
+}
+
+/** Fast exp approximation.
+
+    The argument is split as x*log2(e) = n + f with f in [-.5, .5] and
+    2^f is evaluated with the Cephes exp2f polynomial.  Relative error
+    is below 5e-7 for x in [-87, 87]; the result is undefined outside
+    of that range.
+*/
+inline float4 fastExp(float4 x)
+{
+    float4 t = x * splat(1.44269504088896341f); // log2(e)
+    float4 n = floor(t + splat(0.5f));
+    float4 f = t - n;
+    float4 p = splat(1.535336188319500e-4f);
+    p = p * f + splat(1.339887440266574e-3f);
+    p = p * f + splat(9.618437357674640e-3f);
+    p = p * f + splat(5.550332471162809e-2f);
+    p = p * f + splat(2.402264791363012e-1f);
+    p = p * f + splat(6.931472028550421e-1f);
+    p = p * f + splat(1.0f);
+    return ldexp(p, n);
+}
+
+/// load 3 values (4th lane is zero) without reading past p[2]
+template<typename T> inline float4 load3(const T* p) { return set(p[0], p[1], p[2], 0); }
+
+/// load one value from each of 4 rows
+template<typename T> inline float4 gather(const T* p, int stride)
+{
+    return set(p[0], p[stride], p[2*stride], p[3*stride]);
+}
+
+} // namespace PtexSimd
+
+PTEX_NAMESPACE_END
+
+#endif
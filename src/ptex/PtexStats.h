@@ -0,0 +1,165 @@
+#ifndef PtexStats_h
+#define PtexStats_h
+
+/*
+PTEX SOFTWARE
+Copyright 2014 Disney Enterprises, Inc.  All rights reserved
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+  * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+  * Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+  * The names "Disney", "Walt Disney Pictures", "Walt Disney Animation
+    Studios" or the names of its contributors may NOT be used to
+    endorse or promote products derived from this software without
+    specific prior written permission from Walt Disney Pictures.
+
+Disclaimer: THIS SOFTWARE IS PROVIDED BY WALT DISNEY PICTURES AND
+CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING,
+BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE, NONINFRINGEMENT AND TITLE ARE DISCLAIMED.
+IN NO EVENT SHALL WALT DISNEY PICTURES, THE COPYRIGHT HOLDER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND BASED ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+*/
+
+/**
+   @file PtexStats.h
+   @brief Usage counters and latency histograms collected by the cache
+*/
+
+#include "PtexPlatform.h"
+#include "PtexMutex.h"
+#include "Ptexture.h"
+#include <chrono>
+
+PTEX_NAMESPACE_BEGIN
+
+/** Usage counters shared by the readers of a cache.
+
+    Counters are kept in per-thread slots (threads are assigned to slots
+    round-robin) so that updates from different threads rarely touch the
+    same cache line.  Slots are summed when the stats are queried.
+ */
+class PtexStats
+{
+public:
+    enum Counter {
+        faceHits, faceMisses, tileHits, tileMisses,
+        reductionHits, reductionBuilds,
+        bytesCompressed, bytesDecompressed,
+        inflateTime, lockWaitTime,
+        numCounters
+    };
+    enum Histogram { inflateLatency, lockWaitLatency, numHistograms };
+    enum { numBuckets = PtexCache::DetailedStats::numLatencyBuckets };
+
+    PtexStats() { memset((void*)_slots, 0, sizeof(_slots)); }
+
+    void add(Counter counter, uint64_t amount=1)
+    {
+        AtomicAdd(&slot().counters[counter], amount);
+    }
+
+    /// Add a duration (in ns) to a time counter and its histogram.
+    void addTime(Counter counter, Histogram histogram, uint64_t ns)
+    {
+        Slot& s = slot();
+        AtomicAdd(&s.counters[counter], ns);
+        AtomicIncrement(&s.histograms[histogram][bucket(ns)]);
+    }
+
+    static uint64_t now()
+    {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    uint64_t total(Counter counter) const
+    {
+        uint64_t sum = 0;
+        for (int i = 0; i < numSlots; i++) sum += _slots[i].counters[counter];
+        return sum;
+    }
+
+    void totals(Histogram histogram, uint64_t result[numBuckets]) const
+    {
+        for (int b = 0; b < numBuckets; b++) {
+            uint64_t sum = 0;
+            for (int i = 0; i < numSlots; i++) sum += _slots[i].histograms[histogram][b];
+            result[b] = sum;
+        }
+    }
+
+    /** Records the time from construction to destruction (when stats is non-null). */
+    class Timer {
+    public:
+        Timer(PtexStats* stats, Counter counter, Histogram histogram)
+            : _stats(stats), _counter(counter), _histogram(histogram), _start(stats ? now() : 0) {}
+        ~Timer() { if (_stats) _stats->addTime(_counter, _histogram, now() - _start); }
+    private:
+        PtexStats* _stats;
+        Counter _counter;
+        Histogram _histogram;
+        uint64_t _start;
+    };
+
+    /** Acquire and release a mutex within the enclosing scope, recording the
+        time spent waiting for it (when stats is non-null). */
+    class AutoMutex {
+    public:
+        AutoMutex(Mutex& m, PtexStats* stats) : _m(m)
+        {
+            if (!stats) { _m.lock(); return; }
+            if (_m.trylock()) { stats->addTime(lockWaitTime, lockWaitLatency, 0); return; }
+            uint64_t start = now();
+            _m.lock();
+            stats->addTime(lockWaitTime, lockWaitLatency, now() - start);
+        }
+        ~AutoMutex() { _m.unlock(); }
+    private:
+        Mutex& _m;
+    };
+
+private:
+    static const int numSlots = 64;
+    struct Slot {
+        volatile uint64_t counters[numCounters];
+        volatile uint64_t histograms[numHistograms][numBuckets];
+        char pad[CACHE_LINE_SIZE];
+    };
+
+    // bucket i holds durations in [2^i, 2^(i+1)) ns (and zero in bucket 0)
+    static int bucket(uint64_t ns)
+    {
+        int b = 0;
+        while (ns >>= 1) b++;
+        return b < numBuckets ? b : numBuckets-1;
+    }
+
+    Slot& slot()
+    {
+        static volatile int32_t nextSlot = 0;
+        static thread_local int index = AtomicIncrement(&nextSlot) % numSlots;
+        return _slots[index];
+    }
+
+    Slot _slots[numSlots];
+};
+
+PTEX_NAMESPACE_END
+
+#endif
@@ -0,0 +1,235 @@
+/*
+PTEX SOFTWARE
+Copyright 2014 Disney Enterprises, Inc.  All rights reserved
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+  * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+  * Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+  * The names "Disney", "Walt Disney Pictures", "Walt Disney Animation
+    Studios" or the names of its contributors may NOT be used to
+    endorse or promote products derived from this software without
+    specific prior written permission from Walt Disney Pictures.
+
+Disclaimer: THIS SOFTWARE IS PROVIDED BY WALT DISNEY PICTURES AND
+CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING,
+BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE, NONINFRINGEMENT AND TITLE ARE DISCLAIMED.
+IN NO EVENT SHALL WALT DISNEY PICTURES, THE COPYRIGHT HOLDER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND BASED ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+*/
+
+/**
+   @file PtexThreadPool.cpp
+   @brief Worker thread pool implementation
+
+   The workers are started the first time the pool is accessed.  At
+   exit, the workers finish any queued tasks and are joined.
+
+   Except on Windows: static destructors of a dll run under the loader
+   lock, and a thread can't exit without taking that lock, so joining
+   the workers there (on FreeLibrary or at process exit) would deadlock.
+   On Windows the pools are never destroyed instead; the module holding
+   the pool is pinned when workers are started so that its code can't be
+   unloaded underneath them, and the workers end with the process.
+ */
+
+#include "PtexPlatform.h"
+#include <deque>
+#include <vector>
+
+#include "PtexMutex.h"
+#include "PtexThreadPool.h"
+#include "PtexUtils.h"
+
+PTEX_NAMESPACE_BEGIN
+
+namespace {
+
+#ifdef WINDOWS
+    typedef HANDLE ThreadHandle;
+    typedef unsigned int ThreadResult;
+    #define PTEX_THREAD_CALL __stdcall
+
+    bool startThread(ThreadHandle& thread, ThreadResult (PTEX_THREAD_CALL *fn)(void*), void* arg)
+    {
+        thread = (HANDLE) _beginthreadex(0, 0, fn, arg, 0, 0);
+        return thread != 0;
+    }
+
+    void joinThread(ThreadHandle thread)
+    {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+    }
+
+    unsigned int numProcessors()
+    {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwNumberOfProcessors;
+    }
+
+    void pinModule()
+    {
+        static const char anchor = 0;
+        HMODULE module;
+        GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_PIN,
+                           &anchor, &module);
+    }
+#else
+    typedef pthread_t ThreadHandle;
+    typedef void* ThreadResult;
+    #define PTEX_THREAD_CALL
+
+    bool startThread(ThreadHandle& thread, ThreadResult (*fn)(void*), void* arg)
+    {
+        return 0 == pthread_create(&thread, 0, fn, arg);
+    }
+
+    void joinThread(ThreadHandle thread)
+    {
+        pthread_join(thread, 0);
+    }
+
+    unsigned int numProcessors()
+    {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        return n > 0 ? (unsigned int)n : 1;
+    }
+
+    void pinModule() {}
+#endif
+}
+
+
+class PtexThreadPool::Impl
+{
+public:
+    Impl(int nthreads) : _stop(false)
+    {
+        for (int i = 0; i < nthreads; i++) {
+            ThreadHandle thread;
+            if (startThread(thread, &Impl::threadMain, this)) _threads.push_back(thread);
+        }
+        if (!_threads.empty()) pinModule();
+    }
+
+    ~Impl()
+    {
+        {
+            AutoCondition lock(_queue);
+            _stop = true;
+            _queue.broadcast();
+        }
+        for (size_t i = 0; i < _threads.size(); i++) joinThread(_threads[i]);
+    }
+
+    void enqueue(Task* task)
+    {
+        if (_threads.empty()) {
+            // no workers could be started, run inline
+            task->run();
+            delete task;
+            return;
+        }
+        AutoCondition lock(_queue);
+        _tasks.push_back(task);
+        _queue.signal();
+    }
+
+    int numThreads() { return int(_threads.size()); }
+
+private:
+    static ThreadResult PTEX_THREAD_CALL threadMain(void* arg)
+    {
+        static_cast<Impl*>(arg)->work();
+        return 0;
+    }
+
+    void work()
+    {
+        while (1) {
+            Task* task;
+            {
+                AutoCondition lock(_queue);
+                while (!_stop && _tasks.empty()) _queue.wait();
+                if (_tasks.empty()) return; // stopping and drained
+                task = _tasks.front();
+                _tasks.pop_front();
+            }
+            task->run();
+            delete task;
+        }
+    }
+
+    Condition _queue;           // guards _tasks and _stop, signaled when either changes
+    std::deque<Task*> _tasks;
+    std::vector<ThreadHandle> _threads;
+    bool _stop;
+};
+
+
+PtexThreadPool::PtexThreadPool(int nthreads)
+    : _impl(new Impl(nthreads))
+{
+}
+
+
+PtexThreadPool::~PtexThreadPool()
+{
+    delete _impl;
+}
+
+
+PtexThreadPool& PtexThreadPool::instance()
+{
+    // tasks are mostly I/O and decompression, a few threads is plenty
+#ifdef WINDOWS
+    static PtexThreadPool* pool = new PtexThreadPool((int)PtexUtils::clamp(numProcessors(), 2u, 8u));
+    return *pool;
+#else
+    static PtexThreadPool pool((int)PtexUtils::clamp(numProcessors(), 2u, 8u));
+    return pool;
+#endif
+}
+
+
+PtexThreadPool& PtexThreadPool::computeInstance()
+{
+#ifdef WINDOWS
+    static PtexThreadPool* pool = new PtexThreadPool((int)numProcessors());
+    return *pool;
+#else
+    static PtexThreadPool pool((int)numProcessors());
+    return pool;
+#endif
+}
+
+
+void PtexThreadPool::enqueue(Task* task)
+{
+    _impl->enqueue(task);
+}
+
+
+int PtexThreadPool::numThreads()
+{
+    return _impl->numThreads();
+}
+
+PTEX_NAMESPACE_END
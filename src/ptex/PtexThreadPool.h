@@ -0,0 +1,93 @@
+#ifndef PtexThreadPool_h
+#define PtexThreadPool_h
+
+/*
+PTEX SOFTWARE
+Copyright 2014 Disney Enterprises, Inc.  All rights reserved
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+  * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+  * Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+  * The names "Disney", "Walt Disney Pictures", "Walt Disney Animation
+    Studios" or the names of its contributors may NOT be used to
+    endorse or promote products derived from this software without
+    specific prior written permission from Walt Disney Pictures.
+
+Disclaimer: THIS SOFTWARE IS PROVIDED BY WALT DISNEY PICTURES AND
+CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING,
+BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE, NONINFRINGEMENT AND TITLE ARE DISCLAIMED.
+IN NO EVENT SHALL WALT DISNEY PICTURES, THE COPYRIGHT HOLDER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND BASED ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
+*/
+
+/**
+   @file PtexThreadPool.h
+   @brief Library-owned pool of worker threads for background work
+*/
+
+#include "PtexPlatform.h"
+
+PTEX_NAMESPACE_BEGIN
+
+/** Shared pool of worker threads.
+
+    Tasks are run in FIFO order by a fixed set of threads that are
+    started on first use and joined at exit (on Windows, where that
+    can deadlock under the loader lock, they are left to end with the
+    process; see PtexThreadPool.cpp).  The pool takes ownership
+    of enqueued tasks and deletes each one after it has run.
+
+    There are two process-wide pools: a small one for I/O and
+    decompression, and one with a thread per processor for CPU-bound
+    work such as compression.
+ */
+class PtexThreadPool
+{
+public:
+    class Task {
+    public:
+        virtual ~Task() {}
+        virtual void run() = 0;
+    };
+
+    /// Get the process-wide pool for I/O and decompression.
+    static PtexThreadPool& instance();
+
+    /// Get the process-wide pool for CPU-bound work (one thread per processor).
+    static PtexThreadPool& computeInstance();
+
+    /// Queue a task to be run by a worker thread.
+    void enqueue(Task* task);
+
+    /// Number of worker threads.
+    int numThreads();
+
+private:
+    class Impl;
+    PtexThreadPool(int nthreads);
+    ~PtexThreadPool();
+    PtexThreadPool(const PtexThreadPool&);
+    void operator=(const PtexThreadPool&);
+
+    Impl* _impl;
+};
+
+PTEX_NAMESPACE_END
+
+#endif
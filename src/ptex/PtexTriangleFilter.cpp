@@ -55,10 +55,9 @@ void PtexTriangleFilter::eval(float* result, int firstChan, int nChannels,
     // init
     if (!_tx || nChannels <= 0) return;
     if (faceid < 0 || faceid >= _tx->numFaces()) return;
-    _ntxchan = _tx->numChannels();
-    _dt = _tx->dataType();
-    _firstChanOffset = firstChan*DataSize(_dt);
-    _nchan = PtexUtils::min(nChannels, _ntxchan-firstChan);
+    EvalContext ctx;
+    ctx.firstChanOffset = firstChan*DataSize(_dt);
+    ctx.nchan = PtexUtils::min(nChannels, _ntxchan-firstChan);
 
     // get face info
     const FaceInfo& f = _tx->getFaceInfo(faceid);
@@ -67,8 +66,8 @@ void PtexTriangleFilter::eval(float* result, int firstChan, int nChannels,
     if (f.isNeighborhoodConstant()) {
         PtexPtr<PtexFaceData> data ( _tx->getData(faceid, 0) );
         if (data) {
-            char* d = (char*) data->getData() + _firstChanOffset;
-            Ptex::ConvertToFloat(result, d, _dt, _nchan);
+            char* d = (char*) data->getData() + ctx.firstChanOffset;
+            Ptex::ConvertToFloat(result, d, _dt, ctx.nchan);
         }
         return;
     }
@@ -82,25 +81,80 @@ void PtexTriangleFilter::eval(float* result, int firstChan, int nChannels,
     buildKernel(k, u, v, uw1, vw1, uw2, vw2, width, blur, f.res);
 
     // accumulate the weight as we apply
-    _weight = 0;
+    ctx.weight = 0;
 
     // allocate temporary result
-    _result = (float*) alloca(sizeof(float)*_nchan);
-    memset(_result, 0, sizeof(float)*_nchan);
+    ctx.result = (float*) alloca(sizeof(float)*ctx.nchan);
+    memset(ctx.result, 0, sizeof(float)*ctx.nchan);
 
     // apply to faces
-    splitAndApply(k, faceid, f);
+    splitAndApply(ctx, k, faceid, f);
 
     // normalize (both for data type and cumulative kernel weight applied)
     // and output result
-    float scale = 1.0f / (_weight * OneValue(_dt));
-    for (int i = 0; i < _nchan; i++) result[i] = float(_result[i] * scale);
-
-    // clear temp result
-    _result = 0;
+    float scale = 1.0f / (ctx.weight * OneValue(_dt));
+    for (int i = 0; i < ctx.nchan; i++) result[i] = float(ctx.result[i] * scale);
 }
 
 
+void PtexTriangleFilter::evalDeriv(float* result, float* dresultdu, float* dresultdv,
+                                   int firstChan, int nChannels, int faceid, float u, float v,
+                                   float uw1, float vw1, float uw2, float vw2,
+                                   float width, float blur)
+{
+    // init
+    if (!_tx || nChannels <= 0) return;
+    if (faceid < 0 || faceid >= _tx->numFaces()) return;
+    EvalContext ctx;
+    ctx.firstChanOffset = firstChan*DataSize(_dt);
+    ctx.nchan = PtexUtils::min(nChannels, _ntxchan-firstChan);
+
+    // get face info
+    const FaceInfo& f = _tx->getFaceInfo(faceid);
+
+    // if neighborhood is constant, just return constant value of face
+    memset(dresultdu, 0, sizeof(float)*ctx.nchan);
+    memset(dresultdv, 0, sizeof(float)*ctx.nchan);
+    if (f.isNeighborhoodConstant()) {
+        PtexPtr<PtexFaceData> data ( _tx->getData(faceid, 0) );
+        if (data) {
+            char* d = (char*) data->getData() + ctx.firstChanOffset;
+            Ptex::ConvertToFloat(result, d, _dt, ctx.nchan);
+        }
+        return;
+    }
+
+    // clamp u and v (the result doesn't vary with a clamped coordinate)
+    bool uclamped = !(u >= 0.0f && u <= 1.0f), vclamped = !(v >= 0.0f && v <= 1.0f);
+    u = PtexUtils::clamp(u, 0.0f, 1.0f);
+    v = PtexUtils::clamp(v, 0.0f, 1.0f);
+
+    // build kernel
+    PtexTriangleKernel k;
+    buildKernel(k, u, v, uw1, vw1, uw2, vw2, width, blur, f.res);
+    if (uclamped) k.dudu = k.dvdu = 0;
+    if (vclamped) k.dudv = k.dvdv = 0;
+
+    // allocate temporary results
+    ctx.result = (float*) alloca(sizeof(float)*ctx.nchan*3);
+    memset(ctx.result, 0, sizeof(float)*ctx.nchan*3);
+    ctx.resultDu = ctx.result + ctx.nchan;
+    ctx.resultDv = ctx.resultDu + ctx.nchan;
+
+    // apply to faces
+    splitAndApply(ctx, k, faceid, f);
+
+    // normalize and output result; the derivatives account for the change in
+    // cumulative weight: d(r/w) = (dr - (r/w)*dw) / w
+    float scale = 1.0f / (ctx.weight * OneValue(_dt));
+    float wu = ctx.weightDu / ctx.weight, wv = ctx.weightDv / ctx.weight;
+    for (int i = 0; i < ctx.nchan; i++) {
+        result[i] = float(ctx.result[i] * scale);
+        dresultdu[i] = ctx.resultDu[i] * scale - result[i] * wu;
+        dresultdv[i] = ctx.resultDv[i] * scale - result[i] * wv;
+    }
+}
+
 
 void PtexTriangleFilter::buildKernel(PtexTriangleKernel& k, float u, float v,
                                      float uw1, float vw1, float uw2, float vw2,
@@ -164,40 +218,41 @@ void PtexTriangleFilter::buildKernel(PtexTriangleKernel& k, float u, float v,
 }
 
 
-void PtexTriangleFilter::splitAndApply(PtexTriangleKernel& k, int faceid, const Ptex::FaceInfo& f)
+void PtexTriangleFilter::splitAndApply(EvalContext& ctx, PtexTriangleKernel& k,
+                                       int faceid, const Ptex::FaceInfo& f)
 {
     // do we need to split? if so, split kernel and apply across edge(s)
     if (k.u1 < 0 && f.adjface(2) >= 0) {
         PtexTriangleKernel ka;
         k.splitU(ka);
-        applyAcrossEdge(ka, f, 2);
+        applyAcrossEdge(ctx, ka, f, 2);
     }
     if (k.v1 < 0 && f.adjface(0) >= 0) {
         PtexTriangleKernel ka;
         k.splitV(ka);
-        applyAcrossEdge(ka, f, 0);
+        applyAcrossEdge(ctx, ka, f, 0);
     }
     if (k.w1 < 0 && f.adjface(1) >= 0) {
         PtexTriangleKernel ka;
         k.splitW(ka);
-        applyAcrossEdge(ka, f, 1);
+        applyAcrossEdge(ctx, ka, f, 1);
     }
     // apply to local face
-    apply(k, faceid, f);
+    apply(ctx, k, faceid, f);
 }
 
 
-void PtexTriangleFilter::applyAcrossEdge(PtexTriangleKernel& k,
+void PtexTriangleFilter::applyAcrossEdge(EvalContext& ctx, PtexTriangleKernel& k,
                                          const Ptex::FaceInfo& f, int eid)
 {
     int afid = f.adjface(eid), aeid = f.adjedge(eid);
     const Ptex::FaceInfo& af = _tx->getFaceInfo(afid);
     k.reorient(eid, aeid);
-    splitAndApply(k, afid, af);
+    splitAndApply(ctx, k, afid, af);
 }
 
 
-void PtexTriangleFilter::apply(PtexTriangleKernel& k, int faceid, const Ptex::FaceInfo& f)
+void PtexTriangleFilter::apply(EvalContext& ctx, PtexTriangleKernel& k, int faceid, const Ptex::FaceInfo& f)
 {
     // clamp kernel face (resolution and extent)
     k.clampRes(f.res);
@@ -212,16 +267,15 @@ void PtexTriangleFilter::apply(PtexTriangleKernel& k, int faceid, const Ptex::Fa
     PtexPtr<PtexFaceData> dh ( _tx->getData(faceid, k.res) );
     if (!dh) return;
 
-    if (keven.valid) applyIter(keven, dh);
-    if (kodd.valid) applyIter(kodd, dh);
+    if (keven.valid) applyIter(ctx, keven, dh);
+    if (kodd.valid) applyIter(ctx, kodd, dh);
 }
 
 
-void PtexTriangleFilter::applyIter(PtexTriangleKernelIter& k, PtexFaceData* dh)
+void PtexTriangleFilter::applyIter(EvalContext& ctx, PtexTriangleKernelIter& k, PtexFaceData* dh)
 {
     if (dh->isConstant()) {
-        k.applyConst(_result, (char*)dh->getData()+_firstChanOffset, _dt, _nchan);
-        _weight += k.weight;
+        applyIterConst(ctx, k, (char*)dh->getData()+ctx.firstChanOffset);
     }
     else if (dh->isTiled()) {
         Ptex::Res tileres = dh->tileRes();
@@ -246,20 +300,42 @@ void PtexTriangleFilter::applyIter(PtexTriangleKernelIter& k, PtexFaceData* dh)
                 kt.w2 = k.w2 - wOffset;
                 PtexPtr<PtexFaceData> th ( dh->getTile(tilev * ntilesu + tileu) );
                 if (th) {
-                    kt.weight = 0;
+                    kt.weight = kt.weightDu = kt.weightDv = 0;
                     if (th->isConstant())
-                        kt.applyConst(_result, (char*)th->getData()+_firstChanOffset, _dt, _nchan);
+                        applyIterConst(ctx, kt, (char*)th->getData()+ctx.firstChanOffset);
                     else
-                        kt.apply(_result, (char*)th->getData()+_firstChanOffset, _dt, _nchan, _ntxchan);
-                    _weight += kt.weight;
+                        applyIterData(ctx, kt, (char*)th->getData()+ctx.firstChanOffset);
                 }
             }
         }
     }
     else {
-        k.apply(_result, (char*)dh->getData()+_firstChanOffset, _dt, _nchan, _ntxchan);
-        _weight += k.weight;
+        applyIterData(ctx, k, (char*)dh->getData()+ctx.firstChanOffset);
+    }
+}
+
+
+void PtexTriangleFilter::applyIterData(EvalContext& ctx, PtexTriangleKernelIter& k, void* data)
+{
+    if (ctx.resultDu) {
+        k.applyDeriv(ctx.result, ctx.resultDu, ctx.resultDv, data, _dt, ctx.nchan, _ntxchan);
+        ctx.weightDu += k.weightDu;
+        ctx.weightDv += k.weightDv;
+    }
+    else k.apply(ctx.result, data, _dt, ctx.nchan, _ntxchan);
+    ctx.weight += k.weight;
+}
+
+
+void PtexTriangleFilter::applyIterConst(EvalContext& ctx, PtexTriangleKernelIter& k, void* data)
+{
+    if (ctx.resultDu) {
+        k.applyConstDeriv(ctx.result, ctx.resultDu, ctx.resultDv, data, _dt, ctx.nchan);
+        ctx.weightDu += k.weightDu;
+        ctx.weightDv += k.weightDv;
     }
+    else k.applyConst(ctx.result, data, _dt, ctx.nchan);
+    ctx.weight += k.weight;
 }
 
 PTEX_NAMESPACE_END
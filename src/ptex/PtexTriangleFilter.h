@@ -47,33 +47,48 @@ class PtexTriangleFilter : public PtexFilter
 {
  public:
     PtexTriangleFilter(PtexTexture* tx, const PtexFilter::Options& opts ) :
-        _tx(tx), _options(opts), _result(0), _weight(0),
-        _firstChanOffset(0), _nchan(0), _ntxchan(0),
-        _dt((DataType)0) {}
+        PtexFilter(tx, opts), _ntxchan(tx->numChannels()),
+        _dt(tx->dataType()) {}
     virtual void release() { delete this; }
     virtual void eval(float* result, int firstchan, int nchannels,
                       int faceid, float u, float v,
                       float uw1, float vw1, float uw2, float vw2,
                       float width, float blur);
+    virtual void evalDeriv(float* result, float* dresultdu, float* dresultdv,
+                           int firstchan, int nchannels, int faceid, float u, float v,
+                           float uw1, float vw1, float uw2, float vw2,
+                           float width, float blur);
 
  protected:
+    /** Per-lookup evaluation state.  This lives on the stack of eval rather
+        than in the filter, so that one filter can be shared by any number
+        of threads. */
+    struct EvalContext {
+        float* result;          // temp result
+        float* resultDu;        // temp derivative results (evalDeriv only, else null)
+        float* resultDv;
+        float weight;           // accumulated weight of data in result
+        float weightDu;         // accumulated derivative weights (evalDeriv only)
+        float weightDv;
+        int firstChanOffset;    // byte offset of first channel to eval
+        int nchan;              // number of channels to eval
+        EvalContext() : result(0), resultDu(0), resultDv(0), weight(0), weightDu(0), weightDv(0),
+                        firstChanOffset(0), nchan(0) {}
+    };
+
     void buildKernel(PtexTriangleKernel& k, float u, float v,
                      float uw1, float vw1, float uw2, float vw2,
                      float width, float blur, Res faceRes);
 
-    void splitAndApply(PtexTriangleKernel& k, int faceid, const Ptex::FaceInfo& f);
-    void applyAcrossEdge(PtexTriangleKernel& k, const Ptex::FaceInfo& f, int eid);
-    void apply(PtexTriangleKernel& k, int faceid, const Ptex::FaceInfo& f);
-    void applyIter(PtexTriangleKernelIter& k, PtexFaceData* dh);
+    void splitAndApply(EvalContext& ctx, PtexTriangleKernel& k, int faceid, const Ptex::FaceInfo& f);
+    void applyAcrossEdge(EvalContext& ctx, PtexTriangleKernel& k, const Ptex::FaceInfo& f, int eid);
+    void apply(EvalContext& ctx, PtexTriangleKernel& k, int faceid, const Ptex::FaceInfo& f);
+    void applyIter(EvalContext& ctx, PtexTriangleKernelIter& k, PtexFaceData* dh);
+    void applyIterData(EvalContext& ctx, PtexTriangleKernelIter& k, void* data);
+    void applyIterConst(EvalContext& ctx, PtexTriangleKernelIter& k, void* data);
 
     virtual ~PtexTriangleFilter() {}
 
-    PtexTexture* _tx;           // texture being evaluated
-    Options _options;           // options
-    float* _result;             // temp result
-    float _weight;              // accumulated weight of data in _result
-    int _firstChanOffset;       // byte offset of first channel to eval
-    int _nchan;                 // number of channels to eval
     int _ntxchan;               // number of channels in texture
     DataType _dt;               // data type of texture
 };
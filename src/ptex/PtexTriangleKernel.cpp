@@ -36,42 +36,79 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
 #include "PtexPlatform.h"
 #include "PtexUtils.h"
 #include "PtexHalf.h"
+#include "PtexSimd.h"
 #include "PtexTriangleKernel.h"
 
 PTEX_NAMESPACE_BEGIN
 
 namespace {
-    inline float gaussian(float x_squared)
+    // max number of texels per row chunk (multiple of 4)
+    const int RowChunk = 8;
+
+    // gaussian exponent scale: weight = exp(GaussScale * Q)
+    const float GaussScale = -0.5f * (PtexTriangleKernelWidth * PtexTriangleKernelWidth);
+
+    // compute gaussian weights for up to RowChunk texels starting at texel x of row vi.
+    // The ellipse equation, Q, is evaluated in closed form 4 texels at a time and the
+    // gaussian uses a fast exp approximation; texels outside the ellipse (Q >= 1) get
+    // a weight of zero.  Returns the number of texels computed.
+    inline int rowWeights(const PtexTriangleKernelIter& k, int vi, int x, int x2, float* w)
     {
-        static const float scale = -0.5f * (PtexTriangleKernelWidth * PtexTriangleKernelWidth);
-        return (float)exp(scale * x_squared);
+        using namespace PtexSimd;
+        int n = PtexUtils::min(x2 - x, RowChunk);
+        float V = (float)vi - k.v;
+        float4 A = splat(k.A), BV = splat(k.B*V), CVV = splat(k.C*V*V), one = splat(1.0f);
+        float4 U = set((float)x, (float)(x+1), (float)(x+2), (float)(x+3)) - splat(k.u);
+        for (int i = 0; i < n; i += 4) {
+            float4 Q = (A*U + BV)*U + CVV;
+            float4 weight = fastExp(min(Q, one) * splat(GaussScale)) * splat(k.wscale);
+            store(w + i, select(lessThan(Q, one), weight, zero()));
+            U = U + splat(4.0f);
+        }
+        return n;
+    }
+
+    // find the texel range [x1,x2) of row vi within the kernel bounds, trimmed to the ellipse.
+    // The ellipse extent is solved for a slightly larger ellipse and padded by a texel so that
+    // no texel with Q < 1 is dropped due to rounding (texels outside get zero weight anyway).
+    inline bool rowExtent(const PtexTriangleKernelIter& k, int vi, int& x1, int& x2)
+    {
+        int xw = k.rowlen - vi;
+        x1 = PtexUtils::max(k.u1, xw-k.w2);
+        x2 = PtexUtils::min(k.u2, xw-k.w1);
+
+        // solve A*U^2 + B*V*U + C*V^2 < 1
+        float V = (float)vi - k.v;
+        float b = k.B*V;
+        float disc = b*b - 4.0f*k.A*(k.C*V*V - 1.01f);
+        if (disc < 0) return false;
+        float r = sqrtf(disc), inv = 0.5f / k.A;
+        float ua = PtexUtils::floor(k.u + (-b - r) * inv);
+        float ub = PtexUtils::ceil(k.u + (-b + r) * inv) + 1.0f;
+        if (ua > (float)x1) x1 = int(PtexUtils::min(ua, (float)x2));
+        if (ub < (float)x2) x2 = int(PtexUtils::max(ub, (float)x1));
+        return x2 > x1;
     }
 
     // apply to 1..4 channels (unrolled channel loop) of packed data (nTxChan==nChan)
-    // the ellipse equation, Q, is calculated via finite differences (Heckbert '89 pg 57)
     template<class T, int nChan>
     void Apply(PtexTriangleKernelIter& k, float* result, void* data, int /*nChan*/, int /*nTxChan*/)
     {
         int nTxChan = nChan;
-        float DDQ = 2.0f*k.A;
+        float w[RowChunk];
         for (int vi = k.v1; vi != k.v2; vi++) {
-            int xw = k.rowlen - vi;
-            int x1 = PtexUtils::max(k.u1, xw-k.w2);
-            int x2 = PtexUtils::min(k.u2, xw-k.w1);
-            float U = (float)x1 - k.u;
-            float V = (float)vi - k.v;
-            float DQ = k.A*(2.0f*U+1.0f)+k.B*V;
-            float Q = k.A*U*U + (k.B*U + k.C*V)*V;
+            int x1, x2;
+            if (!rowExtent(k, vi, x1, x2)) continue;
             T* p = static_cast<T*>(data) + (vi * k.rowlen + x1) * nTxChan;
-            T* pEnd = p + (x2-x1)*nTxChan;
-            for (; p < pEnd; p += nTxChan) {
-                if (Q < 1.0f) {
-                    float weight = gaussian(Q)*k.wscale;
-                    k.weight += weight;
-                    PtexUtils::VecAccum<T,nChan>()(result, p, weight);
+            for (int x = x1; x < x2; ) {
+                int n = rowWeights(k, vi, x, x2, w);
+                for (int i = 0; i < n; i++, p += nTxChan) {
+                    if (w[i] != 0) {
+                        k.weight += w[i];
+                        PtexUtils::VecAccum<T,nChan>()(result, p, w[i]);
+                    }
                 }
-                Q += DQ;
-                DQ += DDQ;
+                x += n;
             }
         }
     }
@@ -80,25 +117,20 @@ namespace {
     template<class T, int nChan>
     void ApplyS(PtexTriangleKernelIter& k, float* result, void* data, int /*nChan*/, int nTxChan)
     {
-        float DDQ = 2.0f*k.A;
+        float w[RowChunk];
         for (int vi = k.v1; vi != k.v2; vi++) {
-            int xw = k.rowlen - vi;
-            int x1 = PtexUtils::max(k.u1, xw-k.w2);
-            int x2 = PtexUtils::min(k.u2, xw-k.w1);
-            float U = (float)x1 - k.u;
-            float V = (float)vi - k.v;
-            float DQ = k.A*(2.0f*U+1.0f)+k.B*V;
-            float Q = k.A*U*U + (k.B*U + k.C*V)*V;
+            int x1, x2;
+            if (!rowExtent(k, vi, x1, x2)) continue;
             T* p = static_cast<T*>(data) + (vi * k.rowlen + x1) * nTxChan;
-            T* pEnd = p + (x2-x1)*nTxChan;
-            for (; p < pEnd; p += nTxChan) {
-                if (Q < 1.0f) {
-                    float weight = gaussian(Q)*k.wscale;
-                    k.weight += weight;
-                    PtexUtils::VecAccum<T,nChan>()(result, p, weight);
+            for (int x = x1; x < x2; ) {
+                int n = rowWeights(k, vi, x, x2, w);
+                for (int i = 0; i < n; i++, p += nTxChan) {
+                    if (w[i] != 0) {
+                        k.weight += w[i];
+                        PtexUtils::VecAccum<T,nChan>()(result, p, w[i]);
+                    }
                 }
-                Q += DQ;
-                DQ += DDQ;
+                x += n;
             }
         }
     }
@@ -107,31 +139,72 @@ namespace {
     template<class T>
     void ApplyN(PtexTriangleKernelIter& k, float* result, void* data, int nChan, int nTxChan)
     {
-        float DDQ = 2.0f*k.A;
+        float w[RowChunk];
         for (int vi = k.v1; vi != k.v2; vi++) {
-            int xw = k.rowlen - vi;
-            int x1 = PtexUtils::max(k.u1, xw-k.w2);
-            int x2 = PtexUtils::min(k.u2, xw-k.w1);
-            float U = (float)x1 - k.u;
-            float V = (float)vi - k.v;
-            float DQ = k.A*(2.0f*U+1.0f)+k.B*V;
-            float Q = k.A*U*U + (k.B*U + k.C*V)*V;
+            int x1, x2;
+            if (!rowExtent(k, vi, x1, x2)) continue;
             T* p = static_cast<T*>(data) + (vi * k.rowlen + x1) * nTxChan;
-            T* pEnd = p + (x2-x1)*nTxChan;
-            for (; p < pEnd; p += nTxChan) {
-                if (Q < 1.0f) {
-                    float weight = gaussian(Q)*k.wscale;
-                    k.weight += weight;
-                    PtexUtils::VecAccumN<T>()(result, p, nChan, weight);
+            for (int x = x1; x < x2; ) {
+                int n = rowWeights(k, vi, x, x2, w);
+                for (int i = 0; i < n; i++, p += nTxChan) {
+                    if (w[i] != 0) {
+                        k.weight += w[i];
+                        PtexUtils::VecAccumN<T>()(result, p, nChan, w[i]);
+                    }
                 }
-                Q += DQ;
-                DQ += DDQ;
+                x += n;
+            }
+        }
+    }
+
+    // derivatives of weight w of texel x (in row vi) w.r.t. the lookup position
+    inline void weightDeriv(const PtexTriangleKernelIter& k, int x, int vi, float w, float& du, float& dv)
+    {
+        // partial derivatives w.r.t. the kernel center (in texels), then chain to the lookup u,v
+        float U = (float)x - k.u, V = (float)vi - k.v;
+        float wcu = -GaussScale * w * (2.0f*k.A*U + k.B*V);
+        float wcv = -GaussScale * w * (k.B*U + 2.0f*k.C*V);
+        du = wcu * k.ju[0] + wcv * k.jv[0];
+        dv = wcu * k.ju[1] + wcv * k.jv[1];
+    }
+
+    // apply weights and derivative weights to N channels w/ pixel stride
+    template<class T>
+    void ApplyDeriv(PtexTriangleKernelIter& k, float* result, float* resultDu, float* resultDv,
+                    void* data, int nChan, int nTxChan)
+    {
+        float w[RowChunk];
+        for (int vi = k.v1; vi != k.v2; vi++) {
+            int x1, x2;
+            if (!rowExtent(k, vi, x1, x2)) continue;
+            T* p = static_cast<T*>(data) + (vi * k.rowlen + x1) * nTxChan;
+            for (int x = x1; x < x2; ) {
+                int n = rowWeights(k, vi, x, x2, w);
+                for (int i = 0; i < n; i++, p += nTxChan) {
+                    if (w[i] != 0) {
+                        float wu, wv;
+                        weightDeriv(k, x+i, vi, w[i], wu, wv);
+                        k.weight += w[i];
+                        k.weightDu += wu;
+                        k.weightDv += wv;
+                        PtexUtils::VecAccumN<T>()(result, p, nChan, w[i]);
+                        PtexUtils::VecAccumN<T>()(resultDu, p, nChan, wu);
+                        PtexUtils::VecAccumN<T>()(resultDv, p, nChan, wv);
+                    }
+                }
+                x += n;
             }
         }
     }
 }
 
 
+PtexTriangleKernelIter::ApplyDerivFn
+PtexTriangleKernelIter::applyDerivFunctions[] = {
+    ApplyDeriv<uint8_t>, ApplyDeriv<uint16_t>, ApplyDeriv<PtexHalf>, ApplyDeriv<float>
+};
+
+
 PtexTriangleKernelIter::ApplyFn
 PtexTriangleKernelIter::applyFunctions[] = {
     // nChan == nTxChan
@@ -153,21 +226,14 @@ PtexTriangleKernelIter::applyFunctions[] = {
 void PtexTriangleKernelIter::applyConst(float* dst, void* data, DataType dt, int nChan)
 {
     // iterate over texel locations and calculate weight as if texture weren't const
-    float DDQ = 2.0f*A;
+    float w[RowChunk];
     for (int vi = v1; vi != v2; vi++) {
-        int xw = rowlen - vi;
-        int x1 = PtexUtils::max(u1, xw-w2);
-        int x2 = PtexUtils::min(u2, xw-w1);
-        float U = (float)x1 - u;
-        float V = (float)vi - v;
-        float DQ = A*(2.0f*U+1.0f)+B*V;
-        float Q = A*U*U + (B*U + C*V)*V;
-        for (int x = x1; x < x2; x++) {
-            if (Q < 1.0f) {
-                weight += gaussian(Q)*wscale;
-            }
-            Q += DQ;
-            DQ += DDQ;
+        int x1, x2;
+        if (!rowExtent(*this, vi, x1, x2)) continue;
+        for (int x = x1; x < x2; ) {
+            int n = rowWeights(*this, vi, x, x2, w);
+            for (int i = 0; i < n; i++) weight += w[i];
+            x += n;
         }
     }
 
@@ -175,4 +241,32 @@ void PtexTriangleKernelIter::applyConst(float* dst, void* data, DataType dt, int
     PtexUtils::applyConst(weight, dst, data, dt, nChan);
 }
 
+
+void PtexTriangleKernelIter::applyConstDeriv(float* dst, float* dstDu, float* dstDv, void* data,
+                                             DataType dt, int nChan)
+{
+    // iterate over texel locations and calculate weights as if texture weren't const
+    float w[RowChunk];
+    for (int vi = v1; vi != v2; vi++) {
+        int x1, x2;
+        if (!rowExtent(*this, vi, x1, x2)) continue;
+        for (int x = x1; x < x2; ) {
+            int n = rowWeights(*this, vi, x, x2, w);
+            for (int i = 0; i < n; i++) {
+                float wu, wv;
+                weightDeriv(*this, x+i, vi, w[i], wu, wv);
+                weight += w[i];
+                weightDu += wu;
+                weightDv += wv;
+            }
+            x += n;
+        }
+    }
+
+    // apply weights to single texel value
+    PtexUtils::applyConst(weight, dst, data, dt, nChan);
+    PtexUtils::applyConst(weightDu, dstDu, data, dt, nChan);
+    PtexUtils::applyConst(weightDv, dstDv, data, dt, nChan);
+}
+
 PTEX_NAMESPACE_END
@@ -61,6 +61,8 @@ class PtexTriangleKernelIter {
     bool valid;                 // footprint is valid (non-empty)
     float wscale;               // amount to scale weights by (proportional to texel area)
     float weight;               // accumulated weight
+    float ju[2], jv[2];         // derivatives of the center u and v w.r.t. the lookup u,v (evalDeriv only)
+    float weightDu, weightDv;   // accumulated derivative weights (evalDeriv only)
 
     void apply(float* dst, void* data, DataType dt, int nChan, int nTxChan)
     {
@@ -71,10 +73,21 @@ class PtexTriangleKernelIter {
 
     void applyConst(float* dst, void* data, DataType dt, int nChan);
 
+    // apply the weights and their derivatives w.r.t. the lookup position in a single pass
+    void applyDeriv(float* dst, float* dstDu, float* dstDv, void* data, DataType dt, int nChan, int nTxChan)
+    {
+        applyDerivFunctions[dt](*this, dst, dstDu, dstDv, data, nChan, nTxChan);
+    }
+
+    void applyConstDeriv(float* dst, float* dstDu, float* dstDv, void* data, DataType dt, int nChan);
+
  private:
 
     typedef void (*ApplyFn)(PtexTriangleKernelIter& k, float* dst, void* data, int nChan, int nTxChan);
+    typedef void (*ApplyDerivFn)(PtexTriangleKernelIter& k, float* dst, float* dstDu, float* dstDv,
+                                 void* data, int nChan, int nTxChan);
     static ApplyFn applyFunctions[40];
+    static ApplyDerivFn applyDerivFunctions[4];
 };
 
 
@@ -86,6 +99,7 @@ class PtexTriangleKernel {
     float u1, v1, w1;           // uvw lower bounds
     float u2, v2, w2;           // uvw upper bounds
     float A,B,C;                // ellipse coefficients (F = A*C-B*B/4)
+    float dudu, dudv, dvdu, dvdv; // derivatives of the center u,v w.r.t. the lookup u,v
 
     void set(Res resVal, float uVal, float vVal,
              float u1Val, float v1Val, float w1Val,
@@ -97,6 +111,7 @@ class PtexTriangleKernel {
         u1 = u1Val; v1 = v1Val; w1 = w1Val;
         u2 = u2Val; v2 = v2Val; w2 = w2Val;
         A = AVal; B = BVal; C = CVal;
+        dudu = 1; dudv = 0; dvdu = 0; dvdv = 1;
     }
 
     void set(float uVal, float vVal,
@@ -167,6 +182,14 @@ class PtexTriangleKernel {
         case C(2, 2): set( -u, 1.0f-v, -u2, 1.0f-v2, 1.0f-w2, -u1, 1.0f-v1, 1.0f-w1); break;
 #undef C
         }
+
+        // transform the center derivatives by the linear part of the above
+        float uu = dudu, uv = dudv, vu = dvdu, vv = dvdv;
+        switch ((aeid - eid + 3) % 3) {
+        case 0: dudu = -uu;    dudv = -uv;    dvdu = -vu;    dvdv = -vv;    break; // u'=-u, v'=-v
+        case 1: dudu = uu+vu;  dudv = uv+vv;  dvdu = -uu;    dvdv = -uv;    break; // u'=u+v, v'=-u
+        case 2: dudu = -vu;    dudv = -vv;    dvdu = uu+vu;  dvdv = uv+vv;  break; // u'=-v, v'=u+v
+        }
     }
 
     void clampRes(Res fres)
@@ -208,6 +231,9 @@ class PtexTriangleKernel {
         ke.A = Ak; ke.B = Bk; ke.C = Ck;
         ke.valid = (ke.u2 > ke.u1 && ke.v2 > ke.v1 && ke.w2 > ke.w1);
         ke.weight = 0;
+        ke.ju[0] = dudu * scale; ke.ju[1] = dudv * scale;
+        ke.jv[0] = dvdu * scale; ke.jv[1] = dvdv * scale;
+        ke.weightDu = ke.weightDv = 0;
 
         // build odd iterator: flip kernel across diagonal (u = 1-v, v = 1-u, w = -w)
         ko.rowlen = ke.rowlen;
@@ -223,6 +249,9 @@ class PtexTriangleKernel {
         ko.A = Ck; ko.B = Bk; ko.C = Ak;
         ko.valid = (ko.u2 > ko.u1 && ko.v2 > ko.v1 && ko.w2 > ko.w1);
         ko.weight = 0;
+        ko.ju[0] = -ke.jv[0]; ko.ju[1] = -ke.jv[1];
+        ko.jv[0] = -ke.ju[0]; ko.jv[1] = -ke.ju[1];
+        ko.weightDu = ko.weightDv = 0;
     }
 };
 
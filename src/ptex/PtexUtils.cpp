@@ -41,6 +41,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
 
 #include "PtexHalf.h"
 #include "PtexUtils.h"
+#include "PtexSimd.h"
 
 
 PTEX_NAMESPACE_BEGIN
@@ -119,7 +120,7 @@ void ConvertToFloat(float* dst, const void* src, DataType dt, int numChannels)
     switch (dt) {
     case dt_uint8:  ConvertArray(dst, static_cast<const uint8_t*>(src),  numChannels, 1.f/255.f); break;
     case dt_uint16: ConvertArray(dst, static_cast<const uint16_t*>(src), numChannels, 1.f/65535.f); break;
-    case dt_half:   ConvertArray(dst, static_cast<const PtexHalf*>(src), numChannels, 1.f); break;
+    case dt_half:   PtexHalf::toFloat(dst, static_cast<const PtexHalf*>(src), numChannels); break;
     case dt_float:  memcpy(dst, src, sizeof(float)*numChannels); break;
     }
 }
@@ -130,7 +131,7 @@ void ConvertFromFloat(void* dst, const float* src, DataType dt, int numChannels)
     switch (dt) {
     case dt_uint8:  ConvertArrayClamped(static_cast<uint8_t*>(dst),  src, numChannels, 255.0, 0.5); break;
     case dt_uint16: ConvertArrayClamped(static_cast<uint16_t*>(dst), src, numChannels, 65535.0, 0.5); break;
-    case dt_half:   ConvertArray(static_cast<PtexHalf*>(dst), src, numChannels, 1.0); break;
+    case dt_half:   PtexHalf::fromFloat(static_cast<PtexHalf*>(dst), src, numChannels); break;
     case dt_float:  memcpy(dst, src, sizeof(float)*numChannels); break;
     }
 }
@@ -142,26 +143,388 @@ bool isConstant(const void* data, int stride, int ures, int vres,
                 int pixelSize)
 {
     int rowlen = pixelSize * ures;
-    const char* p = (const char*) data + stride;
+    const char* p = (const char*) data;
+
+    // make sure first row is constant: comparing the row with itself
+    // shifted by one pixel checks every pixel in a single memcmp (which is
+    // vectorized and stops at the first difference)
+    if (rowlen > pixelSize && 0 != memcmp(p, p + pixelSize, rowlen - pixelSize)) return 0;
 
     // compare each row with the first
+    p += stride;
     for (int i = 1; i < vres; i++, p += stride)
         if (0 != memcmp(data, p, rowlen)) return 0;
 
-    // make sure first row is constant
-    p = (const char*) data + pixelSize;
-    for (int i = 1; i < ures; i++, p += pixelSize)
-        if (0 != memcmp(data, p, pixelSize)) return 0;
-
     return 1;
 }
 
 
 namespace {
+#ifdef PTEX_SIMD
+    // 16-byte integer vectors for the data movement kernels below; element
+    // type is given as a template argument where it matters
+#if defined(PTEX_SIMD_SSE2)
+    typedef __m128i ivec;
+
+    inline ivec vload(const void* p) { return _mm_loadu_si128(static_cast<const __m128i*>(p)); }
+    inline void vstore(void* p, ivec a) { _mm_storeu_si128(static_cast<__m128i*>(p), a); }
+    inline ivec vsplat(uint8_t x) { return _mm_set1_epi8(char(x)); }
+    inline ivec vsplat(uint16_t x) { return _mm_set1_epi16(short(x)); }
+
+    template<typename T> ivec vadd(ivec a, ivec b);
+    template<> inline ivec vadd<uint8_t>(ivec a, ivec b) { return _mm_add_epi8(a, b); }
+    template<> inline ivec vadd<uint16_t>(ivec a, ivec b) { return _mm_add_epi16(a, b); }
+    template<typename T> ivec vsub(ivec a, ivec b);
+    template<> inline ivec vsub<uint8_t>(ivec a, ivec b) { return _mm_sub_epi8(a, b); }
+    template<> inline ivec vsub<uint16_t>(ivec a, ivec b) { return _mm_sub_epi16(a, b); }
+
+    // shift toward the high lanes by n bytes, shifting in zeros
+    template<int n> inline ivec vshl(ivec a) { return _mm_slli_si128(a, n); }
+
+    // shift toward the high lanes by one element, shifting in the last element of prev
+    template<typename T> inline ivec vshiftIn(ivec prev, ivec a)
+    {
+        return _mm_or_si128(_mm_slli_si128(a, sizeof(T)), _mm_srli_si128(prev, 16 - sizeof(T)));
+    }
+
+    // broadcast the last element to all lanes
+    template<typename T> ivec vlast(ivec a);
+    template<> inline ivec vlast<uint8_t>(ivec a)
+    {
+        ivec t = _mm_srli_si128(a, 15);
+        t = _mm_unpacklo_epi8(t, t);
+        return _mm_shuffle_epi32(_mm_shufflelo_epi16(t, 0), 0);
+    }
+    template<> inline ivec vlast<uint16_t>(ivec a)
+    {
+        return _mm_shuffle_epi32(_mm_shufflehi_epi16(a, 0xff), 0xff);
+    }
+
+    // interleave the elements of a and b: a gets the low half, b the high half
+    template<typename T> void vzip(ivec& a, ivec& b);
+    template<> inline void vzip<uint8_t>(ivec& a, ivec& b)
+    {
+        ivec lo = _mm_unpacklo_epi8(a, b); b = _mm_unpackhi_epi8(a, b); a = lo;
+    }
+    template<> inline void vzip<uint16_t>(ivec& a, ivec& b)
+    {
+        ivec lo = _mm_unpacklo_epi16(a, b); b = _mm_unpackhi_epi16(a, b); a = lo;
+    }
+    template<> inline void vzip<uint32_t>(ivec& a, ivec& b)
+    {
+        ivec lo = _mm_unpacklo_epi32(a, b); b = _mm_unpackhi_epi32(a, b); a = lo;
+    }
+    template<> inline void vzip<uint64_t>(ivec& a, ivec& b)
+    {
+        ivec lo = _mm_unpacklo_epi64(a, b); b = _mm_unpackhi_epi64(a, b); a = lo;
+    }
+
+    // shift toward the low lanes by n bytes, shifting in zeros
+    template<int n> inline ivec vshr(ivec a) { return _mm_srli_si128(a, n); }
+
+    inline ivec vand(ivec a, ivec b) { return _mm_and_si128(a, b); }
+    inline ivec vor(ivec a, ivec b) { return _mm_or_si128(a, b); }
+    inline ivec vxor(ivec a, ivec b) { return _mm_xor_si128(a, b); }
+    inline ivec vandnot(ivec a, ivec b) { return _mm_andnot_si128(b, a); } // a & ~b
+
+    // average rounding up, and rounding down (i.e. (a+b)>>1)
+    template<typename T> ivec vavgUp(ivec a, ivec b);
+    template<> inline ivec vavgUp<uint8_t>(ivec a, ivec b) { return _mm_avg_epu8(a, b); }
+    template<> inline ivec vavgUp<uint16_t>(ivec a, ivec b) { return _mm_avg_epu16(a, b); }
+    template<typename T> inline ivec vavgDown(ivec a, ivec b)
+    {
+        return vsub<T>(vavgUp<T>(a, b), vand(vxor(a, b), vsplat(T(1))));
+    }
+
+    // float lanes
+    inline ivec vaddf(ivec a, ivec b)
+    {
+        return _mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b)));
+    }
+    inline ivec vmulf(ivec a, float b)
+    {
+        return _mm_castps_si128(_mm_mul_ps(_mm_castsi128_ps(a), _mm_set1_ps(b)));
+    }
+
+#else // PTEX_SIMD_NEON
+    typedef uint8x16_t ivec;
+
+    inline uint16x8_t u16(ivec a) { return vreinterpretq_u16_u8(a); }
+    inline uint32x4_t u32(ivec a) { return vreinterpretq_u32_u8(a); }
+    inline ivec u8(uint16x8_t a) { return vreinterpretq_u8_u16(a); }
+    inline ivec u8(uint32x4_t a) { return vreinterpretq_u8_u32(a); }
+
+    inline ivec vload(const void* p) { return vld1q_u8(static_cast<const uint8_t*>(p)); }
+    inline void vstore(void* p, ivec a) { vst1q_u8(static_cast<uint8_t*>(p), a); }
+    inline ivec vsplat(uint8_t x) { return vdupq_n_u8(x); }
+    inline ivec vsplat(uint16_t x) { return u8(vdupq_n_u16(x)); }
+
+    template<typename T> ivec vadd(ivec a, ivec b);
+    template<> inline ivec vadd<uint8_t>(ivec a, ivec b) { return vaddq_u8(a, b); }
+    template<> inline ivec vadd<uint16_t>(ivec a, ivec b) { return u8(vaddq_u16(u16(a), u16(b))); }
+    template<typename T> ivec vsub(ivec a, ivec b);
+    template<> inline ivec vsub<uint8_t>(ivec a, ivec b) { return vsubq_u8(a, b); }
+    template<> inline ivec vsub<uint16_t>(ivec a, ivec b) { return u8(vsubq_u16(u16(a), u16(b))); }
+
+    template<int n> inline ivec vshl(ivec a) { return vextq_u8(vdupq_n_u8(0), a, 16 - n); }
+
+    template<typename T> inline ivec vshiftIn(ivec prev, ivec a)
+    {
+        return vextq_u8(prev, a, 16 - sizeof(T));
+    }
+
+    template<typename T> ivec vlast(ivec a);
+    template<> inline ivec vlast<uint8_t>(ivec a) { return vdupq_n_u8(vgetq_lane_u8(a, 15)); }
+    template<> inline ivec vlast<uint16_t>(ivec a) { return u8(vdupq_n_u16(vgetq_lane_u16(u16(a), 7))); }
+
+    template<typename T> void vzip(ivec& a, ivec& b);
+    template<> inline void vzip<uint8_t>(ivec& a, ivec& b)
+    {
+        uint8x16x2_t r = vzipq_u8(a, b); a = r.val[0]; b = r.val[1];
+    }
+    template<> inline void vzip<uint16_t>(ivec& a, ivec& b)
+    {
+        uint16x8x2_t r = vzipq_u16(u16(a), u16(b)); a = u8(r.val[0]); b = u8(r.val[1]);
+    }
+    template<> inline void vzip<uint32_t>(ivec& a, ivec& b)
+    {
+        uint32x4x2_t r = vzipq_u32(u32(a), u32(b)); a = u8(r.val[0]); b = u8(r.val[1]);
+    }
+    template<> inline void vzip<uint64_t>(ivec& a, ivec& b)
+    {
+        ivec lo = vcombine_u8(vget_low_u8(a), vget_low_u8(b));
+        b = vcombine_u8(vget_high_u8(a), vget_high_u8(b)); a = lo;
+    }
+
+    template<int n> inline ivec vshr(ivec a) { return vextq_u8(a, vdupq_n_u8(0), n); }
+
+    inline ivec vand(ivec a, ivec b) { return vandq_u8(a, b); }
+    inline ivec vor(ivec a, ivec b) { return vorrq_u8(a, b); }
+    inline ivec vxor(ivec a, ivec b) { return veorq_u8(a, b); }
+    inline ivec vandnot(ivec a, ivec b) { return vbicq_u8(a, b); } // a & ~b
+
+    template<typename T> ivec vavgUp(ivec a, ivec b);
+    template<> inline ivec vavgUp<uint8_t>(ivec a, ivec b) { return vrhaddq_u8(a, b); }
+    template<> inline ivec vavgUp<uint16_t>(ivec a, ivec b) { return u8(vrhaddq_u16(u16(a), u16(b))); }
+    template<typename T> ivec vavgDown(ivec a, ivec b);
+    template<> inline ivec vavgDown<uint8_t>(ivec a, ivec b) { return vhaddq_u8(a, b); }
+    template<> inline ivec vavgDown<uint16_t>(ivec a, ivec b) { return u8(vhaddq_u16(u16(a), u16(b))); }
+
+    inline ivec vaddf(ivec a, ivec b)
+    {
+        return vreinterpretq_u8_f32(vaddq_f32(vreinterpretq_f32_u8(a), vreinterpretq_f32_u8(b)));
+    }
+    inline ivec vmulf(ivec a, float b)
+    {
+        return vreinterpretq_u8_f32(vmulq_n_f32(vreinterpretq_f32_u8(a), b));
+    }
+
+    // NEON has structured loads/stores for 3 channels
+    inline void vstore3(uint8_t* p, const ivec* v)
+    {
+        uint8x16x3_t t; t.val[0] = v[0]; t.val[1] = v[1]; t.val[2] = v[2];
+        vst3q_u8(p, t);
+    }
+    inline void vstore3(uint16_t* p, const ivec* v)
+    {
+        uint16x8x3_t t; t.val[0] = u16(v[0]); t.val[1] = u16(v[1]); t.val[2] = u16(v[2]);
+        vst3q_u16(p, t);
+    }
+    inline void vstore3(uint32_t* p, const ivec* v)
+    {
+        uint32x4x3_t t; t.val[0] = u32(v[0]); t.val[1] = u32(v[1]); t.val[2] = u32(v[2]);
+        vst3q_u32(p, t);
+    }
+    inline void vload3(const uint8_t* p, ivec* v)
+    {
+        uint8x16x3_t t = vld3q_u8(p); v[0] = t.val[0]; v[1] = t.val[1]; v[2] = t.val[2];
+    }
+    inline void vload3(const uint16_t* p, ivec* v)
+    {
+        uint16x8x3_t t = vld3q_u16(p); v[0] = u8(t.val[0]); v[1] = u8(t.val[1]); v[2] = u8(t.val[2]);
+    }
+    inline void vload3(const uint32_t* p, ivec* v)
+    {
+        uint32x4x3_t t = vld3q_u32(p); v[0] = u8(t.val[0]); v[1] = u8(t.val[1]); v[2] = u8(t.val[2]);
+    }
+#endif
+
+    // One perfect shuffle of the elements held in nchan (2 or 4) vectors.
+    // Applied once (twice for 4 channels) it interleaves planar vectors;
+    // applied log2(16/sizeof(T)) times it deinterleaves them.
+    template<typename T, int nchan>
+    inline void riffle(ivec* v)
+    {
+        if (nchan == 2) {
+            vzip<T>(v[0], v[1]);
+        }
+        else {
+            ivec a = v[0], b = v[1], c = v[2], d = v[3];
+            vzip<T>(a, c); vzip<T>(b, d);
+            v[0] = a; v[1] = c; v[2] = b; v[3] = d;
+        }
+    }
+#endif
+
+    // interleave n values from each of nchan planar rows
+    template<typename T, int nchan>
+    inline void interleaveRow(const T* const* src, T* dst, int n)
+    {
+        if (nchan == 1) { memcpy(dst, src[0], n * sizeof(T)); return; }
+        int i = 0;
+#ifdef PTEX_SIMD
+        const int w = 16 / int(sizeof(T));
+        if (nchan == 2 || nchan == 4) {
+            for (; i + w <= n; i += w) {
+                ivec v[nchan];
+                for (int c = 0; c < nchan; c++) v[c] = vload(src[c] + i);
+                riffle<T, nchan>(v);
+                if (nchan == 4) riffle<T, nchan>(v);
+                for (int c = 0; c < nchan; c++) vstore(dst + i * nchan + c * w, v[c]);
+            }
+        }
+#ifdef PTEX_SIMD_NEON
+        if (nchan == 3) {
+            for (; i + w <= n; i += w) {
+                ivec v[3];
+                for (int c = 0; c < 3; c++) v[c] = vload(src[c] + i);
+                vstore3(dst + i * 3, v);
+            }
+        }
+#endif
+#endif
+        for (; i < n; i++)
+            for (int c = 0; c < nchan; c++) dst[i * nchan + c] = src[c][i];
+    }
+
+    // deinterleave n pixels into nchan planar rows
+    template<typename T, int nchan>
+    inline void deinterleaveRow(const T* src, T* const* dst, int n)
+    {
+        if (nchan == 1) { memcpy(dst[0], src, n * sizeof(T)); return; }
+        int i = 0;
+#ifdef PTEX_SIMD
+        const int w = 16 / int(sizeof(T));
+        if (nchan == 2 || nchan == 4) {
+            const int rounds = sizeof(T) == 1 ? 4 : sizeof(T) == 2 ? 3 : 2;
+            for (; i + w <= n; i += w) {
+                ivec v[nchan];
+                for (int c = 0; c < nchan; c++) v[c] = vload(src + i * nchan + c * w);
+                for (int r = 0; r < rounds; r++) riffle<T, nchan>(v);
+                for (int c = 0; c < nchan; c++) vstore(dst[c] + i, v[c]);
+            }
+        }
+#ifdef PTEX_SIMD_NEON
+        if (nchan == 3) {
+            for (; i + w <= n; i += w) {
+                ivec v[3];
+                vload3(src + i * 3, v);
+                for (int c = 0; c < 3; c++) vstore(dst[c] + i, v[c]);
+            }
+        }
+#endif
+#endif
+        for (; i < n; i++)
+            for (int c = 0; c < nchan; c++) dst[c][i] = src[i * nchan + c];
+    }
+
+    // running sum of n values starting from sum (src may equal dst); returns the final sum
+    template<typename T>
+    inline T decodeRow(const T* src, T* dst, int n, T sum)
+    {
+        int i = 0;
+#ifdef PTEX_SIMD
+        const int w = 16 / int(sizeof(T));
+        if (n >= w) {
+            ivec carry = vsplat(sum);
+            for (; i + w <= n; i += w) {
+                // log-step prefix sum within the vector
+                ivec x = vload(src + i);
+                x = vadd<T>(x, vshl<sizeof(T)>(x));
+                x = vadd<T>(x, vshl<2 * sizeof(T)>(x));
+                x = vadd<T>(x, vshl<4 * sizeof(T)>(x));
+                if (sizeof(T) == 1) x = vadd<T>(x, vshl<8>(x));
+                x = vadd<T>(x, carry);
+                vstore(dst + i, x);
+                carry = vlast<T>(x);
+            }
+            sum = dst[i - 1];
+        }
+#endif
+        for (; i < n; i++) dst[i] = sum = T(sum + src[i]);
+        return sum;
+    }
+
+    // differences of n values following prev (src may equal dst); returns the last value
+    template<typename T>
+    inline T encodeRow(const T* src, T* dst, int n, T prev)
+    {
+        int i = 0;
+#ifdef PTEX_SIMD
+        const int w = 16 / int(sizeof(T));
+        if (n >= w) {
+            ivec last = vsplat(prev);
+            for (; i + w <= n; i += w) {
+                ivec x = vload(src + i);
+                vstore(dst + i, vsub<T>(x, vshiftIn<T>(last, x)));
+                last = x;
+            }
+            T lanes[w];
+            vstore(lanes, last);
+            prev = lanes[w - 1];
+        }
+#endif
+        for (; i < n; i++) { T val = src[i]; dst[i] = T(val - prev); prev = val; }
+        return prev;
+    }
+
+    // sum (modulo the type range) of n values
+    template<typename T>
+    inline T sumRow(const T* src, int n)
+    {
+        T sum = 0;
+        int i = 0;
+#ifdef PTEX_SIMD
+        const int w = 16 / int(sizeof(T));
+        if (n >= w) {
+            ivec acc = vload(src);
+            for (i = w; i + w <= n; i += w) acc = vadd<T>(acc, vload(src + i));
+            T lanes[w];
+            vstore(lanes, acc);
+            for (int j = 0; j < w; j++) sum = T(sum + lanes[j]);
+        }
+#endif
+        for (; i < n; i++) sum = T(sum + src[i]);
+        return sum;
+    }
+
+
+    // alpha is premultiplied (if alphachan >= 0) a row at a time while it's still in cache
+    template<typename T, int nchan>
+    inline void interleave(const T* src, int sstride, int uw, int vw,
+                           T* dst, int dstride, DataType dt, int alphachan)
+    {
+        sstride /= (int)sizeof(T);
+        dstride /= (int)sizeof(T);
+        const T* rows[nchan];
+        for (int c = 0; c < nchan; c++) rows[c] = src + c * sstride * vw;
+        for (T* end = dst + dstride * vw; dst != end; dst += dstride) {
+            interleaveRow<T, nchan>(rows, dst, uw);
+            if (alphachan >= 0) PtexUtils::multalpha(dst, uw, dt, nchan, alphachan);
+            for (int c = 0; c < nchan; c++) rows[c] += sstride;
+        }
+    }
+
     template<typename T>
     inline void interleave(const T* src, int sstride, int uw, int vw,
-                           T* dst, int dstride, int nchan)
+                           T* dst, int dstride, int nchan, DataType dt, int alphachan)
     {
+        switch (nchan) {
+        case 1: interleave<T, 1>(src, sstride, uw, vw, dst, dstride, dt, alphachan); return;
+        case 2: interleave<T, 2>(src, sstride, uw, vw, dst, dstride, dt, alphachan); return;
+        case 3: interleave<T, 3>(src, sstride, uw, vw, dst, dstride, dt, alphachan); return;
+        case 4: interleave<T, 4>(src, sstride, uw, vw, dst, dstride, dt, alphachan); return;
+        }
         sstride /= (int)sizeof(T);
         dstride /= (int)sizeof(T);
         // for each channel
@@ -176,6 +539,11 @@ namespace {
                     *dp = *sp++;
             }
         }
+        if (alphachan >= 0) {
+            dst -= nchan;
+            for (T* end = dst + dstride * vw; dst != end; dst += dstride)
+                PtexUtils::multalpha(dst, uw, dt, nchan, alphachan);
+        }
     }
 }
 
@@ -185,20 +553,40 @@ void interleave(const void* src, int sstride, int uw, int vw,
 {
     switch (dt) {
     case dt_uint8:     interleave((const uint8_t*) src, sstride, uw, vw,
-                                  (uint8_t*) dst, dstride, nchan); break;
+                                  (uint8_t*) dst, dstride, nchan, dt, -1); break;
     case dt_half:
     case dt_uint16:    interleave((const uint16_t*) src, sstride, uw, vw,
-                                  (uint16_t*) dst, dstride, nchan); break;
-    case dt_float:     interleave((const float*) src, sstride, uw, vw,
-                                  (float*) dst, dstride, nchan); break;
+                                  (uint16_t*) dst, dstride, nchan, dt, -1); break;
+    case dt_float:     interleave((const uint32_t*) src, sstride, uw, vw,
+                                  (uint32_t*) dst, dstride, nchan, dt, -1); break;
     }
 }
 
 namespace {
+    template<typename T, int nchan>
+    inline void deinterleave(const T* src, int sstride, int uw, int vw,
+                             T* dst, int dstride)
+    {
+        sstride /= (int)sizeof(T);
+        dstride /= (int)sizeof(T);
+        T* rows[nchan];
+        for (int c = 0; c < nchan; c++) rows[c] = dst + c * dstride * vw;
+        for (const T* end = src + sstride * vw; src != end; src += sstride) {
+            deinterleaveRow<T, nchan>(src, rows, uw);
+            for (int c = 0; c < nchan; c++) rows[c] += dstride;
+        }
+    }
+
     template<typename T>
     inline void deinterleave(const T* src, int sstride, int uw, int vw,
                              T* dst, int dstride, int nchan)
     {
+        switch (nchan) {
+        case 1: deinterleave<T, 1>(src, sstride, uw, vw, dst, dstride); return;
+        case 2: deinterleave<T, 2>(src, sstride, uw, vw, dst, dstride); return;
+        case 3: deinterleave<T, 3>(src, sstride, uw, vw, dst, dstride); return;
+        case 4: deinterleave<T, 4>(src, sstride, uw, vw, dst, dstride); return;
+        }
         sstride /= (int)sizeof(T);
         dstride /= (int)sizeof(T);
         // for each channel
@@ -226,56 +614,482 @@ void deinterleave(const void* src, int sstride, int uw, int vw,
     case dt_half:
     case dt_uint16:    deinterleave((const uint16_t*) src, sstride, uw, vw,
                                     (uint16_t*) dst, dstride, nchan); break;
-    case dt_float:     deinterleave((const float*) src, sstride, uw, vw,
-                                    (float*) dst, dstride, nchan); break;
+    case dt_float:     deinterleave((const uint32_t*) src, sstride, uw, vw,
+                                    (uint32_t*) dst, dstride, nchan); break;
+    }
+}
+
+
+void encodeDifference(void* data, int size, DataType dt)
+{
+    switch (dt) {
+    case dt_uint8:    encodeRow(static_cast<uint8_t*>(data), static_cast<uint8_t*>(data),
+                                size, uint8_t(0)); break;
+    case dt_uint16:   encodeRow(static_cast<uint16_t*>(data), static_cast<uint16_t*>(data),
+                                size / 2, uint16_t(0)); break;
+    default: break; // skip other types
+    }
+}
+
+
+void decodeDifference(void* data, int size, DataType dt)
+{
+    switch (dt) {
+    case dt_uint8:    decodeRow(static_cast<uint8_t*>(data), static_cast<uint8_t*>(data),
+                                size, uint8_t(0)); break;
+    case dt_uint16:   decodeRow(static_cast<uint16_t*>(data), static_cast<uint16_t*>(data),
+                                size / 2, uint16_t(0)); break;
+    default: break; // skip other types
     }
 }
 
 
 namespace {
+    template<typename T, int nchan>
+    inline void decodeDifferenceInterleave(const T* src, int uw, int vw, T* dst, int dstride,
+                                           DataType dt, int alphachan)
+    {
+        dstride /= (int)sizeof(T);
+        const int planeSize = uw * vw;
+        if (nchan == 1) {
+            T sum = 0;
+            for (T* end = dst + dstride * vw; dst != end; dst += dstride, src += uw)
+                sum = decodeRow(src, dst, uw, sum);
+            return;
+        }
+
+        // the running sum carries across planes, so each plane starts
+        // from the sum of all the planes before it
+        const T* planes[nchan];
+        T sums[nchan];
+        T sum = 0;
+        for (int c = 0; c < nchan; c++) {
+            planes[c] = src + c * planeSize;
+            sums[c] = sum;
+            if (c + 1 < nchan) sum = T(sum + sumRow(planes[c], planeSize));
+        }
+
+        // decode a segment of each plane into a small buffer, then interleave
+        // it and premultiply alpha (if alphachan >= 0) while it's still in cache
+        const int SegmentSize = 256;
+        T buff[nchan][SegmentSize];
+        const T* rows[nchan];
+        for (int c = 0; c < nchan; c++) rows[c] = buff[c];
+        for (T* end = dst + dstride * vw; dst != end; dst += dstride) {
+            for (int u = 0; u < uw; u += SegmentSize) {
+                int n = std::min(SegmentSize, uw - u);
+                for (int c = 0; c < nchan; c++) {
+                    sums[c] = decodeRow(planes[c], buff[c], n, sums[c]);
+                    planes[c] += n;
+                }
+                interleaveRow<T, nchan>(rows, dst + u * nchan, n);
+                if (alphachan >= 0) PtexUtils::multalpha(dst + u * nchan, n, dt, nchan, alphachan);
+            }
+        }
+    }
+
     template<typename T>
-    void encodeDifference(T* data, int size)
+    inline void decodeDifferenceInterleave(const T* src, int uw, int vw, T* dst, int dstride,
+                                           int nchan, DataType dt, int alphachan)
     {
-        size /= (int)sizeof(T);
-        T* p = static_cast<T*>(data), * end = p + size, tmp, prev = 0;
-        while (p != end) { tmp = prev; prev = *p; *p = T(*p - tmp); p++; }
+        switch (nchan) {
+        case 1: decodeDifferenceInterleave<T, 1>(src, uw, vw, dst, dstride, dt, alphachan); return;
+        case 2: decodeDifferenceInterleave<T, 2>(src, uw, vw, dst, dstride, dt, alphachan); return;
+        case 3: decodeDifferenceInterleave<T, 3>(src, uw, vw, dst, dstride, dt, alphachan); return;
+        case 4: decodeDifferenceInterleave<T, 4>(src, uw, vw, dst, dstride, dt, alphachan); return;
+        }
+        dstride /= (int)sizeof(T);
+        T sum = 0;
+        // for each channel
+        for (T* dstend = dst + nchan; dst != dstend; dst++) {
+            // for each row
+            T* drow = dst;
+            for (const T* rowend = src + uw*vw; src != rowend; drow += dstride) {
+                // decode each pixel across the row
+                T* dp = drow;
+                for (const T* end = src + uw; src != end; dp += nchan)
+                    *dp = sum = T(sum + *src++);
+            }
+        }
+        if (alphachan >= 0) {
+            dst -= nchan;
+            for (T* end = dst + dstride * vw; dst != end; dst += dstride)
+                PtexUtils::multalpha(dst, uw, dt, nchan, alphachan);
+        }
     }
 }
 
-void encodeDifference(void* data, int size, DataType dt)
+
+void decodeInterleave(const void* src, int uw, int vw, void* dst, int dstride,
+                      DataType dt, int nchan, bool diff, int alphachan)
 {
     switch (dt) {
-    case dt_uint8:    encodeDifference(static_cast<uint8_t*>(data), size); break;
-    case dt_uint16:   encodeDifference(static_cast<uint16_t*>(data), size); break;
-    default: break; // skip other types
+    case dt_uint8:
+        if (diff)
+            decodeDifferenceInterleave((const uint8_t*) src, uw, vw, (uint8_t*) dst, dstride,
+                                       nchan, dt, alphachan);
+        else
+            interleave((const uint8_t*) src, uw, uw, vw, (uint8_t*) dst, dstride,
+                       nchan, dt, alphachan);
+        break;
+    case dt_uint16:
+        if (diff)
+            decodeDifferenceInterleave((const uint16_t*) src, uw, vw, (uint16_t*) dst, dstride,
+                                       nchan, dt, alphachan);
+        else
+            interleave((const uint16_t*) src, uw * 2, uw, vw, (uint16_t*) dst, dstride,
+                       nchan, dt, alphachan);
+        break;
+    case dt_half:      interleave((const uint16_t*) src, uw * 2, uw, vw, (uint16_t*) dst, dstride,
+                                  nchan, dt, alphachan); break;
+    case dt_float:     interleave((const uint32_t*) src, uw * 4, uw, vw, (uint32_t*) dst, dstride,
+                                  nchan, dt, alphachan); break;
     }
 }
 
 
 namespace {
+    template<typename T, int nchan>
+    inline void deinterleaveEncodeDifference(const T* src, int sstride, int uw, int vw, T* dst)
+    {
+        sstride /= (int)sizeof(T);
+        const int planeSize = uw * vw;
+
+        // each plane continues from the last value of the plane before it
+        const T* last = src + (vw - 1) * sstride + (uw - 1) * nchan;
+        T* rows[nchan];
+        T prev[nchan];
+        for (int c = 0; c < nchan; c++) {
+            rows[c] = dst + c * planeSize;
+            prev[c] = c ? last[c - 1] : 0;
+        }
+
+        // deinterleave each row and difference it while it's still in cache
+        for (const T* end = src + sstride * vw; src != end; src += sstride) {
+            deinterleaveRow<T, nchan>(src, rows, uw);
+            for (int c = 0; c < nchan; c++) {
+                prev[c] = encodeRow(rows[c], rows[c], uw, prev[c]);
+                rows[c] += uw;
+            }
+        }
+    }
+
     template<typename T>
-    void decodeDifference(T* data, int size)
+    inline void deinterleaveEncodeDifference(const T* src, int sstride, int uw, int vw,
+                                             T* dst, int nchan)
     {
-        size /= (int)sizeof(T);
-        T* p = static_cast<T*>(data), * end = p + size, prev = 0;
-        while (p != end) { *p = T(*p + prev); prev = *p++; }
+        switch (nchan) {
+        case 1: deinterleaveEncodeDifference<T, 1>(src, sstride, uw, vw, dst); return;
+        case 2: deinterleaveEncodeDifference<T, 2>(src, sstride, uw, vw, dst); return;
+        case 3: deinterleaveEncodeDifference<T, 3>(src, sstride, uw, vw, dst); return;
+        case 4: deinterleaveEncodeDifference<T, 4>(src, sstride, uw, vw, dst); return;
+        }
+        deinterleave(src, sstride, uw, vw, dst, uw * (int)sizeof(T), nchan);
+        encodeRow(dst, dst, uw * vw * nchan, T(0));
     }
 }
 
-void decodeDifference(void* data, int size, DataType dt)
+
+void deinterleaveEncodeDifference(const void* src, int sstride, int uw, int vw,
+                                  void* dst, DataType dt, int nchan)
 {
     switch (dt) {
-    case dt_uint8:    decodeDifference(static_cast<uint8_t*>(data), size); break;
-    case dt_uint16:   decodeDifference(static_cast<uint16_t*>(data), size); break;
-    default: break; // skip other types
+    case dt_uint8:     deinterleaveEncodeDifference((const uint8_t*) src, sstride, uw, vw,
+                                                    (uint8_t*) dst, nchan); break;
+    case dt_uint16:    deinterleaveEncodeDifference((const uint16_t*) src, sstride, uw, vw,
+                                                    (uint16_t*) dst, nchan); break;
+    default:           deinterleave(src, sstride, uw, vw, dst, uw * DataSize(dt), dt, nchan); break;
     }
 }
 
 
 namespace {
+#ifdef PTEX_SIMD
+    template<int size> struct UInt {};
+    template<> struct UInt<1> { typedef uint8_t type; };
+    template<> struct UInt<2> { typedef uint16_t type; };
+    template<> struct UInt<4> { typedef uint32_t type; };
+    template<> struct UInt<8> { typedef uint64_t type; };
+
+    // separate the even and odd pixels (of the given byte size) held in two vectors
+    template<int size>
+    inline void splitPixels(ivec* v)
+    {
+        for (int n = 16; n > size; n /= 2) riffle<typename UInt<size>::type, 2>(v);
+    }
+    template<> inline void splitPixels<16>(ivec*) {}
+
+    // box filters matching halve() and quarter() on the scalar sums
+    template<typename T>
+    inline ivec vbox2(ivec a, ivec b) { return vavgDown<T>(a, b); }
+    template<>
+    inline ivec vbox2<float>(ivec a, ivec b) { return vmulf(vaddf(a, b), 0.5f); }
+
+    template<typename T>
+    inline ivec vbox4(ivec a, ivec b, ivec c, ivec d)
+    {
+        // (a+b+c+d)>>2 without widening: average the two pair averages,
+        // rounding up only when both pair sums were odd
+        ivec h1 = vavgDown<T>(a, b), h2 = vavgDown<T>(c, d);
+        ivec odd = vand(vxor(a, b), vxor(c, d));
+        return vsub<T>(vavgUp<T>(h1, h2), vand(vandnot(vxor(h1, h2), odd), vsplat(T(1))));
+    }
+    template<>
+    inline ivec vbox4<float>(ivec a, ivec b, ivec c, ivec d)
+    {
+        return vmulf(vaddf(vaddf(vaddf(a, b), c), d), 0.25f);
+    }
+
+    // Row kernels for 1, 2 or 4 channels: reduce n pixel pairs from rows r0
+    // and r1 (reduceTri: r0, and the even pixels of r1 plus the n pixels of
+    // r2).  Each returns the number of output pixels done.
+    template<typename T, int nchan>
+    inline int reduceRowSimd(const T* r0, const T* r1, T* dst, int n)
+    {
+        const int w = 16 / int(sizeof(T) * nchan); // output pixels per vector
+        int i = 0;
+        for (; i + w <= n; i += w, r0 += 2*w*nchan, r1 += 2*w*nchan, dst += w*nchan) {
+            ivec a[2] = { vload(r0), vload(r0 + w*nchan) };
+            ivec b[2] = { vload(r1), vload(r1 + w*nchan) };
+            splitPixels<sizeof(T) * nchan>(a);
+            splitPixels<sizeof(T) * nchan>(b);
+            vstore(dst, vbox4<T>(a[0], a[1], b[0], b[1]));
+        }
+        return i;
+    }
+
+    template<typename T, int nchan>
+    inline int reduceuRowSimd(const T* r0, T* dst, int n)
+    {
+        const int w = 16 / int(sizeof(T) * nchan);
+        int i = 0;
+        for (; i + w <= n; i += w, r0 += 2*w*nchan, dst += w*nchan) {
+            ivec a[2] = { vload(r0), vload(r0 + w*nchan) };
+            splitPixels<sizeof(T) * nchan>(a);
+            vstore(dst, vbox2<T>(a[0], a[1]));
+        }
+        return i;
+    }
+
+    template<typename T, int nchan>
+    inline int reduceTriRowSimd(const T* r0, const T* r1, const T* r2, T* dst, int n)
+    {
+        const int w = 16 / int(sizeof(T) * nchan);
+        int i = 0;
+        for (; i + w <= n; i += w, r0 += 2*w*nchan, r1 += 2*w*nchan, r2 += w*nchan, dst += w*nchan) {
+            ivec a[2] = { vload(r0), vload(r0 + w*nchan) };
+            ivec b[2] = { vload(r1), vload(r1 + w*nchan) };
+            splitPixels<sizeof(T) * nchan>(a);
+            splitPixels<sizeof(T) * nchan>(b);
+            vstore(dst, vbox4<T>(a[0], a[1], b[0], vload(r2)));
+        }
+        return i;
+    }
+
+    // 3 channel uint8: filter at every byte offset and keep the bytes of
+    // the 3 output pixels (at offsets 0, 6 and 12).  Stores write 16 bytes
+    // for 9 and loads read 19 bytes for 18, so stop short of the row end.
+    inline ivec pick3Pixels(ivec s)
+    {
+        ivec m = vshr<13>(vsplat(uint8_t(0xff)));
+        return vor(vand(s, m), vor(vand(vshr<3>(s), vshl<3>(m)), vand(vshr<6>(s), vshl<6>(m))));
+    }
+
+    // other channel counts default to the scalar loop, unrolled for 3 channels
+    template<typename T>
+    inline int reduceRowOther(const T* r0, const T* r1, T* dst, int n, int nchan)
+    {
+        if (nchan != 3) return 0;
+        for (int i = 0; i < n; i++, r0 += 6, r1 += 6, dst += 3)
+            for (int c = 0; c < 3; c++)
+                dst[c] = T(quarter(r0[c] + r0[c+3] + r1[c] + r1[c+3]));
+        return n;
+    }
+    template<typename T>
+    inline int reduceuRowOther(const T* r0, T* dst, int n, int nchan)
+    {
+        if (nchan != 3) return 0;
+        for (int i = 0; i < n; i++, r0 += 6, dst += 3)
+            for (int c = 0; c < 3; c++)
+                dst[c] = T(halve(r0[c] + r0[c+3]));
+        return n;
+    }
+    template<typename T>
+    inline int reduceTriRowOther(const T* r0, const T* r1, const T* r2, T* dst, int n, int nchan)
+    {
+        if (nchan != 3) return 0;
+        for (int i = 0; i < n; i++, r0 += 6, r1 += 6, r2 += 3, dst += 3)
+            for (int c = 0; c < 3; c++)
+                dst[c] = T(quarter(r0[c] + r0[c+3] + r1[c] + r2[c]));
+        return n;
+    }
+
+    inline int reduceRowOther(const uint8_t* r0, const uint8_t* r1, uint8_t* dst, int n, int nchan)
+    {
+        int i = 0;
+        if (nchan == 3)
+            for (; i + 6 <= n; i += 3, r0 += 18, r1 += 18, dst += 9)
+                vstore(dst, pick3Pixels(vbox4<uint8_t>(vload(r0), vload(r0 + 3),
+                                                       vload(r1), vload(r1 + 3))));
+        return i;
+    }
+
+    inline int reduceuRowOther(const uint8_t* r0, uint8_t* dst, int n, int nchan)
+    {
+        int i = 0;
+        if (nchan == 3)
+            for (; i + 6 <= n; i += 3, r0 += 18, dst += 9)
+                vstore(dst, pick3Pixels(vbox2<uint8_t>(vload(r0), vload(r0 + 3))));
+        return i;
+    }
+
+    // float pixels of 3 or 5+ channels are done 4 channels at a time; the
+    // last group of each pixel overlaps the one before it (or, for 3
+    // channels, spills into the next pixel, so the last pixel is left over)
+    inline int reduceRowOther(const float* r0, const float* r1, float* dst, int n, int nchan)
+    {
+        int i = 0;
+        for (; i < n - (nchan == 3); i++, r0 += 2*nchan, r1 += 2*nchan, dst += nchan)
+            for (int c = 0; c < nchan; c += 4) {
+                int k = nchan == 3 ? 0 : PtexUtils::min(c, nchan - 4);
+                vstore(dst + k, vbox4<float>(vload(r0 + k), vload(r0 + k + nchan),
+                                             vload(r1 + k), vload(r1 + k + nchan)));
+            }
+        return i;
+    }
+
+    inline int reduceuRowOther(const float* r0, float* dst, int n, int nchan)
+    {
+        int i = 0;
+        for (; i < n - (nchan == 3); i++, r0 += 2*nchan, dst += nchan)
+            for (int c = 0; c < nchan; c += 4) {
+                int k = nchan == 3 ? 0 : PtexUtils::min(c, nchan - 4);
+                vstore(dst + k, vbox2<float>(vload(r0 + k), vload(r0 + k + nchan)));
+            }
+        return i;
+    }
+
+    inline int reduceTriRowOther(const float* r0, const float* r1, const float* r2,
+                                 float* dst, int n, int nchan)
+    {
+        int i = 0;
+        for (; i < n - (nchan == 3); i++, r0 += 2*nchan, r1 += 2*nchan, r2 += nchan, dst += nchan)
+            for (int c = 0; c < nchan; c += 4) {
+                int k = nchan == 3 ? 0 : PtexUtils::min(c, nchan - 4);
+                vstore(dst + k, vbox4<float>(vload(r0 + k), vload(r0 + k + nchan),
+                                             vload(r1 + k), vload(r2 + k)));
+            }
+        return i;
+    }
+#endif
+
+    // reduce n pixel pairs of rows r0 and r1 to n pixels
+    template<typename T>
+    inline void reduceRow(const T* r0, const T* r1, T* dst, int n, int nchan)
+    {
+        int i = 0;
+#ifdef PTEX_SIMD
+        switch (nchan) {
+        case 1:  i = reduceRowSimd<T, 1>(r0, r1, dst, n); break;
+        case 2:  i = reduceRowSimd<T, 2>(r0, r1, dst, n); break;
+        case 4:  i = reduceRowSimd<T, 4>(r0, r1, dst, n); break;
+        default: i = reduceRowOther(r0, r1, dst, n, nchan); break;
+        }
+#endif
+        r0 += 2*i*nchan; r1 += 2*i*nchan; dst += i*nchan;
+        for (; i < n; i++, r0 += nchan, r1 += nchan)
+            for (const T* end = r0 + nchan; r0 != end; r0++, r1++)
+                *dst++ = T(quarter(r0[0] + r0[nchan] + r1[0] + r1[nchan]));
+    }
+
+    // reduce n pixel pairs of row r0 to n pixels
+    template<typename T>
+    inline void reduceuRow(const T* r0, T* dst, int n, int nchan)
+    {
+        int i = 0;
+#ifdef PTEX_SIMD
+        switch (nchan) {
+        case 1:  i = reduceuRowSimd<T, 1>(r0, dst, n); break;
+        case 2:  i = reduceuRowSimd<T, 2>(r0, dst, n); break;
+        case 4:  i = reduceuRowSimd<T, 4>(r0, dst, n); break;
+        default: i = reduceuRowOther(r0, dst, n, nchan); break;
+        }
+#endif
+        r0 += 2*i*nchan; dst += i*nchan;
+        for (; i < n; i++, r0 += nchan)
+            for (const T* end = r0 + nchan; r0 != end; r0++)
+                *dst++ = T(halve(r0[0] + r0[nchan]));
+    }
+
+    // reduce n values of rows r0 and r1
+    template<typename T>
+    inline void reducevRow(const T* r0, const T* r1, T* dst, int n)
+    {
+        int i = 0;
+#ifdef PTEX_SIMD
+        for (const int w = 16 / int(sizeof(T)); i + w <= n; i += w)
+            vstore(dst + i, vbox2<T>(vload(r0 + i), vload(r1 + i)));
+#endif
+        for (; i < n; i++) dst[i] = T(halve(r0[i] + r1[i]));
+    }
+
+    // reduce n pixel pairs of row r0 with the even pixels of row r1 and
+    // the n (gathered) pixels of r2
+    template<typename T>
+    inline void reduceTriRow(const T* r0, const T* r1, const T* r2, T* dst, int n, int nchan)
+    {
+        int i = 0;
+#ifdef PTEX_SIMD
+        switch (nchan) {
+        case 1:  i = reduceTriRowSimd<T, 1>(r0, r1, r2, dst, n); break;
+        case 2:  i = reduceTriRowSimd<T, 2>(r0, r1, r2, dst, n); break;
+        case 4:  i = reduceTriRowSimd<T, 4>(r0, r1, r2, dst, n); break;
+        default: i = reduceTriRowOther(r0, r1, r2, dst, n, nchan); break;
+        }
+#endif
+        r0 += 2*i*nchan; r1 += 2*i*nchan; r2 += i*nchan; dst += i*nchan;
+        for (; i < n; i++, r0 += nchan, r1 += nchan)
+            for (const T* end = r0 + nchan; r0 != end; r0++, r1++)
+                *dst++ = T(quarter(r0[0] + r0[nchan] + r1[0] + *r2++));
+    }
+
+
     template<typename T>
     inline void reduce(const T* src, int sstride, int uw, int vw,
                        T* dst, int dstride, int nchan)
+    {
+        sstride /= (int)sizeof(T);
+        dstride /= (int)sizeof(T);
+        for (const T* end = src + vw*sstride; src != end; src += 2*sstride, dst += dstride)
+            reduceRow(src, src + sstride, dst, uw/2, nchan);
+    }
+
+    // half data is reduced in float, converting row segments to and from half in bulk
+    const int HalfSegment = 256; // max values per row segment
+
+    inline void reduceHalf(const PtexHalf* src, int sstride, int uw, int vw,
+                           PtexHalf* dst, int dstride, int nchan)
+    {
+        sstride /= (int)sizeof(PtexHalf);
+        dstride /= (int)sizeof(PtexHalf);
+        int rowlen = uw*nchan;
+        int seglen = HalfSegment / (2*nchan) * (2*nchan);
+        float r0[HalfSegment], r1[HalfSegment], out[HalfSegment/2];
+        for (const PtexHalf* end = src + vw*sstride; src != end; src += 2*sstride, dst += dstride) {
+            for (int x = 0; x < rowlen; x += seglen) {
+                int n = PtexUtils::min(seglen, rowlen - x);
+                PtexHalf::toFloat(r0, src + x, n);
+                PtexHalf::toFloat(r1, src + sstride + x, n);
+                reduceRow(r0, r1, out, n/(2*nchan), nchan);
+                PtexHalf::fromFloat(dst + x/2, out, n/2);
+            }
+        }
+    }
+
+    // generic versions, for half data with too many channels for a row segment
+    template<typename T>
+    inline void reduceGeneric(const T* src, int sstride, int uw, int vw,
+                              T* dst, int dstride, int nchan)
     {
         sstride /= (int)sizeof(T);
         dstride /= (int)sizeof(T);
@@ -296,8 +1110,14 @@ void reduce(const void* src, int sstride, int uw, int vw,
     switch (dt) {
     case dt_uint8:     reduce(static_cast<const uint8_t*>(src), sstride, uw, vw,
                               static_cast<uint8_t*>(dst), dstride, nchan); break;
-    case dt_half:      reduce(static_cast<const PtexHalf*>(src), sstride, uw, vw,
-                              static_cast<PtexHalf*>(dst), dstride, nchan); break;
+    case dt_half:
+        if (2*nchan <= HalfSegment)
+            reduceHalf(static_cast<const PtexHalf*>(src), sstride, uw, vw,
+                       static_cast<PtexHalf*>(dst), dstride, nchan);
+        else
+            reduceGeneric(static_cast<const PtexHalf*>(src), sstride, uw, vw,
+                          static_cast<PtexHalf*>(dst), dstride, nchan);
+        break;
     case dt_uint16:    reduce(static_cast<const uint16_t*>(src), sstride, uw, vw,
                               static_cast<uint16_t*>(dst), dstride, nchan); break;
     case dt_float:     reduce(static_cast<const float*>(src), sstride, uw, vw,
@@ -310,6 +1130,34 @@ namespace {
     template<typename T>
     inline void reduceu(const T* src, int sstride, int uw, int vw,
                         T* dst, int dstride, int nchan)
+    {
+        sstride /= (int)sizeof(T);
+        dstride /= (int)sizeof(T);
+        for (const T* end = src + vw*sstride; src != end; src += sstride, dst += dstride)
+            reduceuRow(src, dst, uw/2, nchan);
+    }
+
+    inline void reduceuHalf(const PtexHalf* src, int sstride, int uw, int vw,
+                            PtexHalf* dst, int dstride, int nchan)
+    {
+        sstride /= (int)sizeof(PtexHalf);
+        dstride /= (int)sizeof(PtexHalf);
+        int rowlen = uw*nchan;
+        int seglen = HalfSegment / (2*nchan) * (2*nchan);
+        float r0[HalfSegment], out[HalfSegment/2];
+        for (const PtexHalf* end = src + vw*sstride; src != end; src += sstride, dst += dstride) {
+            for (int x = 0; x < rowlen; x += seglen) {
+                int n = PtexUtils::min(seglen, rowlen - x);
+                PtexHalf::toFloat(r0, src + x, n);
+                reduceuRow(r0, out, n/(2*nchan), nchan);
+                PtexHalf::fromFloat(dst + x/2, out, n/2);
+            }
+        }
+    }
+
+    template<typename T>
+    inline void reduceuGeneric(const T* src, int sstride, int uw, int vw,
+                               T* dst, int dstride, int nchan)
     {
         sstride /= (int)sizeof(T);
         dstride /= (int)sizeof(T);
@@ -330,8 +1178,14 @@ void reduceu(const void* src, int sstride, int uw, int vw,
     switch (dt) {
     case dt_uint8:     reduceu(static_cast<const uint8_t*>(src), sstride, uw, vw,
                                static_cast<uint8_t*>(dst), dstride, nchan); break;
-    case dt_half:      reduceu(static_cast<const PtexHalf*>(src), sstride, uw, vw,
-                               static_cast<PtexHalf*>(dst), dstride, nchan); break;
+    case dt_half:
+        if (2*nchan <= HalfSegment)
+            reduceuHalf(static_cast<const PtexHalf*>(src), sstride, uw, vw,
+                        static_cast<PtexHalf*>(dst), dstride, nchan);
+        else
+            reduceuGeneric(static_cast<const PtexHalf*>(src), sstride, uw, vw,
+                           static_cast<PtexHalf*>(dst), dstride, nchan);
+        break;
     case dt_uint16:    reduceu(static_cast<const uint16_t*>(src), sstride, uw, vw,
                                static_cast<uint16_t*>(dst), dstride, nchan); break;
     case dt_float:     reduceu(static_cast<const float*>(src), sstride, uw, vw,
@@ -347,13 +1201,26 @@ namespace {
     {
         sstride /= (int)sizeof(T);
         dstride /= (int)sizeof(T);
+        for (const T* end = src + vw*sstride; src != end; src += 2*sstride, dst += dstride)
+            reducevRow(src, src + sstride, dst, uw*nchan);
+    }
+
+    inline void reducevHalf(const PtexHalf* src, int sstride, int uw, int vw,
+                            PtexHalf* dst, int dstride, int nchan)
+    {
+        sstride /= (int)sizeof(PtexHalf);
+        dstride /= (int)sizeof(PtexHalf);
         int rowlen = uw*nchan;
-        int srowskip = 2*sstride - rowlen;
-        int drowskip = dstride - rowlen;
-        for (const T* end = src + vw*sstride; src != end;
-             src += srowskip, dst += drowskip)
-            for (const T* rowend = src + rowlen; src != rowend; src++)
-                *dst++ = T(halve(src[0] + src[sstride]));
+        float r0[HalfSegment], r1[HalfSegment];
+        for (const PtexHalf* end = src + vw*sstride; src != end; src += 2*sstride, dst += dstride) {
+            for (int x = 0; x < rowlen; x += HalfSegment) {
+                int n = PtexUtils::min(HalfSegment, rowlen - x);
+                PtexHalf::toFloat(r0, src + x, n);
+                PtexHalf::toFloat(r1, src + sstride + x, n);
+                reducevRow(r0, r1, r0, n);
+                PtexHalf::fromFloat(dst + x, r0, n);
+            }
+        }
     }
 }
 
@@ -363,8 +1230,8 @@ void reducev(const void* src, int sstride, int uw, int vw,
     switch (dt) {
     case dt_uint8:     reducev(static_cast<const uint8_t*>(src), sstride, uw, vw,
                                static_cast<uint8_t*>(dst), dstride, nchan); break;
-    case dt_half:      reducev(static_cast<const PtexHalf*>(src), sstride, uw, vw,
-                               static_cast<PtexHalf*>(dst), dstride, nchan); break;
+    case dt_half:      reducevHalf(static_cast<const PtexHalf*>(src), sstride, uw, vw,
+                                   static_cast<PtexHalf*>(dst), dstride, nchan); break;
     case dt_uint16:    reducev(static_cast<const uint16_t*>(src), sstride, uw, vw,
                                static_cast<uint16_t*>(dst), dstride, nchan); break;
     case dt_float:     reducev(static_cast<const float*>(src), sstride, uw, vw,
@@ -378,8 +1245,8 @@ namespace {
     // generate a reduction of a packed-triangle texture
     // note: this method won't work for tiled textures
     template<typename T>
-    inline void reduceTri(const T* src, int sstride, int w, int /*vw*/,
-                          T* dst, int dstride, int nchan)
+    inline void reduceTriGeneric(const T* src, int sstride, int w, int /*vw*/,
+                                 T* dst, int dstride, int nchan)
     {
         sstride /= (int)sizeof(T);
         dstride /= (int)sizeof(T);
@@ -395,16 +1262,103 @@ namespace {
                 for (const T* pixend = src+nchan; src != pixend; src++, src2++)
                     *dst++ = T(quarter(src[0] + src[nchan] + src[sstride] + src2[0]));
     }
+
+    // The fourth sample of each output pixel walks up a column of the
+    // opposite triangle; those pixels are gathered into a contiguous
+    // segment so the rest can be done like reduce().
+    const int TriSegment = 256; // max values per gathered segment
+
+    template<typename T, int nchan>
+    inline void gatherPixels(const T* src, int stride, T* dst, int n)
+    {
+        for (T* end = dst + n*nchan; dst != end; src += stride)
+            for (int c = 0; c < nchan; c++) *dst++ = src[c];
+    }
+
+    // copy n pixels spaced stride values apart
+    template<typename T>
+    inline void gatherPixels(const T* src, int stride, T* dst, int n, int nchan)
+    {
+        switch (nchan) {
+        case 1: gatherPixels<T, 1>(src, stride, dst, n); return;
+        case 2: gatherPixels<T, 2>(src, stride, dst, n); return;
+        case 3: gatherPixels<T, 3>(src, stride, dst, n); return;
+        case 4: gatherPixels<T, 4>(src, stride, dst, n); return;
+        }
+        for (T* end = dst + n*nchan; dst != end; src += stride)
+            for (int c = 0; c < nchan; c++) *dst++ = src[c];
+    }
+
+    template<typename T>
+    inline void reduceTri(const T* src, int sstride, int w, int /*vw*/,
+                          T* dst, int dstride, int nchan)
+    {
+        sstride /= (int)sizeof(T);
+        dstride /= (int)sizeof(T);
+        int rowlen = w*nchan;
+        int segpix = TriSegment / nchan;
+        T r2[TriSegment];
+        const T* src2 = src + (w-1) * sstride + rowlen - nchan;
+        for (const T* end = src + w*sstride; src != end;
+             src += 2*sstride, src2 += w*sstride - 2*nchan, dst += dstride) {
+            // src2 steps up two rows per output pixel, and left two pixels per output row
+            for (int x = 0; x < w/2; x += segpix) {
+                int n = PtexUtils::min(segpix, w/2 - x);
+                gatherPixels(src2, -2*sstride, r2, n, nchan);
+                src2 -= 2*sstride*n;
+                reduceTriRow(src + 2*x*nchan, src + sstride + 2*x*nchan, r2,
+                             dst + x*nchan, n, nchan);
+            }
+        }
+    }
+
+    inline void reduceTriHalf(const PtexHalf* src, int sstride, int w, int /*vw*/,
+                              PtexHalf* dst, int dstride, int nchan)
+    {
+        sstride /= (int)sizeof(PtexHalf);
+        dstride /= (int)sizeof(PtexHalf);
+        int rowlen = w*nchan;
+        int segpix = HalfSegment / (2*nchan);
+        PtexHalf h2[HalfSegment/2];
+        float r0[HalfSegment], r1[HalfSegment], r2[HalfSegment/2], out[HalfSegment/2];
+        const PtexHalf* src2 = src + (w-1) * sstride + rowlen - nchan;
+        for (const PtexHalf* end = src + w*sstride; src != end;
+             src += 2*sstride, src2 += w*sstride - 2*nchan, dst += dstride) {
+            for (int x = 0; x < w/2; x += segpix) {
+                int n = PtexUtils::min(segpix, w/2 - x);
+                gatherPixels(src2, -2*sstride, h2, n, nchan);
+                src2 -= 2*sstride*n;
+                PtexHalf::toFloat(r0, src + 2*x*nchan, 2*n*nchan);
+                PtexHalf::toFloat(r1, src + sstride + 2*x*nchan, 2*n*nchan);
+                PtexHalf::toFloat(r2, h2, n*nchan);
+                reduceTriRow(r0, r1, r2, out, n, nchan);
+                PtexHalf::fromFloat(dst + x*nchan, out, n*nchan);
+            }
+        }
+    }
 }
 
 void reduceTri(const void* src, int sstride, int w, int /*vw*/,
                void* dst, int dstride, DataType dt, int nchan)
 {
+    if (nchan > TriSegment/2) {
+        switch (dt) {
+        case dt_uint8:     reduceTriGeneric(static_cast<const uint8_t*>(src), sstride, w, 0,
+                                            static_cast<uint8_t*>(dst), dstride, nchan); break;
+        case dt_half:      reduceTriGeneric(static_cast<const PtexHalf*>(src), sstride, w, 0,
+                                            static_cast<PtexHalf*>(dst), dstride, nchan); break;
+        case dt_uint16:    reduceTriGeneric(static_cast<const uint16_t*>(src), sstride, w, 0,
+                                            static_cast<uint16_t*>(dst), dstride, nchan); break;
+        case dt_float:     reduceTriGeneric(static_cast<const float*>(src), sstride, w, 0,
+                                            static_cast<float*>(dst), dstride, nchan); break;
+        }
+        return;
+    }
     switch (dt) {
     case dt_uint8:     reduceTri(static_cast<const uint8_t*>(src), sstride, w, 0,
                                  static_cast<uint8_t*>(dst), dstride, nchan); break;
-    case dt_half:      reduceTri(static_cast<const PtexHalf*>(src), sstride, w, 0,
-                                 static_cast<PtexHalf*>(dst), dstride, nchan); break;
+    case dt_half:      reduceTriHalf(static_cast<const PtexHalf*>(src), sstride, w, 0,
+                                     static_cast<PtexHalf*>(dst), dstride, nchan); break;
     case dt_uint16:    reduceTri(static_cast<const uint16_t*>(src), sstride, w, 0,
                                  static_cast<uint16_t*>(dst), dstride, nchan); break;
     case dt_float:     reduceTri(static_cast<const float*>(src), sstride, w, 0,
@@ -505,12 +1459,51 @@ namespace {
         sstride /= (int)sizeof(T);
         int rowlen = uw*nchan;
         int rowskip = sstride - rowlen;
-        for (const T* end = src + vw*sstride; src != end; src += rowskip)
-            for (const T* rowend = src + rowlen; src != rowend;)
-                for (int i = 0; i < nchan; i++) buff[i] += (float)*src++;
+        if (nchan >= 4) {
+            // sum 4 channels at a time (each channel keeps its summation order)
+            for (const T* end = src + vw*sstride; src != end; src += rowskip)
+                for (const T* rowend = src + rowlen; src != rowend; src += nchan) {
+                    int i = 0;
+                    for (; i + 4 <= nchan; i += 4)
+                        PtexSimd::store(buff + i, PtexSimd::load(buff + i) + PtexSimd::load(src + i));
+                    for (; i < nchan; i++) buff[i] += (float)src[i];
+                }
+        }
+        else {
+            for (const T* end = src + vw*sstride; src != end; src += rowskip)
+                for (const T* rowend = src + rowlen; src != rowend;)
+                    for (int i = 0; i < nchan; i++) buff[i] += (float)*src++;
+        }
         float scale = 1.0f/(float)(uw*vw);
         for (int i = 0; i < nchan; i++) dst[i] = T(buff[i]*scale);
     }
+
+    inline void averageHalf(const PtexHalf* src, int sstride, int uw, int vw,
+                            PtexHalf* dst, int nchan)
+    {
+        float* buff = (float*) alloca(nchan*sizeof(float));
+        memset(buff, 0, nchan*sizeof(float));
+        sstride /= (int)sizeof(PtexHalf);
+        int rowlen = uw*nchan;
+        int seglen = HalfSegment / nchan * nchan;
+        float row[HalfSegment];
+        for (const PtexHalf* end = src + vw*sstride; src != end; src += sstride) {
+            for (int x = 0; x < rowlen; x += seglen) {
+                int n = PtexUtils::min(seglen, rowlen - x);
+                PtexHalf::toFloat(row, src + x, n);
+                for (int i = 0; i < n; i += nchan) {
+                    // (summing 4 channels at a time keeps each channel's summation order)
+                    int c = 0;
+                    for (; c + 4 <= nchan; c += 4)
+                        PtexSimd::store(buff + c, PtexSimd::load(buff + c) + PtexSimd::load(row + i + c));
+                    for (; c < nchan; c++) buff[c] += row[i+c];
+                }
+            }
+        }
+        float scale = 1.0f/(float)(uw*vw);
+        for (int i = 0; i < nchan; i++) buff[i] *= scale;
+        PtexHalf::fromFloat(dst, buff, nchan);
+    }
 }
 
 void average(const void* src, int sstride, int uw, int vw,
@@ -519,8 +1512,14 @@ void average(const void* src, int sstride, int uw, int vw,
     switch (dt) {
     case dt_uint8:     average(static_cast<const uint8_t*>(src), sstride, uw, vw,
                                static_cast<uint8_t*>(dst), nchan); break;
-    case dt_half:      average(static_cast<const PtexHalf*>(src), sstride, uw, vw,
-                               static_cast<PtexHalf*>(dst), nchan); break;
+    case dt_half:
+        if (nchan <= HalfSegment)
+            averageHalf(static_cast<const PtexHalf*>(src), sstride, uw, vw,
+                        static_cast<PtexHalf*>(dst), nchan);
+        else
+            average(static_cast<const PtexHalf*>(src), sstride, uw, vw,
+                    static_cast<PtexHalf*>(dst), nchan);
+        break;
     case dt_uint16:    average(static_cast<const uint16_t*>(src), sstride, uw, vw,
                                static_cast<uint16_t*>(dst), nchan); break;
     case dt_float:     average(static_cast<const float*>(src), sstride, uw, vw,
@@ -568,16 +1567,94 @@ namespace {
             for (int i = 0; i < nchanmult; i++) data[i] = T((float)data[i] * aval);
         }
     }
+
+#ifdef PTEX_SIMD
+    /** Lane mask of the channels that get scaled by alpha, for 4 channel
+        pixels or pairs of 2 channel pixels (same channels as the scalar
+        loop).  keep gets the bits of the other lanes as 16-bit values. */
+    inline PtexSimd::float4 alphaMask(int nchannels, int alphachan, uint64_t& keep)
+    {
+        float m[4];
+        keep = 0;
+        for (int i = 0; i < 4; i++) {
+            int c = i % nchannels;
+            m[i] = float(c != alphachan && (alphachan == 0 || c < alphachan));
+            if (!m[i]) keep |= uint64_t(0xffff) << (16*i);
+        }
+        return PtexSimd::lessThan(PtexSimd::zero(), PtexSimd::set(m[0], m[1], m[2], m[3]));
+    }
+
+    // store the scaled lanes, leaving the others unchanged
+    template<typename T>
+    inline void storeScaled(T* p, PtexSimd::float4 v, PtexSimd::float4 aval,
+                            PtexSimd::float4 mask, uint64_t /*keep*/)
+    {
+        PtexSimd::store(p, PtexSimd::select(mask, v * aval, v));
+    }
+
+    inline void storeScaled(PtexHalf* p, PtexSimd::float4 v, PtexSimd::float4 aval,
+                            PtexSimd::float4 /*mask*/, uint64_t keep)
+    {
+        // -0 doesn't survive the round trip through float, so restore the
+        // original bits of the unscaled lanes
+        uint64_t orig, bits;
+        memcpy(&orig, &p[0].bits, 8);
+        PtexSimd::store(p, v * aval);
+        memcpy(&bits, &p[0].bits, 8);
+        bits = (bits & ~keep) | (orig & keep);
+        memcpy(&p[0].bits, &bits, 8);
+    }
+
+    template<typename T>
+    inline void multalpha4(T* data, int npixels, int alphachan, float scale)
+    {
+        uint64_t keep;
+        PtexSimd::float4 mask = alphaMask(4, alphachan, keep);
+        for (T* end = data + npixels*4; data != end; data += 4) {
+            PtexSimd::float4 aval = PtexSimd::splat(scale * (float)data[alphachan]);
+            storeScaled(data, PtexSimd::load(data), aval, mask, keep);
+        }
+    }
+
+    template<typename T>
+    inline void multalpha2(T* data, int npixels, int alphachan, float scale)
+    {
+        uint64_t keep;
+        PtexSimd::float4 mask = alphaMask(2, alphachan, keep);
+        T* end = data + (npixels & ~1) * 2;
+        for (; data != end; data += 4) {
+            float a0 = scale * (float)data[alphachan], a1 = scale * (float)data[2+alphachan];
+            storeScaled(data, PtexSimd::load(data), PtexSimd::set(a0, a0, a1, a1), mask, keep);
+        }
+        if (npixels & 1) multalpha(data, 1, 2, alphachan, scale);
+    }
+
+    template<typename T>
+    inline void multalphaSimd(T* data, int npixels, int nchannels, int alphachan, float scale)
+    {
+        switch (nchannels) {
+        case 4: multalpha4(data, npixels, alphachan, scale); break;
+        case 2: multalpha2(data, npixels, alphachan, scale); break;
+        default: multalpha(data, npixels, nchannels, alphachan, scale); break;
+        }
+    }
+#else
+    template<typename T>
+    inline void multalphaSimd(T* data, int npixels, int nchannels, int alphachan, float scale)
+    {
+        multalpha(data, npixels, nchannels, alphachan, scale);
+    }
+#endif
 }
 
 void multalpha(void* data, int npixels, DataType dt, int nchannels, int alphachan)
 {
     float scale = OneValueInv(dt);
     switch(dt) {
-    case dt_uint8:    multalpha(static_cast<uint8_t*>(data), npixels, nchannels, alphachan, scale); break;
-    case dt_uint16:   multalpha(static_cast<uint16_t*>(data), npixels, nchannels, alphachan, scale); break;
-    case dt_half:     multalpha(static_cast<PtexHalf*>(data), npixels, nchannels, alphachan, scale); break;
-    case dt_float:    multalpha(static_cast<float*>(data), npixels, nchannels, alphachan, scale); break;
+    case dt_uint8:    multalphaSimd(static_cast<uint8_t*>(data), npixels, nchannels, alphachan, scale); break;
+    case dt_uint16:   multalphaSimd(static_cast<uint16_t*>(data), npixels, nchannels, alphachan, scale); break;
+    case dt_half:     multalphaSimd(static_cast<PtexHalf*>(data), npixels, nchannels, alphachan, scale); break;
+    case dt_float:    multalphaSimd(static_cast<float*>(data), npixels, nchannels, alphachan, scale); break;
     }
 }
 
@@ -607,16 +1684,44 @@ namespace {
             for (int i = 0; i < nchandiv; i++)  data[i] = T((float)data[i] * aval);
         }
     }
+
+#ifdef PTEX_SIMD
+    template<typename T>
+    inline void divalpha4(T* data, int npixels, int alphachan, float scale)
+    {
+        uint64_t keep;
+        PtexSimd::float4 mask = alphaMask(4, alphachan, keep);
+        for (T* end = data + npixels*4; data != end; data += 4) {
+            T alpha = data[alphachan];
+            if (!alpha) continue; // don't divide by zero!
+            PtexSimd::float4 aval = PtexSimd::splat(scale / (float)alpha);
+            storeScaled(data, PtexSimd::load(data), aval, mask, keep);
+        }
+    }
+
+    template<typename T>
+    inline void divalphaSimd(T* data, int npixels, int nchannels, int alphachan, float scale)
+    {
+        if (nchannels == 4) divalpha4(data, npixels, alphachan, scale);
+        else divalpha(data, npixels, nchannels, alphachan, scale);
+    }
+#else
+    template<typename T>
+    inline void divalphaSimd(T* data, int npixels, int nchannels, int alphachan, float scale)
+    {
+        divalpha(data, npixels, nchannels, alphachan, scale);
+    }
+#endif
 }
 
 void divalpha(void* data, int npixels, DataType dt, int nchannels, int alphachan)
 {
     float scale = OneValue(dt);
     switch(dt) {
-    case dt_uint8:    divalpha(static_cast<uint8_t*>(data), npixels, nchannels, alphachan, scale); break;
-    case dt_uint16:   divalpha(static_cast<uint16_t*>(data), npixels, nchannels, alphachan, scale); break;
-    case dt_half:     divalpha(static_cast<PtexHalf*>(data), npixels, nchannels, alphachan, scale); break;
-    case dt_float:    divalpha(static_cast<float*>(data), npixels, nchannels, alphachan, scale); break;
+    case dt_uint8:    divalphaSimd(static_cast<uint8_t*>(data), npixels, nchannels, alphachan, scale); break;
+    case dt_uint16:   divalphaSimd(static_cast<uint16_t*>(data), npixels, nchannels, alphachan, scale); break;
+    case dt_half:     divalphaSimd(static_cast<PtexHalf*>(data), npixels, nchannels, alphachan, scale); break;
+    case dt_float:    divalphaSimd(static_cast<float*>(data), npixels, nchannels, alphachan, scale); break;
     }
 }
 
@@ -171,6 +171,16 @@ void deinterleave(const void* src, int sstride, int ures, int vres,
                   void* dst, int dstride, DataType dt, int nchannels);
 void encodeDifference(void* data, int size, DataType dt);
 void decodeDifference(void* data, int size, DataType dt);
+/** Interleave planar data (contiguous rows) in one pass, decoding the
+    difference encoding first if diff is set (types that aren't
+    difference-encoded are just interleaved) and premultiplying by alpha
+    if alphachan >= 0. */
+void decodeInterleave(const void* src, int ures, int vres, void* dst, int dstride,
+                      DataType dt, int nchannels, bool diff, int alphachan);
+/** Deinterleave data into contiguous planar rows and difference-encode it
+    in one pass.  Types that aren't difference-encoded are just deinterleaved. */
+void deinterleaveEncodeDifference(const void* src, int sstride, int ures, int vres,
+                                  void* dst, DataType dt, int nchannels);
 typedef void ReduceFn(const void* src, int sstride, int ures, int vres,
                       void* dst, int dstride, DataType dt, int nchannels);
 void reduce(const void* src, int sstride, int ures, int vres,
@@ -55,6 +55,16 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
 
    The final reduction for each face is averaged and stored in the
    const data block.
+
+   Face data are compressed into memory rather than directly to the
+   temp file so that PtexMainWriter can compress faces on the compute
+   thread pool.  Compressed faces are appended to the temp file in the order
+   they were written, so the temp file (and the final file) is the
+   same as if the faces had been compressed one at a time.
+
+   In multi-producer mode, faces are instead compressed by the threads
+   calling writeFace and appended under a lock.  The final file is
+   still the same since the data blocks are copied in faceid order.
 */
 
 #include "PtexPlatform.h"
@@ -69,6 +79,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
 
 #include "Ptexture.h"
 #include "PtexUtils.h"
+#include "PtexThreadPool.h"
 #include "PtexWriter.h"
 
 PTEX_NAMESPACE_BEGIN
@@ -123,6 +134,9 @@ namespace {
 #endif
     }
 
+    // faces smaller than this (in bytes) are compressed by the calling thread
+    const int MinParallelFaceSize = 4096;
+
     std::string fileError(const char* message, const char* path)
     {
         std::stringstream str;
@@ -164,17 +178,73 @@ namespace {
 }
 
 
+/* Deflate stream used to compress face data, so that faces can be
+   compressed concurrently without sharing the writer's stream.  Idle
+   contexts are kept by the writer for reuse and freed with it. */
+class PtexWriterBase::DeflateContext
+{
+    z_stream_s _zstream;
+public:
+    DeflateContext(int level)
+    {
+        memset(&_zstream, 0, sizeof(_zstream));
+        deflateInit(&_zstream, level);
+    }
+    ~DeflateContext() { deflateEnd(&_zstream); }
+
+    /* Compress a complete block and append it to out.  Output is produced
+       in BlockSize pieces, as PtexWriterBase::writeZipBlock does, so that
+       uncompressed (stored) blocks are split the same way.  Returns the
+       compressed size, or -1 on error. */
+    int deflateBlock(const void* data, int size, std::vector<char>& out)
+    {
+        size_t start = out.size();
+        out.reserve(start + deflateBound(&_zstream, uLong(size)) + BlockSize);
+        _zstream.next_in = (Bytef*) const_cast<void*>(data);
+        _zstream.avail_in = size;
+
+        int zresult;
+        do {
+            size_t pos = out.size();
+            out.resize(pos + BlockSize);
+            _zstream.next_out = (Bytef*) &out[pos];
+            _zstream.avail_out = BlockSize;
+            zresult = deflate(&_zstream, Z_FINISH);
+            out.resize(pos + BlockSize - _zstream.avail_out);
+        } while (zresult == Z_OK);
+
+        int total = (int)_zstream.total_out;
+        deflateReset(&_zstream);
+        if (zresult != Z_STREAM_END) {
+            out.resize(start);
+            return -1;
+        }
+        return total;
+    }
+};
+
+
 PtexWriter* PtexWriter::open(const char* path,
                              Ptex::MeshType mt, Ptex::DataType dt,
                              int nchannels, int alphachan, int nfaces,
                              Ptex::String& error, bool genmipmaps)
+{
+    return open(path, mt, dt, nchannels, alphachan, nfaces, error, genmipmaps, false);
+}
+
+
+PtexWriter* PtexWriter::open(const char* path,
+                             Ptex::MeshType mt, Ptex::DataType dt,
+                             int nchannels, int alphachan, int nfaces,
+                             Ptex::String& error, bool genmipmaps,
+                             bool multiProducer)
 {
     if (!checkFormat(mt, dt, nchannels, alphachan, error))
         return 0;
 
     PtexMainWriter* w = new PtexMainWriter(path, 0,
                                            mt, dt, nchannels, alphachan, nfaces,
-                                           genmipmaps);
+                                           genmipmaps, multiProducer);
     if (!w->ok(error)) {
         w->release();
         return 0;
@@ -187,6 +257,16 @@ PtexWriter* PtexWriter::edit(const char* path, bool incremental,
                              Ptex::MeshType mt, Ptex::DataType dt,
                              int nchannels, int alphachan, int nfaces,
                              Ptex::String& error, bool genmipmaps)
+{
+    return edit(path, incremental, mt, dt, nchannels, alphachan, nfaces, error, genmipmaps, false);
+}
+
+
+PtexWriter* PtexWriter::edit(const char* path, bool incremental,
+                             Ptex::MeshType mt, Ptex::DataType dt,
+                             int nchannels, int alphachan, int nfaces,
+                             Ptex::String& error, bool genmipmaps,
+                             bool multiProducer)
 {
     if (!checkFormat(mt, dt, nchannels, alphachan, error))
         return 0;
@@ -228,7 +308,7 @@ PtexWriter* PtexWriter::edit(const char* path, bool incremental,
             }
         }
         w = new PtexMainWriter(path, tex, mt, dt, nchannels, alphachan,
-                               nfaces, genmipmaps);
+                               nfaces, genmipmaps, multiProducer);
     }
 
     if (!w->ok(error)) {
@@ -264,7 +344,8 @@ PtexWriterBase::PtexWriterBase(const char* path,
                                bool compress)
     : _ok(true),
       _path(path),
-      _tilefp(0)
+      _closed(false),
+      _compress(compress)
 {
     memset(&_header, 0, sizeof(_header));
     _header.magic = Magic;
@@ -288,13 +369,6 @@ PtexWriterBase::PtexWriterBase(const char* path,
 
     memset(&_zstream, 0, sizeof(_zstream));
     deflateInit(&_zstream, compress ? Z_DEFAULT_COMPRESSION : 0);
-
-    // create temp file for writing tiles
-    // (must compress each tile before assembling a tiled face)
-    _tilefp = OpenTempFile(_tilepath);
-    if (!_tilefp) {
-        setError(fileError("Error creating temp file: ", _tilepath.c_str()));
-    }
 }
 
 
@@ -302,7 +376,7 @@ void PtexWriterBase::release()
 {
     Ptex::String error;
     // close writer if app didn't, and report error if any
-    if (_tilefp && !close(error))
+    if (!_closed && !close(error))
         std::cerr << error.c_str() << std::endl;
     delete this;
 }
@@ -310,6 +384,30 @@ void PtexWriterBase::release()
 PtexWriterBase::~PtexWriterBase()
 {
     deflateEnd(&_zstream);
+    for (size_t i = 0; i < _deflateContexts.size(); i++)
+        delete _deflateContexts[i];
+}
+
+
+PtexWriterBase::DeflateContext* PtexWriterBase::acquireDeflateContext() const
+{
+    // reuse an idle context if there is one
+    {
+        AutoMutex locker(_deflateLock);
+        if (!_deflateContexts.empty()) {
+            DeflateContext* context = _deflateContexts.back();
+            _deflateContexts.pop_back();
+            return context;
+        }
+    }
+    return new DeflateContext(_compress ? Z_DEFAULT_COMPRESSION : 0);
+}
+
+
+void PtexWriterBase::releaseDeflateContext(DeflateContext* context) const
+{
+    AutoMutex locker(_deflateLock);
+    _deflateContexts.push_back(context);
 }
 
 
@@ -317,11 +415,7 @@ bool PtexWriterBase::close(Ptex::String& error)
 {
     if (_ok) finish();
     if (!_ok) getError(error);
-    if (_tilefp) {
-        fclose(_tilefp);
-        unlink(_tilepath.c_str());
-        _tilefp = 0;
-    }
+    _closed = true;
     return _ok;
 }
 
@@ -567,7 +661,7 @@ int PtexWriterBase::copyBlock(FILE* dst, FILE* src, FilePos pos, int size)
 }
 
 
-Ptex::Res PtexWriterBase::calcTileRes(Res faceres)
+Ptex::Res PtexWriterBase::calcTileRes(Res faceres) const
 {
     // desired number of tiles = floor(log2(facesize / tilesize))
     int facesize = faceres.size() * _pixelSize;
@@ -589,45 +683,37 @@ Ptex::Res PtexWriterBase::calcTileRes(Res faceres)
 }
 
 
-void PtexWriterBase::writeConstFaceBlock(FILE* fp, const void* data,
-                                         FaceDataHeader& fdh)
-{
-    // write a single const face data block
-    // record level data for face and output the one pixel value
-    fdh.set(_pixelSize, enc_constant);
-    writeBlock(fp, data, _pixelSize);
-}
-
-
-void PtexWriterBase::writeFaceBlock(FILE* fp, const void* data, int stride,
-                                    Res res, FaceDataHeader& fdh)
+bool PtexWriterBase::encodeFaceBlock(const void* data, int stride, Res res,
+                                     FaceDataHeader& fdh, std::vector<char>& out) const
 {
-    // write a single face data block
-    // copy to temp buffer, and deinterleave
+    // encode a single face data block
+    // copy to temp buffer, deinterleave, and difference if needed
     int ures = res.u(), vres = res.v();
     int blockSize = ures*vres*_pixelSize;
     bool useNew = blockSize > AllocaMax;
     char* buff = useNew ? new char [blockSize] : (char*)alloca(blockSize);
-    PtexUtils::deinterleave(data, stride, ures, vres, buff,
-                            ures*DataSize(datatype()),
-                            datatype(), _header.nchannels);
-
-    // difference if needed
     bool diff = (datatype() == dt_uint8 ||
                  datatype() == dt_uint16);
-    if (diff) PtexUtils::encodeDifference(buff, blockSize, datatype());
-
-    // compress and stream data to file, and record size in header
-    int zippedsize = writeZipBlock(fp, buff, blockSize);
-
-    // record compressed size and encoding in data header
-    fdh.set(zippedsize, diff ? enc_diffzipped : enc_zipped);
+    if (diff)
+        PtexUtils::deinterleaveEncodeDifference(data, stride, ures, vres, buff,
+                                                datatype(), _header.nchannels);
+    else
+        PtexUtils::deinterleave(data, stride, ures, vres, buff,
+                                ures*DataSize(datatype()),
+                                datatype(), _header.nchannels);
+
+    // compress data, and record compressed size and encoding in data header
+    DeflateContext* context = acquireDeflateContext();
+    int zippedsize = context->deflateBlock(buff, blockSize, out);
+    releaseDeflateContext(context);
+    fdh.set(zippedsize < 0 ? 0 : zippedsize, diff ? enc_diffzipped : enc_zipped);
     if (useNew) delete [] buff;
+    return zippedsize >= 0;
 }
 
 
-void PtexWriterBase::writeFaceData(FILE* fp, const void* data, int stride,
-                                   Res res, FaceDataHeader& fdh)
+bool PtexWriterBase::encodeFaceData(const void* data, int stride, Res res,
+                                    FaceDataHeader& fdh, std::vector<char>& out) const
 {
     // determine whether to break into tiles
     Res tileres = calcTileRes(res);
@@ -635,71 +721,95 @@ void PtexWriterBase::writeFaceData(FILE* fp, const void* data, int stride,
     int ntilesv = res.ntilesv(tileres);
     int ntiles = ntilesu * ntilesv;
     if (ntiles == 1) {
-        // write single block
-        writeFaceBlock(fp, data, stride, res, fdh);
-    } else {
-        // write tiles to tilefp temp file
-        rewind(_tilefp);
-
-        // alloc tile header
-        std::vector<FaceDataHeader> tileHeader(ntiles);
-        int tileures = tileres.u();
-        int tilevres = tileres.v();
-        int tileustride = tileures*_pixelSize;
-        int tilevstride = tilevres*stride;
-
-        // output tiles
-        FaceDataHeader* tdh = &tileHeader[0];
-        int datasize = 0;
-        const char* rowp = (const char*) data;
-        const char* rowpend = rowp + ntilesv * tilevstride;
-        for (; rowp != rowpend; rowp += tilevstride) {
-            const char* p = rowp;
-            const char* pend = p + ntilesu * tileustride;
-            for (; p != pend; tdh++, p += tileustride) {
-                // determine if tile is constant
-                if (PtexUtils::isConstant(p, stride, tileures, tilevres, _pixelSize))
-                    writeConstFaceBlock(_tilefp, p, *tdh);
-                else
-                    writeFaceBlock(_tilefp, p, stride, tileres, *tdh);
-                datasize += tdh->blocksize();
+        // encode single block
+        return encodeFaceBlock(data, stride, res, fdh, out);
+    }
+
+    // alloc tile header
+    std::vector<FaceDataHeader> tileHeader(ntiles);
+    int tileures = tileres.u();
+    int tilevres = tileres.v();
+    int tileustride = tileures*_pixelSize;
+    int tilevstride = tilevres*stride;
+
+    // encode tiles (must compress each tile before assembling the tiled face)
+    std::vector<char> tiledata;
+    FaceDataHeader* tdh = &tileHeader[0];
+    bool ok = true;
+    const char* rowp = (const char*) data;
+    const char* rowpend = rowp + ntilesv * tilevstride;
+    for (; rowp != rowpend; rowp += tilevstride) {
+        const char* p = rowp;
+        const char* pend = p + ntilesu * tileustride;
+        for (; p != pend; tdh++, p += tileustride) {
+            // determine if tile is constant
+            if (PtexUtils::isConstant(p, stride, tileures, tilevres, _pixelSize)) {
+                tiledata.insert(tiledata.end(), p, p + _pixelSize);
+                tdh->set(_pixelSize, enc_constant);
             }
+            else
+                ok = encodeFaceBlock(p, stride, tileres, *tdh, tiledata) && ok;
         }
+    }
+
+    // output tile data pre-header, then compressed tile header, then tile data
+    size_t start = out.size();
+    out.insert(out.end(), (const char*)&tileres, (const char*)&tileres + sizeof(Res));
+    uint32_t tileheadersize = 0;
+    size_t sizepos = out.size();
+    out.insert(out.end(), (const char*)&tileheadersize, (const char*)&tileheadersize + sizeof(tileheadersize));
+    DeflateContext* context = acquireDeflateContext();
+    int zippedsize = context->deflateBlock(&tileHeader[0],
+                                           int(sizeof(FaceDataHeader)*tileHeader.size()), out);
+    releaseDeflateContext(context);
+    ok = zippedsize >= 0 && ok;
+    tileheadersize = zippedsize < 0 ? 0 : uint32_t(zippedsize);
+    memcpy(&out[sizepos], &tileheadersize, sizeof(tileheadersize));
+    out.insert(out.end(), tiledata.begin(), tiledata.end());
+
+    fdh.set(int(out.size() - start), enc_tiled);
+    return ok;
+}
 
-        // output compressed tile header
-        uint32_t tileheadersize = writeZipBlock(_tilefp, &tileHeader[0],
-                                                int(sizeof(FaceDataHeader)*tileHeader.size()));
 
+void PtexWriterBase::encodeReduction(const void* data, int stride, Res res, std::vector<char>& out) const
+{
+    // reduce into out (replacing its contents)
+    Ptex::Res newres((int8_t)(res.ulog2-1), (int8_t)(res.vlog2-1));
+    out.resize(newres.size() * _pixelSize);
+    int dstride = newres.u() * _pixelSize;
+    _reduceFn(data, stride, res.u(), res.v(), &out[0], dstride, datatype(), _header.nchannels);
+}
 
-        // output tile data pre-header
-        int totalsize = 0;
-        totalsize += writeBlock(fp, &tileres, sizeof(Res));
-        totalsize += writeBlock(fp, &tileheadersize, sizeof(tileheadersize));
 
-        // copy compressed tile header from temp file
-        totalsize += copyBlock(fp, _tilefp, datasize, tileheadersize);
+void PtexWriterBase::computeConstValue(const void* data, int stride, Res res, void* constval) const
+{
+    // compute average value (data must already be premultiplied)
+    PtexUtils::average(data, stride, res.u(), res.v(), constval,
+                       datatype(), _header.nchannels);
+    if (_header.hasAlpha())
+        PtexUtils::divalpha(constval, 1, datatype(), _header.nchannels, _header.alphachan);
+}
 
-        // copy tile data from temp file
-        totalsize += copyBlock(fp, _tilefp, 0, datasize);
 
-        fdh.set(totalsize, enc_tiled);
+void PtexWriterBase::writeFaceData(FILE* fp, const void* data, int stride,
+                                   Res res, FaceDataHeader& fdh)
+{
+    std::vector<char> block;
+    if (!encodeFaceData(data, stride, res, fdh, block)) {
+        setError("PtexWriter error: data compression internal error");
+        return;
     }
+    writeBlock(fp, &block[0], int(block.size()));
 }
 
 
 void PtexWriterBase::writeReduction(FILE* fp, const void* data, int stride, Res res)
 {
     // reduce and write to file
-    Ptex::Res newres((int8_t)(res.ulog2-1), (int8_t)(res.vlog2-1));
-    int buffsize = newres.size() * _pixelSize;
-    bool useNew = buffsize > AllocaMax;
-    char* buff = useNew ? new char [buffsize] : (char*)alloca(buffsize);
-
-    int dstride = newres.u() * _pixelSize;
-    _reduceFn(data, stride, res.u(), res.v(), buff, dstride, datatype(), _header.nchannels);
-    writeBlock(fp, buff, buffsize);
-
-    if (useNew) delete [] buff;
+    std::vector<char> buff;
+    encodeReduction(data, stride, res, buff);
+    writeBlock(fp, &buff[0], int(buff.size()));
 }
 
 
@@ -722,11 +832,14 @@ int PtexWriterBase::writeMetaDataBlock(FILE* fp, MetaEntry& val)
 
 PtexMainWriter::PtexMainWriter(const char* path, PtexTexture* tex,
                                Ptex::MeshType mt, Ptex::DataType dt,
-                               int nchannels, int alphachan, int nfaces, bool genmipmaps)
+                               int nchannels, int alphachan, int nfaces, bool genmipmaps,
+                               bool multiProducer)
     : PtexWriterBase(path, mt, dt, nchannels, alphachan, nfaces,
                      /* compress */ true),
       _hasNewData(false),
       _genmipmaps(genmipmaps),
+      _multiProducer(multiProducer),
+      _maxPending(multiProducer ? 0 : 2 * PtexThreadPool::computeInstance().numThreads()),
       _reader(0)
 {
     _tmpfp = OpenTempFile(_tmppath);
@@ -773,12 +886,17 @@ PtexMainWriter::PtexMainWriter(const char* path, PtexTexture* tex,
 
 PtexMainWriter::~PtexMainWriter()
 {
+    flushPending(true);
     if (_reader) _reader->release();
 }
 
 
 bool PtexMainWriter::close(Ptex::String& error)
 {
+    // wait for faces still being compressed (finish() also does this, but
+    // isn't called if an error has occurred)
+    flushPending(true);
+
     // closing base writer will write all pending data via finish() method
     // and will close _fp (which in this case is on the temp disk)
     bool result = PtexWriterBase::close(error);
@@ -803,6 +921,139 @@ bool PtexMainWriter::close(Ptex::String& error)
     return result;
 }
 
+/* A face queued for compression.  The face data are copied so the
+   caller's buffer can be reused as soon as writeFace returns.  The
+   face is encoded by whichever thread claims it first: a pool task,
+   or the writer itself when it needs the result.  Refs are held by the
+   writer and by the pool task (if any); the last one deletes it. */
+struct PtexMainWriter::PendingFace {
+    int faceid;
+    Res res;
+    bool reduce;                        // generate first reduction (else const value)
+    std::vector<uint8_t> data;          // copy of face data (stride = res.u()*pixelsize)
+    std::vector<char> block;            // encoded face data
+    FaceDataHeader fdh;                 // header for encoded face data
+    std::vector<char> reduction;        // first reduction (if reduce)
+    std::vector<uint8_t> constval;      // constant value (if !reduce)
+    bool ok;                            // false if compression failed
+    volatile int32_t claimed;
+    volatile int32_t done;
+    volatile int32_t refs;
+
+    bool claim() { return AtomicCompareAndSwap(&claimed, int32_t(0), int32_t(1)); }
+    void unref() { if (AtomicDecrement(&refs) == 0) delete this; }
+};
+
+
+class PtexMainWriter::EncodeTask : public PtexThreadPool::Task
+{
+public:
+    EncodeTask(const PtexMainWriter* writer, PendingFace* face) : _writer(writer), _face(face) {}
+
+    virtual void run()
+    {
+        // the writer may have already claimed (and written) the face;
+        // if so, it may also be gone so don't touch it
+        if (_face->claim()) {
+            _writer->encodePendingFace(*_face);
+            AutoCondition lock(_writer->_encoded);
+            AtomicStore(&_face->done, int32_t(1));
+            _writer->_encoded.broadcast();
+        }
+        _face->unref();
+    }
+
+private:
+    const PtexMainWriter* _writer;
+    PendingFace* _face;
+};
+
+
+void PtexMainWriter::initPendingFace(PendingFace& face, int faceid, Res res,
+                                     const void* data, int stride) const
+{
+    face.faceid = faceid;
+    face.res = res;
+    face.reduce = _genmipmaps &&
+        (res.ulog2 > MinReductionLog2 && res.vlog2 > MinReductionLog2);
+    int rowlen = res.u() * _pixelSize, nrows = res.v();
+    face.data.resize(size_t(rowlen) * nrows);
+    PtexUtils::copy(data, stride, &face.data[0], rowlen, nrows, rowlen);
+    face.ok = true;
+    face.done = 0;
+}
+
+
+void PtexMainWriter::encodePendingFace(PendingFace& face) const
+{
+    int stride = face.res.u() * _pixelSize;
+    face.ok = encodeFaceData(&face.data[0], stride, face.res, face.fdh, face.block);
+
+    // premultiply (if needed) before making reductions; the data is our own copy
+    if (_header.hasAlpha())
+        PtexUtils::multalpha(&face.data[0], face.res.size(), datatype(), _header.nchannels,
+                             _header.alphachan);
+
+    // generate first reduction (or const value)
+    if (face.reduce)
+        encodeReduction(&face.data[0], stride, face.res, face.reduction);
+    else {
+        face.constval.resize(_pixelSize);
+        computeConstValue(&face.data[0], stride, face.res, &face.constval[0]);
+    }
+    std::vector<uint8_t>().swap(face.data);
+}
+
+
+void PtexMainWriter::flushPending(bool all)
+{
+    // append encoded faces to the tmp file in the order they were written,
+    // waiting for (or encoding) the oldest face when too many are queued
+    while (!_pending.empty() &&
+           (all || int(_pending.size()) > _maxPending || _pending.front()->done))
+    {
+        PendingFace* face = _pending.front();
+        _pending.pop_front();
+        if (!face->done) {
+            if (face->claim()) {
+                encodePendingFace(*face);
+                face->done = 1;
+            }
+            else {
+                AutoCondition lock(_encoded);
+                while (!face->done) _encoded.wait();
+            }
+        }
+        PtexMemoryFence();
+        writeEncodedFace(*face);
+        face->unref();
+    }
+}
+
+
+void PtexMainWriter::writeEncodedFace(const PendingFace& face)
+{
+    int faceid = face.faceid;
+    if (!face.ok)
+        setError("PtexWriter error: data compression internal error");
+
+    // record position of face and write face data
+    _levels.front().pos[faceid] = ftello(_tmpfp);
+    _levels.front().fdh[faceid] = face.fdh;
+    if (!face.block.empty())
+        writeBlock(_tmpfp, &face.block[0], int(face.block.size()));
+
+    // write first reduction (or store const value)
+    if (face.reduce) {
+        _rpos[faceid] = ftello(_tmpfp);
+        writeBlock(_tmpfp, &face.reduction[0], int(face.reduction.size()));
+    }
+    else {
+        memcpy(&_constdata[faceid*_pixelSize], &face.constval[0], _pixelSize);
+    }
+}
+
+
 bool PtexMainWriter::writeFace(int faceid, const FaceInfo& f, const void* data, int stride)
 {
     if (!_ok) return 0;
@@ -816,57 +1067,65 @@ bool PtexMainWriter::writeFace(int faceid, const FaceInfo& f, const void* data,
 
     // non-constant case, ...
 
+    if (_multiProducer) {
+        // compress in the calling thread; only storing the face info and
+        // appending the encoded face to the tmp file are done under the lock
+        PendingFace face;
+        initPendingFace(face, faceid, f.res, data, stride);
+        encodePendingFace(face);
+
+        AutoMutex locker(_writeLock);
+        if (!storeFaceInfo(faceid, _faceinfo[faceid], f)) return 0;
+        writeEncodedFace(face);
+        _hasNewData = true;
+        return _ok;
+    }
+
     // check and store face info
     if (!storeFaceInfo(faceid, _faceinfo[faceid], f)) return 0;
 
-    // record position of current face
-    _levels.front().pos[faceid] = ftello(_tmpfp);
-
-    // write face data
-    writeFaceData(_tmpfp, data, stride, f.res, _levels.front().fdh[faceid]);
-    if (!_ok) return 0;
-
-    // premultiply (if needed) before making reductions; use temp copy of data
-    uint8_t* temp = 0;
-    if (_header.hasAlpha()) {
-        // first copy to temp buffer
-        int rowlen = f.res.u() * _pixelSize, nrows = f.res.v();
-        temp = new uint8_t [rowlen * nrows];
-        PtexUtils::copy(data, stride, temp, rowlen, nrows, rowlen);
-
-        // multiply alpha
-        PtexUtils::multalpha(temp, f.res.size(), datatype(), _header.nchannels,
-                             _header.alphachan);
-
-        // override source buffer
-        data = temp;
-        stride = rowlen;
-    }
-
-    // generate first reduction (if needed)
-    if (_genmipmaps &&
-        (f.res.ulog2 > MinReductionLog2 && f.res.vlog2 > MinReductionLog2))
-    {
-        _rpos[faceid] = ftello(_tmpfp);
-        writeReduction(_tmpfp, data, stride, f.res);
+    // queue a copy of the face to be compressed
+    PendingFace* face = new PendingFace;
+    initPendingFace(*face, faceid, f.res, data, stride);
+    _pending.push_back(face);
+
+    if (f.res.size() * _pixelSize < MinParallelFaceSize) {
+        // small face; not worth handing off
+        face->claimed = 1;
+        face->refs = 1;
+        encodePendingFace(*face);
+        face->done = 1;
     }
     else {
-        storeConstValue(faceid, data, stride, f.res);
+        face->claimed = 0;
+        face->refs = 2;
+        PtexThreadPool::computeInstance().enqueue(new EncodeTask(this, face));
     }
 
-    if (temp) delete [] temp;
+    // write out any faces that are ready
+    flushPending(false);
     _hasNewData = true;
-    return 1;
+    return _ok;
 }
 
 
 bool PtexMainWriter::writeConstantFace(int faceid, const FaceInfo& f, const void* data)
 {
     if (!_ok) return 0;
+    AutoMutex locker(_writeLock);
 
     // check and store face info
     if (!storeFaceInfo(faceid, _faceinfo[faceid], f, FaceInfo::flag_constant)) return 0;
 
+    // if the face is still being compressed, let that finish first so it
+    // doesn't overwrite the constant value
+    for (size_t i = 0; i < _pending.size(); i++) {
+        if (_pending[i]->faceid == faceid) {
+            flushPending(true);
+            break;
+        }
+    }
+
     // store face value in constant block
     memcpy(&_constdata[faceid*_pixelSize], data, _pixelSize);
     _hasNewData = true;
@@ -878,11 +1137,7 @@ bool PtexMainWriter::writeConstantFace(int faceid, const FaceInfo& f, const void
 void PtexMainWriter::storeConstValue(int faceid, const void* data, int stride, Res res)
 {
     // compute average value and store in _constdata block
-    uint8_t* constdata = &_constdata[faceid*_pixelSize];
-    PtexUtils::average(data, stride, res.u(), res.v(), constdata,
-                       datatype(), _header.nchannels);
-    if (_header.hasAlpha())
-        PtexUtils::divalpha(constdata, 1, datatype(), _header.nchannels, _header.alphachan);
+    computeConstValue(data, stride, res, &_constdata[faceid*_pixelSize]);
 }
 
 
@@ -921,6 +1176,9 @@ void PtexMainWriter::finish()
         }
     }
 
+    // wait for queued faces to be written to the tmp file
+    flushPending(true);
+
     // write reductions to tmp file
     if (_genmipmaps)
         generateReductions();
@@ -1281,14 +1539,6 @@ bool PtexIncrWriter::writeFace(int faceid, const FaceInfo& f, const void* data,
     EditFaceDataHeader efdh;
     efdh.faceid = faceid;
 
-    // check and store face info
-    if (!storeFaceInfo(faceid, efdh.faceinfo, f))
-        return 0;
-
-    // record position and skip headers
-    FilePos pos = ftello(_fp);
-    writeBlank(_fp, sizeof(edittype) + sizeof(editsize) + sizeof(efdh));
-
     // must compute constant (average) val first
     uint8_t* constval = new uint8_t [_pixelSize];
 
@@ -1315,22 +1565,30 @@ bool PtexIncrWriter::writeFace(int faceid, const FaceInfo& f, const void* data,
         PtexUtils::average(data, stride, f.res.u(), f.res.v(), constval,
                            datatype(), _header.nchannels);
     }
-    // write const val
-    writeBlock(_fp, constval, _pixelSize);
-    delete [] constval;
 
-    // write face data
-    writeFaceData(_fp, data, stride, f.res, efdh.fdh);
+    // encode face data (in the calling thread, before taking the lock)
+    std::vector<char> block;
+    bool encoded = encodeFaceData(data, stride, f.res, efdh.fdh, block);
 
-    // update editsize in header
-    editsize = (uint32_t)(sizeof(efdh) + (size_t)_pixelSize + efdh.fdh.blocksize());
+    AutoMutex locker(_writeLock);
 
-    // rewind and write headers
-    fseeko(_fp, pos, SEEK_SET);
+    // check and store face info
+    if (!storeFaceInfo(faceid, efdh.faceinfo, f) || !encoded) {
+        if (!encoded) setError("PtexWriter error: data compression internal error");
+        delete [] constval;
+        return 0;
+    }
+
+    // write headers
+    editsize = (uint32_t)(sizeof(efdh) + (size_t)_pixelSize + efdh.fdh.blocksize());
     writeBlock(_fp, &edittype, sizeof(edittype));
     writeBlock(_fp, &editsize, sizeof(editsize));
     writeBlock(_fp, &efdh, sizeof(efdh));
-    fseeko(_fp, 0, SEEK_END);
+
+    // write const val and face data
+    writeBlock(_fp, constval, _pixelSize);
+    writeBlock(_fp, &block[0], int(block.size()));
+    delete [] constval;
     return 1;
 }
 
@@ -1345,6 +1603,8 @@ bool PtexIncrWriter::writeConstantFace(int faceid, const FaceInfo& f, const void
     efdh.fdh.set(0, enc_constant);
     editsize = (uint32_t)sizeof(efdh) + _pixelSize;
 
+    AutoMutex locker(_writeLock);
+
     // check and store face info
     if (!storeFaceInfo(faceid, efdh.faceinfo, f, FaceInfo::flag_constant))
         return 0;
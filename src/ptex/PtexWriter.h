@@ -38,6 +38,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGES.
 
 #include "PtexPlatform.h"
 #include <zlib.h>
+#include <deque>
 #include <map>
 #include <vector>
 #include <stdio.h>
@@ -93,16 +94,27 @@ protected:
                    bool compress);
     virtual ~PtexWriterBase();
 
+    class DeflateContext;
+    DeflateContext* acquireDeflateContext() const;
+    void releaseDeflateContext(DeflateContext* context) const;
+
     int writeBlank(FILE* fp, int size);
     int writeBlock(FILE* fp, const void* data, int size);
     int writeZipBlock(FILE* fp, const void* data, int size, bool finish=true);
     int readBlock(FILE* fp, void* data, int size);
     int copyBlock(FILE* dst, FILE* src, FilePos pos, int size);
-    Res calcTileRes(Res faceres);
+    Res calcTileRes(Res faceres) const;
     virtual void addMetaData(const char* key, MetaDataType t, const void* value, int size);
-    void writeConstFaceBlock(FILE* fp, const void* data, FaceDataHeader& fdh);
-    void writeFaceBlock(FILE* fp, const void* data, int stride, Res res,
-                       FaceDataHeader& fdh);
+
+    // encode into memory (appending to out); these only read the header so
+    // they can run on any thread.  False is returned if compression fails.
+    bool encodeFaceBlock(const void* data, int stride, Res res,
+                         FaceDataHeader& fdh, std::vector<char>& out) const;
+    bool encodeFaceData(const void* data, int stride, Res res,
+                        FaceDataHeader& fdh, std::vector<char>& out) const;
+    void encodeReduction(const void* data, int stride, Res res, std::vector<char>& out) const;
+    void computeConstValue(const void* data, int stride, Res res, void* constval) const;
+
     void writeFaceData(FILE* fp, const void* data, int stride, Res res,
                        FaceDataHeader& fdh);
     void writeReduction(FILE* fp, const void* data, int stride, Res res);
@@ -113,14 +125,17 @@ protected:
     bool _ok;                                // true if no error has occurred
     std::string _error;                      // the error text (if any)
     std::string _path;                       // file path
-    std::string _tilepath;                   // temp tile file path ("<path>.tiles.tmp")
-    FILE* _tilefp;                           // temp tile file handle
+    bool _closed;                            // true once close() has been called
+    bool _compress;                          // false to store face data uncompressed
+    Mutex _writeLock;                        // guards shared state during writeFace calls
     Header _header;                          // the file header
     ExtHeader _extheader;                    // extended header
     int _pixelSize;                          // size of a pixel in bytes
     std::vector<MetaEntry> _metadata;        // meta data waiting to be written
     std::map<std::string,int> _metamap;      // for preventing duplicate keys
     z_stream_s _zstream;                     // libzip compression stream
+    mutable Mutex _deflateLock;              // guards _deflateContexts
+    mutable std::vector<DeflateContext*> _deflateContexts; // idle streams for encoding faces concurrently
 
     PtexUtils::ReduceFn* _reduceFn;
 };
@@ -130,7 +145,8 @@ class PtexMainWriter : public PtexWriterBase {
 public:
     PtexMainWriter(const char* path, PtexTexture* tex,
                    Ptex::MeshType mt, Ptex::DataType dt,
-                   int nchannels, int alphachan, int nfaces, bool genmipmaps);
+                   int nchannels, int alphachan, int nfaces, bool genmipmaps,
+                   bool multiProducer=false);
 
     virtual bool close(Ptex::String& error);
     virtual bool writeFace(int faceid, const FaceInfo& f, const void* data, int stride);
@@ -145,17 +161,25 @@ protected:
     }
 
 private:
+    class EncodeTask;
+    struct PendingFace;
+
     virtual void finish();
     void generateReductions();
     void flagConstantNeighorhoods();
     void storeConstValue(int faceid, const void* data, int stride, Res res);
     void writeMetaData(FILE* fp);
+    void initPendingFace(PendingFace& face, int faceid, Res res, const void* data, int stride) const;
+    void encodePendingFace(PendingFace& face) const;
+    void writeEncodedFace(const PendingFace& face);
+    void flushPending(bool all);
 
     std::string _newpath;                 // path to ".new" file
     std::string _tmppath;                 // temp file path ("<path>.tmp")
     FILE* _tmpfp;                         // temp file handle
     bool _hasNewData;                     // true if data has been written
     bool _genmipmaps;                     // true if mipmaps should be generated
+    bool _multiProducer;                  // true if faces may be written concurrently
     std::vector<FaceInfo> _faceinfo;      // info about each face
     std::vector<uint8_t> _constdata;      // constant data for each face
     std::vector<uint32_t> _rfaceids;      // faceid reordering for reduction levels
@@ -173,6 +197,9 @@ private:
     };
     std::vector<LevelRec> _levels;        // info about each level
     std::vector<FilePos> _rpos;           // reduction file positions
+    std::deque<PendingFace*> _pending;    // faces being compressed, in the order written
+    mutable Condition _encoded;           // signaled when a pool task finishes encoding a face
+    int _maxPending;                      // number of faces to let run ahead of the tmp file
 
     PtexReader* _reader;                  // reader for accessing existing data in file
 };
@@ -486,6 +486,15 @@ class PtexTexture {
     */
     PTEXAPI static PtexTexture* open(const char* path, Ptex::String& error, bool premultiply=0);
 
+    /** Open a ptex file for reading, optionally memory mapped.
+
+        If the memoryMapped param is set to true, the file will be memory mapped rather than read
+        through buffered stdio calls.  Compressed face data is then decompressed directly from the
+        mapped pages.  The other params are the same as for the open() above.
+    */
+    PTEXAPI static PtexTexture* open(const char* path, Ptex::String& error, bool premultiply,
+                                     bool memoryMapped);
+
 
     /// Release resources held by this pointer (pointer becomes invalid).
     virtual void release() = 0;
@@ -619,6 +628,48 @@ class PtexTexture {
     virtual void getPixel(int faceid, int u, int v,
                           float* result, int firstchan, int nchannels,
                           Ptex::Res res) = 0;
+
+    /** Load face data in the background.
+
+        The level header and face data needed for a later getData
+        call at the given resolution are read and decoded on a
+        library-owned worker thread; this call returns immediately.
+        If a getData call for the same face arrives while the load is
+        in progress, it waits for the load rather than decoding the
+        face again.  Requests for invalid or constant faces are ignored.
+        The default implementation does nothing.
+
+        @param faceid Face index [0..numFaces-1]
+        @param res Resolution to load; clamped to the face resolution.
+    */
+    virtual void prefetch(int faceid, Ptex::Res res) { (void)faceid; (void)res; }
+
+    /** Load several faces at full resolution in the background.
+        See previous prefetch() method for details.
+    */
+    virtual void prefetch(const int* faceids, int nfaces) { (void)faceids; (void)nfaces; }
+
+    /** Access texture data for several faces at highest-resolution.
+
+        Equivalent to calling getData(faceids[i], buffers[i], strides[i])
+        for each face, but the data blocks of faces that aren't already
+        loaded are read in file order, with adjacent blocks coalesced
+        into single reads.  The default implementation calls getData()
+        for each face in turn.
+
+        @param faceids Face indices [0..numFaces-1]
+        @param nfaces Number of faces
+        @param buffers User-supplied buffer for each face (see previous getData() method)
+        @param strides Size of each row in each user buffer, or null if all buffers are packed
+        @param parallel If true, decompress faces on library worker threads
+    */
+    virtual void getData(const int* faceids, int nfaces, void* const* buffers, const int* strides,
+                         bool parallel=false)
+    {
+        (void)parallel;
+        for (int i = 0; i < nfaces; i++)
+            getData(faceids[i], buffers[i], strides ? strides[i] : 0);
+    }
 };
 
 
@@ -664,6 +715,33 @@ class PtexInputHandler {
 
     /** Return the last error message encountered. */
     virtual const char* lastError() = 0;
+
+    /** Access a range of bytes directly in memory.
+        If the bytes [pos, pos+size) are addressable without copying (e.g. the file is
+        memory mapped), return a pointer to them; otherwise return null and the data will
+        be read via seek() and read().  The pointer must remain valid until the handle is
+        closed.  The stream position is not affected.  The default implementation returns null.
+    */
+    virtual const void* map(Handle handle, int64_t pos, size_t size)
+    {
+        (void)handle; (void)pos; (void)size;
+        return 0;
+    }
+
+    /** True if the handler implements readAt().  The default implementation returns false. */
+    virtual bool supportsReadAt() { return false; }
+
+    /** Read a number of bytes starting at an absolute byte position.
+        Unlike seek() and read(), this neither uses nor changes the stream position
+        and may be called concurrently from multiple threads on the same handle.
+        Returns the number of bytes successfully read.  Only called if
+        supportsReadAt() returns true.
+    */
+    virtual size_t readAt(Handle handle, int64_t pos, void* buffer, size_t size)
+    {
+        (void)handle; (void)pos; (void)buffer; (void)size;
+        return 0;
+    }
 };
 
 
@@ -706,6 +784,13 @@ class PtexCache {
     virtual ~PtexCache() {}
 
  public:
+    /** Replacement policy used to choose which texture data to free
+        when the cache is over its memory limit. */
+    enum Policy {
+        policy_lru,     ///< Least recently used data is freed first.
+        policy_2q       ///< Data of files used only once is freed before data of files that are reused.
+    };
+
     /** Create a cache with the specified limits.
 
         @param maxFiles Maximum open file handles.  If zero,
@@ -733,6 +818,28 @@ class PtexCache {
                                      PtexInputHandler* inputHandler=0,
                                      PtexErrorHandler* errorHandler=0);
 
+    /** Create a cache with the specified limits and options.
+        The first five params are the same as for the create() above.
+
+        @param memoryMapped If true, files will be memory mapped rather than read through
+        buffered stdio calls.  Ignored if an input handler is specified.
+
+        @param policy Replacement policy for data when maxMem is exceeded.  With
+        policy_2q, files start out on probation and are only protected once they
+        are used again after some of their data was freed.  Protected files keep
+        their data until no probationary data is left, but may only hold up to
+        three quarters of maxMem so that new files still have room to prove
+        themselves.  This keeps a single pass over many textures (e.g. a bake or
+        a texture dump) from flushing the textures that are used repeatedly.
+     */
+    PTEXAPI static PtexCache* create(int maxFiles,
+                                     size_t maxMem,
+                                     bool premultiply,
+                                     PtexInputHandler* inputHandler,
+                                     PtexErrorHandler* errorHandler,
+                                     bool memoryMapped,
+                                     Policy policy=policy_lru);
+
     /// Release PtexCache.  Cache will be immediately destroyed and all resources will be released.
     virtual void release() = 0;
 
@@ -807,6 +914,44 @@ class PtexCache {
 
     /** Get stats. */
     virtual void getStats(Stats& stats) = 0;
+
+    /** Detailed usage and timing stats, for tuning cache limits.
+
+        The struct is versioned: the constructor sets version to the
+        version the application was compiled against, and getDetailedStats
+        only fills in the fields that exist in that version.  Fields are only
+        ever added at the end.
+
+        Latency histograms have log2 buckets: bucket i counts events
+        that took [2^i, 2^(i+1)) nanoseconds (bucket 0 also counts
+        events that took no measurable time, and the last bucket counts
+        everything longer).
+     */
+    struct DetailedStats {
+        enum { currentVersion = 1, numLatencyBuckets = 32 };
+        DetailedStats() : version(currentVersion) {}
+
+        uint32_t version;               ///< Version of this struct
+        uint64_t faceHits;              ///< Face data requests satisfied from memory
+        uint64_t faceMisses;            ///< Face data requests that read from the file
+        uint64_t tileHits;              ///< Tile requests satisfied from memory
+        uint64_t tileMisses;            ///< Tile requests that read from the file or were reduced
+        uint64_t reductionHits;         ///< Dynamic reductions found in memory
+        uint64_t reductionBuilds;       ///< Dynamic reductions computed
+        uint64_t bytesCompressed;       ///< Compressed bytes decompressed
+        uint64_t bytesDecompressed;     ///< Bytes produced by decompression
+        uint64_t inflateTime;           ///< Time spent reading and decompressing zipped blocks (ns)
+        uint64_t lockWaitTime;          ///< Time spent waiting for file read and face load locks (ns)
+        uint64_t inflateLatency[numLatencyBuckets];   ///< Zipped block reads by duration
+        uint64_t lockWaitLatency[numLatencyBuckets];  ///< Lock acquisitions by wait time
+    };
+
+    /** Query the replacement policy the cache was created with. */
+    virtual Policy getPolicy() { return policy_lru; }
+
+    /** Get detailed stats.  The default implementation, for caches
+        that don't keep them, sets all the counts to zero. */
+    PTEXAPI virtual void getDetailedStats(DetailedStats& stats);
 };
 
 
@@ -848,6 +993,18 @@ class PtexWriter {
                             int nchannels, int alphachan, int nfaces,
                             Ptex::String& error, bool genmipmaps=true);
 
+    /** Open a new texture file for writing, optionally from multiple threads.
+        The params are the same as for the open() above, plus:
+        @param multiProducer Specify true to call writeFace and writeConstantFace from
+        multiple threads at once (see writeFace).
+     */
+    PTEXAPI
+    static PtexWriter* open(const char* path,
+                            Ptex::MeshType mt, Ptex::DataType dt,
+                            int nchannels, int alphachan, int nfaces,
+                            Ptex::String& error, bool genmipmaps,
+                            bool multiProducer);
+
     /** Open an existing texture file for writing.
 
         If the incremental param is specified as true, then data
@@ -871,6 +1028,16 @@ class PtexWriter {
                             int nchannels, int alphachan, int nfaces,
                             Ptex::String& error, bool genmipmaps=true);
 
+    /** Open an existing texture file for writing, optionally from multiple threads.
+        The multiProducer param has the same meaning as for open().
+     */
+    PTEXAPI
+    static PtexWriter* edit(const char* path, bool incremental,
+                            Ptex::MeshType mt, Ptex::DataType dt,
+                            int nchannels, int alphachan, int nfaces,
+                            Ptex::String& error, bool genmipmaps,
+                            bool multiProducer);
+
     /** Apply edits to a file.
 
         If a file has pending edits, the edits will be applied and the
@@ -922,6 +1089,17 @@ class PtexWriter {
 
         If an error is encountered while writing, false is returned and an error message can be
         retrieved when close is called.
+
+        The data is copied (or written) before returning, so the buffer may be reused right away.
+        A non-incremental writer compresses faces in the background, so a compression error
+        may be reported by a later call, or by close.
+
+        If the writer was opened with multiProducer set, writeFace and writeConstantFace may be
+        called concurrently from multiple threads, provided that each face is written by only
+        one thread.  Each face is then compressed in the calling thread; the calls only
+        serialize briefly to record the face and append its data to the (temp) file.  The
+        file contents don't depend on the order in which faces are written.  All other
+        methods, including close, must not be called while a write is in progress.
      */
     virtual bool writeFace(int faceid, const Ptex::FaceInfo& info, const void* data, int stride=0) = 0;
 
@@ -968,7 +1146,8 @@ class PtexFilter {
         f_bicubic,              ///< General bi-cubic filter (uses sharpness option)
         f_bspline,              ///< BSpline (equivalent to bi-cubic w/ sharpness=0)
         f_catmullrom,           ///< Catmull-Rom (equivalent to bi-cubic w/ sharpness=1)
-        f_mitchell              ///< Mitchell (equivalent to bi-cubic w/ sharpness=2/3)
+        f_mitchell,             ///< Mitchell (equivalent to bi-cubic w/ sharpness=2/3)
+        f_ewa                   ///< Elliptical weighted average (gaussian over the footprint ellipse)
     };
 
     /// Choose filter options
@@ -986,9 +1165,29 @@ class PtexFilter {
     };
 
     /* Construct a filter for the given texture.
+
+       Filters keep no per-lookup state, so a single filter may be
+       used by any number of threads at once.
     */
     PTEXAPI static PtexFilter* getFilter(PtexTexture* tx, const Options& opts);
 
+    /** Get a filter for a texture obtained from the given cache.
+
+        The filter is created on first use for each texture and set of
+        options and then kept with the cached texture, shared by all
+        threads, so that filter construction stays out of the lookup
+        path.  The filter remains valid while the texture is held and
+        is discarded when the file is purged from the cache, so that a
+        reopened file gets filters that match its new contents.  It may
+        be released like any other filter (release() does nothing).
+
+        @param cache Cache the texture was obtained from.
+        @param tx Texture returned by cache->get().
+        @param opts Filter options.
+        @return The filter, or null if tx wasn't obtained from cache.
+    */
+    PTEXAPI static PtexFilter* getFilter(PtexCache* cache, PtexTexture* tx, const Options& opts);
+
     /** Release resources held by this pointer (pointer becomes invalid). */
     virtual void release() = 0;
 
@@ -1016,6 +1215,106 @@ class PtexFilter {
     virtual void eval(float* result, int firstchan, int nchannels,
                       int faceid, float u, float v, float uw1, float vw1, float uw2, float vw2,
                       float width=1, float blur=0) = 0;
+
+    /** Apply filter to a batch of lookups.
+
+        Equivalent to calling eval() once per query, but the inputs
+        and outputs are held in parallel (structure-of-arrays) buffers
+        so that coherent query streams (e.g. a shading batch that
+        mostly shares a faceid) can be evaluated together.  Queries
+        landing on the same face and resolution share a single face
+        data fetch.
+
+        Results for query i are written to result[c*resultStride + i]
+        for each channel c in [0..nchannels-1].  As with eval(),
+        queries with an invalid faceid leave their results unchanged.
+
+        @param result Buffer to hold filter results, nchannels rows of resultStride floats.
+        @param resultStride Number of floats between channel rows in result (>= n).
+        @param firstchan First channel to evaluate [0..tx->numChannels()-1]
+        @param nchannels Number of channels to evaluate
+        @param n Number of queries
+        @param faceid Array of n face indices
+        @param u Array of n U coordinates
+        @param v Array of n V coordinates
+        @param uw1 Array of n U filter widths 1
+        @param vw1 Array of n V filter widths 1
+        @param uw2 Array of n U filter widths 2
+        @param vw2 Array of n V filter widths 2
+        @param width scale factor for filter width (shared by all queries)
+        @param blur amount to add to filter width (shared by all queries)
+    */
+    PTEXAPI virtual void evalBatch(float* result, int resultStride, int firstchan, int nchannels,
+                                   int n, const int* faceid, const float* u, const float* v,
+                                   const float* uw1, const float* vw1, const float* uw2, const float* vw2,
+                                   float width=1, float blur=0);
+
+    /** Apply filter and compute the derivatives of the result.
+
+        Equivalent to eval(), and also computes the partial derivatives
+        of the result with respect to the lookup position u and v (in
+        the same normalized face coordinates), e.g. for bump mapping.
+        The separable and triangle filters compute the derivatives
+        analytically from the same kernel and texels as the value, in
+        a single pass.  Other filters take forward differences of
+        three eval() calls.
+
+        @param result Buffer to hold filter result (nchannels values).
+        @param dresultdu Buffer to hold d(result)/du (nchannels values).
+        @param dresultdv Buffer to hold d(result)/dv (nchannels values).
+        Remaining parameters are as for eval().
+    */
+    PTEXAPI virtual void evalDeriv(float* result, float* dresultdu, float* dresultdv,
+                                   int firstchan, int nchannels,
+                                   int faceid, float u, float v,
+                                   float uw1, float vw1, float uw2, float vw2,
+                                   float width=1, float blur=0);
+
+    /** Apply filter to several textures at the same location and footprint.
+
+        For layered materials where several textures (e.g. color,
+        specular, roughness) are painted on the same mesh.  The
+        separable filters build the kernel and split it across face
+        edges once, using the filter's own texture, and then apply the
+        resulting kernel pieces to each texture's data, reduced to the
+        texture's face resolution where that is lower (so the filter
+        should be created for the highest resolution texture).  Results
+        match separate eval() calls when the face resolutions match.
+
+        A texture that doesn't share the filter texture's topology
+        (face count, mesh type, border modes or the lookup face's
+        adjacency) is evaluated separately with the filter's options.
+        Other filter types evaluate each texture separately; the
+        default implementation calls eval() for the filter's own
+        texture and a filter with the same options for the others.
+
+        @param ntextures Number of textures.
+        @param textures Textures to filter; the filter's own texture may be included.
+        @param results Result buffer for each texture (nchannels[i] values).
+        @param firstchans First channel to evaluate for each texture.
+        @param nchannels Number of channels to evaluate for each texture.
+        Remaining parameters are as for eval().
+    */
+    PTEXAPI virtual void evalMulti(int ntextures, PtexTexture* const* textures, float* const* results,
+                                   const int* firstchans, const int* nchannels,
+                                   int faceid, float u, float v,
+                                   float uw1, float vw1, float uw2, float vw2,
+                                   float width=1, float blur=0);
+
+ protected:
+    /** Constructor for filter implementations.  The texture and
+        options are used by the default evalMulti() implementation. */
+    PtexFilter(PtexTexture* tx=0, const Options& opts=Options())
+        : _tx(tx), _options(opts)
+    {
+        // if caller was compiled with older version of struct, set default for new opts
+        if (_options.__structSize < (char*)&_options.noedgeblend - (char*)&_options) {
+            _options.noedgeblend = 0;
+        }
+    }
+
+    PtexTexture* _tx;           ///< Texture being evaluated.
+    Options _options;           ///< Filter options.
 };
 
 
@@ -0,0 +1,115 @@
+#include <string>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include "Ptexture.h"
+#include "testutil.h"
+using namespace Ptex;
+
+// Batched filter lookup test.
+//
+// Writes a 2x2 grid of quads with a different resolution on each face,
+// then checks that PtexFilter::evalBatch gives exactly the same results
+// as per-query eval() for every filter type.  The queries come in runs
+// on the same face (as from a shading batch) with positions clustered
+// near the face edges and corners so that most footprints cross into
+// neighboring faces of a different resolution.
+
+static const int nfaces = 4, nchan = 3;
+static TestRandom rnd;
+
+static bool writeTexture(const char* path)
+{
+    // faces 0,1 on the bottom row, 3,2 on the top row, all with the same orientation
+    static const int adjfaces[nfaces][4] = { { -1, 1, 3, -1 }, { -1, -1, 2, 0 },
+                                             { 1, -1, -1, 3 }, { 0, 2, -1, -1 } };
+    static const int adjedges[nfaces][4] = { { 0, 3, 0, 0 }, { 0, 0, 0, 1 },
+                                             { 2, 0, 0, 1 }, { 2, 3, 0, 0 } };
+    static const float origin[nfaces][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+    static const Res res[nfaces] = { Res(5, 5), Res(3, 4), Res(6, 2), Res(4, 4) };
+    TestMesh mesh(mt_quad);
+    for (int faceid = 0; faceid < nfaces; faceid++)
+        mesh.addFace(res[faceid], adjfaces[faceid], adjedges[faceid]);
+
+    return writeTestTexture(path, mesh, dt_float, nchan,
+                            [](float* p, int faceid, int ui, int vi, Res fres) {
+        float x = origin[faceid][0] + (float(ui) + 0.5f) / float(fres.u());
+        float y = origin[faceid][1] + (float(vi) + 0.5f) / float(fres.v());
+        p[0] = testWave(x, y, 5.0f, 3.0f, 0.0f);
+        p[1] = testHash(faceid, ui, vi, fres);
+        p[2] = testChecker(ui, vi);
+    });
+}
+
+
+// coordinate biased toward the face edges
+static float coord()
+{
+    switch (rnd(3)) {
+    case 0: return float(rnd(100)) / 1000.0f;
+    case 1: return 1.0f - float(rnd(100)) / 1000.0f;
+    default: return float(rnd(1001)) / 1000.0f;
+    }
+}
+
+
+int main()
+{
+    if (!writeTexture("batchtest.ptx")) return 1;
+
+    PtexPtr<PtexTexture> r(openTexture("batchtest.ptx"));
+    if (!r) return 1;
+
+    const int n = 300, stride = n + 5;
+    std::vector<int> faceid(n);
+    std::vector<float> u(n), v(n), uw1(n), vw1(n), uw2(n), vw2(n);
+    std::vector<float> result(stride * nchan);
+    int count = 0;
+
+    for (int ft = PtexFilter::f_point; ft <= PtexFilter::f_ewa; ft++) {
+        for (int mode = 0; mode < 4; mode++) {
+            bool lerp = mode & 1, noedgeblend = (mode & 2) != 0;
+            PtexFilter::Options opts(PtexFilter::FilterType(ft), lerp, 0.3f, noedgeblend);
+            PtexPtr<PtexFilter> f(PtexFilter::getFilter(r, opts));
+
+            int face = 0;
+            for (int i = 0; i < n; i++) {
+                if (rnd(6) == 0) face = rnd(nfaces);
+                faceid[i] = rnd(50) == 0 ? -1 : face;
+                u[i] = coord();
+                v[i] = coord();
+                float w = powf(2.0f, -float(rnd(9)) - 0.5f * float(rnd(2)));
+                float skew = float(rnd(3) - 1) * 0.3f;
+                uw1[i] = w;
+                vw1[i] = w * skew;
+                uw2[i] = -w * skew * 0.5f;
+                vw2[i] = w * (0.2f + 0.2f * float(rnd(5)));
+            }
+
+            // invalid faces must leave their results unchanged
+            for (size_t i = 0; i < result.size(); i++) result[i] = -1.0f;
+            f->evalBatch(&result[0], stride, 0, nchan, n, &faceid[0], &u[0], &v[0],
+                         &uw1[0], &vw1[0], &uw2[0], &vw2[0], 1.2f, 0.01f);
+
+            for (int i = 0; i < n; i++) {
+                float expected[nchan] = { -1.0f, -1.0f, -1.0f };
+                f->eval(expected, 0, nchan, faceid[i], u[i], v[i], uw1[i], vw1[i], uw2[i], vw2[i], 1.2f, 0.01f);
+                for (int c = 0; c < nchan; c++) {
+                    if (memcmp(&result[c * stride + i], &expected[c], sizeof(float)) != 0) {
+                        fprintf(stderr, "filter %d lerp %d noedgeblend %d face %d uv (%g, %g) chan %d: "
+                                "%.7f, expected %.7f\n", ft, int(lerp), int(noedgeblend), faceid[i],
+                                u[i], v[i], c, result[c * stride + i], expected[c]);
+                        return 1;
+                    }
+                }
+                count++;
+            }
+        }
+    }
+
+    printf("%d lookups checked\n", count);
+    return 0;
+}
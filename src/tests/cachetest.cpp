@@ -0,0 +1,109 @@
+#include <iostream>
+#include <stdio.h>
+#include <vector>
+#include "Ptexture.h"
+#include "testutil.h"
+using namespace Ptex;
+
+// Cache replacement policy test.
+//
+// A "hot" texture is read repeatedly while a series of "cold" textures
+// is scanned once each through a cache that is much smaller than the
+// scan.  With policy_2q the hot texture is protected once it is reused
+// after losing data, so reading it again after another scan must not
+// read any faces from the file; with policy_lru the scan flushes it.
+
+static const int nfaces = 16, nchan = 4, ncold = 32;
+static const size_t maxMem = 1024 * 1024;
+
+
+static bool writeTexture(const char* path)
+{
+    TestMesh mesh(mt_quad);
+    for (int i = 0; i < nfaces; i++) mesh.addFace(Res(6, 6)); // 16 KiB per face
+    return writeTestTexture(path, mesh, dt_uint8, nchan,
+                            [](float* p, int faceid, int ui, int vi, Res res) {
+        for (int c = 0; c < nchan; c++) p[c] = testHash(faceid, ui, vi, res, 8 + 4 * c);
+    });
+}
+
+
+// read every face, releasing the texture to the cache after each one
+static bool readTexture(PtexCache* cache, const char* path)
+{
+    std::vector<char> buffer;
+    for (int faceid = 0; faceid < nfaces; faceid++) {
+        Ptex::String error;
+        PtexPtr<PtexTexture> tx(cache->get(path, error));
+        if (!tx) {
+            std::cerr << error.c_str() << std::endl;
+            return 0;
+        }
+        Res res = tx->getFaceInfo(faceid).res;
+        buffer.resize(res.size() * nchan);
+        tx->getData(faceid, &buffer[0], 0);
+    }
+    return 1;
+}
+
+
+static bool scan(PtexCache* cache, int first)
+{
+    for (int i = first; i < first + ncold / 2; i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "cachetest_cold%d.ptx", i);
+        if (!readTexture(cache, path)) return 0;
+    }
+    return 1;
+}
+
+
+// number of hot faces read from the file after a scan of the cold textures
+static int hotMisses(PtexCache::Policy policy)
+{
+    PtexPtr<PtexCache> cache(PtexCache::create(0, maxMem, false, 0, 0, false, policy));
+    if (cache->getPolicy() != policy) {
+        std::cerr << "getPolicy returned " << cache->getPolicy() << ", expected " << policy << std::endl;
+        return -1;
+    }
+
+    // use the hot texture, lose some of its data to a scan, then reuse it
+    for (int i = 0; i < 2; i++) if (!readTexture(cache.get(), "cachetest_hot.ptx")) return -1;
+    if (!scan(cache.get(), 0)) return -1;
+    for (int i = 0; i < 2; i++) if (!readTexture(cache.get(), "cachetest_hot.ptx")) return -1;
+
+    // a one-pass scan of other textures, then the hot texture again
+    if (!scan(cache.get(), ncold / 2)) return -1;
+    PtexCache::DetailedStats before, after;
+    cache->getDetailedStats(before);
+    if (!readTexture(cache.get(), "cachetest_hot.ptx")) return -1;
+    cache->getDetailedStats(after);
+    return int(after.faceMisses - before.faceMisses);
+}
+
+
+int main()
+{
+    if (!writeTexture("cachetest_hot.ptx")) return 1;
+    for (int i = 0; i < ncold; i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "cachetest_cold%d.ptx", i);
+        if (!writeTexture(path)) return 1;
+    }
+
+    int lruMisses = hotMisses(PtexCache::policy_lru);
+    int twoqMisses = hotMisses(PtexCache::policy_2q);
+    if (lruMisses < 0 || twoqMisses < 0) return 1;
+    printf("hot texture faces reread after a scan: lru %d, 2q %d\n", lruMisses, twoqMisses);
+
+    // the scan must be large enough to flush the hot texture under lru for the test to mean anything
+    if (lruMisses == 0) {
+        std::cerr << "scan didn't flush the hot texture with policy_lru" << std::endl;
+        return 1;
+    }
+    if (twoqMisses != 0) {
+        std::cerr << "scan flushed the hot texture with policy_2q" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -1,6 +1,6 @@
 message("Run ${CMD} to produce: ${OUT} and compare with: ${DATA}")
 # run the test
-execute_process(COMMAND "${CMD}" OUTPUT_FILE "${OUT}" RESULT_VARIABLE ret)
+execute_process(COMMAND "${CMD}" ${ARGS} OUTPUT_FILE "${OUT}" RESULT_VARIABLE ret)
 if(NOT ${ret} EQUAL 0)
   message(FATAL_ERROR "${CMD} returned a non-zero value:${ret}")
 endif()
@@ -0,0 +1,150 @@
+#include <string>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include "Ptexture.h"
+#include "testutil.h"
+using namespace Ptex;
+
+// Filter derivative test.
+//
+// Writes a smoothly varying quad texture and triangle texture (two
+// faces each, sharing an edge) and checks PtexFilter::evalDeriv for
+// the separable filters and the triangle filter: the value must match
+// eval() exactly, and the derivatives must match central differences
+// of eval() to within a tolerance relative to the derivative's size.
+// The finite differences also pick up the small steps that occur when
+// a texel enters or leaves the kernel; where these are large enough to
+// be detected the sample is skipped.  The triangle kernel is truncated
+// at its edge, so wide triangle footprints take many small steps and
+// are checked with a looser tolerance.
+
+static const float tolerance = 0.02f, triTolerance = 0.1f;
+static const int nchan = 2;
+
+static bool writeTexture(const char* path, MeshType mt)
+{
+    // quads side by side, or triangles sharing their diagonal edge
+    TestMesh mesh(mt);
+    for (int faceid = 0; faceid < 2; faceid++) {
+        int adjfaces[4] = { -1, -1, -1, -1 }, adjedges[4] = { 0, 0, 0, 0 };
+        if (mt == mt_triangle) { adjfaces[1] = 1-faceid; adjedges[1] = 1; }
+        else { adjfaces[faceid ? 3 : 1] = 1-faceid; adjedges[faceid ? 3 : 1] = faceid ? 1 : 3; }
+        mesh.addFace(mt == mt_triangle ? Res(5, 5) : Res(5, 4), adjfaces, adjedges);
+    }
+
+    return writeTestTexture(path, mesh, dt_float, nchan,
+                            [](float* p, int faceid, int ui, int vi, Res res) {
+        float x = (float(ui) + 0.5f) / float(res.u()) + float(faceid);
+        float y = (float(vi) + 0.5f) / float(res.v());
+        p[0] = 0.5f + 0.4f * sinf(2.0f * x + 3.0f * y);
+        p[1] = 0.5f + 0.4f * cosf(4.0f * x - 1.5f * y);
+    });
+}
+
+
+static int check(PtexTexture* tx, PtexFilter::FilterType type, bool lerp, float& maxerr,
+                 int& checked, int& skipped)
+{
+    PtexFilter::Options opts(type, lerp, 0.5f);
+    PtexPtr<PtexFilter> f(PtexFilter::getFilter(tx, opts));
+    bool triangle = tx->meshType() == mt_triangle;
+    float tol = triangle ? triTolerance : tolerance;
+
+    static const float widths[] = { 0.01f, 0.04f, 0.1f, 0.3f };
+    const int nwidths = sizeof(widths)/sizeof(widths[0]);
+    int count = 0;
+    for (int faceid = 0; faceid < 2; faceid++) {
+        for (int wi = 0; wi < nwidths; wi++) {
+            float w = widths[wi];
+            for (int vi = 1; vi < 8; vi++) {
+                for (int ui = 1; ui < 8; ui++) {
+                    float u = (float(ui) + 0.3f) / 8.5f, v = (float(vi) + 0.6f) / 8.5f;
+                    if (triangle && u + v >= 0.95f) continue;
+                    float uw1 = w, vw1 = w * 0.2f, uw2 = -w * 0.1f, vw2 = w * 0.7f;
+                    float result[nchan], du[nchan], dv[nchan], expected[nchan];
+                    f->evalDeriv(result, du, dv, 0, nchan, faceid, u, v, uw1, vw1, uw2, vw2);
+                    f->eval(expected, 0, nchan, faceid, u, v, uw1, vw1, uw2, vw2);
+                    if (memcmp(result, expected, sizeof(result)) != 0) {
+                        fprintf(stderr, "filter %d lerp %d %s face %d width %g uv (%g, %g): "
+                                "value %.7f, expected %.7f\n", int(type), int(lerp),
+                                triangle ? "triangles" : "quads", faceid, w, u, v, result[0], expected[0]);
+                        return -1;
+                    }
+
+                    // skip an axis where the one-sided differences disagree, i.e. where a
+                    // texel enters or leaves the kernel between the sample points
+                    float h = 1e-2f * w;
+                    float u1[nchan], u2[nchan], v1[nchan], v2[nchan];
+                    f->eval(u1, 0, nchan, faceid, u - h, v, uw1, vw1, uw2, vw2);
+                    f->eval(u2, 0, nchan, faceid, u + h, v, uw1, vw1, uw2, vw2);
+                    f->eval(v1, 0, nchan, faceid, u, v - h, uw1, vw1, uw2, vw2);
+                    f->eval(v2, 0, nchan, faceid, u, v + h, uw1, vw1, uw2, vw2);
+                    for (int c = 0; c < nchan; c++) {
+                        float fd[2] = { (u2[c] - u1[c]) / (2 * h), (v2[c] - v1[c]) / (2 * h) };
+                        float step[2] = { (u2[c] - 2 * result[c] + u1[c]) / h,
+                                          (v2[c] - 2 * result[c] + v1[c]) / h };
+                        float d[2] = { du[c], dv[c] };
+                        float scale = 1.0f + fabsf(fd[0]) + fabsf(fd[1]);
+                        for (int axis = 0; axis < 2; axis++) {
+                            if (fabsf(step[axis]) > tolerance * scale) { skipped++; continue; }
+                            float err = fabsf(d[axis] - fd[axis]) / scale;
+                            if (err > maxerr) maxerr = err;
+                            if (!(err <= tol)) {
+                                fprintf(stderr, "filter %d lerp %d %s face %d width %g uv (%g, %g) chan %d: "
+                                        "d/d%c %g, expected %g\n", int(type), int(lerp),
+                                        triangle ? "triangles" : "quads", faceid, w, u, v, c,
+                                        axis ? 'v' : 'u', d[axis], fd[axis]);
+                                return -1;
+                            }
+                            checked++;
+                        }
+                    }
+                    count++;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+
+int main()
+{
+    if (!writeTexture("derivtest.ptx", mt_quad)) return 1;
+    if (!writeTexture("derivtest_tri.ptx", mt_triangle)) return 1;
+
+    PtexPtr<PtexTexture> quads(openTexture("derivtest.ptx"));
+    PtexPtr<PtexTexture> tris(openTexture("derivtest_tri.ptx"));
+    if (!quads || !tris) return 1;
+
+    // the separable filters (the triangle filter is used for all types on triangle meshes)
+    static const PtexFilter::FilterType types[] = {
+        PtexFilter::f_bilinear, PtexFilter::f_box, PtexFilter::f_gaussian, PtexFilter::f_bicubic,
+        PtexFilter::f_bspline, PtexFilter::f_catmullrom, PtexFilter::f_mitchell };
+    const int ntypes = sizeof(types)/sizeof(types[0]);
+
+    float maxerr = 0;
+    int count = 0, checked = 0, skipped = 0;
+    for (int lerp = 0; lerp < 2; lerp++) {
+        for (int ti = 0; ti < ntypes; ti++) {
+            int n = check(quads, types[ti], lerp, maxerr, checked, skipped);
+            if (n < 0) return 1;
+            count += n;
+        }
+        int n = check(tris, PtexFilter::f_gaussian, lerp, maxerr, checked, skipped);
+        if (n < 0) return 1;
+        count += n;
+    }
+
+    printf("%d lookups, %d derivatives checked (%d skipped), max error %g\n",
+           count, checked, skipped, maxerr);
+    if (skipped > checked / 10) {
+        std::cerr << "Too many derivatives skipped" << std::endl;
+        return 1;
+    }
+    return 0;
+}
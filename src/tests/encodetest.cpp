@@ -0,0 +1,91 @@
+#include <iostream>
+#include <stdio.h>
+#include <vector>
+#include "Ptexture.h"
+#include "testutil.h"
+using namespace Ptex;
+
+// Parallel face compression test.
+//
+// Writes textures whose faces are mostly large enough to be compressed
+// on the compute thread pool (including tiled faces, constant faces and
+// premultiplied alpha reductions) and checks a checksum of each file
+// against that of the same file written by the original serial writer.
+// The files must be byte-identical no matter how the faces were
+// scheduled.
+
+struct Golden {
+    const char* path;
+    MeshType mt;
+    DataType dt;
+    int nchan, alphachan;
+    uint32_t checksum;          // of the file written by the serial writer
+};
+
+static const Golden golden[] = {
+    { "encodetest_quad.ptx", mt_quad, dt_uint16, 4, 3, 0x441456ea },
+    { "encodetest_tri.ptx", mt_triangle, dt_float, 3, -1, 0xeb75238a },
+};
+static const int nfaces = 96;
+
+
+static Res faceRes(MeshType mt, int faceid)
+{
+    // mostly 4 KiB and up; a few small faces and a few tiled ones
+    int ulog2 = 3 + faceid % 5 + (faceid % 23 == 0 ? 2 : 0);
+    int vlog2 = mt == mt_triangle ? ulog2 : 3 + faceid / 5 % 5;
+    return Res(int8_t(ulog2), int8_t(vlog2));
+}
+
+
+static bool writeTexture(const Golden& g)
+{
+    TestMesh mesh(g.mt);
+    for (int i = 0; i < nfaces; i++) mesh.addFace(faceRes(g.mt, i));
+    int nchan = g.nchan;
+    return writeTestTexture(g.path, mesh, g.dt, nchan,
+                            [nchan](float* p, int faceid, int ui, int vi, Res res) {
+        // ramps and noise (integer based, so that the data is the same on every platform)
+        for (int c = 0; c < nchan; c++) {
+            if (faceid % 7 == 3) p[c] = float(c + 1) / 5.0f; // constant face
+            else if (c % 2) p[c] = testHash(faceid, ui, vi, res, 8 + 4 * c);
+            else p[c] = float(ui + vi + c) / float(res.u() + res.v() + 4);
+        }
+    }, g.alphachan);
+}
+
+
+// FNV-1a of the file contents
+static bool checksum(const char* path, uint32_t& hash)
+{
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        std::cerr << "can't open " << path << std::endl;
+        return 0;
+    }
+    hash = 2166136261u;
+    char buff[65536];
+    size_t size;
+    while ((size = fread(buff, 1, sizeof(buff), fp)) > 0) {
+        for (size_t i = 0; i < size; i++) hash = (hash ^ uint8_t(buff[i])) * 16777619u;
+    }
+    fclose(fp);
+    return 1;
+}
+
+
+int main()
+{
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(golden) / sizeof(golden[0]); i++) {
+        const Golden& g = golden[i];
+        uint32_t hash;
+        if (!writeTexture(g) || !checksum(g.path, hash)) return 1;
+        printf("%s: %08x\n", g.path, hash);
+        if (hash != g.checksum) {
+            fprintf(stderr, "%s checksum is %08x, expected %08x\n", g.path, hash, g.checksum);
+            failed = 1;
+        }
+    }
+    return failed;
+}
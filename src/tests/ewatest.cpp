@@ -0,0 +1,123 @@
+#include <string>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include "Ptexture.h"
+#include "testutil.h"
+using namespace Ptex;
+
+// EWA filter regression test.
+//
+// Writes a small quad mesh with subfaces and evaluates the EWA filter
+// over a grid of lookups and filter widths, checking each result
+// against the reference values in ewatestok.dat.  Lookups near the
+// face edges carry the kernel across main face / subface transitions
+// (in both directions), around corners, and into a rotated neighbor.
+// The gaussian weights may be computed with a fast exp approximation,
+// so results are compared with a tolerance rather than exactly.
+//
+// Usage: ewatest ewatestok.dat  (check results against reference)
+//        ewatest                (print results, e.g. to regenerate reference)
+
+static const float tolerance = 1e-4f;
+static const int nfaces = 7, nchan = 3;
+
+static bool writeTexture(const char* path)
+{
+    // face 0 is the unit square; its right neighbor is split into subfaces 1-4
+    // (1,2 on the bottom row, 4,3 on the top row), face 5 is above face 0 and
+    // face 6 is to the left of face 0, rotated so that its bottom edge is shared
+    static const int adjfaces[nfaces][4] = { { -1, 1, 5, 6 }, { -1, 2, 4, 0 }, { -1, -1, 3, 1 },
+                                             { 2, -1, -1, 4 }, { 1, 3, -1, 0 }, { 0, -1, -1, -1 },
+                                             { 0, -1, -1, -1 } };
+    static const int adjedges[nfaces][4] = { { 0, 3, 0, 0 }, { 0, 3, 0, 1 }, { 0, 0, 0, 1 },
+                                             { 2, 0, 0, 1 }, { 2, 3, 0, 1 }, { 2, 0, 0, 0 },
+                                             { 3, 0, 0, 0 } };
+    static const bool subface[nfaces] = { 0, 1, 1, 1, 1, 0, 0 };
+    static const Res res[nfaces] = { Res(5, 5), Res(4, 4), Res(3, 4), Res(4, 4), Res(4, 2),
+                                     Res(5, 3), Res(3, 6) };
+    TestMesh mesh(mt_quad);
+    for (int faceid = 0; faceid < nfaces; faceid++)
+        mesh.addFace(res[faceid], adjfaces[faceid], adjedges[faceid], subface[faceid]);
+
+    return writeTestTexture(path, mesh, dt_float, nchan,
+                            [](float* p, int faceid, int ui, int vi, Res fres) {
+        float x = (float(ui) + 0.5f) / float(fres.u()), y = (float(vi) + 0.5f) / float(fres.v());
+        p[0] = testWave(x, y, 9.0f, 5.0f, float(faceid));
+        p[1] = testHash(faceid, ui, vi, fres);
+        p[2] = testChecker(ui, vi);
+    });
+}
+
+
+int main(int argc, char** argv)
+{
+    FILE* ref = 0;
+    if (argc >= 2) {
+        ref = fopen(argv[1], "r");
+        if (!ref) {
+            std::cerr << "Can't open " << argv[1] << std::endl;
+            return 1;
+        }
+    }
+
+    if (!writeTexture("ewatest.ptx")) return 1;
+
+    PtexPtr<PtexTexture> r(openTexture("ewatest.ptx"));
+    if (!r) return 1;
+
+    PtexFilter::Options opts(PtexFilter::f_ewa);
+    PtexPtr<PtexFilter> f(PtexFilter::getFilter(r, opts));
+
+    // the main face, a primary and a secondary subface, and the two plain neighbors
+    static const int faces[] = { 0, 1, 4, 5, 6 };
+    static const float widths[] = { 0.002f, 0.02f, 0.08f, 0.2f, 0.5f };
+    const int nlookupfaces = sizeof(faces)/sizeof(faces[0]);
+    const int nwidths = sizeof(widths)/sizeof(widths[0]);
+    float maxdiff = 0;
+    int count = 0;
+    for (int fi = 0; fi < nlookupfaces; fi++) {
+        int faceid = faces[fi];
+        for (int wi = 0; wi < nwidths; wi++) {
+            float w = widths[wi];
+            for (int vi = 0; vi <= 4; vi++) {
+                for (int ui = 0; ui <= 4; ui++) {
+                    float u = float(ui) / 4.0f, v = float(vi) / 4.0f;
+                    float result[3];
+                    // anisotropic footprint, skewed against the texel grid
+                    f->eval(result, 0, 3, faceid, u, v, w, w * 0.3f, -w * 0.2f, w * 0.6f);
+                    if (!ref) {
+                        printf("%d %g %g %g -> %.7f %.7f %.7f\n", faceid, w, u, v,
+                               result[0], result[1], result[2]);
+                        continue;
+                    }
+                    int rf;
+                    float rw, ru, rv, expected[3];
+                    if (fscanf(ref, "%d %g %g %g -> %g %g %g", &rf, &rw, &ru, &rv,
+                               &expected[0], &expected[1], &expected[2]) != 7) {
+                        std::cerr << "Reference data is incomplete" << std::endl;
+                        return 1;
+                    }
+                    for (int c = 0; c < 3; c++) {
+                        float diff = fabsf(result[c] - expected[c]);
+                        if (diff > maxdiff) maxdiff = diff;
+                        if (!(diff <= tolerance)) {
+                            fprintf(stderr, "face %d width %g uv (%g, %g) chan %d: %.7f, expected %.7f\n",
+                                    faceid, w, u, v, c, result[c], expected[c]);
+                            return 1;
+                        }
+                    }
+                    count++;
+                }
+            }
+        }
+    }
+
+    if (ref) {
+        fclose(ref);
+        printf("%d lookups checked, max deviation %g\n", count, maxdiff);
+    }
+    return 0;
+}
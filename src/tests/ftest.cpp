@@ -2,13 +2,17 @@
 #include <iostream>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "Ptexture.h"
 using namespace Ptex;
 
 int main(int argc, char** argv)
 {
-    int maxmem = argc >= 2 ? atoi(argv[1]) : 1024*1024;
-    PtexPtr<PtexCache> c(PtexCache::create(0, maxmem));
+    // usage: ftest [-m] [maxmem]   (-m: read the file memory mapped)
+    bool memoryMapped = argc >= 2 && strcmp(argv[1], "-m") == 0;
+    int argi = memoryMapped ? 2 : 1;
+    int maxmem = argc > argi ? atoi(argv[argi]) : 1024*1024;
+    PtexPtr<PtexCache> c(PtexCache::create(0, maxmem, false, 0, 0, memoryMapped));
 
     Ptex::String error;
     PtexPtr<PtexTexture> r ( c->get("test.ptx", error) );
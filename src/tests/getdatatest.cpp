@@ -0,0 +1,135 @@
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "Ptexture.h"
+#include "testutil.h"
+using namespace Ptex;
+
+// Batched getData test.
+//
+// Writes a texture with a mix of small, large (tiled) and constant faces
+// of mostly incompressible data, with long enough stretches of untiled
+// faces that the batched reads cross the coalesced read size limit
+// (CoalesceMax) and are split into several runs, and checks that the
+// batched getData gives exactly the same data as per-face getData calls,
+// for all faces in file order and for shuffled subsets with repeated
+// faces and padded strides, reading serially and in parallel, through
+// buffered and memory-mapped reads and through a cache.
+
+static const int nfaces = 160, nchan = 4;
+static const DataType dt = dt_uint16;
+static const char* path = "getdatatest.ptx";
+static TestRandom rnd;
+
+
+static Res faceRes(int faceid)
+{
+    // two tiled faces (256x256, 512 KiB); the rest are 8 to 32 KiB, with
+    // over 2 MiB of them in a row between the tiled faces
+    if (faceid == 20 || faceid == 140) return Res(8, 8);
+    return Res(int8_t(5 + faceid % 2), int8_t(5 + faceid / 2 % 2));
+}
+
+
+static bool writeTexture()
+{
+    TestMesh mesh(mt_quad);
+    for (int i = 0; i < nfaces; i++) mesh.addFace(faceRes(i));
+    return writeTestTexture(path, mesh, dt, nchan,
+                            [](float* p, int faceid, int, int, Res) {
+        for (int c = 0; c < nchan; c++)
+            p[c] = faceid % 9 == 0 ? float(c + 1) / 8.0f // constant face
+                                   : float(rnd(65536)) / 65535.0f;
+    });
+}
+
+
+struct Batch {
+    std::vector<int> faceids;
+    std::vector<int> strides;
+    std::vector<std::vector<char> > data;
+    std::vector<void*> buffers;
+
+    void init(PtexTexture* tx, bool padded)
+    {
+        int pixelsize = nchan * DataSize(dt);
+        data.resize(faceids.size());
+        strides.resize(faceids.size());
+        buffers.resize(faceids.size());
+        for (size_t i = 0; i < faceids.size(); i++) {
+            Res res = tx->getFaceInfo(faceids[i]).res;
+            strides[i] = res.u() * pixelsize + (padded ? pixelsize * (1 + rnd(3)) : 0);
+            data[i].assign(strides[i] * res.v(), char(0x5a));
+            buffers[i] = &data[i][0];
+        }
+    }
+};
+
+
+static bool check(PtexTexture* tx, const char* what, bool padded, bool parallel)
+{
+    Batch batch;
+    if (padded) {
+        for (int i = 0, n = 1 + rnd(2 * nfaces); i < n; i++) batch.faceids.push_back(rnd(nfaces));
+    }
+    else {
+        for (int i = 0; i < nfaces; i++) batch.faceids.push_back(i);
+    }
+    batch.init(tx, padded);
+
+    // the same faces read one at a time by a fresh reader
+    Batch expected = batch;
+    PtexPtr<PtexTexture> ref(openTexture(path));
+    if (!ref) return 0;
+    for (size_t i = 0; i < expected.faceids.size(); i++)
+        ref->getData(expected.faceids[i], &expected.data[i][0], expected.strides[i]);
+
+    tx->getData(&batch.faceids[0], int(batch.faceids.size()), &batch.buffers[0],
+                padded ? &batch.strides[0] : 0, parallel);
+    for (size_t i = 0; i < batch.faceids.size(); i++) {
+        if (batch.data[i] != expected.data[i]) {
+            std::cerr << what << (padded ? ", padded" : "") << (parallel ? ", parallel" : "")
+                      << ": face " << batch.faceids[i] << " differs" << std::endl;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+int main()
+{
+    if (!writeTexture()) return 1;
+
+    int count = 0;
+    for (int pass = 0; pass < 8; pass++) {
+        bool padded = (pass & 1) != 0, parallel = (pass & 2) != 0, memoryMapped = (pass & 4) != 0;
+        const char* what = memoryMapped ? "memory mapped" : "buffered";
+
+        // a fresh reader, so that nothing is loaded yet
+        Ptex::String error;
+        PtexPtr<PtexTexture> tx(PtexTexture::open(path, error, false, memoryMapped));
+        if (!tx) {
+            std::cerr << error.c_str() << std::endl;
+            return 1;
+        }
+        if (!check(tx.get(), what, padded, parallel)) return 1;
+        // again, now that some of the faces are loaded
+        if (!check(tx.get(), what, padded, parallel)) return 1;
+
+        // through a cache
+        PtexPtr<PtexCache> cache(PtexCache::create(0, 0, false, 0, 0, memoryMapped));
+        tx.reset(cache->get(path, error));
+        if (!tx) {
+            std::cerr << error.c_str() << std::endl;
+            return 1;
+        }
+        if (!check(tx.get(), "cached", padded, parallel)) return 1;
+        tx.reset(0);
+        count += 3;
+    }
+
+    printf("%d batches checked\n", count);
+    return 0;
+}
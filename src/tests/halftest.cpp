@@ -349,6 +349,42 @@ int overflowtestall()
 }
 
 
+#ifndef OPEN_EXR
+int bulkcheck()
+{
+    // bulk (SIMD) conversion must match the scalar conversion
+    // (nans are skipped, hardware conversion may quiet them)
+    int count = 0;
+    static H h[65536], h2[65536];
+    static float f[65536];
+    for (int i = 0; i < 65536; i++) h[i].bits = uint16_t(i);
+    PtexHalf::toFloat(f, h, 65536);
+    for (int i = 0; i < 65536; i++) {
+        float expected = h2f(i);
+        if (expected != expected) continue;
+        if (memcmp(&f[i], &expected, 4)) {
+            printf("error: bulk 0x%x -> %g, expected %g\n", i, f[i], expected);
+            count++;
+        }
+    }
+
+    // sample the whole float range, including denormals, inf and nan
+    for (uint64_t base = 0; base < 0x100000000ull; base += 65536 * 997ull) {
+        for (int i = 0; i < 65536; i++) f[i] = bitsToFloat(uint32_t(base + uint64_t(i) * 997));
+        PtexHalf::fromFloat(h2, f, 65536);
+        for (int i = 0; i < 65536; i++) {
+            if (h2[i].bits != f2h(f[i])) {
+                printf("error: bulk %g(0x%0x) -> 0x%x, expected 0x%x\n",
+                       f[i], floatToBits(f[i]), h2[i].bits, f2h(f[i]));
+                if (++count > 10) return count;
+            }
+        }
+    }
+    return count;
+}
+#endif
+
+
 int test(const char* name, int (*fn)())
 {
     printf("%s...\n", name);
@@ -368,6 +404,9 @@ int testall(bool fulltest)
     total += test("Nan conversion", nancheck);
     total += test("Overflow", overflowtestall);
     total += test("Rounding", fulltest ? testroundall : testroundsome);
+#ifndef OPEN_EXR
+    total += test("Bulk conversion", bulkcheck);
+#endif
     if (!total)
         printf("halftest: all tests passed.\n");
     else
@@ -0,0 +1,157 @@
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "Ptexture.h"
+#include "testutil.h"
+using namespace Ptex;
+
+// Multi-producer writer test.
+//
+// Writes the same texture twice, once serially and once with
+// writeFace / writeConstantFace called from several threads at once
+// (in an order unrelated to the face ids), and checks that the two
+// files are byte-identical.  The same is then done for a
+// non-incremental edit of each file.
+
+static const int nfaces = 64, nchan = 4, alpha = 3, nthreads = 4;
+static const DataType dt = dt_uint16;
+
+struct Face {
+    FaceInfo info;
+    bool isconst;
+    std::vector<uint16_t> data;
+};
+
+
+static void makeFaces(std::vector<Face>& faces, unsigned seed)
+{
+    // a strip of faces with a mix of sizes, some large enough to be compressed in the background
+    TestRandom rnd(seed);
+    faces.resize(nfaces);
+    for (int i = 0; i < nfaces; i++) {
+        Face& f = faces[i];
+        Res res(int8_t(rnd(9)), int8_t(rnd(9)));
+        int adjfaces[4] = { -1, i + 1 < nfaces ? i + 1 : -1, -1, i ? i - 1 : -1 }, adjedges[4] = { 0, 3, 0, 1 };
+        f.info = FaceInfo(res, adjfaces, adjedges);
+        f.isconst = rnd(7) == 0;
+        f.data.resize(res.size() * nchan);
+        int ures = res.u();
+        for (int j = 0; j < res.size(); j++) {
+            int u = j % ures, v = j / ures;
+            for (int c = 0; c < nchan; c++) {
+                f.data[j * nchan + c] = f.isconst ? uint16_t(1000 * (c + 1) + i)
+                                                  : uint16_t((u * 37 + v * 101 + c * 4099 + i * 7919) & 0xffff);
+            }
+        }
+    }
+}
+
+
+static bool writeFace(PtexWriter* w, int faceid, const Face& f)
+{
+    return f.isconst ? w->writeConstantFace(faceid, f.info, &f.data[0])
+                     : w->writeFace(faceid, f.info, &f.data[0]);
+}
+
+
+static bool writeTexture(PtexWriter* w, const std::vector<Face>& faces, bool multi,
+                         int firstface, int step)
+{
+    if (!w) return 0;
+    w->writeMeta("name", "mpwtest");
+    int ok = 1;
+    if (!multi) {
+        for (int i = firstface; i < nfaces; i += step)
+            if (!writeFace(w, i, faces[i])) ok = 0;
+    }
+    else {
+        // each thread writes every nthreads-th face, in decreasing order
+        std::vector<std::thread> threads;
+        std::vector<int> threadok(nthreads, 1);
+        for (int t = 0; t < nthreads; t++) {
+            threads.push_back(std::thread([&, t]() {
+                for (int i = nfaces - 1 - t; i >= firstface; i -= nthreads) {
+                    if ((i - firstface) % step == 0 && !writeFace(w, i, faces[i]))
+                        threadok[t] = 0;
+                }
+            }));
+        }
+        for (int t = 0; t < nthreads; t++) {
+            threads[t].join();
+            if (!threadok[t]) ok = 0;
+        }
+    }
+    Ptex::String error;
+    if (!w->close(error)) {
+        std::cerr << error.c_str() << std::endl;
+        ok = 0;
+    }
+    w->release();
+    return ok;
+}
+
+
+static bool readFile(const char* path, std::vector<char>& contents)
+{
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return 0;
+    char buff[4096];
+    size_t n;
+    contents.clear();
+    while ((n = fread(buff, 1, sizeof(buff), fp)) > 0) contents.insert(contents.end(), buff, buff + n);
+    fclose(fp);
+    return 1;
+}
+
+
+static bool compareFiles(const char* path1, const char* path2)
+{
+    std::vector<char> data1, data2;
+    if (!readFile(path1, data1) || !readFile(path2, data2)) {
+        std::cerr << "Can't read " << path1 << " or " << path2 << std::endl;
+        return 0;
+    }
+    if (data1 != data2) {
+        std::cerr << path2 << " differs from " << path1 << std::endl;
+        return 0;
+    }
+    return 1;
+}
+
+
+int main(int /*argc*/, char** /*argv*/)
+{
+    std::vector<Face> faces, edits;
+    makeFaces(faces, 7);
+    makeFaces(edits, 11);
+
+    const char* paths[2] = { "mpwtest_serial.ptx", "mpwtest_multi.ptx" };
+    Ptex::String error;
+    for (int multi = 0; multi < 2; multi++) {
+        PtexWriter* w = multi ?
+            PtexWriter::open(paths[multi], mt_quad, dt, nchan, alpha, nfaces, error, true, true) :
+            PtexWriter::open(paths[multi], mt_quad, dt, nchan, alpha, nfaces, error);
+        if (!writeTexture(w, faces, multi, 0, 1)) {
+            std::cerr << "Write failed: " << error.c_str() << std::endl;
+            return 1;
+        }
+    }
+    if (!compareFiles(paths[0], paths[1])) return 1;
+
+    // rewrite every third face
+    for (int multi = 0; multi < 2; multi++) {
+        PtexWriter* w = multi ?
+            PtexWriter::edit(paths[multi], false, mt_quad, dt, nchan, alpha, nfaces, error, true, true) :
+            PtexWriter::edit(paths[multi], false, mt_quad, dt, nchan, alpha, nfaces, error);
+        if (!writeTexture(w, edits, multi, 1, 3)) {
+            std::cerr << "Edit failed: " << error.c_str() << std::endl;
+            return 1;
+        }
+    }
+    if (!compareFiles(paths[0], paths[1])) return 1;
+
+    return 0;
+}
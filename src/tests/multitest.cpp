@@ -0,0 +1,128 @@
+#include <string>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include "Ptexture.h"
+#include "testutil.h"
+using namespace Ptex;
+
+// Layered filter lookup test.
+//
+// Writes several layers painted on the same mesh (with different data
+// types and channel counts) plus a layer with different topology, and
+// checks that PtexFilter::evalMulti gives exactly the same results as
+// a separate eval() on each layer with the same filter options, for
+// every filter type on a 2x2 quad grid and a pair of triangles.
+
+static const int maxchan = 4;
+
+static bool writeTexture(const char* path, MeshType mt, DataType dt, int nchan,
+                         bool connected, float seed)
+{
+    // quads: faces 0,1 on the bottom row, 3,2 on the top row, all with the same orientation
+    // triangles: two triangles sharing their diagonal edge
+    static const int quadfaces[4][4] = { { -1, 1, 3, -1 }, { -1, -1, 2, 0 }, { 1, -1, -1, 3 }, { 0, 2, -1, -1 } };
+    static const int quadedges[4][4] = { { 0, 3, 0, 0 }, { 0, 0, 0, 1 }, { 2, 0, 0, 1 }, { 2, 3, 0, 0 } };
+    static const int trifaces[2][4] = { { -1, 1, -1, -1 }, { -1, 0, -1, -1 } };
+    static const int triedges[2][4] = { { 0, 1, 0, 0 }, { 0, 1, 0, 0 } };
+    static const Res quadres[4] = { Res(5, 5), Res(3, 4), Res(6, 2), Res(4, 4) };
+    TestMesh mesh(mt);
+    for (int faceid = 0; faceid < (mt == mt_triangle ? 2 : 4); faceid++) {
+        Res res = mt == mt_triangle ? Res(5, 5) : quadres[faceid];
+        if (!connected) mesh.addFace(res);
+        else if (mt == mt_triangle) mesh.addFace(res, trifaces[faceid], triedges[faceid]);
+        else mesh.addFace(res, quadfaces[faceid], quadedges[faceid]);
+    }
+
+    return writeTestTexture(path, mesh, dt, nchan,
+                            [=](float* p, int faceid, int ui, int vi, Res res) {
+        float x = (float(ui) + 0.5f) / float(res.u()), y = (float(vi) + 0.5f) / float(res.v());
+        for (int c = 0; c < nchan; c++)
+            p[c] = c % 2 ? testHash(faceid, ui, vi, res, 8 + 4 * c)
+                         : testWave(x, y, 7.0f, 3.0f, seed + float(faceid + c));
+    });
+}
+
+
+static TestRandom rnd;
+
+
+static int check(PtexTexture* const* layers, int nlayers, const int* firstchans, const int* nchannels)
+{
+    MeshType mt = layers[0]->meshType();
+    int nfaces = layers[0]->numFaces();
+    int count = 0;
+    for (int ft = PtexFilter::f_point; ft <= PtexFilter::f_ewa; ft++) {
+        for (int lerp = 0; lerp < 2; lerp++) {
+            PtexFilter::Options opts(PtexFilter::FilterType(ft), lerp, 0.3f);
+            PtexPtr<PtexFilter> f(PtexFilter::getFilter(layers[0], opts));
+            std::vector<PtexFilter*> single(nlayers);
+            for (int i = 0; i < nlayers; i++) single[i] = PtexFilter::getFilter(layers[i], opts);
+
+            for (int q = 0; q < 200; q++) {
+                int faceid = rnd(nfaces);
+                float u = float(rnd(1001)) / 1000.0f, v = float(rnd(1001)) / 1000.0f;
+                if (mt == mt_triangle && u + v > 1.0f) { u = 1.0f - u; v = 1.0f - v; }
+                float w = powf(2.0f, -float(rnd(8)) - 0.5f * float(rnd(2)));
+                float uw1 = w, vw1 = w * 0.2f, uw2 = -w * 0.1f, vw2 = w * 0.8f;
+
+                float results[8][maxchan], expected[8][maxchan];
+                float* resultptrs[8];
+                memset(results, 0, sizeof(results));
+                memset(expected, 0, sizeof(expected));
+                for (int i = 0; i < nlayers; i++) resultptrs[i] = results[i];
+                f->evalMulti(nlayers, layers, resultptrs, firstchans, nchannels,
+                             faceid, u, v, uw1, vw1, uw2, vw2);
+                for (int i = 0; i < nlayers; i++) {
+                    single[i]->eval(expected[i], firstchans[i], nchannels[i],
+                                    faceid, u, v, uw1, vw1, uw2, vw2);
+                    if (memcmp(results[i], expected[i], sizeof(float) * nchannels[i]) != 0) {
+                        fprintf(stderr, "%s filter %d lerp %d layer %d face %d uv (%g, %g) width %g: "
+                                "%.7f, expected %.7f\n", mt == mt_triangle ? "triangles" : "quads",
+                                ft, lerp, i, faceid, u, v, w, results[i][0], expected[i][0]);
+                        for (int j = 0; j < nlayers; j++) single[j]->release();
+                        return -1;
+                    }
+                }
+                count++;
+            }
+            for (int i = 0; i < nlayers; i++) single[i]->release();
+        }
+    }
+    return count;
+}
+
+
+int main()
+{
+    // layers 0-2 share the mesh; layer 3 has no adjacency and is evaluated separately
+    static const MeshType meshTypes[] = { mt_quad, mt_triangle };
+    static const DataType dataTypes[] = { dt_float, dt_uint8, dt_half, dt_uint16 };
+    static const int layerChannels[] = { 3, 1, 4, 2 };
+    static const int firstchans[] = { 0, 0, 1, 0 }, nchannels[] = { 3, 1, 3, 2 };
+    const int nlayers = 4;
+
+    int count = 0;
+    for (int m = 0; m < 2; m++) {
+        PtexPtr<PtexTexture> tex[nlayers];
+        PtexTexture* layers[nlayers];
+        for (int i = 0; i < nlayers; i++) {
+            char path[64];
+            snprintf(path, sizeof(path), "multitest%d_%d.ptx", m, i);
+            if (!writeTexture(path, meshTypes[m], dataTypes[i], layerChannels[i], i < 3, float(i)))
+                return 1;
+            tex[i].reset(openTexture(path));
+            if (!tex[i]) return 1;
+            layers[i] = tex[i].get();
+        }
+        int n = check(layers, nlayers, firstchans, nchannels);
+        if (n < 0) return 1;
+        count += n;
+    }
+
+    printf("%d lookups checked\n", count);
+    return 0;
+}
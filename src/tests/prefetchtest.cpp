@@ -0,0 +1,118 @@
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "Ptexture.h"
+#include "testutil.h"
+using namespace Ptex;
+
+// Background prefetch test.
+//
+// Queues prefetches of every face and then, while the loads are still
+// in flight, releases the texture, purges it from a cache, or releases
+// the whole cache.  None of these may hang or crash, and data read
+// after a prefetch (complete or not) must match data read without one.
+
+static const int nfaces = 48, nchan = 4, iterations = 20;
+static const char* path = "prefetchtest.ptx";
+
+
+static bool writeTexture()
+{
+    // large enough faces that the loads take a while, some of them tiled
+    TestMesh mesh(mt_quad);
+    for (int i = 0; i < nfaces; i++) mesh.addFace(Res(int8_t(5 + i % 4), int8_t(5 + i / 4 % 4)));
+    return writeTestTexture(path, mesh, dt_uint16, nchan,
+                            [](float* p, int faceid, int ui, int vi, Res res) {
+        float x = (float(ui) + 0.5f) / float(res.u()), y = (float(vi) + 0.5f) / float(res.v());
+        for (int c = 0; c < nchan; c++)
+            p[c] = c % 2 ? testHash(faceid, ui, vi, res, 8 + 4 * c) : testWave(x, y, 9.0f, 5.0f, float(faceid + c));
+    });
+}
+
+
+static void readFaces(PtexTexture* tx, std::vector<std::vector<char> >& data)
+{
+    data.resize(nfaces);
+    for (int faceid = 0; faceid < nfaces; faceid++) {
+        Res res = tx->getFaceInfo(faceid).res;
+        data[faceid].resize(res.size() * nchan * DataSize(tx->dataType()));
+        tx->getData(faceid, &data[faceid][0], 0);
+    }
+}
+
+
+static bool check(PtexTexture* tx, const std::vector<std::vector<char> >& expected, const char* what)
+{
+    std::vector<std::vector<char> > data;
+    readFaces(tx, data);
+    for (int faceid = 0; faceid < nfaces; faceid++) {
+        if (data[faceid] != expected[faceid]) {
+            std::cerr << "face " << faceid << " data differs after " << what << std::endl;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+static void prefetchAll(PtexTexture* tx)
+{
+    int faceids[nfaces];
+    for (int i = 0; i < nfaces; i++) faceids[i] = nfaces - 1 - i;
+    tx->prefetch(faceids, nfaces);
+}
+
+
+int main()
+{
+    if (!writeTexture()) return 1;
+
+    std::vector<std::vector<char> > expected;
+    {
+        PtexPtr<PtexTexture> tx(openTexture(path));
+        if (!tx) return 1;
+        readFaces(tx.get(), expected);
+    }
+
+    for (int i = 0; i < iterations; i++) {
+        // release a texture with prefetches in flight
+        PtexPtr<PtexTexture> tx(openTexture(path));
+        if (!tx) return 1;
+        prefetchAll(tx.get());
+        tx.reset(0);
+
+        // read while prefetches are in flight
+        tx.reset(openTexture(path));
+        if (!tx) return 1;
+        prefetchAll(tx.get());
+        if (!check(tx.get(), expected, "prefetch")) return 1;
+
+        // purge a cached texture with prefetches in flight, then read it again
+        PtexPtr<PtexCache> cache(PtexCache::create(0, 0));
+        Ptex::String error;
+        tx.reset(cache->get(path, error));
+        if (!tx) {
+            std::cerr << error.c_str() << std::endl;
+            return 1;
+        }
+        prefetchAll(tx.get());
+        cache->purge(tx.get());
+        tx.reset(0);
+        tx.reset(cache->get(path, error));
+        if (!tx) {
+            std::cerr << error.c_str() << std::endl;
+            return 1;
+        }
+        if (!check(tx.get(), expected, "purge")) return 1;
+
+        // release the cache with prefetches in flight (and the texture released)
+        cache->purgeAll();
+        prefetchAll(tx.get());
+        tx.reset(0);
+        cache.reset(0);
+    }
+
+    printf("%d iterations\n", iterations);
+    return 0;
+}
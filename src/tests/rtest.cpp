@@ -4,6 +4,7 @@
 #include "Ptexture.h"
 #include <cstdlib>
 #include <cstdio> // printf()
+#include <cstring>
 using namespace Ptex;
 
 void DumpData(Ptex::Res res, Ptex::DataType dt, int nchan, void* data, std::string prefix)
@@ -92,10 +93,12 @@ void DumpMetaData(PtexMetaData* meta)
     }
 }
 
-int main(int /*argc*/, char** /*argv*/)
+int main(int argc, char** argv)
 {
+    // -m: read the file memory mapped
+    bool memoryMapped = argc >= 2 && strcmp(argv[1], "-m") == 0;
     Ptex::String error;
-    PtexPtr<PtexCache> c(PtexCache::create(0,0));
+    PtexPtr<PtexCache> c(PtexCache::create(0,0,false,0,0,memoryMapped));
     c->setSearchPath("foo/bar:.");
     PtexPtr<PtexTexture> r(c->get("test.ptx", error));
 
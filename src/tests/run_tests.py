@@ -9,7 +9,20 @@ def CompareFiles(a, b):
 tests = ['wtest',
          ('rtest', 'rtest.dat', 'rtestok.dat'),
          ('ftest', 'ftest.dat', 'ftestok.dat'),
-         'halftest']
+         ('rtest -m', 'rtest_mmap.dat', 'rtestok.dat'),
+         ('ftest -m', 'ftest_mmap.dat', 'ftestok.dat'),
+         'halftest',
+         'trtest trtestok.dat',
+         'batchtest',
+         'ewatest ewatestok.dat',
+         'derivtest',
+         'multitest',
+         'mpwtest',
+         'cachetest',
+         'utiltest',
+         'prefetchtest',
+         'getdatatest',
+         'encodetest']
 
 failed = 0
 for test in tests:
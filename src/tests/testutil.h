@@ -0,0 +1,131 @@
+#ifndef testutil_h
+#define testutil_h
+
+// Shared fixtures for the tests that write their own textures.
+//
+// A test describes its mesh layout with a TestMesh and supplies a texel
+// function that fills in the channel values (as floats) for each
+// texel; writeTestTexture does the rest.  The channel helpers below give
+// the usual mix of a smooth wave, a pseudo-random hash and a checkerboard.
+
+#include <iostream>
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include "Ptexture.h"
+
+/// Face layout of a test mesh.
+struct TestMesh
+{
+    Ptex::MeshType meshType;
+    std::vector<Ptex::FaceInfo> faces;
+
+    TestMesh(Ptex::MeshType mt) : meshType(mt) {}
+
+    int numFaces() const { return int(faces.size()); }
+
+    /// Add a face; unconnected edges have adjface -1.
+    void addFace(Ptex::Res res, const int adjfaces[4], const int adjedges[4], bool isSubface=false)
+    {
+        int f[4], e[4];
+        memcpy(f, adjfaces, sizeof(f));
+        memcpy(e, adjedges, sizeof(e));
+        faces.push_back(Ptex::FaceInfo(res, f, e, isSubface));
+    }
+
+    /// Add a face with no neighbors.
+    void addFace(Ptex::Res res)
+    {
+        static const int nofaces[4] = { -1, -1, -1, -1 }, noedges[4] = { 0, 0, 0, 0 };
+        addFace(res, nofaces, noedges);
+    }
+};
+
+
+/// Smooth wave in [0, 1].
+inline float testWave(float x, float y, float fu, float fv, float phase)
+{
+    return 0.5f + 0.5f * sinf(fu * x + fv * y + phase);
+}
+
+/// Pseudo-random value in [0, 1] that depends only on the texel, for high frequency content.
+inline float testHash(int faceid, int ui, int vi, Ptex::Res res, int shift=16)
+{
+    unsigned hash = unsigned((faceid * res.v() + vi) * res.u() + ui) * 2654435761u;
+    return float((hash >> shift) & 0xff) / 255.0f;
+}
+
+/// Checkerboard of 0 and 1 texels.
+inline float testChecker(int ui, int vi)
+{
+    return (ui + vi) % 2 ? 1.0f : 0.0f;
+}
+
+
+/** Write a texture with the given layout.  texel(p, faceid, ui, vi, res)
+    stores the nchannels float values of a texel in p; they are converted
+    to the data type before writing.  Errors are reported on stderr. */
+template <typename TexelFn>
+bool writeTestTexture(const char* path, const TestMesh& mesh, Ptex::DataType dt, int nchannels,
+                      TexelFn texel, int alphachan=-1)
+{
+    Ptex::String error;
+    PtexPtr<PtexWriter> w(PtexWriter::open(path, mesh.meshType, dt, nchannels, alphachan,
+                                           mesh.numFaces(), error));
+    if (!w) {
+        std::cerr << error.c_str() << std::endl;
+        return 0;
+    }
+
+    std::vector<float> data;
+    std::vector<char> buffer;
+    for (int faceid = 0; faceid < mesh.numFaces(); faceid++) {
+        const Ptex::FaceInfo& f = mesh.faces[faceid];
+        int ures = f.res.u(), vres = f.res.v();
+        data.resize(f.res.size() * nchannels);
+        for (int vi = 0; vi < vres; vi++)
+            for (int ui = 0; ui < ures; ui++)
+                texel(&data[(vi * ures + ui) * nchannels], faceid, ui, vi, f.res);
+        buffer.resize(data.size() * Ptex::DataSize(dt));
+        Ptex::ConvertFromFloat(&buffer[0], &data[0], dt, int(data.size()));
+        if (!w->writeFace(faceid, f, &buffer[0])) {
+            std::cerr << "writeFace failed" << std::endl;
+            return 0;
+        }
+    }
+    if (!w->close(error)) {
+        std::cerr << error.c_str() << std::endl;
+        return 0;
+    }
+    return 1;
+}
+
+
+/// Open a texture, reporting errors on stderr.
+inline PtexTexture* openTexture(const char* path)
+{
+    Ptex::String error;
+    PtexTexture* tx = PtexTexture::open(path, error);
+    if (!tx) std::cerr << error.c_str() << std::endl;
+    return tx;
+}
+
+
+/// Repeatable pseudo-random sequence for test inputs.
+class TestRandom
+{
+public:
+    TestRandom(unsigned seed=1) : _seed(seed) {}
+
+    /// Integer in [0, n).
+    int operator()(int n)
+    {
+        _seed = _seed * 1103515245u + 12345u;
+        return int((_seed >> 8) % unsigned(n));
+    }
+
+private:
+    unsigned _seed;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include <string>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include "Ptexture.h"
+#include "testutil.h"
+using namespace Ptex;
+
+// Triangle filter regression test.
+//
+// Writes a two-triangle texture, evaluates the triangle filter over a
+// grid of lookups and filter widths, and checks each result against
+// the reference values in trtestok.dat.  The gaussian weights may be
+// computed with a fast exp approximation, so results are compared with
+// a tolerance rather than exactly.
+//
+// Usage: trtest trtestok.dat  (check results against reference)
+//        trtest               (print results, e.g. to regenerate reference)
+
+static const float tolerance = 1e-4f;
+
+static bool writeTexture(const char* path)
+{
+    // two triangles sharing their diagonal edge
+    TestMesh mesh(mt_triangle);
+    for (int faceid = 0; faceid < 2; faceid++) {
+        int adjfaces[4] = { -1, 1-faceid, -1, -1 };
+        int adjedges[4] = { 0, 1, 0, 0 };
+        mesh.addFace(Res(6, 6), adjfaces, adjedges);
+    }
+
+    return writeTestTexture(path, mesh, dt_float, 3,
+                            [](float* p, int faceid, int ui, int vi, Res res) {
+        float x = float(ui) / float(res.u()), y = float(vi) / float(res.v());
+        p[0] = testWave(x, y, 13.0f, 7.0f, float(faceid));
+        p[1] = testHash(faceid, ui, vi, res);
+        p[2] = testChecker(ui, vi);
+    });
+}
+
+
+int main(int argc, char** argv)
+{
+    FILE* ref = 0;
+    if (argc >= 2) {
+        ref = fopen(argv[1], "r");
+        if (!ref) {
+            std::cerr << "Can't open " << argv[1] << std::endl;
+            return 1;
+        }
+    }
+
+    if (!writeTexture("trtest.ptx")) return 1;
+
+    PtexPtr<PtexTexture> r(openTexture("trtest.ptx"));
+    if (!r) return 1;
+
+    PtexFilter::Options opts(PtexFilter::f_gaussian);
+    PtexPtr<PtexFilter> f(PtexFilter::getFilter(r, opts));
+
+    static const float widths[] = { 0.002f, 0.01f, 0.03f, 0.08f, 0.2f, 0.5f };
+    const int nwidths = sizeof(widths)/sizeof(widths[0]);
+    float maxdiff = 0;
+    int count = 0;
+    for (int faceid = 0; faceid < 2; faceid++) {
+        for (int wi = 0; wi < nwidths; wi++) {
+            float w = widths[wi];
+            for (int vi = 0; vi <= 8; vi++) {
+                for (int ui = 0; ui + vi <= 8; ui++) {
+                    float u = float(ui) / 8.0f, v = float(vi) / 8.0f;
+                    float result[3];
+                    // anisotropic footprint, skewed against the texel grid
+                    f->eval(result, 0, 3, faceid, u, v, w, w * 0.3f, -w * 0.2f, w * 0.6f);
+                    if (!ref) {
+                        printf("%d %g %g %g -> %.7f %.7f %.7f\n", faceid, w, u, v,
+                               result[0], result[1], result[2]);
+                        continue;
+                    }
+                    int rf;
+                    float rw, ru, rv, expected[3];
+                    if (fscanf(ref, "%d %g %g %g -> %g %g %g", &rf, &rw, &ru, &rv,
+                               &expected[0], &expected[1], &expected[2]) != 7) {
+                        std::cerr << "Reference data is incomplete" << std::endl;
+                        return 1;
+                    }
+                    for (int c = 0; c < 3; c++) {
+                        float diff = fabsf(result[c] - expected[c]);
+                        if (diff > maxdiff) maxdiff = diff;
+                        if (!(diff <= tolerance)) {
+                            fprintf(stderr, "face %d width %g uv (%g, %g) chan %d: %.7f, expected %.7f\n",
+                                    faceid, w, u, v, c, result[c], expected[c]);
+                            return 1;
+                        }
+                    }
+                    count++;
+                }
+            }
+        }
+    }
+
+    if (ref) {
+        fclose(ref);
+        printf("%d lookups checked, max deviation %g\n", count, maxdiff);
+    }
+    return 0;
+}
@@ -0,0 +1,517 @@
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "Ptexture.h"
+#include "PtexUtils.h"
+#include "testutil.h"
+using namespace Ptex;
+
+// Data layout, reduction and premultiply utility test.
+//
+// Checks the (possibly vectorized) PtexUtils routines against plain
+// scalar versions of the same operations, bit for bit, for every data
+// type, odd and even row sizes and padded row strides.  The alpha
+// routines are run with the alpha channel first and last and with
+// half and float data that include -0, infinities and NaNs.  The whole
+// destination buffer (including the padding) is compared so that writes
+// past the end of a row are caught as well.  The reductions are also
+// digested and checked against the digest of the original scalar
+// implementation, so a change to the reference itself is caught too.
+
+namespace {
+    // scalar reference implementations; the data are only copied, so
+    // types are handled by size (half data is moved as uint16 and float
+    // data as uint32)
+
+    template<typename T>
+    void refInterleave(const T* src, int sstride, int uw, int vw, T* dst, int dstride, int nchan)
+    {
+        sstride /= (int)sizeof(T);
+        dstride /= (int)sizeof(T);
+        for (int c = 0; c < nchan; c++)
+            for (int v = 0; v < vw; v++)
+                for (int u = 0; u < uw; u++)
+                    dst[v * dstride + u * nchan + c] = src[(c * vw + v) * sstride + u];
+    }
+
+    template<typename T>
+    void refDeinterleave(const T* src, int sstride, int uw, int vw, T* dst, int dstride, int nchan)
+    {
+        sstride /= (int)sizeof(T);
+        dstride /= (int)sizeof(T);
+        for (int c = 0; c < nchan; c++)
+            for (int v = 0; v < vw; v++)
+                for (int u = 0; u < uw; u++)
+                    dst[(c * vw + v) * dstride + u] = src[v * sstride + u * nchan + c];
+    }
+
+    template<typename T>
+    void refEncodeDifference(T* data, int size)
+    {
+        T prev = 0;
+        for (int i = 0; i < size / (int)sizeof(T); i++) {
+            T val = data[i];
+            data[i] = T(val - prev);
+            prev = val;
+        }
+    }
+
+    template<typename T>
+    void refDecodeDifference(T* data, int size)
+    {
+        T prev = 0;
+        for (int i = 0; i < size / (int)sizeof(T); i++)
+            prev = data[i] = T(data[i] + prev);
+    }
+
+    // the reductions compute in the data type (half data in float), so types are handled by type
+
+    template<typename T>
+    void refReduce(const T* src, int sstride, int uw, int vw, T* dst, int dstride, int nchan)
+    {
+        sstride /= (int)sizeof(T);
+        dstride /= (int)sizeof(T);
+        for (int v = 0; v < vw/2; v++)
+            for (int u = 0; u < uw/2; u++)
+                for (int c = 0; c < nchan; c++) {
+                    const T* s = src + 2*v*sstride + 2*u*nchan + c;
+                    dst[v*dstride + u*nchan + c] = T(PtexUtils::quarter(s[0] + s[nchan] + s[sstride] + s[sstride+nchan]));
+                }
+    }
+
+    template<typename T>
+    void refReduceu(const T* src, int sstride, int uw, int vw, T* dst, int dstride, int nchan)
+    {
+        sstride /= (int)sizeof(T);
+        dstride /= (int)sizeof(T);
+        for (int v = 0; v < vw; v++)
+            for (int u = 0; u < uw/2; u++)
+                for (int c = 0; c < nchan; c++) {
+                    const T* s = src + v*sstride + 2*u*nchan + c;
+                    dst[v*dstride + u*nchan + c] = T(PtexUtils::halve(s[0] + s[nchan]));
+                }
+    }
+
+    template<typename T>
+    void refReducev(const T* src, int sstride, int uw, int vw, T* dst, int dstride, int nchan)
+    {
+        sstride /= (int)sizeof(T);
+        dstride /= (int)sizeof(T);
+        for (int v = 0; v < vw/2; v++)
+            for (int i = 0; i < uw*nchan; i++) {
+                const T* s = src + 2*v*sstride + i;
+                dst[v*dstride + i] = T(PtexUtils::halve(s[0] + s[sstride]));
+            }
+    }
+
+    template<typename T>
+    void refReduceTri(const T* src, int sstride, int w, int /*vw*/, T* dst, int dstride, int nchan)
+    {
+        // the fourth texel of each triangle comes from the opposite corner, transposed
+        sstride /= (int)sizeof(T);
+        dstride /= (int)sizeof(T);
+        for (int v = 0; v < w/2; v++)
+            for (int u = 0; u < w/2; u++)
+                for (int c = 0; c < nchan; c++) {
+                    const T* s = src + 2*v*sstride + 2*u*nchan + c;
+                    const T* s2 = src + (w-1-2*u)*sstride + (w-1-2*v)*nchan + c;
+                    dst[v*dstride + u*nchan + c] = T(PtexUtils::quarter(s[0] + s[nchan] + s[sstride] + s2[0]));
+                }
+    }
+
+    template<typename T>
+    void refMultalpha(T* data, int npixels, int nchan, int alphachan, float scale)
+    {
+        // with alpha first, all the other channels are scaled; otherwise the channels before it
+        int first = alphachan == 0 ? 1 : 0, last = alphachan == 0 ? nchan : alphachan;
+        for (int i = 0; i < npixels; i++, data += nchan) {
+            float aval = scale * (float)data[alphachan];
+            for (int c = first; c < last; c++) data[c] = T((float)data[c] * aval);
+        }
+    }
+
+    template<typename T>
+    void refDivalpha(T* data, int npixels, int nchan, int alphachan, float scale)
+    {
+        int first = alphachan == 0 ? 1 : 0, last = alphachan == 0 ? nchan : alphachan;
+        for (int i = 0; i < npixels; i++, data += nchan) {
+            T alpha = data[alphachan];
+            if (!alpha) continue;
+            float aval = scale / (float)alpha;
+            for (int c = first; c < last; c++) data[c] = T((float)data[c] * aval);
+        }
+    }
+
+    template<typename T>
+    void refAverage(const T* src, int sstride, int uw, int vw, T* dst, int /*dstride*/, int nchan)
+    {
+        sstride /= (int)sizeof(T);
+        std::vector<float> sum(nchan, 0.0f);
+        for (int v = 0; v < vw; v++)
+            for (int u = 0; u < uw; u++)
+                for (int c = 0; c < nchan; c++) sum[c] += (float)src[v*sstride + u*nchan + c];
+        float scale = 1.0f/(float)(uw*vw);
+        for (int c = 0; c < nchan; c++) dst[c] = T(sum[c]*scale);
+    }
+}
+
+
+static void refInterleave(const void* src, int sstride, int uw, int vw,
+                          void* dst, int dstride, DataType dt, int nchan)
+{
+    switch (DataSize(dt)) {
+    case 1: refInterleave((const uint8_t*)src, sstride, uw, vw, (uint8_t*)dst, dstride, nchan); break;
+    case 2: refInterleave((const uint16_t*)src, sstride, uw, vw, (uint16_t*)dst, dstride, nchan); break;
+    case 4: refInterleave((const uint32_t*)src, sstride, uw, vw, (uint32_t*)dst, dstride, nchan); break;
+    }
+}
+
+
+static void refDeinterleave(const void* src, int sstride, int uw, int vw,
+                            void* dst, int dstride, DataType dt, int nchan)
+{
+    switch (DataSize(dt)) {
+    case 1: refDeinterleave((const uint8_t*)src, sstride, uw, vw, (uint8_t*)dst, dstride, nchan); break;
+    case 2: refDeinterleave((const uint16_t*)src, sstride, uw, vw, (uint16_t*)dst, dstride, nchan); break;
+    case 4: refDeinterleave((const uint32_t*)src, sstride, uw, vw, (uint32_t*)dst, dstride, nchan); break;
+    }
+}
+
+
+static void refEncodeDifference(void* data, int size, DataType dt)
+{
+    if (dt == dt_uint8) refEncodeDifference((uint8_t*)data, size);
+    else if (dt == dt_uint16) refEncodeDifference((uint16_t*)data, size);
+}
+
+
+static void refDecodeDifference(void* data, int size, DataType dt)
+{
+    if (dt == dt_uint8) refDecodeDifference((uint8_t*)data, size);
+    else if (dt == dt_uint16) refDecodeDifference((uint16_t*)data, size);
+}
+
+
+static void refMultalpha(void* data, int npixels, DataType dt, int nchan, int alphachan)
+{
+    float scale = OneValueInv(dt);
+    switch (dt) {
+    case dt_uint8:  refMultalpha((uint8_t*)data, npixels, nchan, alphachan, scale); break;
+    case dt_uint16: refMultalpha((uint16_t*)data, npixels, nchan, alphachan, scale); break;
+    case dt_half:   refMultalpha((PtexHalf*)data, npixels, nchan, alphachan, scale); break;
+    case dt_float:  refMultalpha((float*)data, npixels, nchan, alphachan, scale); break;
+    }
+}
+
+
+static void refDivalpha(void* data, int npixels, DataType dt, int nchan, int alphachan)
+{
+    float scale = OneValue(dt);
+    switch (dt) {
+    case dt_uint8:  refDivalpha((uint8_t*)data, npixels, nchan, alphachan, scale); break;
+    case dt_uint16: refDivalpha((uint16_t*)data, npixels, nchan, alphachan, scale); break;
+    case dt_half:   refDivalpha((PtexHalf*)data, npixels, nchan, alphachan, scale); break;
+    case dt_float:  refDivalpha((float*)data, npixels, nchan, alphachan, scale); break;
+    }
+}
+
+
+typedef void RefFn(const void* src, int sstride, int uw, int vw,
+                   void* dst, int dstride, DataType dt, int nchan);
+
+template<template<typename> class Fn>
+static void refReduction(const void* src, int sstride, int uw, int vw,
+                         void* dst, int dstride, DataType dt, int nchan)
+{
+    switch (dt) {
+    case dt_uint8:  Fn<uint8_t>()((const uint8_t*)src, sstride, uw, vw, (uint8_t*)dst, dstride, nchan); break;
+    case dt_uint16: Fn<uint16_t>()((const uint16_t*)src, sstride, uw, vw, (uint16_t*)dst, dstride, nchan); break;
+    case dt_half:   Fn<PtexHalf>()((const PtexHalf*)src, sstride, uw, vw, (PtexHalf*)dst, dstride, nchan); break;
+    case dt_float:  Fn<float>()((const float*)src, sstride, uw, vw, (float*)dst, dstride, nchan); break;
+    }
+}
+
+#define REF_FUNCTOR(name) \
+    template<typename T> struct name##Fn { \
+        void operator()(const T* src, int sstride, int uw, int vw, T* dst, int dstride, int nchan) \
+        { name(src, sstride, uw, vw, dst, dstride, nchan); } \
+    };
+REF_FUNCTOR(refReduce)
+REF_FUNCTOR(refReduceu)
+REF_FUNCTOR(refReducev)
+REF_FUNCTOR(refReduceTri)
+REF_FUNCTOR(refAverage)
+#undef REF_FUNCTOR
+
+static void average(const void* src, int sstride, int uw, int vw,
+                    void* dst, int /*dstride*/, DataType dt, int nchan)
+{
+    PtexUtils::average(src, sstride, uw, vw, dst, dt, nchan);
+}
+
+
+static TestRandom rnd;
+
+static void fillRandom(std::vector<char>& buff)
+{
+    for (size_t i = 0; i < buff.size(); i++) buff[i] = char(rnd(256));
+}
+
+
+/// Test buffer: random contents, with the data starting one element in so it isn't aligned.
+struct TestBuffer
+{
+    std::vector<char> data;
+    int offset;
+
+    TestBuffer(int size, DataType dt) : data(size + DataSize(dt)), offset(DataSize(dt)) { fillRandom(data); }
+    char* get() { return &data[offset]; }
+};
+
+
+static int numFailed = 0;
+
+/// True if the buffers match bit for bit, except that any two NaNs match.
+static bool sameValues(const TestBuffer& result, const TestBuffer& expected, DataType dt)
+{
+    // (NaN payloads and signs depend on operand order, which the compiler is free to choose)
+    if (dt != dt_half && dt != dt_float) return result.data == expected.data;
+    for (size_t i = 0; i < result.data.size(); i += DataSize(dt)) {
+        bool bothNaN;
+        if (dt == dt_half) {
+            uint16_t a, b;
+            memcpy(&a, &result.data[i], 2); memcpy(&b, &expected.data[i], 2);
+            bothNaN = (a & 0x7fff) > 0x7c00 && (b & 0x7fff) > 0x7c00;
+        }
+        else {
+            uint32_t a, b;
+            memcpy(&a, &result.data[i], 4); memcpy(&b, &expected.data[i], 4);
+            bothNaN = (a & 0x7fffffff) > 0x7f800000 && (b & 0x7fffffff) > 0x7f800000;
+        }
+        if (!bothNaN && memcmp(&result.data[i], &expected.data[i], DataSize(dt)) != 0) return 0;
+    }
+    return 1;
+}
+
+
+static void check(const TestBuffer& result, const TestBuffer& expected, const char* fn,
+                  DataType dt, int nchan, int uw, int vw, bool anyNaN=false)
+{
+    if (anyNaN ? !sameValues(result, expected, dt) : result.data != expected.data) {
+        if (numFailed++ < 10)
+            fprintf(stderr, "%s differs from reference: %s, %d channels, %dx%d\n",
+                    fn, DataTypeName(dt), nchan, uw, vw);
+    }
+}
+
+
+static void testLayout(DataType dt, int nchan, int uw, int vw)
+{
+    int ds = DataSize(dt);
+    int rowlen = uw * ds, pixrowlen = uw * nchan * ds;
+    int planarStride = rowlen + ds * rnd(4), interleavedStride = pixrowlen + ds * rnd(4);
+    int planarSize = planarStride * vw * nchan, interleavedSize = interleavedStride * vw;
+    int size = rowlen * vw * nchan;
+
+    // interleave from padded planar rows
+    TestBuffer planar(planarSize, dt), result(interleavedSize, dt);
+    TestBuffer expected = result;
+    PtexUtils::interleave(planar.get(), planarStride, uw, vw, result.get(), interleavedStride, dt, nchan);
+    refInterleave(planar.get(), planarStride, uw, vw, expected.get(), interleavedStride, dt, nchan);
+    check(result, expected, "interleave", dt, nchan, uw, vw);
+
+    // deinterleave to padded planar rows
+    TestBuffer interleaved(interleavedSize, dt), planarResult(planarSize, dt);
+    TestBuffer planarExpected = planarResult;
+    PtexUtils::deinterleave(interleaved.get(), interleavedStride, uw, vw,
+                            planarResult.get(), planarStride, dt, nchan);
+    refDeinterleave(interleaved.get(), interleavedStride, uw, vw,
+                    planarExpected.get(), planarStride, dt, nchan);
+    check(planarResult, planarExpected, "deinterleave", dt, nchan, uw, vw);
+
+    // difference coding of the whole block
+    TestBuffer diff(size, dt);
+    TestBuffer diffExpected = diff;
+    PtexUtils::encodeDifference(diff.get(), size, dt);
+    refEncodeDifference(diffExpected.get(), size, dt);
+    check(diff, diffExpected, "encodeDifference", dt, nchan, uw, vw);
+    PtexUtils::decodeDifference(diff.get(), size, dt);
+    refDecodeDifference(diffExpected.get(), size, dt);
+    check(diff, diffExpected, "decodeDifference", dt, nchan, uw, vw);
+
+    // fused decode + interleave from contiguous planar rows (as read from a file)
+    for (int decode = 0; decode < 2; decode++) {
+        TestBuffer src(size, dt), dst(interleavedSize, dt);
+        TestBuffer decoded = src, dstExpected = dst;
+        PtexUtils::decodeInterleave(src.get(), uw, vw, dst.get(), interleavedStride, dt, nchan, decode != 0, -1);
+        if (decode) refDecodeDifference(decoded.get(), size, dt);
+        refInterleave(decoded.get(), rowlen, uw, vw, dstExpected.get(), interleavedStride, dt, nchan);
+        check(dst, dstExpected, decode ? "decodeInterleave (diff)" : "decodeInterleave", dt, nchan, uw, vw);
+    }
+
+    // fused deinterleave + encode to contiguous planar rows (as written to a file)
+    TestBuffer encoded(size, dt);
+    TestBuffer encodedExpected = encoded;
+    PtexUtils::deinterleaveEncodeDifference(interleaved.get(), interleavedStride, uw, vw,
+                                            encoded.get(), dt, nchan);
+    refDeinterleave(interleaved.get(), interleavedStride, uw, vw, encodedExpected.get(), rowlen, dt, nchan);
+    refEncodeDifference(encodedExpected.get(), size, dt);
+    check(encoded, encodedExpected, "deinterleaveEncodeDifference", dt, nchan, uw, vw);
+}
+
+
+/// Fill a buffer with random values of the data type (finite values in [-8, 8) for half and float).
+static void fillRandom(std::vector<char>& buff, DataType dt)
+{
+    int n = int(buff.size()) / DataSize(dt);
+    if (dt == dt_half) {
+        PtexHalf* p = (PtexHalf*)&buff[0];
+        for (int i = 0; i < n; i++) p[i] = float(rnd(65536)) / 4096.0f - 8.0f;
+    }
+    else if (dt == dt_float) {
+        float* p = (float*)&buff[0];
+        for (int i = 0; i < n; i++) p[i] = float(rnd(1 << 24)) / float(1 << 20) - 8.0f;
+    }
+    else fillRandom(buff);
+}
+
+
+/// Fill a buffer with random values of the data type, including zeros and (for half and float) -0, inf and NaN.
+static void fillRandomSpecial(std::vector<char>& buff, DataType dt)
+{
+    fillRandom(buff, dt);
+    int n = int(buff.size()) / DataSize(dt);
+    for (int i = 0; i < n; i++) {
+        int special = rnd(16);
+        if (special >= 5) continue;
+        static const uint16_t halfBits[] = { 0x0000, 0x8000, 0x7c00, 0x7e00, 0xfe01 };
+        static const uint32_t floatBits[] = { 0x00000000, 0x80000000, 0x7f800000, 0x7fc00000, 0xffc00001 };
+        switch (dt) {
+        case dt_uint8:  buff[i] = 0; break;
+        case dt_uint16: memset(&buff[i*2], 0, 2); break;
+        case dt_half:   memcpy(&buff[i*2], &halfBits[special], 2); break;
+        case dt_float:  memcpy(&buff[i*4], &floatBits[special], 4); break;
+        }
+    }
+}
+
+
+static void testAlpha(DataType dt, int nchan, int alphachan, int npixels)
+{
+    int ds = DataSize(dt), size = npixels * nchan * ds;
+
+    TestBuffer data(size, dt);
+    fillRandomSpecial(data.data, dt);
+    TestBuffer expected = data;
+    PtexUtils::multalpha(data.get(), npixels, dt, nchan, alphachan);
+    refMultalpha((void*)expected.get(), npixels, dt, nchan, alphachan);
+    check(data, expected, alphachan ? "multalpha (alpha last)" : "multalpha (alpha first)", dt, nchan, npixels, 1, true);
+
+    fillRandomSpecial(data.data, dt);
+    expected = data;
+    PtexUtils::divalpha(data.get(), npixels, dt, nchan, alphachan);
+    refDivalpha((void*)expected.get(), npixels, dt, nchan, alphachan);
+    check(data, expected, alphachan ? "divalpha (alpha last)" : "divalpha (alpha first)", dt, nchan, npixels, 1, true);
+
+    // premultiply fused into the interleave of planar rows, with and without difference decoding
+    for (int decode = 0; decode < 2; decode++) {
+        int uw = npixels, vw = 3, rowlen = uw * ds, dstride = uw * nchan * ds + ds * rnd(4);
+        TestBuffer src(rowlen * vw * nchan, dt), dst(dstride * vw, dt);
+        fillRandomSpecial(src.data, dt);
+        TestBuffer decoded = src, dstExpected = dst;
+        PtexUtils::decodeInterleave(src.get(), uw, vw, dst.get(), dstride, dt, nchan, decode != 0, alphachan);
+        if (decode) refDecodeDifference(decoded.get(), rowlen * vw * nchan, dt);
+        refInterleave(decoded.get(), rowlen, uw, vw, dstExpected.get(), dstride, dt, nchan);
+        for (int v = 0; v < vw; v++) refMultalpha((void*)(dstExpected.get() + v * dstride), uw, dt, nchan, alphachan);
+        check(dst, dstExpected, decode ? "decodeInterleave (diff, alpha)" : "decodeInterleave (alpha)",
+              dt, nchan, uw, vw, true);
+    }
+}
+
+
+static uint32_t digest(uint32_t hash, const std::vector<char>& buff)
+{
+    // FNV-1a
+    for (size_t i = 0; i < buff.size(); i++) hash = (hash ^ uint8_t(buff[i])) * 16777619u;
+    return hash;
+}
+
+
+static uint32_t reductionDigest = 2166136261u;
+
+static void testReduction(PtexUtils::ReduceFn fn, RefFn ref, const char* name,
+                          DataType dt, int nchan, int uw, int vw, int duw, int dvw)
+{
+    int ds = DataSize(dt);
+    int sstride = uw * nchan * ds + ds * rnd(4), dstride = duw * nchan * ds + ds * rnd(4);
+    TestBuffer src(sstride * vw, dt), result(dstride * dvw, dt);
+    fillRandom(src.data, dt);
+    TestBuffer expected = result;
+    fn(src.get(), sstride, uw, vw, result.get(), dstride, dt, nchan);
+    ref(src.get(), sstride, uw, vw, expected.get(), dstride, dt, nchan);
+    check(result, expected, name, dt, nchan, uw, vw);
+    reductionDigest = digest(reductionDigest, result.data);
+}
+
+
+static void testReductions(DataType dt, int nchan, int uw, int vw)
+{
+    if (uw > 1 && vw > 1)
+        testReduction(PtexUtils::reduce, refReduction<refReduceFn>, "reduce", dt, nchan, uw, vw, uw/2, vw/2);
+    if (uw > 1)
+        testReduction(PtexUtils::reduceu, refReduction<refReduceuFn>, "reduceu", dt, nchan, uw, vw, uw/2, vw);
+    if (vw > 1)
+        testReduction(PtexUtils::reducev, refReduction<refReducevFn>, "reducev", dt, nchan, uw, vw, uw, vw/2);
+    if (uw == vw && uw > 1)
+        testReduction(PtexUtils::reduceTri, refReduction<refReduceTriFn>, "reduceTri", dt, nchan, uw, vw, uw/2, vw/2);
+    testReduction(average, refReduction<refAverageFn>, "average", dt, nchan, uw, vw, 1, 1);
+}
+
+
+int main()
+{
+    static const DataType dataTypes[] = { dt_uint8, dt_uint16, dt_half, dt_float };
+    static const int rowSizes[] = { 1, 2, 3, 5, 7, 8, 9, 15, 16, 17, 31, 33, 63, 64, 65, 127, 255, 256, 257, 301 };
+    static const int numRowSizes = int(sizeof(rowSizes) / sizeof(rowSizes[0]));
+    static const int numRows[] = { 1, 2, 3, 5 };
+
+    int count = 0;
+    for (int d = 0; d < 4; d++)
+        for (int nchan = 1; nchan <= 7; nchan++)
+            for (int i = 0; i < numRowSizes; i++)
+                for (int j = 0; j < 4; j++, count++)
+                    testLayout(dataTypes[d], nchan, rowSizes[i], numRows[j]);
+
+    // reductions of all power of two sizes up to 512 (and up to 4096 texels)
+    int nreductions = 0;
+    for (int d = 0; d < 4; d++)
+        for (int nchan = 1; nchan <= 9; nchan++)
+            for (int ulog2 = 0; ulog2 <= 9; ulog2++)
+                for (int vlog2 = 0; ulog2 + vlog2 <= 12 && vlog2 <= 9; vlog2++, nreductions++)
+                    testReductions(dataTypes[d], nchan, 1 << ulog2, 1 << vlog2);
+
+    // premultiply and unpremultiply with alpha first and last
+    static const int numPixels[] = { 1, 2, 3, 4, 7, 16, 33, 255, 257 };
+    int nalpha = 0;
+    for (int d = 0; d < 4; d++)
+        for (int nchan = 1; nchan <= 7; nchan++)
+            for (int i = 0; i < int(sizeof(numPixels) / sizeof(numPixels[0])); i++) {
+                testAlpha(dataTypes[d], nchan, 0, numPixels[i]);
+                if (nchan > 1) testAlpha(dataTypes[d], nchan, nchan - 1, numPixels[i]);
+                nalpha++;
+            }
+
+    if (numFailed) {
+        fprintf(stderr, "%d of the checks failed\n", numFailed);
+        return 1;
+    }
+    // digest of the original scalar reductions of the same inputs
+    const uint32_t expectedDigest = 0x1c58fab6;
+    if (reductionDigest != expectedDigest) {
+        fprintf(stderr, "reduction digest is %08x, expected %08x\n", reductionDigest, expectedDigest);
+        return 1;
+    }
+    printf("%d layouts, %d reduction sizes and %d alpha layouts checked\n", count, nreductions, nalpha);
+    return 0;
+}